@@ -953,6 +953,7 @@ ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
 {
     u_char           *file;
     ngx_slab_pool_t  *sp;
+    ngx_core_conf_t  *ccf;
 
     sp = (ngx_slab_pool_t *) zn->shm.addr;
 
@@ -1010,6 +1011,12 @@ ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
 
     ngx_slab_init(sp);
 
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if (ccf->slab_cache) {
+        ngx_slab_cache_init(sp, ccf->worker_processes, ccf->slab_cache);
+    }
+
     return NGX_OK;
 }
 
@@ -558,6 +558,149 @@ ngx_cidr_match(struct sockaddr *sa, ngx_array_t *cidrs)
 }
 
 
+ngx_cidr_tree_t *
+ngx_cidr_tree_create(ngx_pool_t *pool)
+{
+    ngx_cidr_tree_t  *ct;
+
+    ct = ngx_pcalloc(pool, sizeof(ngx_cidr_tree_t));
+    if (ct == NULL) {
+        return NULL;
+    }
+
+    ct->pool = pool;
+
+    return ct;
+}
+
+
+ngx_int_t
+ngx_cidr_tree_add(ngx_cidr_tree_t *ct, ngx_cidr_t *cidr)
+{
+    uint32_t  key, mask;
+
+    switch (cidr->family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+
+        if (ct->tree6 == NULL) {
+            ct->tree6 = ngx_radix_tree_create(ct->pool, 0);
+            if (ct->tree6 == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
+        /* the addresses are already matched by a shorter prefix */
+
+        if (ngx_radix128tree_cover(ct->tree6, cidr->u.in6.addr.s6_addr,
+                                   cidr->u.in6.mask.s6_addr)
+            != NGX_RADIX_NO_VALUE)
+        {
+            return NGX_OK;
+        }
+
+        if (ngx_radix128tree_insert(ct->tree6, cidr->u.in6.addr.s6_addr,
+                                    cidr->u.in6.mask.s6_addr, 1)
+            == NGX_ERROR)
+        {
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+#endif
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    case AF_UNIX:
+        ct->local = 1;
+        return NGX_OK;
+#endif
+
+    default: /* AF_INET */
+
+        if (ct->tree == NULL) {
+            ct->tree = ngx_radix_tree_create(ct->pool, 0);
+            if (ct->tree == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
+        key = ntohl(cidr->u.in.addr);
+        mask = ntohl(cidr->u.in.mask);
+
+        if (ngx_radix32tree_cover(ct->tree, key, mask) != NGX_RADIX_NO_VALUE) {
+            return NGX_OK;
+        }
+
+        if (ngx_radix32tree_insert(ct->tree, key, mask, 1) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+}
+
+
+ngx_int_t
+ngx_cidr_tree_match(struct sockaddr *sa, ngx_cidr_tree_t *ct)
+{
+#if (NGX_HAVE_INET6)
+    u_char           *p;
+    struct in6_addr  *inaddr6;
+#endif
+    uintptr_t         value;
+    in_addr_t         inaddr;
+
+    switch (sa->sa_family) {
+
+    case AF_INET:
+        inaddr = ntohl(((struct sockaddr_in *) sa)->sin_addr.s_addr);
+        break;
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        inaddr6 = &((struct sockaddr_in6 *) sa)->sin6_addr;
+
+        if (!IN6_IS_ADDR_V4MAPPED(inaddr6)) {
+
+            if (ct->tree6 == NULL) {
+                return NGX_DECLINED;
+            }
+
+            value = ngx_radix128tree_find(ct->tree6, inaddr6->s6_addr);
+
+            return (value != NGX_RADIX_NO_VALUE) ? NGX_OK : NGX_DECLINED;
+        }
+
+        p = inaddr6->s6_addr;
+
+        inaddr = p[12] << 24;
+        inaddr += p[13] << 16;
+        inaddr += p[14] << 8;
+        inaddr += p[15];
+
+        break;
+#endif
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    case AF_UNIX:
+        return ct->local ? NGX_OK : NGX_DECLINED;
+#endif
+
+    default:
+        return NGX_DECLINED;
+    }
+
+    if (ct->tree == NULL) {
+        return NGX_DECLINED;
+    }
+
+    value = ngx_radix32tree_find(ct->tree, inaddr);
+
+    return (value != NGX_RADIX_NO_VALUE) ? NGX_OK : NGX_DECLINED;
+}
+
+
 ngx_int_t
 ngx_parse_addr(ngx_pool_t *pool, ngx_addr_t *addr, u_char *text, size_t len)
 {
@@ -263,6 +263,40 @@ ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key)
 }
 
 
+uintptr_t
+ngx_radix32tree_cover(ngx_radix_tree_t *tree, uint32_t key, uint32_t mask)
+{
+    uint32_t           bit;
+    ngx_radix_node_t  *node;
+
+    /* the shortest prefix in the tree which covers the whole key/mask */
+
+    bit = 0x80000000;
+    node = tree->root;
+
+    while (node) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            return node->value;
+        }
+
+        if ((mask & bit) == 0) {
+            break;
+        }
+
+        if (key & bit) {
+            node = node->right;
+
+        } else {
+            node = node->left;
+        }
+
+        bit >>= 1;
+    }
+
+    return NGX_RADIX_NO_VALUE;
+}
+
+
 #if (NGX_HAVE_INET6)
 
 ngx_int_t
@@ -457,6 +491,45 @@ ngx_radix128tree_find(ngx_radix_tree_t *tree, u_char *key)
     return value;
 }
 
+
+uintptr_t
+ngx_radix128tree_cover(ngx_radix_tree_t *tree, u_char *key, u_char *mask)
+{
+    u_char             bit;
+    ngx_uint_t         i;
+    ngx_radix_node_t  *node;
+
+    i = 0;
+    bit = 0x80;
+    node = tree->root;
+
+    while (node) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            return node->value;
+        }
+
+        if (i == 16 || (mask[i] & bit) == 0) {
+            break;
+        }
+
+        if (key[i] & bit) {
+            node = node->right;
+
+        } else {
+            node = node->left;
+        }
+
+        bit >>= 1;
+
+        if (bit == 0) {
+            i++;
+            bit = 0x80;
+        }
+    }
+
+    return NGX_RADIX_NO_VALUE;
+}
+
 #endif
 
 
@@ -42,6 +42,8 @@ ngx_int_t ngx_radix32tree_insert(ngx_radix_tree_t *tree,
 ngx_int_t ngx_radix32tree_delete(ngx_radix_tree_t *tree,
     uint32_t key, uint32_t mask);
 uintptr_t ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key);
+uintptr_t ngx_radix32tree_cover(ngx_radix_tree_t *tree, uint32_t key,
+    uint32_t mask);
 
 #if (NGX_HAVE_INET6)
 ngx_int_t ngx_radix128tree_insert(ngx_radix_tree_t *tree,
@@ -49,6 +51,8 @@ ngx_int_t ngx_radix128tree_insert(ngx_radix_tree_t *tree,
 ngx_int_t ngx_radix128tree_delete(ngx_radix_tree_t *tree,
     u_char *key, u_char *mask);
 uintptr_t ngx_radix128tree_find(ngx_radix_tree_t *tree, u_char *key);
+uintptr_t ngx_radix128tree_cover(ngx_radix_tree_t *tree, u_char *key,
+    u_char *mask);
 #endif
 
 
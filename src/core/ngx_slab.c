@@ -69,6 +69,33 @@
 
 #endif
 
+#define NGX_SLAB_CACHE_MAX_SHIFT  9
+
+/* the worker caches take at most 1/16 of the pool */
+#define NGX_SLAB_CACHE_SHARE      16
+
+
+#define ngx_slab_cache_trylock(cache)                                        \
+    ngx_atomic_cmp_set(&(cache)->lock, 0, ngx_pid)
+
+#define ngx_slab_cache_unlock(cache)                                         \
+    (void) ngx_atomic_cmp_set(&(cache)->lock, ngx_pid, 0)
+
+
+static void *ngx_slab_alloc_chunk(ngx_slab_pool_t *pool, size_t size);
+static void *ngx_slab_alloc_reclaim(ngx_slab_pool_t *pool, size_t size);
+static void ngx_slab_free_chunk(ngx_slab_pool_t *pool, void *p);
+static ngx_slab_cache_slot_t *ngx_slab_cache_lookup(ngx_slab_pool_t *pool,
+    ngx_uint_t shift, ngx_uint_t locked);
+static ngx_uint_t ngx_slab_cache_find(ngx_slab_cache_slot_t *cs, void *p);
+static void *ngx_slab_cache_refill(ngx_slab_pool_t *pool,
+    ngx_slab_cache_slot_t *cs, ngx_uint_t shift);
+static void ngx_slab_cache_drain(ngx_slab_pool_t *pool,
+    ngx_slab_cache_slot_t *cs, ngx_uint_t shift, ngx_uint_t n);
+static void ngx_slab_cache_drain_all(ngx_slab_pool_t *pool,
+    ngx_slab_cache_t *cache);
+static ngx_uint_t ngx_slab_size_shift(ngx_slab_pool_t *pool, size_t size);
+static ngx_uint_t ngx_slab_chunk_shift(ngx_slab_pool_t *pool, void *p);
 static ngx_slab_page_t *ngx_slab_alloc_pages(ngx_slab_pool_t *pool,
     ngx_uint_t pages);
 static void ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
@@ -161,17 +188,60 @@ void ngx_slab_init(ngx_slab_pool_t *pool)
     pool->log_nomem = 1;
     pool->log_ctx = &pool->zero;
     pool->zero = '\0';
+
+    pool->caches = NULL;
+    pool->ncaches = 0;
+    pool->cache_size = 0;
+    pool->cache_gen = 0;
+
+    pool->next = NULL;
 }
 
 
 void *
 ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 {
-    void  *p;
+    void                   *p;
+    ngx_uint_t              shift;
+    ngx_slab_cache_t       *cache;
+    ngx_slab_cache_slot_t  *cs;
+
+    shift = ngx_slab_size_shift(pool, size);
+
+    cs = ngx_slab_cache_lookup(pool, shift, 0);
+
+    if (cs) {
+        cache = pool->caches[ngx_worker];
+
+        if (ngx_slab_cache_trylock(cache)) {
+
+            if (cs->count) {
+
+                /* the chunk is taken from the worker cache */
+
+                cs->hits++;
+                p = cs->chunks[--cs->count];
+
+                ngx_slab_cache_unlock(cache);
+
+                ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                               "slab alloc: %uz cached: %p", size, p);
+
+                return p;
+            }
+
+            ngx_slab_cache_unlock(cache);
+        }
+    }
 
     ngx_shmtx_lock(&pool->mutex);
 
-    p = ngx_slab_alloc_locked(pool, size);
+    if (cs) {
+        p = ngx_slab_cache_refill(pool, cs, shift);
+
+    } else {
+        p = ngx_slab_alloc_reclaim(pool, size);
+    }
 
     ngx_shmtx_unlock(&pool->mutex);
 
@@ -181,6 +251,29 @@ ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 
 void *
 ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
+{
+    ngx_uint_t              shift;
+    ngx_slab_cache_slot_t  *cs;
+
+    shift = ngx_slab_size_shift(pool, size);
+
+    cs = ngx_slab_cache_lookup(pool, shift, 1);
+
+    if (cs == NULL) {
+        return ngx_slab_alloc_reclaim(pool, size);
+    }
+
+    if (cs->count) {
+        cs->hits++;
+        return cs->chunks[--cs->count];
+    }
+
+    return ngx_slab_cache_refill(pool, cs, shift);
+}
+
+
+static void *
+ngx_slab_alloc_chunk(ngx_slab_pool_t *pool, size_t size)
 {
     size_t            s;
     uintptr_t         p, m, mask, *bitmap;
@@ -448,16 +541,178 @@ ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size)
 void
 ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 {
+    ngx_uint_t              shift;
+    ngx_slab_cache_t       *cache;
+    ngx_slab_cache_slot_t  *cs;
+
+    shift = ngx_slab_chunk_shift(pool, p);
+
+    cs = ngx_slab_cache_lookup(pool, shift, 0);
+
+    if (cs) {
+        cache = pool->caches[ngx_worker];
+
+        if (ngx_slab_cache_trylock(cache)) {
+
+            if (ngx_slab_cache_find(cs, p)) {
+                ngx_slab_cache_unlock(cache);
+                goto already;
+            }
+
+            if (cs->count < pool->cache_size) {
+
+                /* the chunk is returned to the worker cache */
+
+                cs->chunks[cs->count++] = p;
+
+                ngx_slab_cache_unlock(cache);
+
+                ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                               "slab free: %p cached", p);
+
+                return;
+            }
+
+            ngx_slab_cache_unlock(cache);
+        }
+    }
+
     ngx_shmtx_lock(&pool->mutex);
 
-    ngx_slab_free_locked(pool, p);
+    if (cs) {
+        if (ngx_slab_cache_find(cs, p)) {
+            ngx_shmtx_unlock(&pool->mutex);
+            goto already;
+        }
+
+        if (cs->count == pool->cache_size) {
+            ngx_slab_cache_drain(pool, cs, shift, pool->cache_size / 2);
+        }
+
+        cs->chunks[cs->count++] = p;
+
+    } else {
+        ngx_slab_free_chunk(pool, p);
+    }
 
     ngx_shmtx_unlock(&pool->mutex);
+
+    return;
+
+already:
+
+    ngx_slab_error(pool, NGX_LOG_ALERT,
+                   "ngx_slab_free(): chunk is already free");
 }
 
 
 void
 ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
+{
+    ngx_uint_t              shift;
+    ngx_slab_cache_slot_t  *cs;
+
+    shift = ngx_slab_chunk_shift(pool, p);
+
+    cs = ngx_slab_cache_lookup(pool, shift, 1);
+
+    if (cs == NULL) {
+        ngx_slab_free_chunk(pool, p);
+        return;
+    }
+
+    if (ngx_slab_cache_find(cs, p)) {
+        ngx_slab_error(pool, NGX_LOG_ALERT,
+                       "ngx_slab_free(): chunk is already free");
+        return;
+    }
+
+    if (cs->count == pool->cache_size) {
+        ngx_slab_cache_drain(pool, cs, shift, pool->cache_size / 2);
+    }
+
+    cs->chunks[cs->count++] = p;
+}
+
+
+static void *
+ngx_slab_alloc_reclaim(ngx_slab_pool_t *pool, size_t size)
+{
+    void              *p;
+    size_t             s;
+    ngx_uint_t         i, slot, busy, log_nomem;
+    ngx_slab_cache_t  *cache;
+
+    if (pool->caches == NULL) {
+        return ngx_slab_alloc_chunk(pool, size);
+    }
+
+    log_nomem = pool->log_nomem;
+    pool->log_nomem = 0;
+
+    p = ngx_slab_alloc_chunk(pool, size);
+
+    if (p == NULL) {
+
+        /*
+         * the chunks cached by workers are still marked as busy
+         * in the pool, so they are returned to the pool and the
+         * allocation is retried; a locked cache is being used by
+         * its worker, and is drained on the worker's next request
+         */
+
+        busy = 0;
+
+        for (i = 0; i < pool->ncaches; i++) {
+            cache = pool->caches[i];
+
+            if (!ngx_slab_cache_trylock(cache)) {
+                busy = 1;
+                continue;
+            }
+
+            ngx_slab_cache_drain_all(pool, cache);
+
+            ngx_slab_cache_unlock(cache);
+        }
+
+        p = ngx_slab_alloc_chunk(pool, size);
+
+        if (p == NULL && busy) {
+            pool->cache_gen++;
+        }
+
+        if (size <= ngx_slab_max_size) {
+
+            /* the retried allocation is counted once */
+
+            if (size > pool->min_size) {
+                slot = 1;
+                for (s = size - 1; s >>= 1; slot++) { /* void */ }
+                slot -= pool->min_shift;
+
+            } else {
+                slot = 0;
+            }
+
+            pool->stats[slot].reqs--;
+            pool->stats[slot].fails--;
+        }
+    }
+
+    pool->log_nomem = log_nomem;
+
+    if (p == NULL && pool->log_nomem) {
+        ngx_slab_error(pool, NGX_LOG_CRIT,
+                       "ngx_slab_alloc() failed: no memory");
+    }
+
+    return p;
+}
+
+
+static void
+ngx_slab_free_chunk(ngx_slab_pool_t *pool, void *p)
 {
     size_t            size;
     uintptr_t         slab, m, *bitmap;
@@ -673,6 +928,440 @@ fail:
 }
 
 
+/*
+ * The optional worker cache keeps per size class stacks of free small
+ * chunks in each worker.  The stacks live in the pool itself, one set per
+ * worker slot, and a slot is owned by the process which has claimed it,
+ * so an old worker and a new one with the same ngx_worker number never
+ * share a slot during reconfiguration.  The stacks are refilled from
+ * partially used pages and drained in batches under the pool mutex,
+ * and ngx_slab_alloc() and ngx_slab_free() do not lock the mutex at all
+ * if the request can be satisfied by the cache.  Instead, the worker
+ * locks its own cache, which is only contended when an allocation fails
+ * and another worker returns the cached chunks to the pool.
+ */
+
+void
+ngx_slab_cache_init(ngx_slab_pool_t *pool, ngx_uint_t n, ngx_uint_t size)
+{
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    u_char             *p;
+    size_t              len, max, s;
+    ngx_uint_t          i, j, slots, log_nomem;
+    ngx_slab_cache_t  **caches, *cache;
+
+    if (n == 0 || size < 2) {
+        return;
+    }
+
+    /*
+     * the cache size is reduced in small pools, and the caches are not
+     * used at all if they do not fit, counting the rounding of chunks and
+     * two pages which may be used partially
+     */
+
+    max = (pool->end - pool->start) / NGX_SLAB_CACHE_SHARE;
+
+    if (max < 2 * ngx_pagesize + n * sizeof(ngx_slab_cache_t *)) {
+        return;
+    }
+
+    max = (max - 2 * ngx_pagesize - n * sizeof(ngx_slab_cache_t *)) / n;
+
+    if (max >= ngx_pagesize) {
+        max &= ~((size_t) ngx_pagesize - 1);
+
+    } else {
+        for (s = ngx_pagesize; s > max; s >>= 1) { /* void */ }
+        max = s;
+    }
+
+    slots = NGX_SLAB_CACHE_MAX_SHIFT - pool->min_shift + 1;
+
+    len = sizeof(ngx_slab_cache_t) + slots * sizeof(ngx_slab_cache_slot_t);
+
+    if (max < len + 2 * slots * sizeof(void *)) {
+        return;
+    }
+
+    size = ngx_min(size, (max - len) / (slots * sizeof(void *)));
+
+    len += slots * size * sizeof(void *);
+
+    log_nomem = pool->log_nomem;
+    pool->log_nomem = 0;
+
+    caches = ngx_slab_alloc_chunk(pool, n * sizeof(ngx_slab_cache_t *));
+    if (caches == NULL) {
+        pool->log_nomem = log_nomem;
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+
+        /* separate chunks keep the caches of workers in different lines */
+
+        p = ngx_slab_alloc_chunk(pool, len);
+        if (p == NULL) {
+            goto failed;
+        }
+
+        cache = (ngx_slab_cache_t *) p;
+        p += sizeof(ngx_slab_cache_t);
+
+        cache->pid = 0;
+        cache->lock = 0;
+        cache->gen = 0;
+        cache->slots = (ngx_slab_cache_slot_t *) p;
+        p += slots * sizeof(ngx_slab_cache_slot_t);
+
+        for (j = 0; j < slots; j++) {
+            cache->slots[j].count = 0;
+            cache->slots[j].hits = 0;
+            cache->slots[j].reported = 0;
+            cache->slots[j].chunks = (void **) p;
+            p += size * sizeof(void *);
+        }
+
+        caches[i] = cache;
+    }
+
+    pool->caches = caches;
+    pool->ncaches = n;
+    pool->cache_size = size;
+
+    pool->log_nomem = log_nomem;
+
+    return;
+
+failed:
+
+    while (i--) {
+        ngx_slab_free_chunk(pool, caches[i]);
+    }
+
+    ngx_slab_free_chunk(pool, caches);
+
+    pool->log_nomem = log_nomem;
+
+#endif
+}
+
+
+void
+ngx_slab_cache_flush(ngx_slab_pool_t *pool)
+{
+    ngx_slab_cache_t  *cache;
+
+    if (pool->caches == NULL
+        || ngx_process != NGX_PROCESS_WORKER
+        || ngx_worker >= pool->ncaches)
+    {
+        return;
+    }
+
+    cache = pool->caches[ngx_worker];
+
+    if (cache->pid != (ngx_atomic_uint_t) ngx_pid) {
+        return;
+    }
+
+    ngx_shmtx_lock(&pool->mutex);
+
+    ngx_slab_cache_drain_all(pool, cache);
+
+    ngx_shmtx_unlock(&pool->mutex);
+
+    ngx_memory_barrier();
+
+    cache->pid = 0;
+}
+
+
+ngx_uint_t
+ngx_slab_cache_force_unlock(ngx_slab_pool_t *pool, ngx_pid_t pid)
+{
+    ngx_uint_t  i;
+
+    if (pool->caches == NULL) {
+        return 0;
+    }
+
+    /*
+     * the free chunks are left in the cache, and
+     * will be used by the next process claiming it
+     */
+
+    for (i = 0; i < pool->ncaches; i++) {
+        if (ngx_atomic_cmp_set(&pool->caches[i]->pid, pid, 0)) {
+            (void) ngx_atomic_cmp_set(&pool->caches[i]->lock, pid, 0);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+void
+ngx_slab_cache_stat(ngx_slab_pool_t *pool, ngx_uint_t *hits, ngx_uint_t *reqs,
+    ngx_uint_t *cached)
+{
+    ngx_uint_t  shift, slot;
+
+    if (pool->caches == NULL) {
+        return;
+    }
+
+    /* the counters are updated on each refill and drain of a cache */
+
+    for (shift = pool->min_shift; shift <= NGX_SLAB_CACHE_MAX_SHIFT; shift++) {
+        slot = shift - pool->min_shift;
+
+        *hits += pool->stats[slot].hits;
+        *reqs += pool->stats[slot].reqs;
+        *cached += pool->stats[slot].cached;
+    }
+}
+
+
+static ngx_slab_cache_slot_t *
+ngx_slab_cache_lookup(ngx_slab_pool_t *pool, ngx_uint_t shift,
+    ngx_uint_t locked)
+{
+    ngx_slab_cache_t  *cache;
+
+    if (pool->caches == NULL
+        || shift > NGX_SLAB_CACHE_MAX_SHIFT
+        || ngx_process != NGX_PROCESS_WORKER
+        || ngx_worker >= pool->ncaches)
+    {
+        return NULL;
+    }
+
+    cache = pool->caches[ngx_worker];
+
+    if (cache->pid != (ngx_atomic_uint_t) ngx_pid
+        && !(cache->pid == 0 && ngx_atomic_cmp_set(&cache->pid, 0, ngx_pid)))
+    {
+        /* the cache is still owned by an exiting process */
+        return NULL;
+    }
+
+    if (cache->gen != pool->cache_gen) {
+
+        /*
+         * an allocation has failed in another worker,
+         * the chunks cached by this one are returned to the pool
+         */
+
+        if (!locked) {
+            ngx_shmtx_lock(&pool->mutex);
+        }
+
+        ngx_slab_cache_drain_all(pool, cache);
+
+        if (!locked) {
+            ngx_shmtx_unlock(&pool->mutex);
+        }
+    }
+
+    return &cache->slots[shift - pool->min_shift];
+}
+
+
+static ngx_uint_t
+ngx_slab_cache_find(ngx_slab_cache_slot_t *cs, void *p)
+{
+    ngx_uint_t  i;
+
+    /*
+     * cached chunks are still marked as busy in the pool,
+     * so a chunk freed twice can only be found in the cache
+     */
+
+    for (i = 0; i < cs->count; i++) {
+        if (cs->chunks[i] == p) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static void *
+ngx_slab_cache_refill(ngx_slab_pool_t *pool, ngx_slab_cache_slot_t *cs,
+    ngx_uint_t shift)
+{
+    void             *p;
+    size_t            size;
+    ngx_uint_t        slot, n;
+    ngx_slab_page_t  *page, *slots;
+
+    size = (size_t) 1 << shift;
+    slot = shift - pool->min_shift;
+
+    p = ngx_slab_alloc_reclaim(pool, size);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    /* prefetch only chunks of pages already used by the size class */
+
+    slots = ngx_slab_slots(pool);
+
+    for (n = 0; cs->count < pool->cache_size / 2; n++) {
+        page = slots[slot].next;
+
+        if (page->next == page) {
+            break;
+        }
+
+        cs->chunks[cs->count++] = ngx_slab_alloc_chunk(pool, size);
+    }
+
+    pool->stats[slot].reqs += cs->hits - n;
+    pool->stats[slot].hits += cs->hits;
+    pool->stats[slot].cached += cs->count - cs->reported;
+
+    cs->hits = 0;
+    cs->reported = cs->count;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                   "slab cache refill: slot: %ui count: %ui "
+                   "hits: %ui reqs: %ui", slot, cs->count,
+                   pool->stats[slot].hits, pool->stats[slot].reqs);
+
+    return p;
+}
+
+
+static void
+ngx_slab_cache_drain(ngx_slab_pool_t *pool, ngx_slab_cache_slot_t *cs,
+    ngx_uint_t shift, ngx_uint_t n)
+{
+    ngx_uint_t  slot;
+
+    slot = shift - pool->min_shift;
+
+    while (n--) {
+        ngx_slab_free_chunk(pool, cs->chunks[--cs->count]);
+    }
+
+    pool->stats[slot].reqs += cs->hits;
+    pool->stats[slot].hits += cs->hits;
+    pool->stats[slot].cached += cs->count;
+    pool->stats[slot].cached -= cs->reported;
+
+    cs->hits = 0;
+    cs->reported = cs->count;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                   "slab cache drain: slot: %ui count: %ui", slot, cs->count);
+}
+
+
+static void
+ngx_slab_cache_drain_all(ngx_slab_pool_t *pool, ngx_slab_cache_t *cache)
+{
+    ngx_uint_t              shift;
+    ngx_slab_cache_slot_t  *cs;
+
+    for (shift = pool->min_shift; shift <= NGX_SLAB_CACHE_MAX_SHIFT; shift++) {
+        cs = &cache->slots[shift - pool->min_shift];
+        ngx_slab_cache_drain(pool, cs, shift, cs->count);
+    }
+
+    cache->gen = pool->cache_gen;
+}
+
+
+static ngx_uint_t
+ngx_slab_size_shift(ngx_slab_pool_t *pool, size_t size)
+{
+    size_t      s;
+    ngx_uint_t  shift;
+
+    if (pool->caches == NULL
+        || size > ((size_t) 1 << NGX_SLAB_CACHE_MAX_SHIFT))
+    {
+        return NGX_SLAB_CACHE_MAX_SHIFT + 1;
+    }
+
+    if (size <= pool->min_size) {
+        return pool->min_shift;
+    }
+
+    shift = 1;
+    for (s = size - 1; s >>= 1; shift++) { /* void */ }
+
+    return shift;
+}
+
+
+static ngx_uint_t
+ngx_slab_chunk_shift(ngx_slab_pool_t *pool, void *p)
+{
+    uintptr_t         m, *bitmap;
+    ngx_uint_t        n, shift;
+    ngx_slab_page_t  *page;
+
+    if (pool->caches == NULL
+        || (u_char *) p < pool->start
+        || (u_char *) p >= pool->end)
+    {
+        return NGX_SLAB_CACHE_MAX_SHIFT + 1;
+    }
+
+    /*
+     * the chunk type and size are not changed while
+     * the chunk is allocated, so no locking is needed
+     */
+
+    page = &pool->pages[((u_char *) p - pool->start) >> ngx_pagesize_shift];
+
+    n = (uintptr_t) p & (ngx_pagesize - 1);
+
+    switch (ngx_slab_page_type(page)) {
+
+    case NGX_SLAB_SMALL:
+        shift = page->slab & NGX_SLAB_SHIFT_MASK;
+        n >>= shift;
+        bitmap = (uintptr_t *)
+                             ((uintptr_t) p & ~((uintptr_t) ngx_pagesize - 1));
+        m = bitmap[n / (8 * sizeof(uintptr_t))]
+            & ((uintptr_t) 1 << (n % (8 * sizeof(uintptr_t))));
+        break;
+
+    case NGX_SLAB_EXACT:
+        shift = ngx_slab_exact_shift;
+        m = page->slab & ((uintptr_t) 1 << (n >> shift));
+        break;
+
+    case NGX_SLAB_BIG:
+        shift = page->slab & NGX_SLAB_SHIFT_MASK;
+        m = page->slab & ((uintptr_t) 1 << ((n >> shift) + NGX_SLAB_MAP_SHIFT));
+        break;
+
+    default: /* NGX_SLAB_PAGE */
+        return NGX_SLAB_CACHE_MAX_SHIFT + 1;
+    }
+
+    /*
+     * wrong and already free chunks are not cached,
+     * ngx_slab_free_chunk() reports them under the mutex
+     */
+
+    if (m == 0 || ((uintptr_t) p & (((uintptr_t) 1 << shift) - 1))) {
+        return NGX_SLAB_CACHE_MAX_SHIFT + 1;
+    }
+
+    return shift;
+}
+
+
 static ngx_slab_page_t *
 ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
@@ -35,10 +35,39 @@ typedef struct {
     ngx_uint_t        reqs;
     //分配内存失败次数
     ngx_uint_t        fails;
+    //由工作进程缓存满足的请求次数
+    ngx_uint_t        hits;
+    //工作进程缓存中的空闲块数
+    ngx_uint_t        cached;
 } ngx_slab_stat_t;
 
-//内存池结构体
+//工作进程缓存中某种规格的空闲块
+typedef struct {
+    //空闲块数
+    ngx_uint_t        count;
+    //尚未计入统计信息的命中次数
+    ngx_uint_t        hits;
+    //已计入统计信息的空闲块数
+    ngx_uint_t        reported;
+    //空闲块指针数组
+    void            **chunks;
+} ngx_slab_cache_slot_t;
+
+//工作进程空闲块缓存
 typedef struct {
+    //持有该缓存的进程
+    ngx_atomic_t            pid;
+    //缓存锁，值为加锁进程的进程号，其他进程可在回收空闲块时加锁
+    ngx_atomic_t            lock;
+    //已处理的回收请求代数
+    ngx_uint_t              gen;
+    ngx_slab_cache_slot_t  *slots;
+} ngx_slab_cache_t;
+
+//内存池结构体
+typedef struct ngx_slab_pool_s  ngx_slab_pool_t;
+
+struct ngx_slab_pool_s {
     //互斥锁
     ngx_shmtx_sh_t    lock;
     //可分配的最小内存
@@ -68,7 +97,17 @@ typedef struct {
 
     void             *data;
     void             *addr;
-} ngx_slab_pool_t;
+
+    //每个工作进程一个的空闲块缓存
+    ngx_slab_cache_t **caches;
+    ngx_uint_t        ncaches;
+    //每种规格缓存的空闲块数
+    ngx_uint_t        cache_size;
+    //回收请求代数，分配失败时递增，各工作进程随后归还缓存的空闲块
+    ngx_uint_t        cache_gen;
+    //从本内存池划分出的、拥有各自互斥锁的子内存池链表
+    ngx_slab_pool_t  *next;
+};
 
 
 void ngx_slab_sizes_init(void);
@@ -79,6 +118,11 @@ void *ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+void ngx_slab_cache_init(ngx_slab_pool_t *pool, ngx_uint_t n, ngx_uint_t size);
+void ngx_slab_cache_flush(ngx_slab_pool_t *pool);
+ngx_uint_t ngx_slab_cache_force_unlock(ngx_slab_pool_t *pool, ngx_pid_t pid);
+void ngx_slab_cache_stat(ngx_slab_pool_t *pool, ngx_uint_t *hits,
+    ngx_uint_t *reqs, ngx_uint_t *cached);
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
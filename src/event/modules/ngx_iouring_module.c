@@ -0,0 +1,1593 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * The module keeps the readiness model used by the rest of nginx:
+ * every socket is watched by a single multishot IORING_OP_POLL_ADD request
+ * which behaves like an EPOLLET registration, so ngx_recv() and friends run
+ * unchanged on top of ngx_os_io.  The difference with epoll is that all poll
+ * arming and removal requests as well as file AIO reads are only queued in
+ * the submission ring and are passed to the kernel in batch by the single
+ * io_uring_enter() call which also waits for completions, so there are
+ * no epoll_ctl() and io_submit() syscalls at all.
+ *
+ * Listening TCP sockets are served by multishot IORING_OP_ACCEPT requests
+ * instead of polling: the kernel accepts connections as they arrive, and
+ * ngx_event_accept() takes the accepted sockets from a per-listening queue.
+ *
+ * Memory buffers are sent with IORING_OP_SEND and IORING_OP_SENDMSG
+ * requests passed to a separate small ring, where the completion is
+ * waited for immediately, so ngx_send_chain() remains synchronous from
+ * the caller's view and the main ring completions are not reordered.
+ */
+
+
+#define NGX_IOURING_AIO_EVENT     2
+#define NGX_IOURING_ACCEPT_EVENT  4
+
+#define NGX_IOURING_POLL          (POLLIN|POLLOUT)
+
+#define NGX_IOURING_SEND_ENTRIES  2
+#define NGX_IOURING_ACCEPT_QUEUE  16
+
+#ifndef IORING_ACCEPT_MULTISHOT
+#define IORING_ACCEPT_MULTISHOT   (1U << 0)
+#endif
+
+
+typedef struct {
+    ngx_uint_t             entries;
+} ngx_iouring_conf_t;
+
+
+typedef struct {
+    uint32_t              *head;
+    uint32_t              *tail;
+    uint32_t              *mask;
+    uint32_t              *entries;
+    uint32_t              *array;
+    struct io_uring_sqe   *sqes;
+    uint32_t               local_tail;
+} ngx_iouring_sq_t;
+
+
+typedef struct {
+    uint32_t              *head;
+    uint32_t              *tail;
+    uint32_t              *mask;
+    struct io_uring_cqe   *cqes;
+} ngx_iouring_cq_t;
+
+
+typedef struct {
+    int                    fd;
+    ngx_iouring_sq_t       sq;
+    ngx_iouring_cq_t       cq;
+    void                  *sq_ring;
+    size_t                 sq_ring_size;
+    void                  *cq_ring;
+    size_t                 cq_ring_size;
+    size_t                 sqes_size;
+} ngx_iouring_ring_t;
+
+
+typedef struct {
+    ngx_socket_t          *fds;
+    ngx_uint_t             head;
+    ngx_uint_t             n;
+    ngx_uint_t             size;
+} ngx_iouring_accept_t;
+
+
+#define ngx_iouring_null_ring                                                 \
+    { -1, { NULL, NULL, NULL, NULL, NULL, NULL, 0 },                          \
+      { NULL, NULL, NULL, NULL }, MAP_FAILED, 0, MAP_FAILED, 0, 0 }
+
+
+static ngx_int_t ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+static ngx_int_t ngx_iouring_setup(ngx_iouring_ring_t *r, ngx_uint_t entries,
+    ngx_log_t *log);
+static ngx_int_t ngx_iouring_test_multishot(ngx_cycle_t *cycle);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_iouring_notify_init(ngx_log_t *log);
+static void ngx_iouring_notify_handler(ngx_event_t *ev);
+#endif
+static void ngx_iouring_done(ngx_cycle_t *cycle);
+static void ngx_iouring_close(ngx_iouring_ring_t *r, ngx_log_t *log);
+static struct io_uring_sqe *ngx_iouring_get_sqe(ngx_iouring_ring_t *r,
+    ngx_log_t *log);
+static ngx_int_t ngx_iouring_poll_add(ngx_connection_t *c, uint32_t events,
+    ngx_log_t *log);
+static ngx_int_t ngx_iouring_poll_remove(ngx_connection_t *c,
+    ngx_log_t *log);
+static ngx_int_t ngx_iouring_accept_add(ngx_connection_t *c, ngx_log_t *log);
+static ngx_int_t ngx_iouring_accept_cancel(ngx_connection_t *c,
+    ngx_log_t *log);
+static ngx_int_t ngx_iouring_accept_push(ngx_iouring_accept_t *q,
+    ngx_socket_t s, ngx_log_t *log);
+static void ngx_iouring_accept_close(ngx_connection_t *c, ngx_log_t *log);
+static ngx_int_t ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_iouring_notify(ngx_event_handler_pt handler);
+#endif
+static ngx_int_t ngx_iouring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+static void ngx_iouring_process_poll(ngx_cycle_t *cycle,
+    struct io_uring_cqe *cqe, ngx_uint_t flags);
+static void ngx_iouring_process_accept(ngx_cycle_t *cycle,
+    struct io_uring_cqe *cqe, ngx_uint_t flags);
+static ngx_chain_t *ngx_iouring_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+static ssize_t ngx_iouring_send(ngx_connection_t *c, ngx_iovec_t *vec);
+
+static void *ngx_iouring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf);
+
+static ngx_iouring_ring_t   ring = ngx_iouring_null_ring;
+static ngx_iouring_ring_t   send_ring = ngx_iouring_null_ring;
+
+static ngx_os_io_t          ngx_iouring_io;
+
+#if (NGX_HAVE_EVENTFD)
+static int                  notify_fd = -1;
+static ngx_event_t          notify_event;
+static ngx_connection_t     notify_conn;
+#endif
+
+#if (NGX_HAVE_FILE_AIO)
+ngx_uint_t                  ngx_iouring_aio;
+#endif
+
+ngx_uint_t                  ngx_iouring_multishot_accept;
+
+static ngx_str_t      iouring_name = ngx_string("io_uring");
+
+static ngx_command_t  ngx_iouring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_iouring_conf_t, entries),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_event_module_t  ngx_iouring_module_ctx = {
+    &iouring_name,
+    ngx_iouring_create_conf,             /* create configuration */
+    ngx_iouring_init_conf,               /* init configuration */
+
+    {
+        ngx_iouring_add_event,           /* add an event */
+        ngx_iouring_del_event,           /* delete an event */
+        ngx_iouring_add_event,           /* enable an event */
+        ngx_iouring_del_event,           /* disable an event */
+        NULL,                            /* add an connection */
+        NULL,                            /* delete an connection */
+#if (NGX_HAVE_EVENTFD)
+        ngx_iouring_notify,              /* trigger a notify */
+#else
+        NULL,                            /* trigger a notify */
+#endif
+        ngx_iouring_process_events,      /* process the events */
+        ngx_iouring_init,                /* init the events */
+        ngx_iouring_done,                /* done the events */
+    }
+};
+
+ngx_module_t  ngx_iouring_module = {
+    NGX_MODULE_V1,
+    &ngx_iouring_module_ctx,             /* module context */
+    ngx_iouring_commands,                /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    NULL,                                /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/*
+ * We call io_uring_setup() and io_uring_enter() directly as syscalls
+ * instead of liburing usage to avoid an external dependency.
+ */
+
+static int
+io_uring_setup(u_int entries, struct io_uring_params *p)
+{
+    return syscall(SYS_io_uring_setup, entries, p);
+}
+
+
+static int
+io_uring_enter(int fd, u_int to_submit, u_int min_complete, u_int flags,
+    struct timespec *ts)
+{
+    struct io_uring_getevents_arg  arg;
+
+    if (ts == NULL) {
+        return syscall(SYS_io_uring_enter, fd, to_submit, min_complete,
+                       flags, NULL, 0);
+    }
+
+    arg.sigmask = 0;
+    arg.sigmask_sz = 0;
+    arg.pad = 0;
+    arg.ts = (uint64_t) (uintptr_t) ts;
+
+    return syscall(SYS_io_uring_enter, fd, to_submit, min_complete,
+                   flags|IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+
+static ngx_int_t
+ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    ngx_iouring_conf_t  *iucf;
+
+    iucf = ngx_event_get_conf(cycle->conf_ctx, ngx_iouring_module);
+
+    if (ring.fd == -1) {
+        if (ngx_iouring_setup(&ring, iucf->entries, cycle->log) != NGX_OK) {
+            ngx_iouring_done(cycle);
+            return NGX_ERROR;
+        }
+
+        if (ngx_iouring_test_multishot(cycle) != NGX_OK) {
+            ngx_iouring_done(cycle);
+            return NGX_ERROR;
+        }
+
+#if (NGX_HAVE_EVENTFD)
+        if (ngx_iouring_notify_init(cycle->log) != NGX_OK) {
+            ngx_iouring_module_ctx.actions.notify = NULL;
+        }
+#endif
+
+        if (ngx_iouring_setup(&send_ring, NGX_IOURING_SEND_ENTRIES,
+                              cycle->log)
+            != NGX_OK)
+        {
+            ngx_iouring_done(cycle);
+            return NGX_ERROR;
+        }
+
+#if (NGX_HAVE_FILE_AIO)
+        ngx_iouring_aio = 1;
+#endif
+
+        /* the kernel support is checked on the first accept completion */
+
+        ngx_iouring_multishot_accept = 1;
+    }
+
+    ngx_iouring_io = ngx_os_io;
+    ngx_iouring_io.send_chain = ngx_iouring_send_chain;
+
+    ngx_io = ngx_iouring_io;
+
+    ngx_event_actions = ngx_iouring_module_ctx.actions;
+
+    ngx_event_flags = NGX_USE_CLEAR_EVENT
+                      |NGX_USE_GREEDY_EVENT
+                      |NGX_USE_DRAIN_EVENT;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_setup(ngx_iouring_ring_t *r, ngx_uint_t entries, ngx_log_t *log)
+{
+    u_char                  *p;
+    uint32_t                 i;
+    struct io_uring_params   params;
+
+    ngx_memzero(&params, sizeof(struct io_uring_params));
+
+    r->fd = io_uring_setup(entries, &params);
+
+    if (r->fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      "io_uring_setup() failed");
+        return NGX_ERROR;
+    }
+
+    if (!(params.features & IORING_FEAT_EXT_ARG)
+        || !(params.features & IORING_FEAT_NODROP))
+    {
+        ngx_log_error(NGX_LOG_EMERG, log, 0,
+                      "io_uring is not supported by the kernel, "
+                      "Linux 5.13 or newer is required");
+        return NGX_ERROR;
+    }
+
+    r->sq_ring_size = params.sq_off.array
+                      + params.sq_entries * sizeof(uint32_t);
+    r->cq_ring_size = params.cq_off.cqes
+                      + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        r->sq_ring_size = ngx_max(r->sq_ring_size, r->cq_ring_size);
+        r->cq_ring_size = 0;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ|PROT_WRITE,
+                      MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+
+    if (r->sq_ring == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      "mmap(IORING_OFF_SQ_RING) failed");
+        return NGX_ERROR;
+    }
+
+    if (r->cq_ring_size) {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ|PROT_WRITE,
+                          MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+
+        if (r->cq_ring == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                          "mmap(IORING_OFF_CQ_RING) failed");
+            return NGX_ERROR;
+        }
+
+        p = r->cq_ring;
+
+    } else {
+        p = r->sq_ring;
+    }
+
+    r->cq.head = (uint32_t *) (p + params.cq_off.head);
+    r->cq.tail = (uint32_t *) (p + params.cq_off.tail);
+    r->cq.mask = (uint32_t *) (p + params.cq_off.ring_mask);
+    r->cq.cqes = (struct io_uring_cqe *) (p + params.cq_off.cqes);
+
+    r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq.sqes = mmap(NULL, r->sqes_size, PROT_READ|PROT_WRITE,
+                      MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+
+    if (r->sq.sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      "mmap(IORING_OFF_SQES) failed");
+        r->sq.sqes = NULL;
+        return NGX_ERROR;
+    }
+
+    p = r->sq_ring;
+
+    r->sq.head = (uint32_t *) (p + params.sq_off.head);
+    r->sq.tail = (uint32_t *) (p + params.sq_off.tail);
+    r->sq.mask = (uint32_t *) (p + params.sq_off.ring_mask);
+    r->sq.entries = (uint32_t *) (p + params.sq_off.ring_entries);
+    r->sq.array = (uint32_t *) (p + params.sq_off.array);
+    r->sq.local_tail = *r->sq.tail;
+
+    /* sqes are always used in order, so the index array is static */
+
+    for (i = 0; i < params.sq_entries; i++) {
+        r->sq.array[i] = i;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring: fd:%d sq:%uD cq:%uD",
+                   r->fd, params.sq_entries, params.cq_entries);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_test_multishot(ngx_cycle_t *cycle)
+{
+    int                   s[2], n;
+    ngx_int_t             rc;
+    uint32_t              head;
+    struct timespec       ts;
+    struct io_uring_sqe  *sqe;
+    struct io_uring_cqe  *cqe;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "socketpair() failed");
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+
+    if (write(s[1], "", 1) != 1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "write() failed");
+        goto failed;
+    }
+
+    /* the zero user data is never dispatched by ngx_iouring_process_events() */
+
+    sqe = ngx_iouring_get_sqe(&ring, cycle->log);
+    if (sqe == NULL) {
+        goto failed;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = s[0];
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+
+    ngx_memory_barrier();
+    *ring.sq.tail = ring.sq.local_tail;
+
+    ts.tv_sec = 5;
+    ts.tv_nsec = 0;
+
+    n = io_uring_enter(ring.fd, 1, 1, IORING_ENTER_GETEVENTS, &ts);
+
+    if (n == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring_enter() failed");
+        goto failed;
+    }
+
+    head = *ring.cq.head;
+    ngx_memory_barrier();
+
+    if (head == *ring.cq.tail) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, NGX_ETIMEDOUT,
+                      "io_uring_enter() timed out");
+        goto failed;
+    }
+
+    cqe = &ring.cq.cqes[head & *ring.cq.mask];
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "testing io_uring multishot poll: res:%d flags:%uD",
+                   cqe->res, cqe->flags);
+
+    if (cqe->res < 0 || !(cqe->flags & IORING_CQE_F_MORE)) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "io_uring multishot poll is not supported by "
+                      "the kernel, Linux 5.13 or newer is required");
+
+        ngx_memory_barrier();
+        *ring.cq.head = head + 1;
+
+        goto failed;
+    }
+
+    ngx_memory_barrier();
+    *ring.cq.head = head + 1;
+
+    /* the removal completions are skipped as stale ones */
+
+    rc = ngx_iouring_poll_remove(NULL, cycle->log);
+
+failed:
+
+    if (close(s[1]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "close() failed");
+    }
+
+    if (close(s[0]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "close() failed");
+    }
+
+    return rc;
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_iouring_notify_init(ngx_log_t *log)
+{
+#if (NGX_HAVE_SYS_EVENTFD_H)
+    notify_fd = eventfd(0, 0);
+#else
+    notify_fd = syscall(SYS_eventfd, 0);
+#endif
+
+    if (notify_fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno, "eventfd() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "notify eventfd: %d", notify_fd);
+
+    notify_event.handler = ngx_iouring_notify_handler;
+    notify_event.log = log;
+    notify_event.active = 1;
+
+    notify_conn.fd = notify_fd;
+    notify_conn.read = &notify_event;
+    notify_conn.log = log;
+
+    if (ngx_iouring_poll_add(&notify_conn, POLLIN, log) != NGX_OK) {
+
+        if (close(notify_fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "eventfd close() failed");
+        }
+
+        notify_fd = -1;
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_iouring_notify_handler(ngx_event_t *ev)
+{
+    ssize_t               n;
+    uint64_t              count;
+    ngx_err_t             err;
+    ngx_event_handler_pt  handler;
+
+    if (++ev->index == NGX_MAX_UINT32_VALUE) {
+        ev->index = 0;
+
+        n = read(notify_fd, &count, sizeof(uint64_t));
+
+        err = ngx_errno;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "read() eventfd %d: %z count:%uL", notify_fd, n, count);
+
+        if ((size_t) n != sizeof(uint64_t)) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                          "read() eventfd %d failed", notify_fd);
+        }
+    }
+
+    handler = ev->data;
+    handler(ev);
+}
+
+#endif
+
+
+static void
+ngx_iouring_done(ngx_cycle_t *cycle)
+{
+    ngx_iouring_close(&ring, cycle->log);
+    ngx_iouring_close(&send_ring, cycle->log);
+
+#if (NGX_HAVE_EVENTFD)
+
+    if (notify_fd != -1 && close(notify_fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "eventfd close() failed");
+    }
+
+    notify_fd = -1;
+
+#endif
+
+#if (NGX_HAVE_FILE_AIO)
+    ngx_iouring_aio = 0;
+#endif
+
+    ngx_iouring_multishot_accept = 0;
+}
+
+
+static void
+ngx_iouring_close(ngx_iouring_ring_t *r, ngx_log_t *log)
+{
+    if (r->fd != -1 && close(r->fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    r->fd = -1;
+
+    if (r->sq.sqes) {
+        if (munmap(r->sq.sqes, r->sqes_size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "munmap(IORING_OFF_SQES) failed");
+        }
+
+        r->sq.sqes = NULL;
+    }
+
+    if (r->cq_ring != MAP_FAILED) {
+        if (munmap(r->cq_ring, r->cq_ring_size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "munmap(IORING_OFF_CQ_RING) failed");
+        }
+
+        r->cq_ring = MAP_FAILED;
+    }
+
+    if (r->sq_ring != MAP_FAILED) {
+        if (munmap(r->sq_ring, r->sq_ring_size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "munmap(IORING_OFF_SQ_RING) failed");
+        }
+
+        r->sq_ring = MAP_FAILED;
+    }
+}
+
+
+static struct io_uring_sqe *
+ngx_iouring_get_sqe(ngx_iouring_ring_t *r, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    if (r->sq.local_tail - *r->sq.head >= *r->sq.entries) {
+
+        /* the submission queue is full, pass the queued requests */
+
+        ngx_memory_barrier();
+        *r->sq.tail = r->sq.local_tail;
+
+        if (io_uring_enter(r->fd, r->sq.local_tail - *r->sq.head, 0, 0, NULL)
+            == -1)
+        {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "io_uring_enter() failed");
+            return NULL;
+        }
+
+        if (r->sq.local_tail - *r->sq.head >= *r->sq.entries) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "io_uring submission queue overflow");
+            return NULL;
+        }
+    }
+
+    sqe = &r->sq.sqes[r->sq.local_tail & *r->sq.mask];
+
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    r->sq.local_tail++;
+
+    return sqe;
+}
+
+
+static ngx_int_t
+ngx_iouring_poll_add(ngx_connection_t *c, uint32_t events, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring poll add: fd:%d ev:%08XD", c->fd, events);
+
+    sqe = ngx_iouring_get_sqe(&ring, log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = c->fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = events;
+    sqe->user_data = (uint64_t) ((uintptr_t) c | c->read->instance);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_poll_remove(ngx_connection_t *c, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(&ring, log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+
+    if (c) {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "io_uring poll remove: fd:%d", c->fd);
+
+        sqe->addr = (uint64_t) ((uintptr_t) c | c->read->instance);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_accept_add(ngx_connection_t *c, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring accept add: fd:%d", c->fd);
+
+    /* the data of a listening connection is not used otherwise */
+
+    if (c->data == NULL) {
+        c->data = ngx_calloc(sizeof(ngx_iouring_accept_t), log);
+        if (c->data == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    sqe = ngx_iouring_get_sqe(&ring, log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = c->fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = (uint64_t) ((uintptr_t) c | NGX_IOURING_ACCEPT_EVENT
+                                 | c->read->instance);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_accept_cancel(ngx_connection_t *c, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring accept cancel: fd:%d", c->fd);
+
+    sqe = ngx_iouring_get_sqe(&ring, log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (uint64_t) ((uintptr_t) c | NGX_IOURING_ACCEPT_EVENT
+                            | c->read->instance);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_accept_push(ngx_iouring_accept_t *q, ngx_socket_t s,
+    ngx_log_t *log)
+{
+    ngx_uint_t     i, size;
+    ngx_socket_t  *fds;
+
+    if (q->n == q->size) {
+        size = q->size ? 2 * q->size : NGX_IOURING_ACCEPT_QUEUE;
+
+        fds = ngx_alloc(size * sizeof(ngx_socket_t), log);
+        if (fds == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < q->n; i++) {
+            fds[i] = q->fds[(q->head + i) & (q->size - 1)];
+        }
+
+        if (q->fds) {
+            ngx_free(q->fds);
+        }
+
+        q->fds = fds;
+        q->head = 0;
+        q->size = size;
+    }
+
+    q->fds[(q->head + q->n) & (q->size - 1)] = s;
+    q->n++;
+
+    return NGX_OK;
+}
+
+
+ngx_socket_t
+ngx_iouring_accept(ngx_event_t *ev, struct sockaddr *sockaddr,
+    socklen_t *socklen)
+{
+    socklen_t              len;
+    ngx_socket_t           s;
+    ngx_connection_t      *c;
+    ngx_iouring_accept_t  *q;
+
+    c = ev->data;
+    q = c->data;
+
+    len = *socklen;
+
+    while (q && q->n) {
+        s = q->fds[q->head];
+
+        q->head = (q->head + 1) & (q->size - 1);
+        q->n--;
+
+        if (q->n) {
+
+            /*
+             * the accepted connections are not reported again,
+             * so the rest of the queue is taken in the next iterations
+             * even if the accept() loop stops early
+             */
+
+            ngx_post_event(ev, &ngx_posted_next_events);
+        }
+
+        /* the errors are kept in the queue as negative numbers */
+
+        if (s < 0) {
+            ngx_set_socket_errno(-s);
+            return (ngx_socket_t) -1;
+        }
+
+        *socklen = len;
+
+        if (getpeername(s, sockaddr, socklen) == 0) {
+            return s;
+        }
+
+        ngx_log_error(NGX_LOG_ERR, ev->log, ngx_socket_errno,
+                      "getpeername() failed");
+
+        if (ngx_close_socket(s) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+    }
+
+    ngx_set_socket_errno(NGX_EAGAIN);
+
+    return (ngx_socket_t) -1;
+}
+
+
+static void
+ngx_iouring_accept_close(ngx_connection_t *c, ngx_log_t *log)
+{
+    ngx_socket_t           s;
+    ngx_iouring_accept_t  *q;
+
+    q = c->data;
+
+    if (q == NULL) {
+        return;
+    }
+
+    while (q->n) {
+        s = q->fds[q->head];
+
+        q->head = (q->head + 1) & (q->size - 1);
+        q->n--;
+
+        if (s >= 0 && ngx_close_socket(s) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+    }
+
+    if (q->fds) {
+        ngx_free(q->fds);
+    }
+
+    ngx_free(q);
+
+    c->data = NULL;
+}
+
+
+static ngx_int_t
+ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    ngx_event_t       *e;
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    e = (event == NGX_READ_EVENT) ? c->write : c->read;
+
+    if (ev->accept && c->type == SOCK_STREAM && ngx_iouring_multishot_accept) {
+
+        if (!ev->active && ngx_iouring_accept_add(c, ev->log) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ev->active = 1;
+
+        return NGX_OK;
+    }
+
+    /*
+     * a socket is always polled for both directions, and the events
+     * of the inactive direction are ignored
+     */
+
+    if (!ev->active && !e->active) {
+        if (ngx_iouring_poll_add(c, NGX_IOURING_POLL, ev->log) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    ev->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    ngx_event_t       *e;
+    ngx_connection_t  *c;
+
+    if (!ev->active) {
+        return NGX_OK;
+    }
+
+    c = ev->data;
+
+    e = (event == NGX_READ_EVENT) ? c->write : c->read;
+
+    ev->active = 0;
+
+    if (ev->accept && c->type == SOCK_STREAM && ngx_iouring_multishot_accept) {
+
+        /*
+         * the connections which are already accepted are processed
+         * unless the listening socket is closed
+         */
+
+        if (flags & NGX_CLOSE_EVENT) {
+            ngx_iouring_accept_close(c, ev->log);
+        }
+
+        return ngx_iouring_accept_cancel(c, ev->log);
+    }
+
+    /*
+     * unlike epoll, the poll request holds a reference to the file,
+     * so it must be removed even before the closing the file descriptor
+     */
+
+    if (e->active && !(flags & NGX_CLOSE_EVENT)) {
+        return NGX_OK;
+    }
+
+    e->active = 0;
+
+    return ngx_iouring_poll_remove(c, ev->log);
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_iouring_notify(ngx_event_handler_pt handler)
+{
+    static uint64_t inc = 1;
+
+    notify_event.data = handler;
+
+    if ((size_t) write(notify_fd, &inc, sizeof(uint64_t)) != sizeof(uint64_t)) {
+        ngx_log_error(NGX_LOG_ALERT, notify_event.log, ngx_errno,
+                      "write() to eventfd %d failed", notify_fd);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+#if (NGX_HAVE_FILE_AIO)
+
+ngx_int_t
+ngx_iouring_aio_read(ngx_event_t *ev, ngx_fd_t fd, u_char *buf, size_t size,
+    off_t offset)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(&ring, ev->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = (uint64_t) ((uintptr_t) ev | NGX_IOURING_AIO_EVENT);
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_iouring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    int                   n;
+    uint32_t              head, tail, mask;
+    ngx_uint_t            level;
+    ngx_err_t             err;
+    struct timespec       ts, *tp;
+    struct io_uring_cqe  *cqe;
+#if (NGX_HAVE_FILE_AIO)
+    ngx_event_t          *e;
+    ngx_event_aio_t      *aio;
+#endif
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M, submit: %uD",
+                   timer, ring.sq.local_tail - *ring.sq.head);
+
+    if (timer == NGX_TIMER_INFINITE) {
+        tp = NULL;
+
+    } else {
+        ts.tv_sec = timer / 1000;
+        ts.tv_nsec = (timer % 1000) * 1000000;
+        tp = &ts;
+    }
+
+    /* all requests queued since the previous iteration are passed at once */
+
+    ngx_memory_barrier();
+    *ring.sq.tail = ring.sq.local_tail;
+
+    n = io_uring_enter(ring.fd, ring.sq.local_tail - *ring.sq.head, 1,
+                       IORING_ENTER_GETEVENTS, tp);
+
+    err = (n == -1) ? ngx_errno : 0;
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    /* ETIME is returned if the timer has expired without completions */
+
+    if (err && err != ETIME && err != NGX_EBUSY) {
+        if (err == NGX_EINTR) {
+
+            if (ngx_event_timer_alarm) {
+                ngx_event_timer_alarm = 0;
+                return NGX_OK;
+            }
+
+            level = NGX_LOG_INFO;
+
+        } else {
+            level = NGX_LOG_ALERT;
+        }
+
+        ngx_log_error(level, cycle->log, err, "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    head = *ring.cq.head;
+    tail = *ring.cq.tail;
+    mask = *ring.cq.mask;
+
+    ngx_memory_barrier();
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring completions: %uD", tail - head);
+
+    for ( /* void */ ; head != tail; head++) {
+        cqe = &ring.cq.cqes[head & mask];
+
+        if (cqe->user_data == 0) {
+            continue;
+        }
+
+#if (NGX_HAVE_FILE_AIO)
+
+        if (cqe->user_data & NGX_IOURING_AIO_EVENT) {
+            e = (ngx_event_t *) (uintptr_t)
+                               (cqe->user_data & ~NGX_IOURING_AIO_EVENT);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring aio: %p res:%d", e, cqe->res);
+
+            e->complete = 1;
+            e->active = 0;
+            e->ready = 1;
+
+            aio = e->data;
+            aio->res = cqe->res;
+
+            ngx_post_event(e, &ngx_posted_events);
+
+            continue;
+        }
+
+#endif
+
+        if (cqe->user_data & NGX_IOURING_ACCEPT_EVENT) {
+            ngx_iouring_process_accept(cycle, cqe, flags);
+            continue;
+        }
+
+        ngx_iouring_process_poll(cycle, cqe, flags);
+    }
+
+    ngx_memory_barrier();
+    *ring.cq.head = head;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_iouring_process_poll(ngx_cycle_t *cycle, struct io_uring_cqe *cqe,
+    ngx_uint_t flags)
+{
+    uint32_t           revents;
+    ngx_int_t          instance;
+    ngx_event_t       *rev, *wev;
+    ngx_queue_t       *queue;
+    ngx_connection_t  *c;
+
+    c = (ngx_connection_t *) (uintptr_t) cqe->user_data;
+
+    instance = (uintptr_t) c & 1;
+    c = (ngx_connection_t *) ((uintptr_t) c & (uintptr_t) ~1);
+
+    rev = c->read;
+
+    if (c->fd == -1 || rev->instance != instance) {
+
+        /*
+         * the stale event from a file descriptor
+         * that was just closed in this iteration
+         */
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: stale event %p", c);
+        return;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: fd:%d res:%d fl:%uD d:%p",
+                   c->fd, cqe->res, cqe->flags, (void *) cqe->user_data);
+
+    if (cqe->res < 0) {
+        if (cqe->res == -NGX_ECANCELED) {
+
+            /* the request was removed, and may have been armed again */
+
+            return;
+        }
+
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, -cqe->res,
+                      "io_uring poll failed on fd:%d", c->fd);
+
+        revents = POLLERR;
+
+    } else {
+        revents = cqe->res;
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)
+        && (rev->active || (c->write && c->write->active)))
+    {
+        /*
+         * the kernel has terminated the multishot request,
+         * which is always the case if it has failed
+         */
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring poll rearm: fd:%d", c->fd);
+
+        if (ngx_iouring_poll_add(c, c->write ? NGX_IOURING_POLL : POLLIN,
+                                 cycle->log)
+            != NGX_OK)
+        {
+            revents = POLLERR;
+        }
+    }
+
+    if (revents & (POLLERR|POLLHUP)) {
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring error on fd:%d ev:%04XD", c->fd, revents);
+
+        /*
+         * if the error events were returned, add POLLIN and POLLOUT
+         * to handle the events at least in one active handler
+         */
+
+        revents |= POLLIN|POLLOUT;
+    }
+
+    if ((revents & POLLIN) && rev->active) {
+
+        rev->ready = 1;
+        rev->available = -1;
+
+        if (flags & NGX_POST_EVENTS) {
+            queue = rev->accept ? &ngx_posted_accept_events
+                                : &ngx_posted_events;
+
+            ngx_post_event(rev, queue);
+
+        } else {
+            rev->handler(rev);
+        }
+    }
+
+    wev = c->write;
+
+    if ((revents & POLLOUT) && wev && wev->active) {
+
+        if (c->fd == -1 || wev->instance != instance) {
+
+            /*
+             * the stale event from a file descriptor
+             * that was just closed in this iteration
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %p", c);
+            return;
+        }
+
+        wev->ready = 1;
+#if (NGX_THREADS)
+        wev->complete = 1;
+#endif
+
+        if (flags & NGX_POST_EVENTS) {
+            ngx_post_event(wev, &ngx_posted_events);
+
+        } else {
+            wev->handler(wev);
+        }
+    }
+}
+
+
+static void
+ngx_iouring_process_accept(ngx_cycle_t *cycle, struct io_uring_cqe *cqe,
+    ngx_uint_t flags)
+{
+    ngx_int_t              instance;
+    ngx_event_t           *rev;
+    ngx_connection_t      *c;
+    ngx_iouring_accept_t  *q;
+
+    c = (ngx_connection_t *) (uintptr_t)
+                             (cqe->user_data & ~NGX_IOURING_ACCEPT_EVENT);
+
+    instance = (uintptr_t) c & 1;
+    c = (ngx_connection_t *) ((uintptr_t) c & (uintptr_t) ~1);
+
+    rev = c->read;
+
+    if (c->fd == -1 || rev->instance != instance || !rev->accept
+        || c->data == NULL)
+    {
+        /*
+         * the listening socket was closed in this iteration,
+         * so the connection accepted meanwhile is closed as well
+         */
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: stale accept %p res:%d", c, cqe->res);
+
+        if (cqe->res >= 0 && ngx_close_socket(cqe->res) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+
+        return;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring accept: fd:%d res:%d fl:%uD d:%p",
+                   c->fd, cqe->res, cqe->flags, (void *) cqe->user_data);
+
+    if (cqe->res == -NGX_ECANCELED) {
+
+        /* the request was cancelled, and may have been armed again */
+
+        return;
+    }
+
+    if (cqe->res == -NGX_EINVAL) {
+
+        /* the multishot accept appeared in Linux 5.19 */
+
+        if (ngx_iouring_multishot_accept) {
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                          "io_uring multishot accept is not supported "
+                          "by the kernel, polling listening sockets");
+
+            ngx_iouring_multishot_accept = 0;
+        }
+
+        ngx_iouring_accept_close(c, cycle->log);
+
+        if (rev->active) {
+            (void) ngx_iouring_poll_add(c, POLLIN, cycle->log);
+        }
+
+        return;
+    }
+
+    q = c->data;
+
+    if (ngx_iouring_accept_push(q, cqe->res, cycle->log) != NGX_OK) {
+
+        if (cqe->res >= 0 && ngx_close_socket(cqe->res) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+
+        return;
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)
+        && rev->active
+        && cqe->res != -NGX_EMFILE
+        && cqe->res != -NGX_ENFILE)
+    {
+        /*
+         * the kernel has terminated the multishot request, which is
+         * always the case if it has failed; on EMFILE and ENFILE
+         * the request is armed again when accept events are enabled
+         * after the ngx_event_accept() delay
+         */
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring accept rearm: fd:%d", c->fd);
+
+        (void) ngx_iouring_accept_add(c, cycle->log);
+    }
+
+    rev->ready = 1;
+    rev->available = -1;
+
+    if (flags & NGX_POST_EVENTS) {
+        ngx_post_event(rev, &ngx_posted_accept_events);
+
+    } else {
+        rev->handler(rev);
+    }
+}
+
+
+static ngx_chain_t *
+ngx_iouring_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
+{
+    ssize_t        n, sent;
+    off_t          send, prev_send;
+    ngx_chain_t   *cl;
+    ngx_event_t   *wev;
+    ngx_iovec_t    vec;
+    struct iovec   iovs[NGX_IOVS_PREALLOCATE];
+
+    /* file buffers are sent by sendfile() */
+
+    for (cl = in; cl; cl = cl->next) {
+        if (cl->buf->in_file) {
+            return ngx_os_io.send_chain(c, in, limit);
+        }
+    }
+
+    wev = c->write;
+
+    if (!wev->ready) {
+        return in;
+    }
+
+    /* the maximum limit size is the maximum size_t value - the page size */
+
+    if (limit == 0 || limit > (off_t) (NGX_MAX_SIZE_T_VALUE - ngx_pagesize)) {
+        limit = NGX_MAX_SIZE_T_VALUE - ngx_pagesize;
+    }
+
+    send = 0;
+
+    vec.iovs = iovs;
+    vec.nalloc = NGX_IOVS_PREALLOCATE;
+
+    for ( ;; ) {
+        prev_send = send;
+
+        /* create the iovec and coalesce the neighbouring bufs */
+
+        cl = ngx_output_chain_to_iovec(&vec, in, limit - send, c->log);
+
+        if (cl == NGX_CHAIN_ERROR) {
+            return NGX_CHAIN_ERROR;
+        }
+
+        send += vec.size;
+
+        n = ngx_iouring_send(c, &vec);
+
+        if (n == NGX_ERROR) {
+            return NGX_CHAIN_ERROR;
+        }
+
+        sent = (n == NGX_AGAIN) ? 0 : n;
+
+        c->sent += sent;
+
+        in = ngx_chain_update_sent(in, sent);
+
+        if (send - prev_send != sent) {
+            wev->ready = 0;
+            return in;
+        }
+
+        if (send >= limit || in == NULL) {
+            return in;
+        }
+    }
+}
+
+
+static ssize_t
+ngx_iouring_send(ngx_connection_t *c, ngx_iovec_t *vec)
+{
+    int                   n;
+    uint32_t              head;
+    ngx_err_t             err;
+    struct msghdr         msg;
+    struct io_uring_sqe  *sqe;
+
+    if (vec->count == 0) {
+        return 0;
+    }
+
+    ngx_memzero(&msg, sizeof(struct msghdr));
+
+    msg.msg_iov = vec->iovs;
+    msg.msg_iovlen = vec->count;
+
+eintr:
+
+    sqe = ngx_iouring_get_sqe(&send_ring, c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* a single buffer does not need the message header to be copied */
+
+    if (vec->count == 1) {
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = (uint64_t) (uintptr_t) vec->iovs[0].iov_base;
+        sqe->len = vec->iovs[0].iov_len;
+
+    } else {
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->addr = (uint64_t) (uintptr_t) &msg;
+        sqe->len = 1;
+    }
+
+    sqe->fd = c->fd;
+
+    /* EAGAIN is reported instead of waiting for the socket to be writable */
+
+    sqe->msg_flags = MSG_DONTWAIT;
+
+    sqe->user_data = (uint64_t) (uintptr_t) c;
+
+    ngx_memory_barrier();
+    *send_ring.sq.tail = send_ring.sq.local_tail;
+
+    for ( ;; ) {
+        n = io_uring_enter(send_ring.fd,
+                           send_ring.sq.local_tail - *send_ring.sq.head, 1,
+                           IORING_ENTER_GETEVENTS, NULL);
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err != NGX_EINTR) {
+                ngx_log_error(NGX_LOG_ALERT, c->log, err,
+                              "io_uring_enter() failed");
+
+                /* the request is dropped, as the message is not kept */
+
+                send_ring.sq.local_tail = *send_ring.sq.head;
+                *send_ring.sq.tail = send_ring.sq.local_tail;
+
+                c->write->error = 1;
+                return NGX_ERROR;
+            }
+        }
+
+        head = *send_ring.cq.head;
+        ngx_memory_barrier();
+
+        if (head != *send_ring.cq.tail) {
+            break;
+        }
+    }
+
+    n = send_ring.cq.cqes[head & *send_ring.cq.mask].res;
+
+    ngx_memory_barrier();
+    *send_ring.cq.head = head + 1;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring send: fd:%d %d of %uz", c->fd, n, vec->size);
+
+    if (n < 0) {
+        err = -n;
+
+        switch (err) {
+        case NGX_EAGAIN:
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "io_uring send not ready");
+            return NGX_AGAIN;
+
+        case NGX_EINTR:
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "io_uring send was interrupted");
+            goto eintr;
+
+        default:
+            c->write->error = 1;
+            ngx_connection_error(c, err, "io_uring send failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return n;
+}
+
+
+static void *
+ngx_iouring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_iouring_conf_t  *iucf;
+
+    iucf = ngx_palloc(cycle->pool, sizeof(ngx_iouring_conf_t));
+    if (iucf == NULL) {
+        return NULL;
+    }
+
+    iucf->entries = NGX_CONF_UNSET;
+
+    return iucf;
+}
+
+
+static char *
+ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_iouring_conf_t *iucf = conf;
+
+    ngx_conf_init_uint_value(iucf->entries, 1024);
+
+    return NGX_CONF_OK;
+}
@@ -23,6 +23,8 @@ extern ngx_module_t ngx_select_module;
 static char *ngx_event_init_conf(ngx_cycle_t *cycle, void *conf);
 static ngx_int_t ngx_event_module_init(ngx_cycle_t *cycle);
 static ngx_int_t ngx_event_process_init(ngx_cycle_t *cycle);
+static void ngx_event_loop_update(ngx_msec_t idle, ngx_msec_t start,
+    ngx_uint_t handled);
 static char *ngx_events_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 static char *ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -43,6 +45,11 @@ static ngx_uint_t     ngx_event_max_module;
 ngx_uint_t            ngx_event_flags;
 ngx_event_actions_t   ngx_event_actions;
 
+ngx_uint_t            ngx_event_loop_timing;
+ngx_msec_t            ngx_event_loop_lag;
+ngx_uint_t            ngx_event_loop_events;
+ngx_uint_t            ngx_events_handled;
+
 
 static ngx_atomic_t   connection_counter = 1;
 ngx_atomic_t         *ngx_connection_counter = &connection_counter;
@@ -74,6 +81,18 @@ static ngx_atomic_t   ngx_stat_writing0;
 ngx_atomic_t         *ngx_stat_writing = &ngx_stat_writing0;
 static ngx_atomic_t   ngx_stat_waiting0;
 ngx_atomic_t         *ngx_stat_waiting = &ngx_stat_waiting0;
+static ngx_atomic_t   ngx_stat_ktls_send0;
+ngx_atomic_t         *ngx_stat_ktls_send = &ngx_stat_ktls_send0;
+static ngx_atomic_t   ngx_stat_ktls_recv0;
+ngx_atomic_t         *ngx_stat_ktls_recv = &ngx_stat_ktls_recv0;
+static ngx_atomic_t   ngx_stat_keepalive_idle0;
+ngx_atomic_t         *ngx_stat_keepalive_idle = &ngx_stat_keepalive_idle0;
+static ngx_atomic_t   ngx_stat_keepalive_reused0;
+ngx_atomic_t         *ngx_stat_keepalive_reused = &ngx_stat_keepalive_reused0;
+static ngx_atomic_t   ngx_stat_keepalive_missed0;
+ngx_atomic_t         *ngx_stat_keepalive_missed = &ngx_stat_keepalive_missed0;
+static ngx_atomic_t   ngx_stat_keepalive_passed0;
+ngx_atomic_t         *ngx_stat_keepalive_passed = &ngx_stat_keepalive_passed0;
 
 #endif
 
@@ -155,6 +174,13 @@ static ngx_command_t  ngx_event_core_commands[] = {
       offsetof(ngx_event_conf_t, accept_mutex_delay),
       NULL },
 
+    { ngx_string("timer_wheel"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_event_conf_t, timer_wheel),
+      NULL },
+
     { ngx_string("debug_connection"),
       NGX_EVENT_CONF|NGX_CONF_TAKE1,
       ngx_event_debug_connection,
@@ -194,8 +220,8 @@ ngx_module_t  ngx_event_core_module = {
 void
 ngx_process_events_and_timers(ngx_cycle_t *cycle)
 {
-    ngx_uint_t  flags;
-    ngx_msec_t  timer, delta;
+    ngx_uint_t  flags, handled;
+    ngx_msec_t  timer, delta, start;
 
     if (ngx_timer_resolution) {
         timer = NGX_TIMER_INFINITE;
@@ -216,6 +242,16 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
 #endif
     }
 
+    if (ngx_event_loop_timing) {
+
+        /*
+         * ready events are posted to be handled after the wait,
+         * so the loop can tell waiting from handling and count them
+         */
+
+        flags |= NGX_UPDATE_TIME|NGX_POST_EVENTS;
+    }
+
     if (ngx_use_accept_mutex) {
         if (ngx_accept_disabled > 0) {
             ngx_accept_disabled--;
@@ -252,6 +288,9 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
                    "timer delta: %M", delta);
 
+    start = ngx_current_msec;
+    handled = ngx_events_handled;
+
     ngx_event_process_posted(cycle, &ngx_posted_accept_events);
 
     if (ngx_accept_mutex_held) {
@@ -261,6 +300,44 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
     ngx_event_expire_timers();
 
     ngx_event_process_posted(cycle, &ngx_posted_events);
+
+    if (ngx_event_loop_timing) {
+        ngx_event_loop_update(delta, start, handled);
+    }
+}
+
+
+static void
+ngx_event_loop_update(ngx_msec_t idle, ngx_msec_t start, ngx_uint_t handled)
+{
+    ngx_msec_t         busy;
+    static ngx_msec_t  lag;
+
+    /*
+     * the time spent handling events after a wakeup is how long
+     * a newly ready event may wait for its turn; it is smoothed
+     * the same way as TCP smoothes round-trip time, lag is scaled by 8
+     */
+
+    ngx_time_update();
+
+    busy = ngx_current_msec - start;
+
+    if (idle > (lag >> 3)) {
+
+        /* the loop slept longer than the lag, nothing was waiting */
+
+        lag = busy << 3;
+
+    } else {
+        lag = lag - (lag >> 3) + busy;
+    }
+
+    ngx_event_loop_lag = lag >> 3;
+    ngx_event_loop_events = ngx_events_handled - handled;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
+                   "event loop busy: %M, lag: %M", busy, ngx_event_loop_lag);
 }
 
 
@@ -542,7 +619,13 @@ ngx_event_module_init(ngx_cycle_t *cycle)
            + cl          /* ngx_stat_active */
            + cl          /* ngx_stat_reading */
            + cl          /* ngx_stat_writing */
-           + cl;         /* ngx_stat_waiting */
+           + cl          /* ngx_stat_waiting */
+           + cl          /* ngx_stat_ktls_send */
+           + cl          /* ngx_stat_ktls_recv */
+           + cl          /* ngx_stat_keepalive_idle */
+           + cl          /* ngx_stat_keepalive_reused */
+           + cl          /* ngx_stat_keepalive_missed */
+           + cl;         /* ngx_stat_keepalive_passed */
 
 #endif
 
@@ -589,6 +672,12 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     ngx_stat_reading = (ngx_atomic_t *) (shared + 7 * cl);
     ngx_stat_writing = (ngx_atomic_t *) (shared + 8 * cl);
     ngx_stat_waiting = (ngx_atomic_t *) (shared + 9 * cl);
+    ngx_stat_ktls_send = (ngx_atomic_t *) (shared + 10 * cl);
+    ngx_stat_ktls_recv = (ngx_atomic_t *) (shared + 11 * cl);
+    ngx_stat_keepalive_idle = (ngx_atomic_t *) (shared + 12 * cl);
+    ngx_stat_keepalive_reused = (ngx_atomic_t *) (shared + 13 * cl);
+    ngx_stat_keepalive_missed = (ngx_atomic_t *) (shared + 14 * cl);
+    ngx_stat_keepalive_passed = (ngx_atomic_t *) (shared + 15 * cl);
 
 #endif
 
@@ -651,6 +740,8 @@ ngx_event_process_init(ngx_cycle_t *cycle)
     ngx_queue_init(&ngx_posted_next_events);
     ngx_queue_init(&ngx_posted_events);
 
+    ngx_event_timer_wheel = ecf->timer_wheel;
+
     if (ngx_event_timer_init(cycle->log) == NGX_ERROR) {
         return NGX_ERROR;
     }
@@ -1238,6 +1329,7 @@ ngx_event_core_create_conf(ngx_cycle_t *cycle)
     ecf->multi_accept = NGX_CONF_UNSET;
     ecf->accept_mutex = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
+    ecf->timer_wheel = NGX_CONF_UNSET;
     ecf->name = (void *) NGX_CONF_UNSET;
 
 #if (NGX_DEBUG)
@@ -1337,6 +1429,7 @@ ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_value(ecf->multi_accept, 0);
     ngx_conf_init_value(ecf->accept_mutex, 0);
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);
+    ngx_conf_init_value(ecf->timer_wheel, 0);
 
     return NGX_CONF_OK;
 }
@@ -267,6 +267,13 @@ extern ngx_uint_t            ngx_use_epoll_rdhup;
  */
 #define NGX_USE_VNODE_EVENT      0x00002000
 
+/*
+ * The event filter may coalesce notifications, so a listening socket
+ * not drained on a notification is handled again in the next iteration:
+ * io_uring multishot poll.
+ */
+#define NGX_USE_DRAIN_EVENT      0x00004000
+
 
 /*
  * The event filter is deleted just before the closing file.
@@ -435,6 +442,8 @@ typedef struct {
 
     ngx_msec_t    accept_mutex_delay;
 
+    ngx_flag_t    timer_wheel;
+
     u_char       *name;
 
 #if (NGX_DEBUG)
@@ -474,6 +483,12 @@ extern ngx_atomic_t  *ngx_stat_active;
 extern ngx_atomic_t  *ngx_stat_reading;
 extern ngx_atomic_t  *ngx_stat_writing;
 extern ngx_atomic_t  *ngx_stat_waiting;
+extern ngx_atomic_t  *ngx_stat_ktls_send;
+extern ngx_atomic_t  *ngx_stat_ktls_recv;
+extern ngx_atomic_t  *ngx_stat_keepalive_idle;
+extern ngx_atomic_t  *ngx_stat_keepalive_reused;
+extern ngx_atomic_t  *ngx_stat_keepalive_missed;
+extern ngx_atomic_t  *ngx_stat_keepalive_passed;
 
 #endif
 
@@ -484,6 +499,10 @@ extern ngx_atomic_t  *ngx_stat_waiting;
 
 extern sig_atomic_t           ngx_event_timer_alarm;
 extern ngx_uint_t             ngx_event_flags;
+extern ngx_uint_t             ngx_event_loop_timing;
+extern ngx_msec_t             ngx_event_loop_lag;
+extern ngx_uint_t             ngx_event_loop_events;
+extern ngx_uint_t             ngx_events_handled;
 extern ngx_module_t           ngx_events_module;
 extern ngx_module_t           ngx_event_core_module;
 
@@ -10,6 +10,14 @@
 #include <ngx_event.h>
 
 
+#if (NGX_HAVE_IO_URING)
+extern ngx_uint_t  ngx_iouring_multishot_accept;
+
+ngx_socket_t ngx_iouring_accept(ngx_event_t *ev, struct sockaddr *sockaddr,
+    socklen_t *socklen);
+#endif
+
+
 static ngx_int_t ngx_disable_accept_events(ngx_cycle_t *cycle, ngx_uint_t all);
 #if (NGX_HAVE_EPOLLEXCLUSIVE)
 static void ngx_reorder_accept_events(ngx_listening_t *ls);
@@ -58,6 +66,12 @@ ngx_event_accept(ngx_event_t *ev)
     do {
         socklen = sizeof(ngx_sockaddr_t);
 
+#if (NGX_HAVE_IO_URING)
+        if (ngx_iouring_multishot_accept) {
+            s = ngx_iouring_accept(ev, &sa.sockaddr, &socklen);
+
+        } else
+#endif
 #if (NGX_HAVE_ACCEPT4)
         if (use_accept4) {
             s = accept4(lc->fd, &sa.sockaddr, &socklen, SOCK_NONBLOCK);
@@ -318,6 +332,23 @@ ngx_event_accept(ngx_event_t *ev)
 
     } while (ev->available);
 
+    if ((ngx_event_flags & NGX_USE_DRAIN_EVENT)
+        && (ngx_accept_mutex_held || !ngx_use_accept_mutex
+#if (NGX_HAVE_REUSEPORT)
+            || ls->reuseport
+#endif
+           ))
+    {
+        /*
+         * the listening socket is reported again only when a new
+         * connection arrives, so the rest of the queue is accepted
+         * in the next iterations, unless another worker holds
+         * the accept mutex
+         */
+
+        ngx_post_event(ev, &ngx_posted_next_events);
+    }
+
 #if (NGX_HAVE_EPOLLEXCLUSIVE)
     ngx_reorder_accept_events(ls);
 #endif
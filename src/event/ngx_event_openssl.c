@@ -9,12 +9,17 @@
 #include <ngx_core.h>
 #include <ngx_event.h>
 
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
+
 
 #define NGX_SSL_PASSWORD_BUFFER_SIZE  4096
 
 
 typedef struct {
     ngx_uint_t  engine;   /* unsigned  engine:1; */
+    ngx_uint_t  ktls;     /* unsigned  ktls:1; */
 } ngx_openssl_conf_t;
 
 
@@ -33,6 +38,7 @@ static int ngx_ssl_new_client_session(ngx_ssl_conn_t *ssl_conn,
 #ifdef SSL_READ_EARLY_DATA_SUCCESS
 static ngx_int_t ngx_ssl_try_early_data(ngx_connection_t *c);
 #endif
+static void ngx_ssl_handshake_ktls(ngx_connection_t *c);
 #if (NGX_DEBUG)
 static void ngx_ssl_handshake_log(ngx_connection_t *c);
 #endif
@@ -49,6 +55,8 @@ static ssize_t ngx_ssl_write_early(ngx_connection_t *c, u_char *data,
 #endif
 static ssize_t ngx_ssl_sendfile(ngx_connection_t *c, ngx_buf_t *file,
     size_t size);
+static ssize_t ngx_ssl_read_file(ngx_connection_t *c, ngx_buf_t *file,
+    u_char *buf, size_t size);
 static void ngx_ssl_read_handler(ngx_event_t *rev);
 static void ngx_ssl_shutdown_handler(ngx_event_t *ev);
 static void ngx_ssl_connection_error(ngx_connection_t *c, int sslerr,
@@ -65,8 +73,8 @@ static ngx_ssl_session_t *ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 #endif
     u_char *id, int len, int *copy);
 static void ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess);
-static void ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n);
+static void ngx_ssl_expire_sessions(ngx_ssl_session_shard_t *shard,
+    ngx_uint_t n);
 static void ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
@@ -74,6 +82,7 @@ static void ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
 static int ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *ectx,
     HMAC_CTX *hctx, int enc);
+static ngx_int_t ngx_ssl_rotate_ticket_keys(SSL_CTX *ssl_ctx, ngx_log_t *log);
 static void ngx_ssl_session_ticket_keys_cleanup(void *data);
 #endif
 
@@ -1509,6 +1518,46 @@ ngx_ssl_early_data(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable)
 }
 
 
+ngx_int_t
+ngx_ssl_ktls(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable)
+{
+    if (!enable) {
+        return NGX_OK;
+    }
+
+#ifdef SSL_OP_ENABLE_KTLS
+
+    /*
+     * the kernel offload is negotiated by OpenSSL after the handshake,
+     * connections with ciphers not supported by the kernel use SSL_write()
+     */
+
+    SSL_CTX_set_options(ssl->ctx, SSL_OP_ENABLE_KTLS);
+
+    ((ngx_openssl_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                         ngx_openssl_module))->ktls = 1;
+
+#else
+    ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
+                  "\"ssl_ktls\" is not supported on this platform, ignored");
+#endif
+
+    return NGX_OK;
+}
+
+
+ngx_uint_t
+ngx_ssl_ktls_enabled(ngx_cycle_t *cycle)
+{
+    ngx_openssl_conf_t  *oscf;
+
+    oscf = (ngx_openssl_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                               ngx_openssl_module);
+
+    return oscf->ktls;
+}
+
+
 ngx_int_t
 ngx_ssl_conf_commands(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *commands)
 {
@@ -1769,15 +1818,7 @@ ngx_ssl_handshake(ngx_connection_t *c)
 #endif
 #endif
 
-#ifdef BIO_get_ktls_send
-
-        if (BIO_get_ktls_send(SSL_get_wbio(c->ssl->connection)) == 1) {
-            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                           "BIO_get_ktls_send(): 1");
-            c->ssl->sendfile = 1;
-        }
-
-#endif
+        ngx_ssl_handshake_ktls(c);
 
         rc = ngx_ssl_ocsp_validate(c);
 
@@ -1914,15 +1955,7 @@ ngx_ssl_try_early_data(ngx_connection_t *c)
         c->read->ready = 1;
         c->write->ready = 1;
 
-#ifdef BIO_get_ktls_send
-
-        if (BIO_get_ktls_send(SSL_get_wbio(c->ssl->connection)) == 1) {
-            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                           "BIO_get_ktls_send(): 1");
-            c->ssl->sendfile = 1;
-        }
-
-#endif
+        ngx_ssl_handshake_ktls(c);
 
         rc = ngx_ssl_ocsp_validate(c);
 
@@ -2002,6 +2035,42 @@ ngx_ssl_try_early_data(ngx_connection_t *c)
 #endif
 
 
+static void
+ngx_ssl_handshake_ktls(ngx_connection_t *c)
+{
+#ifdef BIO_get_ktls_send
+
+    if (!c->ssl->ktls_send
+        && BIO_get_ktls_send(SSL_get_wbio(c->ssl->connection)) == 1)
+    {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "BIO_get_ktls_send(): 1");
+
+        c->ssl->ktls_send = 1;
+        c->ssl->sendfile = 1;
+
+#if (NGX_STAT_STUB)
+        (void) ngx_atomic_fetch_add(ngx_stat_ktls_send, 1);
+#endif
+    }
+
+    if (!c->ssl->ktls_recv
+        && BIO_get_ktls_recv(SSL_get_rbio(c->ssl->connection)) == 1)
+    {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "BIO_get_ktls_recv(): 1");
+
+        c->ssl->ktls_recv = 1;
+
+#if (NGX_STAT_STUB)
+        (void) ngx_atomic_fetch_add(ngx_stat_ktls_recv, 1);
+#endif
+    }
+
+#endif
+}
+
+
 #if (NGX_DEBUG)
 
 static void
@@ -2610,6 +2679,56 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                 break;
             }
 
+            if (!ngx_buf_in_memory(in->buf)) {
+
+                /* the file bufs queued before SSL_sendfile() has failed */
+
+                size = (ssize_t) (in->buf->file_last - in->buf->file_pos);
+
+                if (size > buf->end - buf->last) {
+                    size = buf->end - buf->last;
+                }
+
+                if (send + size > limit) {
+                    size = (ssize_t) (limit - send);
+                }
+
+                n = ngx_ssl_read_file(c, in->buf, buf->last, size);
+
+                if (n == NGX_ERROR) {
+                    return NGX_CHAIN_ERROR;
+                }
+
+                if (n == NGX_AGAIN) {
+
+                    /*
+                     * the buffer is not sent, and so is not reused,
+                     * until the thread task is complete
+                     */
+
+                    goto done;
+                }
+
+                if (n == 0) {
+                    ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                                  "\"%s\" was truncated at %O",
+                                  in->buf->file->name.data,
+                                  in->buf->file_pos);
+
+                    return NGX_CHAIN_ERROR;
+                }
+
+                buf->last += n;
+                in->buf->file_pos += n;
+                send += n;
+
+                if (in->buf->file_pos == in->buf->file_last) {
+                    in = in->next;
+                }
+
+                continue;
+            }
+
             size = in->buf->last - in->buf->pos;
 
             if (size > buf->end - buf->last) {
@@ -2655,6 +2774,10 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                     return NGX_CHAIN_ERROR;
                 }
 
+                if (n == NGX_DECLINED) {
+                    continue;
+                }
+
                 if (n == NGX_AGAIN) {
                     break;
                 }
@@ -2699,6 +2822,8 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
         }
     }
 
+done:
+
     buf->flush = flush;
 
     if (buf->pos < buf->last) {
@@ -3102,6 +3227,22 @@ ngx_ssl_sendfile(ngx_connection_t *c, ngx_buf_t *file, size_t size)
         return NGX_AGAIN;
     }
 
+    if (sslerr == SSL_ERROR_SYSCALL
+        && (err == NGX_EINVAL || err == NGX_EOPNOTSUPP || err == NGX_ENOSYS))
+    {
+        /*
+         * the file cannot be spliced into the TLS socket,
+         * the rest of the response is sent with SSL_write()
+         */
+
+        ngx_log_error(NGX_LOG_INFO, c->log, err,
+                      "SSL_sendfile() failed, falling back to SSL_write()");
+
+        c->ssl->sendfile = 0;
+
+        return NGX_DECLINED;
+    }
+
     c->ssl->no_wait_shutdown = 1;
     c->ssl->no_send_shutdown = 1;
     c->write->error = 1;
@@ -3117,6 +3258,41 @@ ngx_ssl_sendfile(ngx_connection_t *c, ngx_buf_t *file, size_t size)
 }
 
 
+static ssize_t
+ngx_ssl_read_file(ngx_connection_t *c, ngx_buf_t *file, u_char *buf,
+    size_t size)
+{
+#if (NGX_THREADS)
+    ngx_thread_task_t  *task;
+#endif
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL buf read: %uz @%O", size, file->file_pos);
+
+#if (NGX_THREADS)
+
+    /*
+     * with "aio threads" the file is read in a thread, and the request
+     * continues when the task is complete, as with sendfile() in threads
+     */
+
+    if (file->file->thread_handler) {
+        task = file->file->thread_task;
+
+        if (task && task->event.active) {
+            return NGX_AGAIN;
+        }
+
+        return ngx_thread_read(file->file, buf, size, file->file_pos,
+                               c->pool);
+    }
+
+#endif
+
+    return ngx_read_file(file->file, buf, size, file->file_pos);
+}
+
+
 static void
 ngx_ssl_read_handler(ngx_event_t *rev)
 {
@@ -3717,15 +3893,81 @@ failed:
 }
 
 
+ngx_int_t
+ngx_ssl_session_cache_shards(ngx_conf_t *cf, ngx_shm_zone_t *shm_zone,
+    ngx_uint_t shards)
+{
+    ngx_uint_t  *nshards;
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+
+    if (shards > 1) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "session cache shards are not supported "
+                           "on this platform");
+        return NGX_ERROR;
+    }
+
+#endif
+
+    if (shm_zone->shm.size / shards < 8 * ngx_pagesize) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "session cache \"%V\" is too small for %ui shards",
+                           &shm_zone->shm.name, shards);
+        return NGX_ERROR;
+    }
+
+    nshards = shm_zone->data;
+
+    if (nshards) {
+
+        if (*nshards != shards) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "session cache \"%V\" is already declared "
+                               "with %ui shards", &shm_zone->shm.name,
+                               *nshards);
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+    nshards = ngx_palloc(cf->pool, sizeof(ngx_uint_t));
+    if (nshards == NULL) {
+        return NGX_ERROR;
+    }
+
+    *nshards = shards;
+    shm_zone->data = nshards;
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
-    size_t                    len;
-    ngx_slab_pool_t          *shpool;
+    ngx_ssl_session_cache_t  *ocache = data;
+
+    size_t                    len, size;
+    u_char                   *p;
+    ngx_uint_t                i, nshards;
+    ngx_slab_pool_t          *shpool, *sp;
+    ngx_ssl_session_shard_t  *shard;
     ngx_ssl_session_cache_t  *cache;
 
-    if (data) {
-        shm_zone->data = data;
+    nshards = shm_zone->data ? *(ngx_uint_t *) shm_zone->data : 1;
+
+    if (ocache) {
+
+        if (ocache->nshards != nshards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "session cache \"%V\" had previously %ui shards",
+                          &shm_zone->shm.name, ocache->nshards);
+            return NGX_ERROR;
+        }
+
+        shm_zone->data = ocache;
         return NGX_OK;
     }
 
@@ -3736,7 +3978,7 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
         return NGX_OK;
     }
 
-    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_session_cache_t));
+    cache = ngx_slab_calloc(shpool, sizeof(ngx_ssl_session_cache_t));
     if (cache == NULL) {
         return NGX_ERROR;
     }
@@ -3744,11 +3986,6 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
     shpool->data = cache;
     shm_zone->data = cache;
 
-    ngx_rbtree_init(&cache->session_rbtree, &cache->sentinel,
-                    ngx_ssl_session_rbtree_insert_value);
-
-    ngx_queue_init(&cache->expire_queue);
-
     len = sizeof(" in SSL session shared cache \"\"") + shm_zone->shm.name.len;
 
     shpool->log_ctx = ngx_slab_alloc(shpool, len);
@@ -3761,10 +3998,79 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     shpool->log_nomem = 0;
 
+    cache->shards = ngx_slab_calloc(shpool,
+                                    nshards * sizeof(ngx_ssl_session_shard_t));
+    if (cache->shards == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->nshards = nshards;
+
+    /*
+     * each shard has its own slab pool and mutex carved out of the zone,
+     * leaving some room for the page descriptors of the zone itself
+     */
+
+    size = (shm_zone->shm.size - shm_zone->shm.size / 64 - 4 * ngx_pagesize)
+           / nshards;
+    size &= ~(ngx_pagesize - 1);
+
+    for (i = 0; i < nshards; i++) {
+        shard = &cache->shards[i];
+
+        if (nshards == 1) {
+            sp = shpool;
+
+        } else {
+            p = ngx_slab_alloc(shpool, size);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            sp = (ngx_slab_pool_t *) p;
+
+            sp->end = p + size;
+            sp->min_shift = 3;
+            sp->addr = p;
+
+            if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            ngx_slab_init(sp);
+
+            sp->log_ctx = shpool->log_ctx;
+            sp->log_nomem = 0;
+
+            /* let ngx_unlock_mutexes() find the shard mutex */
+
+            sp->next = shpool->next;
+            shpool->next = sp;
+        }
+
+        shard->shpool = sp;
+
+        ngx_rbtree_init(&shard->session_rbtree, &shard->sentinel,
+                        ngx_ssl_session_rbtree_insert_value);
+
+        ngx_queue_init(&shard->expire_queue);
+    }
+
     return NGX_OK;
 }
 
 
+static ngx_inline ngx_ssl_session_shard_t *
+ngx_ssl_session_shard(ngx_shm_zone_t *shm_zone, uint32_t hash)
+{
+    ngx_ssl_session_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    return &cache->shards[hash % cache->nshards];
+}
+
+
 /*
  * The length of the session id is 16 bytes for SSLv2 sessions and
  * between 1 and 32 bytes for SSLv3/TLSv1, typically 32 bytes.
@@ -3794,7 +4100,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     ngx_connection_t         *c;
     ngx_slab_pool_t          *shpool;
     ngx_ssl_sess_id_t        *sess_id;
-    ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
 
     len = i2d_SSL_SESSION(sess, NULL);
@@ -3808,18 +4114,22 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     p = buf;
     i2d_SSL_SESSION(sess, &p);
 
+    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
+
+    hash = ngx_crc32_short(session_id, session_id_length);
+
     c = ngx_ssl_get_connection(ssl_conn);
 
     ssl_ctx = c->ssl->session_ctx;
     shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
 
-    cache = shm_zone->data;
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shard = ngx_ssl_session_shard(shm_zone, hash);
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
     /* drop one or two expired sessions */
-    ngx_ssl_expire_sessions(cache, shpool, 1);
+    ngx_ssl_expire_sessions(shard, 1);
 
     cached_sess = ngx_slab_alloc_locked(shpool, len);
 
@@ -3827,7 +4137,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         cached_sess = ngx_slab_alloc_locked(shpool, len);
 
@@ -3843,7 +4153,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         sess_id = ngx_slab_alloc_locked(shpool, sizeof(ngx_ssl_sess_id_t));
 
@@ -3852,8 +4162,6 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
         }
     }
 
-    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
-
 #if (NGX_PTR_SIZE == 8)
 
     id = sess_id->sess_id;
@@ -3866,7 +4174,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         id = ngx_slab_alloc_locked(shpool, session_id_length);
 
@@ -3881,8 +4189,6 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     ngx_memcpy(id, session_id, session_id_length);
 
-    hash = ngx_crc32_short(session_id, session_id_length);
-
     ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "ssl new session: %08XD:%ud:%d",
                    hash, session_id_length, len);
@@ -3895,9 +4201,9 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     sess_id->expire = ngx_time() + SSL_CTX_get_timeout(ssl_ctx);
 
-    ngx_queue_insert_head(&cache->expire_queue, &sess_id->queue);
+    ngx_queue_insert_head(&shard->expire_queue, &sess_id->queue);
 
-    ngx_rbtree_insert(&cache->session_rbtree, &sess_id->node);
+    ngx_rbtree_insert(&shard->session_rbtree, &sess_id->node);
 
     ngx_shmtx_unlock(&shpool->mutex);
 
@@ -3938,7 +4244,7 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
     ngx_rbtree_node_t        *node, *sentinel;
     ngx_ssl_session_t        *sess;
     ngx_ssl_sess_id_t        *sess_id;
-    ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
     ngx_connection_t         *c;
 
@@ -3953,16 +4259,16 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
     shm_zone = SSL_CTX_get_ex_data(c->ssl->session_ctx,
                                    ngx_ssl_session_cache_index);
 
-    cache = shm_zone->data;
+    shard = ngx_ssl_session_shard(shm_zone, hash);
 
     sess = NULL;
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -4000,7 +4306,7 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -4044,7 +4350,7 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
     ngx_slab_pool_t          *shpool;
     ngx_rbtree_node_t        *node, *sentinel;
     ngx_ssl_sess_id_t        *sess_id;
-    ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
 
     shm_zone = SSL_CTX_get_ex_data(ssl, ngx_ssl_session_cache_index);
 
@@ -4052,8 +4358,6 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
         return;
     }
 
-    cache = shm_zone->data;
-
     id = (u_char *) SSL_SESSION_get_id(sess, &len);
 
     hash = ngx_crc32_short(id, len);
@@ -4061,12 +4365,13 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                    "ssl remove session: %08XD:%ud", hash, len);
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shard = ngx_ssl_session_shard(shm_zone, hash);
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -4090,7 +4395,7 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -4111,22 +4416,23 @@ done:
 
 
 static void
-ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n)
+ngx_ssl_expire_sessions(ngx_ssl_session_shard_t *shard, ngx_uint_t n)
 {
     time_t              now;
     ngx_queue_t        *q;
+    ngx_slab_pool_t    *shpool;
     ngx_ssl_sess_id_t  *sess_id;
 
     now = ngx_time();
+    shpool = shard->shpool;
 
     while (n < 3) {
 
-        if (ngx_queue_empty(&cache->expire_queue)) {
+        if (ngx_queue_empty(&shard->expire_queue)) {
             return;
         }
 
-        q = ngx_queue_last(&cache->expire_queue);
+        q = ngx_queue_last(&shard->expire_queue);
 
         sess_id = ngx_queue_data(q, ngx_ssl_sess_id_t, queue);
 
@@ -4139,7 +4445,7 @@ ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
         ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                        "expire session: %08Xi", sess_id->node.key);
 
-        ngx_rbtree_delete(&cache->session_rbtree, &sess_id->node);
+        ngx_rbtree_delete(&shard->session_rbtree, &sess_id->node);
 
         ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -4195,7 +4501,8 @@ ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
 
 ngx_int_t
-ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
+ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths,
+    ngx_uint_t rotation)
 {
     u_char                         buf[80];
     size_t                         size;
@@ -4209,7 +4516,42 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
     ngx_ssl_session_ticket_key_t  *key;
 
     if (paths == NULL) {
-        return NGX_OK;
+
+        if (!rotation) {
+            return NGX_OK;
+        }
+
+        if (SSL_CTX_get_ex_data(ssl->ctx, ngx_ssl_session_cache_index)
+            == NULL)
+        {
+            ngx_log_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "\"ssl_session_ticket_rotation\" requires "
+                          "shared session cache");
+            return NGX_ERROR;
+        }
+
+        /*
+         * the keys are generated and rotated in the session cache
+         * shared memory, see ngx_ssl_rotate_ticket_keys()
+         */
+
+        keys = ngx_array_create(cf->pool, 2,
+                                sizeof(ngx_ssl_session_ticket_key_t));
+        if (keys == NULL) {
+            return NGX_ERROR;
+        }
+
+        key = ngx_array_push_n(keys, 2);
+        if (key == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(key, 2 * sizeof(ngx_ssl_session_ticket_key_t));
+
+        key[0].shared = 1;
+        key[1].shared = 1;
+
+        goto done;
     }
 
     keys = ngx_array_create(cf->pool, paths->nelts,
@@ -4280,6 +4622,8 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
             goto failed;
         }
 
+        ngx_memzero(key, sizeof(ngx_ssl_session_ticket_key_t));
+
         if (size == 48) {
             key->size = 48;
             ngx_memcpy(key->name, buf, 16);
@@ -4301,6 +4645,8 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
         ngx_explicit_memzero(&buf, 80);
     }
 
+done:
+
     if (SSL_CTX_set_ex_data(ssl->ctx, ngx_ssl_session_ticket_keys_index, keys)
         == 0)
     {
@@ -4352,6 +4698,10 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     c = ngx_ssl_get_connection(ssl_conn);
     ssl_ctx = c->ssl->session_ctx;
 
+    if (ngx_ssl_rotate_ticket_keys(ssl_ctx, c->log) != NGX_OK) {
+        return -1;
+    }
+
 #ifdef OPENSSL_NO_SHA256
     digest = EVP_sha1();
 #else
@@ -4427,6 +4777,13 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
                        "ssl session ticket decrypt, key: \"%*xs\"%s",
                        (size_t) 16, key[i].name, (i == 0) ? " (default)" : "");
 
+        if (key[i].shared && key[i].expire < ngx_time()) {
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "ssl session ticket decrypt, key: \"%*xs\" expired",
+                           (size_t) 16, key[i].name);
+            return 0;
+        }
+
         if (key[i].size == 48) {
             cipher = EVP_aes_128_cbc();
             size = 16;
@@ -4470,6 +4827,119 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
 }
 
 
+static ngx_int_t
+ngx_ssl_rotate_ticket_keys(SSL_CTX *ssl_ctx, ngx_log_t *log)
+{
+    time_t                         now, expire;
+    ngx_array_t                   *keys;
+    ngx_shm_zone_t                *shm_zone;
+    ngx_slab_pool_t               *shpool;
+    ngx_ssl_session_cache_t       *cache;
+    ngx_ssl_session_ticket_key_t  *key;
+    u_char                         buf[80];
+
+    keys = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_ticket_keys_index);
+    if (keys == NULL) {
+        return NGX_OK;
+    }
+
+    key = keys->elts;
+
+    if (!key[0].shared) {
+        return NGX_OK;
+    }
+
+    /*
+     * the local copy is used as long as the current key is valid for
+     * the sessions being created and the previous key is still needed;
+     * otherwise the keys are synchronized with the shared memory
+     */
+
+    now = ngx_time();
+    expire = now + SSL_CTX_get_timeout(ssl_ctx);
+
+    if (key[0].expire >= expire && key[1].expire >= now) {
+        return NGX_OK;
+    }
+
+    shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
+
+    cache = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    key = cache->ticket_keys;
+
+    if (key[0].expire == 0) {
+
+        /* the first key, it also becomes the next one */
+
+        if (RAND_bytes(buf, 80) != 1) {
+            ngx_shmtx_unlock(&shpool->mutex);
+            ngx_ssl_error(NGX_LOG_ALERT, log, 0, "RAND_bytes() failed");
+            return NGX_ERROR;
+        }
+
+        key[0].shared = 1;
+        key[0].expire = expire;
+        key[0].size = 80;
+        ngx_memcpy(key[0].name, buf, 16);
+        ngx_memcpy(key[0].hmac_key, buf + 16, 32);
+        ngx_memcpy(key[0].aes_key, buf + 48, 32);
+
+        ngx_explicit_memzero(&buf, 80);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "ssl ticket key: \"%*xs\"", (size_t) 16, key[0].name);
+
+        key[2] = key[0];
+    }
+
+    if (key[1].expire < now) {
+
+        /*
+         * the previous key is no longer needed: the current key becomes
+         * the previous one, the next key becomes the current one,
+         * and a new next key is generated
+         */
+
+        key[1] = key[0];
+        key[0] = key[2];
+
+        if (RAND_bytes(buf, 80) != 1) {
+            ngx_shmtx_unlock(&shpool->mutex);
+            ngx_ssl_error(NGX_LOG_ALERT, log, 0, "RAND_bytes() failed");
+            return NGX_ERROR;
+        }
+
+        key[2].shared = 1;
+        key[2].expire = 0;
+        key[2].size = 80;
+        ngx_memcpy(key[2].name, buf, 16);
+        ngx_memcpy(key[2].hmac_key, buf + 16, 32);
+        ngx_memcpy(key[2].aes_key, buf + 48, 32);
+
+        ngx_explicit_memzero(&buf, 80);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "ssl ticket key: \"%*xs\"", (size_t) 16, key[2].name);
+    }
+
+    /* the current key is needed till the sessions being created expire */
+
+    if (key[0].expire < expire) {
+        key[0].expire = expire;
+    }
+
+    ngx_memcpy(keys->elts, key, 2 * sizeof(ngx_ssl_session_ticket_key_t));
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    return NGX_OK;
+}
+
+
 static void
 ngx_ssl_session_ticket_keys_cleanup(void *data)
 {
@@ -4482,13 +4952,20 @@ ngx_ssl_session_ticket_keys_cleanup(void *data)
 #else
 
 ngx_int_t
-ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
+ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths,
+    ngx_uint_t rotation)
 {
     if (paths) {
         ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
                       "\"ssl_session_ticket_key\" ignored, not supported");
     }
 
+    if (rotation) {
+        ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
+                      "\"ssl_session_ticket_rotation\" ignored, "
+                      "not supported");
+    }
+
     return NGX_OK;
 }
 
@@ -4955,6 +5432,26 @@ ngx_ssl_get_early_data(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
 }
 
 
+ngx_int_t
+ngx_ssl_get_ktls(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+    if (c->ssl->ktls_send && c->ssl->ktls_recv) {
+        ngx_str_set(s, "send,recv");
+
+    } else if (c->ssl->ktls_send) {
+        ngx_str_set(s, "send");
+
+    } else if (c->ssl->ktls_recv) {
+        ngx_str_set(s, "recv");
+
+    } else {
+        s->len = 0;
+    }
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_ssl_get_server_name(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
 {
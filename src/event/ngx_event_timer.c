@@ -10,9 +10,54 @@
 #include <ngx_event.h>
 
 
+#define NGX_TIMER_WHEEL_BITS    6
+#define NGX_TIMER_WHEEL_SIZE    (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_MASK    (NGX_TIMER_WHEEL_SIZE - 1)
+#define NGX_TIMER_WHEEL_LEVELS  6
+
+#define ngx_timer_wheel_shift(level)  ((level) * NGX_TIMER_WHEEL_BITS)
+
+/*
+ * the distance in slots of a level, the shifted times are compared
+ * modulo their width, as ngx_msec_t wraps around in 49 days on 32-bit
+ * platforms
+ */
+
+#define ngx_timer_wheel_distance(key, now, level)                             \
+    ((((key) >> ngx_timer_wheel_shift(level))                                 \
+      - ((now) >> ngx_timer_wheel_shift(level)))                              \
+     & ((ngx_msec_t) -1 >> ngx_timer_wheel_shift(level)))
+
+
+static ngx_msec_t ngx_event_timer_wheel_next(void);
+static void ngx_event_timer_wheel_cascade(ngx_uint_t level, ngx_uint_t n);
+static void ngx_event_timer_wheel_expire(void);
+static ngx_int_t ngx_event_timer_wheel_no_timers_left(void);
+static ngx_uint_t ngx_event_timer_wheel_ffs(uint64_t bitmap, ngx_uint_t n);
+
+
 ngx_rbtree_t              ngx_event_timer_rbtree;
 static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 
+ngx_uint_t                ngx_event_timer_wheel;
+
+/*
+ * The hierarchical timer wheel: the level "l" has 64 slots of 64^l
+ * milliseconds each, and the wheel covers about 2 years.  A timer is kept
+ * in the lowest level which can hold it relative to the wheel time, and
+ * timers of a higher level slot are redistributed to the lower levels
+ * when the wheel time reaches the slot.  The slots are circular lists
+ * linked through the "left" and "right" fields of the timer node, the
+ * "parent" field points to the list head, and the bitmaps of non-empty
+ * slots allow to find the nearest slot without scanning the lists.
+ */
+
+static ngx_msec_t         ngx_timer_wheel_time;
+static ngx_uint_t         ngx_timer_wheel_count;
+static uint64_t           ngx_timer_wheel_bitmap[NGX_TIMER_WHEEL_LEVELS];
+static ngx_rbtree_node_t  ngx_timer_wheel[NGX_TIMER_WHEEL_LEVELS]
+                                        [NGX_TIMER_WHEEL_SIZE];
+
 /*
  * the event timer rbtree may contain the duplicate keys, however,
  * it should not be a problem, because we use the rbtree to find
@@ -22,9 +67,29 @@ static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 ngx_int_t
 ngx_event_timer_init(ngx_log_t *log)
 {
+    ngx_uint_t          l, n;
+    ngx_rbtree_node_t  *head;
+
     ngx_rbtree_init(&ngx_event_timer_rbtree, &ngx_event_timer_sentinel,
                     ngx_rbtree_insert_timer_value);
 
+    if (!ngx_event_timer_wheel) {
+        return NGX_OK;
+    }
+
+    for (l = 0; l < NGX_TIMER_WHEEL_LEVELS; l++) {
+        for (n = 0; n < NGX_TIMER_WHEEL_SIZE; n++) {
+            head = &ngx_timer_wheel[l][n];
+            head->left = head;
+            head->right = head;
+        }
+
+        ngx_timer_wheel_bitmap[l] = 0;
+    }
+
+    ngx_timer_wheel_time = ngx_current_msec;
+    ngx_timer_wheel_count = 0;
+
     return NGX_OK;
 }
 
@@ -35,6 +100,23 @@ ngx_event_find_timer(void)
     ngx_msec_int_t      timer;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+
+        if (ngx_timer_wheel_count == 0) {
+            return NGX_TIMER_INFINITE;
+        }
+
+        /*
+         * the start of a higher level slot is used as the timer value,
+         * the process wakes up to redistribute the slot timers
+         */
+
+        timer = (ngx_msec_int_t)
+                    (ngx_event_timer_wheel_next() - ngx_current_msec);
+
+        return (ngx_msec_t) (timer > 0 ? timer : 0);
+    }
+
     if (ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel) {
         return NGX_TIMER_INFINITE;
     }
@@ -56,6 +138,11 @@ ngx_event_expire_timers(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_expire();
+        return;
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
 
     for ( ;; ) {
@@ -91,6 +178,8 @@ ngx_event_expire_timers(void)
 
         ev->timedout = 1;
 
+        ngx_events_handled++;
+
         ev->handler(ev);
     }
 }
@@ -102,6 +191,10 @@ ngx_event_no_timers_left(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        return ngx_event_timer_wheel_no_timers_left();
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
     root = ngx_event_timer_rbtree.root;
 
@@ -124,3 +217,243 @@ ngx_event_no_timers_left(void)
 
     return NGX_OK;
 }
+
+
+void
+ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node)
+{
+    ngx_msec_t          key, now;
+    ngx_uint_t          l, n;
+    ngx_rbtree_node_t  *head;
+
+    now = ngx_timer_wheel_time;
+    key = node->key;
+
+    if ((ngx_msec_int_t) (key - now) < 0) {
+
+        /* the timer has already expired, it is run on the next expiration */
+
+        key = now;
+    }
+
+    for (l = 0; l < NGX_TIMER_WHEEL_LEVELS - 1; l++) {
+        if (ngx_timer_wheel_distance(key, now, l) < NGX_TIMER_WHEEL_SIZE) {
+            break;
+        }
+    }
+
+    if (ngx_timer_wheel_distance(key, now, l) < NGX_TIMER_WHEEL_SIZE) {
+        n = (key >> ngx_timer_wheel_shift(l)) & NGX_TIMER_WHEEL_MASK;
+
+    } else {
+
+        /* the most distant slot of the last level */
+
+        n = ((now >> ngx_timer_wheel_shift(l)) + NGX_TIMER_WHEEL_MASK)
+            & NGX_TIMER_WHEEL_MASK;
+    }
+
+    head = &ngx_timer_wheel[l][n];
+
+    node->parent = head;
+    node->left = head->left;
+    node->right = head;
+    head->left->right = node;
+    head->left = node;
+
+    ngx_timer_wheel_bitmap[l] |= (uint64_t) 1 << n;
+    ngx_timer_wheel_count++;
+}
+
+
+void
+ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t          n;
+    ngx_rbtree_node_t  *head;
+
+    head = node->parent;
+
+    node->left->right = node->right;
+    node->right->left = node->left;
+
+    if (head->right == head) {
+        n = head - &ngx_timer_wheel[0][0];
+
+        ngx_timer_wheel_bitmap[n / NGX_TIMER_WHEEL_SIZE] &=
+                             ~((uint64_t) 1 << (n & NGX_TIMER_WHEEL_MASK));
+    }
+
+    ngx_timer_wheel_count--;
+}
+
+
+static ngx_msec_t
+ngx_event_timer_wheel_next(void)
+{
+    ngx_msec_t  now, next, start;
+    ngx_uint_t  l, n, found;
+
+    now = ngx_timer_wheel_time;
+    next = now;
+    found = 0;
+
+    for (l = 0; l < NGX_TIMER_WHEEL_LEVELS; l++) {
+
+        if (ngx_timer_wheel_bitmap[l] == 0) {
+            continue;
+        }
+
+        n = ngx_event_timer_wheel_ffs(ngx_timer_wheel_bitmap[l],
+                                      (now >> ngx_timer_wheel_shift(l))
+                                      & NGX_TIMER_WHEEL_MASK);
+
+        start = ((now >> ngx_timer_wheel_shift(l)) + n)
+                << ngx_timer_wheel_shift(l);
+
+        if (!found || (ngx_msec_int_t) (start - next) < 0) {
+            next = start;
+            found = 1;
+        }
+    }
+
+    return next;
+}
+
+
+static void
+ngx_event_timer_wheel_cascade(ngx_uint_t level, ngx_uint_t n)
+{
+    ngx_rbtree_node_t  *node, *head;
+
+    head = &ngx_timer_wheel[level][n];
+
+    while (head->right != head) {
+        node = head->right;
+
+        ngx_event_timer_wheel_delete(node);
+        ngx_event_timer_wheel_insert(node);
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_expire(void)
+{
+    ngx_msec_t          now, next;
+    ngx_uint_t          l, n;
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *head;
+
+    for ( ;; ) {
+
+        if (ngx_timer_wheel_count == 0) {
+            ngx_timer_wheel_time = ngx_current_msec;
+            return;
+        }
+
+        next = ngx_event_timer_wheel_next();
+
+        if ((ngx_msec_int_t) (next - ngx_current_msec) > 0) {
+            ngx_timer_wheel_time = ngx_current_msec;
+            return;
+        }
+
+        ngx_timer_wheel_time = next;
+        now = next;
+
+        for (l = NGX_TIMER_WHEEL_LEVELS - 1; l > 0; l--) {
+
+            if (now & (((ngx_msec_t) 1 << ngx_timer_wheel_shift(l)) - 1)) {
+                continue;
+            }
+
+            n = (now >> ngx_timer_wheel_shift(l)) & NGX_TIMER_WHEEL_MASK;
+
+            if (ngx_timer_wheel_bitmap[l] & ((uint64_t) 1 << n)) {
+                ngx_event_timer_wheel_cascade(l, n);
+            }
+        }
+
+        head = &ngx_timer_wheel[0][now & NGX_TIMER_WHEEL_MASK];
+
+        while (head->right != head) {
+            ev = ngx_rbtree_data(head->right, ngx_event_t, timer);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event timer del: %d: %M",
+                           ngx_event_ident(ev->data), ev->timer.key);
+
+            ngx_event_timer_wheel_delete(&ev->timer);
+
+#if (NGX_DEBUG)
+            ev->timer.left = NULL;
+            ev->timer.right = NULL;
+            ev->timer.parent = NULL;
+#endif
+
+            ev->timer_set = 0;
+
+            ev->timedout = 1;
+
+            ngx_events_handled++;
+
+            ev->handler(ev);
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_event_timer_wheel_no_timers_left(void)
+{
+    ngx_uint_t          l, n;
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *node, *head;
+
+    for (l = 0; l < NGX_TIMER_WHEEL_LEVELS; l++) {
+        for (n = 0; n < NGX_TIMER_WHEEL_SIZE; n++) {
+
+            head = &ngx_timer_wheel[l][n];
+
+            for (node = head->right; node != head; node = node->right) {
+                ev = ngx_rbtree_data(node, ngx_event_t, timer);
+
+                if (!ev->cancelable) {
+                    return NGX_AGAIN;
+                }
+            }
+        }
+    }
+
+    /* only cancelable timers left */
+
+    return NGX_OK;
+}
+
+
+/* the distance from the slot "n" to the next non-empty slot */
+
+static ngx_uint_t
+ngx_event_timer_wheel_ffs(uint64_t bitmap, ngx_uint_t n)
+{
+    ngx_uint_t  i;
+
+    if (n) {
+        bitmap = (bitmap >> n) | (bitmap << (NGX_TIMER_WHEEL_SIZE - n));
+    }
+
+#if (__GNUC__ >= 4 || __clang__ || __INTEL_COMPILER)
+
+    i = __builtin_ctzll(bitmap);
+
+#else
+
+    for (i = 0; (bitmap & 1) == 0; i++) {
+        bitmap >>= 1;
+    }
+
+#endif
+
+    return i;
+}
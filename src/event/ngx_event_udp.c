@@ -422,6 +422,18 @@ ngx_event_recvmsg(ngx_event_t *ev)
         }
 
     } while (ev->available);
+
+    if ((ngx_event_flags & NGX_USE_DRAIN_EVENT)
+        && (ngx_accept_mutex_held || !ngx_use_accept_mutex
+#if (NGX_HAVE_REUSEPORT)
+            || ls->reuseport
+#endif
+           ))
+    {
+        /* the rest of the datagrams are received in the next iterations */
+
+        ngx_post_event(ev, &ngx_posted_next_events);
+    }
 }
 
 
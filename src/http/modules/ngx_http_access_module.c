@@ -10,34 +10,18 @@
 #include <ngx_http.h>
 
 
-typedef struct {
-    in_addr_t         mask;
-    in_addr_t         addr;
-    ngx_uint_t        deny;      /* unsigned  deny:1; */
-} ngx_http_access_rule_t;
-
-#if (NGX_HAVE_INET6)
-
-typedef struct {
-    struct in6_addr   addr;
-    struct in6_addr   mask;
-    ngx_uint_t        deny;      /* unsigned  deny:1; */
-} ngx_http_access_rule6_t;
-
-#endif
-
 #if (NGX_HAVE_UNIX_DOMAIN)
 
 typedef struct {
-    ngx_uint_t        deny;      /* unsigned  deny:1; */
+    ngx_uint_t         deny;      /* unsigned  deny:1; */
 } ngx_http_access_rule_un_t;
 
 #endif
 
 typedef struct {
-    ngx_array_t      *rules;     /* array of ngx_http_access_rule_t */
+    ngx_radix_tree_t *rules;     /* deny flags of inet rules */
 #if (NGX_HAVE_INET6)
-    ngx_array_t      *rules6;    /* array of ngx_http_access_rule6_t */
+    ngx_radix_tree_t *rules6;    /* deny flags of inet6 rules */
 #endif
 #if (NGX_HAVE_UNIX_DOMAIN)
     ngx_array_t      *rules_un;  /* array of ngx_http_access_rule_un_t */
@@ -183,22 +167,18 @@ static ngx_int_t
 ngx_http_access_inet(ngx_http_request_t *r, ngx_http_access_loc_conf_t *alcf,
     in_addr_t addr)
 {
-    ngx_uint_t               i;
-    ngx_http_access_rule_t  *rule;
+    uintptr_t  value;
 
-    rule = alcf->rules->elts;
-    for (i = 0; i < alcf->rules->nelts; i++) {
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "access: %08XD", addr);
 
-        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "access: %08XD %08XD %08XD",
-                       addr, rule[i].mask, rule[i].addr);
+    value = ngx_radix32tree_find(alcf->rules, ntohl(addr));
 
-        if ((addr & rule[i].mask) == rule[i].addr) {
-            return ngx_http_access_found(r, rule[i].deny);
-        }
+    if (value == NGX_RADIX_NO_VALUE) {
+        return NGX_DECLINED;
     }
 
-    return NGX_DECLINED;
+    return ngx_http_access_found(r, value);
 }
 
 
@@ -208,42 +188,27 @@ static ngx_int_t
 ngx_http_access_inet6(ngx_http_request_t *r, ngx_http_access_loc_conf_t *alcf,
     u_char *p)
 {
-    ngx_uint_t                n;
-    ngx_uint_t                i;
-    ngx_http_access_rule6_t  *rule6;
-
-    rule6 = alcf->rules6->elts;
-    for (i = 0; i < alcf->rules6->nelts; i++) {
+    uintptr_t  value;
 
 #if (NGX_DEBUG)
-        {
-        size_t  cl, ml, al;
-        u_char  ct[NGX_INET6_ADDRSTRLEN];
-        u_char  mt[NGX_INET6_ADDRSTRLEN];
-        u_char  at[NGX_INET6_ADDRSTRLEN];
+    {
+    size_t  cl;
+    u_char  ct[NGX_INET6_ADDRSTRLEN];
 
-        cl = ngx_inet6_ntop(p, ct, NGX_INET6_ADDRSTRLEN);
-        ml = ngx_inet6_ntop(rule6[i].mask.s6_addr, mt, NGX_INET6_ADDRSTRLEN);
-        al = ngx_inet6_ntop(rule6[i].addr.s6_addr, at, NGX_INET6_ADDRSTRLEN);
+    cl = ngx_inet6_ntop(p, ct, NGX_INET6_ADDRSTRLEN);
 
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "access: %*s %*s %*s", cl, ct, ml, mt, al, at);
-        }
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "access: %*s", cl, ct);
+    }
 #endif
 
-        for (n = 0; n < 16; n++) {
-            if ((p[n] & rule6[i].mask.s6_addr[n]) != rule6[i].addr.s6_addr[n]) {
-                goto next;
-            }
-        }
-
-        return ngx_http_access_found(r, rule6[i].deny);
+    value = ngx_radix128tree_find(alcf->rules6, p);
 
-    next:
-        continue;
+    if (value == NGX_RADIX_NO_VALUE) {
+        return NGX_DECLINED;
     }
 
-    return NGX_DECLINED;
+    return ngx_http_access_found(r, value);
 }
 
 #endif
@@ -301,9 +266,11 @@ ngx_http_access_rule(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_uint_t                  all;
     ngx_str_t                  *value;
     ngx_cidr_t                  cidr;
-    ngx_http_access_rule_t     *rule;
+    uint32_t                    key;
+    uint32_t                    mask;
+    ngx_uint_t                  deny;
 #if (NGX_HAVE_INET6)
-    ngx_http_access_rule6_t    *rule6;
+    u_char                     *key6, *mask6;
 #endif
 #if (NGX_HAVE_UNIX_DOMAIN)
     ngx_http_access_rule_un_t  *rule_un;
@@ -337,45 +304,55 @@ ngx_http_access_rule(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         }
     }
 
+    deny = (value[0].data[0] == 'd') ? 1 : 0;
+
+    /*
+     * the rules are kept in radix trees: a rule which is covered by
+     * an earlier one can never match and is skipped, while the longest
+     * prefix match lets earlier more specific rules take precedence
+     */
+
     if (cidr.family == AF_INET || all) {
 
         if (alcf->rules == NULL) {
-            alcf->rules = ngx_array_create(cf->pool, 4,
-                                           sizeof(ngx_http_access_rule_t));
+            alcf->rules = ngx_radix_tree_create(cf->pool, 0);
             if (alcf->rules == NULL) {
                 return NGX_CONF_ERROR;
             }
         }
 
-        rule = ngx_array_push(alcf->rules);
-        if (rule == NULL) {
+        key = ntohl(cidr.u.in.addr);
+        mask = ntohl(cidr.u.in.mask);
+
+        if (ngx_radix32tree_cover(alcf->rules, key, mask)
+            == NGX_RADIX_NO_VALUE
+            && ngx_radix32tree_insert(alcf->rules, key, mask, deny)
+               == NGX_ERROR)
+        {
             return NGX_CONF_ERROR;
         }
-
-        rule->mask = cidr.u.in.mask;
-        rule->addr = cidr.u.in.addr;
-        rule->deny = (value[0].data[0] == 'd') ? 1 : 0;
     }
 
 #if (NGX_HAVE_INET6)
     if (cidr.family == AF_INET6 || all) {
 
         if (alcf->rules6 == NULL) {
-            alcf->rules6 = ngx_array_create(cf->pool, 4,
-                                            sizeof(ngx_http_access_rule6_t));
+            alcf->rules6 = ngx_radix_tree_create(cf->pool, 0);
             if (alcf->rules6 == NULL) {
                 return NGX_CONF_ERROR;
             }
         }
 
-        rule6 = ngx_array_push(alcf->rules6);
-        if (rule6 == NULL) {
+        key6 = cidr.u.in6.addr.s6_addr;
+        mask6 = cidr.u.in6.mask.s6_addr;
+
+        if (ngx_radix128tree_cover(alcf->rules6, key6, mask6)
+            == NGX_RADIX_NO_VALUE
+            && ngx_radix128tree_insert(alcf->rules6, key6, mask6, deny)
+               == NGX_ERROR)
+        {
             return NGX_CONF_ERROR;
         }
-
-        rule6->mask = cidr.u.in6.mask;
-        rule6->addr = cidr.u.in6.addr;
-        rule6->deny = (value[0].data[0] == 'd') ? 1 : 0;
     }
 #endif
 
@@ -9,6 +9,7 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 #include <ngx_crypt.h>
+#include <ngx_md5.h>
 
 
 #define NGX_HTTP_AUTH_BUF_SIZE  2048
@@ -17,20 +18,94 @@
 typedef struct {
     ngx_http_complex_value_t  *realm;
     ngx_http_complex_value_t  *user_file;
+    ngx_flag_t                 cache;
+    time_t                     cache_valid;
+#if (NGX_THREADS)
+    ngx_thread_pool_t         *thread_pool;
+#endif
 } ngx_http_auth_basic_loc_conf_t;
 
 
+typedef struct {
+    ngx_str_t                  passwd;
+    u_char                    *encrypted;
+    ngx_int_t                  rc;
+    unsigned                   done:1;
+#if (NGX_THREADS)
+    ngx_thread_task_t         *task;
+#endif
+} ngx_http_auth_basic_ctx_t;
+
+
+#if (NGX_THREADS)
+
+typedef struct {
+    u_char                    *key;
+    u_char                    *salt;
+    u_char                    *encrypted;
+    ngx_pool_t                *pool;
+    ngx_int_t                  rc;
+} ngx_http_auth_basic_thread_ctx_t;
+
+#endif
+
+
+typedef struct {
+    ngx_str_node_t             sn;
+    ngx_str_t                  passwd;
+    time_t                     verified;
+    u_char                     digest[16];
+} ngx_http_auth_basic_user_t;
+
+
+typedef struct {
+    ngx_str_node_t             sn;
+    ngx_rbtree_t               rbtree;
+    ngx_rbtree_node_t          sentinel;
+    ngx_file_uniq_t            uniq;
+    time_t                     mtime;
+    off_t                      size;
+    ngx_pool_t                *pool;
+} ngx_http_auth_basic_file_t;
+
+
+typedef struct {
+    ngx_rbtree_t               rbtree;
+    ngx_rbtree_node_t          sentinel;
+    ngx_uint_t                 salted;
+    uint32_t                   salt[4];
+} ngx_http_auth_basic_main_conf_t;
+
+
 static ngx_int_t ngx_http_auth_basic_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_auth_basic_cached_handler(ngx_http_request_t *r,
+    ngx_str_t *user_file, ngx_str_t *realm);
+static ngx_int_t ngx_http_auth_basic_load(ngx_http_request_t *r,
+    ngx_http_auth_basic_file_t *file);
+static void ngx_http_auth_basic_digest(ngx_http_request_t *r,
+    u_char *digest);
+static void ngx_http_auth_basic_cleanup_buf(void *data);
 static ngx_int_t ngx_http_auth_basic_crypt_handler(ngx_http_request_t *r,
     ngx_str_t *passwd, ngx_str_t *realm);
 static ngx_int_t ngx_http_auth_basic_set_realm(ngx_http_request_t *r,
     ngx_str_t *realm);
+#if (NGX_THREADS && NGX_HAVE_GNU_CRYPT_R)
+static ngx_int_t ngx_http_auth_basic_crypt_thread(ngx_http_request_t *r,
+    ngx_http_auth_basic_ctx_t *ctx, ngx_thread_pool_t *tp);
+static void ngx_http_auth_basic_crypt_thread_handler(void *data,
+    ngx_log_t *log);
+static void ngx_http_auth_basic_crypt_event_handler(ngx_event_t *ev);
+#endif
+static void *ngx_http_auth_basic_create_main_conf(ngx_conf_t *cf);
+static void ngx_http_auth_basic_cleanup_files(void *data);
 static void *ngx_http_auth_basic_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_auth_basic_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
 static ngx_int_t ngx_http_auth_basic_init(ngx_conf_t *cf);
 static char *ngx_http_auth_basic_user_file(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_auth_basic_thread_pool(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 
 
 static ngx_command_t  ngx_http_auth_basic_commands[] = {
@@ -51,6 +126,30 @@ static ngx_command_t  ngx_http_auth_basic_commands[] = {
       offsetof(ngx_http_auth_basic_loc_conf_t, user_file),
       NULL },
 
+    { ngx_string("auth_basic_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LMT_CONF
+                        |NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_auth_basic_loc_conf_t, cache),
+      NULL },
+
+    { ngx_string("auth_basic_cache_valid"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LMT_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_conf_set_sec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_auth_basic_loc_conf_t, cache_valid),
+      NULL },
+
+    { ngx_string("auth_basic_thread_pool"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LMT_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_http_auth_basic_thread_pool,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -59,7 +158,7 @@ static ngx_http_module_t  ngx_http_auth_basic_module_ctx = {
     NULL,                                  /* preconfiguration */
     ngx_http_auth_basic_init,              /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
+    ngx_http_auth_basic_create_main_conf,  /* create main configuration */
     NULL,                                  /* init main configuration */
 
     NULL,                                  /* create server configuration */
@@ -105,6 +204,13 @@ ngx_http_auth_basic_handler(ngx_http_request_t *r)
         sw_skip
     } state;
 
+    if (r->aio) {
+
+        /* the hash is being computed in a thread */
+
+        return NGX_AGAIN;
+    }
+
     alcf = ngx_http_get_module_loc_conf(r, ngx_http_auth_basic_module);
 
     if (alcf->realm == NULL || alcf->user_file == NULL) {
@@ -137,6 +243,10 @@ ngx_http_auth_basic_handler(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
+    if (alcf->cache) {
+        return ngx_http_auth_basic_cached_handler(r, &user_file, &realm);
+    }
+
     fd = ngx_open_file(user_file.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
 
     if (fd == NGX_INVALID_FILE) {
@@ -281,16 +391,448 @@ cleanup:
 }
 
 
+static ngx_int_t
+ngx_http_auth_basic_cached_handler(ngx_http_request_t *r,
+    ngx_str_t *user_file, ngx_str_t *realm)
+{
+    u_char                            digest[16];
+    uint32_t                          hash;
+    ngx_int_t                         rc;
+    ngx_uint_t                        level;
+    ngx_open_file_info_t              of;
+    ngx_http_core_loc_conf_t         *clcf;
+    ngx_http_auth_basic_user_t       *user;
+    ngx_http_auth_basic_file_t       *file;
+    ngx_http_auth_basic_loc_conf_t   *alcf;
+    ngx_http_auth_basic_main_conf_t  *amcf;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    /* the file is checked for changes like other files are */
+
+    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+
+    of.test_only = 1;
+    of.valid = clcf->open_file_cache_valid;
+    of.min_uses = clcf->open_file_cache_min_uses;
+    of.errors = clcf->open_file_cache_errors;
+    of.events = clcf->open_file_cache_events;
+
+    if (ngx_open_cached_file(clcf->open_file_cache, user_file, &of, r->pool)
+        != NGX_OK)
+    {
+        if (of.err == 0) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        if (of.err == NGX_ENOENT || of.err == NGX_ENOTDIR) {
+            level = NGX_LOG_ERR;
+            rc = NGX_HTTP_FORBIDDEN;
+
+        } else {
+            level = NGX_LOG_CRIT;
+            rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        ngx_log_error(level, r->connection->log, of.err,
+                      "%s \"%s\" failed", of.failed, user_file->data);
+
+        return rc;
+    }
+
+    amcf = ngx_http_get_module_main_conf(r, ngx_http_auth_basic_module);
+
+    hash = ngx_crc32_long(user_file->data, user_file->len);
+
+    file = (ngx_http_auth_basic_file_t *)
+               ngx_str_rbtree_lookup(&amcf->rbtree, user_file, hash);
+
+    if (file == NULL) {
+        file = ngx_alloc(sizeof(ngx_http_auth_basic_file_t) + user_file->len,
+                         r->connection->log);
+        if (file == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        ngx_memzero(file, sizeof(ngx_http_auth_basic_file_t));
+
+        file->sn.node.key = hash;
+        file->sn.str.len = user_file->len;
+        file->sn.str.data = (u_char *) file
+                            + sizeof(ngx_http_auth_basic_file_t);
+
+        ngx_memcpy(file->sn.str.data, user_file->data, user_file->len);
+
+        ngx_rbtree_init(&file->rbtree, &file->sentinel,
+                        ngx_str_rbtree_insert_value);
+
+        ngx_rbtree_insert(&amcf->rbtree, &file->sn.node);
+    }
+
+    if (file->pool == NULL
+        || file->uniq != of.uniq
+        || file->mtime != of.mtime
+        || file->size != of.size)
+    {
+        rc = ngx_http_auth_basic_load(r, file);
+
+        if (rc != NGX_OK) {
+            return rc;
+        }
+    }
+
+    hash = ngx_crc32_long(r->headers_in.user.data, r->headers_in.user.len);
+
+    user = (ngx_http_auth_basic_user_t *)
+               ngx_str_rbtree_lookup(&file->rbtree, &r->headers_in.user, hash);
+
+    if (user == NULL) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "user \"%V\" was not found in \"%s\"",
+                      &r->headers_in.user, user_file->data);
+
+        return ngx_http_auth_basic_set_realm(r, realm);
+    }
+
+    alcf = ngx_http_get_module_loc_conf(r, ngx_http_auth_basic_module);
+
+    if (alcf->cache_valid == 0) {
+        return ngx_http_auth_basic_crypt_handler(r, &user->passwd, realm);
+    }
+
+    ngx_http_auth_basic_digest(r, digest);
+
+    if (user->verified >= ngx_time()
+        && ngx_memcmp(user->digest, digest, 16) == 0)
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "user: \"%V\" verified", &r->headers_in.user);
+
+        return NGX_OK;
+    }
+
+    rc = ngx_http_auth_basic_crypt_handler(r, &user->passwd, realm);
+
+    if (rc == NGX_OK) {
+        ngx_memcpy(user->digest, digest, 16);
+        user->verified = ngx_time() + alcf->cache_valid;
+    }
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_auth_basic_load(ngx_http_request_t *r,
+    ngx_http_auth_basic_file_t *file)
+{
+    u_char                      *buf, *p, *last, *login, *passwd;
+    size_t                       size;
+    ssize_t                      n;
+    uint32_t                     hash;
+    ngx_fd_t                     fd;
+    ngx_int_t                    rc;
+    ngx_err_t                    err;
+    ngx_str_t                    name;
+    ngx_uint_t                   level, nusers;
+    ngx_file_t                   f;
+    ngx_pool_t                  *pool;
+    ngx_file_info_t              fi;
+    ngx_pool_cleanup_t          *cln;
+    ngx_http_auth_basic_user_t  *user;
+
+    name = file->sn.str;
+
+    pool = NULL;
+    rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+
+    fd = ngx_open_file(name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        if (err == NGX_ENOENT) {
+            level = NGX_LOG_ERR;
+            rc = NGX_HTTP_FORBIDDEN;
+
+        } else {
+            level = NGX_LOG_CRIT;
+        }
+
+        ngx_log_error(level, r->connection->log, err,
+                      ngx_open_file_n " \"%s\" failed", name.data);
+
+        return rc;
+    }
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name.data);
+        goto failed;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        goto failed;
+    }
+
+    cln = ngx_pool_cleanup_add(pool, sizeof(ngx_str_t));
+    if (cln == NULL) {
+        goto failed;
+    }
+
+    buf = ngx_pnalloc(pool, size + 1);
+    if (buf == NULL) {
+        goto failed;
+    }
+
+    ((ngx_str_t *) cln->data)->len = size + 1;
+    ((ngx_str_t *) cln->data)->data = buf;
+    cln->handler = ngx_http_auth_basic_cleanup_buf;
+
+    ngx_memzero(&f, sizeof(ngx_file_t));
+
+    f.fd = fd;
+    f.name = name;
+    f.log = r->connection->log;
+
+    for (last = buf; last < buf + size; last += n) {
+        n = ngx_read_file(&f, last, buf + size - last, last - buf);
+
+        if (n == NGX_ERROR) {
+            goto failed;
+        }
+
+        if (n == 0) {
+            break;
+        }
+    }
+
+    *last = '\0';
+
+    ngx_rbtree_init(&file->rbtree, &file->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    /*
+     * each "login:passwd[:comment]" line is indexed by login, the
+     * password hash is null-terminated in place for ngx_crypt()
+     */
+
+    nusers = 0;
+
+    for (p = buf; p < last; p++) {
+
+        if (*p == '#' || *p == CR || *p == LF) {
+            goto skip;
+        }
+
+        login = p;
+
+        while (p < last && *p != ':' && *p != LF) {
+            p++;
+        }
+
+        if (p == last || *p == LF) {
+            continue;
+        }
+
+        name.len = p - login;
+        name.data = login;
+
+        passwd = ++p;
+
+        while (p < last && *p != ':' && *p != CR && *p != LF) {
+            p++;
+        }
+
+        hash = ngx_crc32_long(name.data, name.len);
+
+        if (ngx_str_rbtree_lookup(&file->rbtree, &name, hash) == NULL) {
+
+            user = ngx_pcalloc(pool, sizeof(ngx_http_auth_basic_user_t));
+            if (user == NULL) {
+                goto failed;
+            }
+
+            user->sn.node.key = hash;
+            user->sn.str = name;
+            user->passwd.len = p - passwd;
+            user->passwd.data = passwd;
+
+            ngx_rbtree_insert(&file->rbtree, &user->sn.node);
+
+            nusers++;
+        }
+
+        if (p == last) {
+            break;
+        }
+
+        if (*p == LF) {
+            *p = '\0';
+            continue;
+        }
+
+        *p = '\0';
+
+    skip:
+
+        while (p < last && *p != LF) {
+            p++;
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "auth basic file \"%s\": %ui users",
+                   file->sn.str.data, nusers);
+
+    if (file->pool) {
+        ngx_destroy_pool(file->pool);
+    }
+
+    file->pool = pool;
+    file->uniq = ngx_file_uniq(&fi);
+    file->mtime = ngx_file_mtime(&fi);
+    file->size = ngx_file_size(&fi);
+
+    rc = NGX_OK;
+    pool = NULL;
+
+failed:
+
+    if (pool) {
+        ngx_destroy_pool(pool);
+
+        if (file->pool) {
+
+            /* the old index cannot be trusted after the file was changed */
+
+            ngx_destroy_pool(file->pool);
+            file->pool = NULL;
+
+            ngx_rbtree_init(&file->rbtree, &file->sentinel,
+                            ngx_str_rbtree_insert_value);
+        }
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file->sn.str.data);
+    }
+
+    return rc;
+}
+
+
+static void
+ngx_http_auth_basic_digest(ngx_http_request_t *r, u_char *digest)
+{
+    ngx_uint_t                        i;
+    ngx_md5_t                         md5;
+    ngx_http_auth_basic_main_conf_t  *amcf;
+
+    amcf = ngx_http_get_module_main_conf(r, ngx_http_auth_basic_module);
+
+    /* passwords are not kept, only their salted per worker digests */
+
+    if (!amcf->salted) {
+        for (i = 0; i < 4; i++) {
+            amcf->salt[i] = (uint32_t) ngx_random();
+        }
+
+        amcf->salted = 1;
+    }
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, amcf->salt, sizeof(amcf->salt));
+    ngx_md5_update(&md5, r->headers_in.passwd.data, r->headers_in.passwd.len);
+    ngx_md5_final(digest, &md5);
+}
+
+
+static void
+ngx_http_auth_basic_cleanup_buf(void *data)
+{
+    ngx_str_t  *buf = data;
+
+    ngx_explicit_memzero(buf->data, buf->len);
+}
+
+
 static ngx_int_t
 ngx_http_auth_basic_crypt_handler(ngx_http_request_t *r, ngx_str_t *passwd,
     ngx_str_t *realm)
 {
-    ngx_int_t   rc;
-    u_char     *encrypted;
+    ngx_int_t                        rc;
+    u_char                          *encrypted;
+    ngx_http_auth_basic_ctx_t       *ctx;
+#if (NGX_THREADS && NGX_HAVE_GNU_CRYPT_R)
+    ngx_http_auth_basic_loc_conf_t  *alcf;
+#endif
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_auth_basic_module);
+
+    if (ctx && ctx->done
+        && ctx->passwd.len == passwd->len
+        && ngx_strncmp(ctx->passwd.data, passwd->data, passwd->len) == 0)
+    {
+        /* the hash was computed in a thread */
+
+        rc = ctx->rc;
+        encrypted = ctx->encrypted;
+
+        goto done;
+    }
+
+#if (NGX_THREADS && NGX_HAVE_GNU_CRYPT_R)
+
+    alcf = ngx_http_get_module_loc_conf(r, ngx_http_auth_basic_module);
+
+    /*
+     * the schemes implemented in ngx_crypt() are cheap, while
+     * crypt_r() may run bcrypt or SHA-crypt for tens of milliseconds
+     */
+
+    if (alcf->thread_pool
+        && passwd->data[0] != '{'
+        && ngx_strncmp(passwd->data, "$apr1$", sizeof("$apr1$") - 1) != 0)
+    {
+        if (ctx == NULL) {
+            ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_auth_basic_ctx_t));
+            if (ctx == NULL) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            ngx_http_set_ctx(r, ctx, ngx_http_auth_basic_module);
+        }
+
+        ctx->passwd.len = passwd->len;
+        ctx->passwd.data = ngx_pnalloc(r->pool, passwd->len + 1);
+        if (ctx->passwd.data == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        ngx_cpystrn(ctx->passwd.data, passwd->data, passwd->len + 1);
+        ctx->done = 0;
+
+        if (ngx_http_auth_basic_crypt_thread(r, ctx, alcf->thread_pool)
+            != NGX_OK)
+        {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        return NGX_AGAIN;
+    }
+
+#endif
 
     rc = ngx_crypt(r->pool, r->headers_in.passwd.data, passwd->data,
                    &encrypted);
 
+done:
+
     ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "rc: %i user: \"%V\" salt: \"%s\"",
                    rc, &r->headers_in.user, passwd->data);
@@ -314,6 +856,122 @@ ngx_http_auth_basic_crypt_handler(ngx_http_request_t *r, ngx_str_t *passwd,
 }
 
 
+#if (NGX_THREADS && NGX_HAVE_GNU_CRYPT_R)
+
+static ngx_int_t
+ngx_http_auth_basic_crypt_thread(ngx_http_request_t *r,
+    ngx_http_auth_basic_ctx_t *ctx, ngx_thread_pool_t *tp)
+{
+    ngx_thread_task_t                 *task;
+    ngx_http_auth_basic_thread_ctx_t  *tctx;
+
+    task = ctx->task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(r->pool,
+                                     sizeof(ngx_http_auth_basic_thread_ctx_t));
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        task->handler = ngx_http_auth_basic_crypt_thread_handler;
+
+        ctx->task = task;
+    }
+
+    tctx = task->ctx;
+
+    /*
+     * the thread only uses its own pool and copies of the strings,
+     * the request cannot be freed while it is blocked
+     */
+
+    tctx->key = r->headers_in.passwd.data;
+    tctx->salt = ctx->passwd.data;
+    tctx->encrypted = NULL;
+    tctx->rc = NGX_ERROR;
+
+    tctx->pool = ngx_create_pool(NGX_MIN_POOL_SIZE, r->connection->log);
+    if (tctx->pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    task->event.data = r;
+    task->event.handler = ngx_http_auth_basic_crypt_event_handler;
+
+    if (ngx_thread_task_post(tp, task) != NGX_OK) {
+        ngx_destroy_pool(tctx->pool);
+        return NGX_ERROR;
+    }
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_auth_basic_crypt_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_auth_basic_thread_ctx_t *tctx = data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "auth basic crypt thread");
+
+    tctx->rc = ngx_crypt(tctx->pool, tctx->key, tctx->salt,
+                         &tctx->encrypted);
+}
+
+
+static void
+ngx_http_auth_basic_crypt_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t                  *c;
+    ngx_http_request_t                *r;
+    ngx_http_auth_basic_ctx_t         *ctx;
+    ngx_http_auth_basic_thread_ctx_t  *tctx;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http auth basic thread: \"%V?%V\"", &r->uri, &r->args);
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_auth_basic_module);
+    tctx = ctx->task->ctx;
+
+    ctx->rc = tctx->rc;
+    ctx->encrypted = NULL;
+
+    if (tctx->rc == NGX_OK) {
+        ctx->encrypted = ngx_pnalloc(r->pool,
+                                     ngx_strlen(tctx->encrypted) + 1);
+        if (ctx->encrypted == NULL) {
+            ctx->rc = NGX_ERROR;
+
+        } else {
+            ngx_cpystrn(ctx->encrypted, tctx->encrypted,
+                        ngx_strlen(tctx->encrypted) + 1);
+        }
+    }
+
+    ngx_destroy_pool(tctx->pool);
+    tctx->pool = NULL;
+
+    ctx->done = 1;
+
+    r->write_event_handler(r);
+    ngx_http_run_posted_requests(c);
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_auth_basic_set_realm(ngx_http_request_t *r, ngx_str_t *realm)
 {
@@ -347,6 +1005,56 @@ ngx_http_auth_basic_set_realm(ngx_http_request_t *r, ngx_str_t *realm)
 }
 
 
+static void *
+ngx_http_auth_basic_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_pool_cleanup_t               *cln;
+    ngx_http_auth_basic_main_conf_t  *amcf;
+
+    amcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_auth_basic_main_conf_t));
+    if (amcf == NULL) {
+        return NULL;
+    }
+
+    ngx_rbtree_init(&amcf->rbtree, &amcf->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_http_auth_basic_cleanup_files;
+    cln->data = amcf;
+
+    return amcf;
+}
+
+
+static void
+ngx_http_auth_basic_cleanup_files(void *data)
+{
+    ngx_http_auth_basic_main_conf_t  *amcf = data;
+
+    ngx_rbtree_node_t           *node;
+    ngx_http_auth_basic_file_t  *file;
+
+    while (amcf->rbtree.root != amcf->rbtree.sentinel) {
+        node = ngx_rbtree_min(amcf->rbtree.root, amcf->rbtree.sentinel);
+
+        ngx_rbtree_delete(&amcf->rbtree, node);
+
+        file = (ngx_http_auth_basic_file_t *) node;
+
+        if (file->pool) {
+            ngx_destroy_pool(file->pool);
+        }
+
+        ngx_free(file);
+    }
+}
+
+
 static void *
 ngx_http_auth_basic_create_loc_conf(ngx_conf_t *cf)
 {
@@ -359,6 +1067,11 @@ ngx_http_auth_basic_create_loc_conf(ngx_conf_t *cf)
 
     conf->realm = NGX_CONF_UNSET_PTR;
     conf->user_file = NGX_CONF_UNSET_PTR;
+    conf->cache = NGX_CONF_UNSET;
+    conf->cache_valid = NGX_CONF_UNSET;
+#if (NGX_THREADS)
+    conf->thread_pool = NGX_CONF_UNSET_PTR;
+#endif
 
     return conf;
 }
@@ -372,6 +1085,11 @@ ngx_http_auth_basic_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_ptr_value(conf->realm, prev->realm, NULL);
     ngx_conf_merge_ptr_value(conf->user_file, prev->user_file, NULL);
+    ngx_conf_merge_value(conf->cache, prev->cache, 0);
+    ngx_conf_merge_sec_value(conf->cache_valid, prev->cache_valid, 5);
+#if (NGX_THREADS)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+#endif
 
     return NGX_CONF_OK;
 }
@@ -429,3 +1147,48 @@ ngx_http_auth_basic_user_file(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     return NGX_CONF_OK;
 }
+
+
+static char *
+ngx_http_auth_basic_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+#if (NGX_THREADS)
+    ngx_http_auth_basic_loc_conf_t *alcf = conf;
+#endif
+
+    ngx_str_t  *value;
+
+    value = cf->args->elts;
+
+#if (NGX_THREADS)
+
+    if (alcf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        alcf->thread_pool = NULL;
+        return NGX_CONF_OK;
+    }
+
+    alcf->thread_pool = ngx_thread_pool_add(cf, &value[1]);
+    if (alcf->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+
+#else
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        return NGX_CONF_OK;
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"auth_basic_thread_pool\" "
+                       "is unsupported on this platform");
+    return NGX_CONF_ERROR;
+
+#endif
+}
@@ -11,46 +11,57 @@
 
 
 typedef struct {
-    size_t      sbrk_size;
+    ngx_msec_t                 lag;
+    ngx_uint_t                 events;
+    ngx_uint_t                 accept_queue;
 } ngx_http_degradation_main_conf_t;
 
 
 typedef struct {
-    ngx_uint_t  degrade;
+    ngx_uint_t                 degrade;
+    ngx_http_complex_value_t  *priority;
 } ngx_http_degradation_loc_conf_t;
 
 
 static ngx_conf_enum_t  ngx_http_degrade[] = {
     { ngx_string("204"), 204 },
     { ngx_string("444"), 444 },
+    { ngx_string("503"), 503 },
     { ngx_null_string, 0 }
 };
 
 
+static ngx_uint_t ngx_http_degradation_load(ngx_http_request_t *r);
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+static ngx_uint_t ngx_http_degradation_accept_queue(ngx_http_request_t *r);
+#endif
 static void *ngx_http_degradation_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_degradation_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_degradation_merge_loc_conf(ngx_conf_t *cf, void *parent,
     void *child);
 static char *ngx_http_degradation(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_degradation_degrade(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static ngx_int_t ngx_http_degradation_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_degradation_init_process(ngx_cycle_t *cycle);
 
 
 static ngx_command_t  ngx_http_degradation_commands[] = {
 
     { ngx_string("degradation"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
       ngx_http_degradation,
       NGX_HTTP_MAIN_CONF_OFFSET,
       0,
       NULL },
 
     { ngx_string("degrade"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
-      ngx_conf_set_enum_slot,
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_degradation_degrade,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_degradation_loc_conf_t, degrade),
-      &ngx_http_degrade },
+      0,
+      NULL },
 
       ngx_null_command
 };
@@ -78,7 +89,7 @@ ngx_module_t  ngx_http_degradation_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_degradation_init_process,     /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -90,66 +101,157 @@ ngx_module_t  ngx_http_degradation_module = {
 static ngx_int_t
 ngx_http_degradation_handler(ngx_http_request_t *r)
 {
+    ngx_int_t                         priority;
+    ngx_str_t                         value;
+    ngx_uint_t                        load;
     ngx_http_degradation_loc_conf_t  *dlcf;
 
     dlcf = ngx_http_get_module_loc_conf(r, ngx_http_degradation_module);
 
-    if (dlcf->degrade && ngx_http_degraded(r)) {
-        return dlcf->degrade;
+    if (!dlcf->degrade) {
+        return NGX_DECLINED;
+    }
+
+    load = ngx_http_degradation_load(r);
+
+    if (load < 100) {
+        return NGX_DECLINED;
+    }
+
+    priority = 0;
+
+    if (dlcf->priority) {
+        if (ngx_http_complex_value(r, dlcf->priority, &value) != NGX_OK) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        priority = ngx_atoi(value.data, value.len);
+
+        if (priority == NGX_ERROR) {
+            priority = 0;
+        }
+    }
+
+    /* requests of priority N are shed when the load is N + 1 times over */
+
+    if ((ngx_uint_t) priority >= load / 100) {
+        return NGX_DECLINED;
     }
 
-    return NGX_DECLINED;
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "degradation load:%ui%% priority:%i", load, priority);
+
+    return dlcf->degrade;
 }
 
 
 ngx_uint_t
 ngx_http_degraded(ngx_http_request_t *r)
+{
+    return ngx_http_degradation_load(r) >= 100;
+}
+
+
+static ngx_uint_t
+ngx_http_degradation_load(ngx_http_request_t *r)
 {
     time_t                             now;
-    ngx_uint_t                         log;
-    static size_t                      sbrk_size;
-    static time_t                      sbrk_time;
+    ngx_uint_t                         load, n, queue;
+    static time_t                      log_time;
     ngx_http_degradation_main_conf_t  *dmcf;
 
     dmcf = ngx_http_get_module_main_conf(r, ngx_http_degradation_module);
 
-    if (dmcf->sbrk_size) {
+    /*
+     * the load is the largest of the event loop lag, the number
+     * of events handled in the last event loop iteration,
+     * and the accept queue length, in percents of the configured limits
+     */
 
-        log = 0;
-        now = ngx_time();
+    load = 0;
+    queue = 0;
 
-        /* lock mutex */
+    if (dmcf->lag) {
+        load = ngx_event_loop_lag * 100 / dmcf->lag;
+    }
 
-        if (now != sbrk_time) {
+    if (dmcf->events) {
+        n = ngx_event_loop_events * 100 / dmcf->events;
 
-            /*
-             * ELF/i386 is loaded at 0x08000000, 128M
-             * ELF/amd64 is loaded at 0x00400000, 4M
-             *
-             * use a function address to subtract the loading address
-             */
+        if (n > load) {
+            load = n;
+        }
+    }
+
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+
+    if (dmcf->accept_queue) {
+        queue = ngx_http_degradation_accept_queue(r);
 
-            sbrk_size = (size_t) sbrk(0) - ((uintptr_t) ngx_palloc & ~0x3FFFFF);
-            sbrk_time = now;
-            log = 1;
+        n = queue * 100 / dmcf->accept_queue;
+
+        if (n > load) {
+            load = n;
         }
+    }
 
-        /* unlock mutex */
+#endif
 
-        if (sbrk_size >= dmcf->sbrk_size) {
-            if (log) {
-                ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                              "degradation sbrk:%uzM",
-                              sbrk_size / (1024 * 1024));
-            }
+    if (load >= 100) {
+        now = ngx_time();
+
+        if (now != log_time) {
+            log_time = now;
 
-            return 1;
+            ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                          "degradation lag:%Mms events:%ui accept queue:%ui",
+                          ngx_event_loop_lag, ngx_event_loop_events, queue);
         }
     }
 
-    return 0;
+    return load;
+}
+
+
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+
+static ngx_uint_t
+ngx_http_degradation_accept_queue(ngx_http_request_t *r)
+{
+    socklen_t                 len;
+    ngx_listening_t          *ls;
+    struct tcp_info           ti;
+    static ngx_uint_t         queue;
+    static ngx_msec_t         sampled;
+    static ngx_listening_t   *last;
+
+    ls = r->connection->listening;
+
+    if (ls == last && ngx_current_msec == sampled) {
+        return queue;
+    }
+
+    last = ls;
+    sampled = ngx_current_msec;
+
+    /* for a listening socket Linux reports the accept queue as unacked */
+
+    len = sizeof(struct tcp_info);
+
+    if (ls->sockaddr->sa_family == AF_UNIX
+        || getsockopt(ls->fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == -1)
+    {
+        queue = 0;
+        return queue;
+    }
+
+    queue = ti.tcpi_unacked;
+
+    return queue;
 }
 
+#endif
+
 
 static void *
 ngx_http_degradation_create_main_conf(ngx_conf_t *cf)
@@ -176,6 +278,7 @@ ngx_http_degradation_create_loc_conf(ngx_conf_t *cf)
     }
 
     conf->degrade = NGX_CONF_UNSET_UINT;
+    conf->priority = NGX_CONF_UNSET_PTR;
 
     return conf;
 }
@@ -188,6 +291,7 @@ ngx_http_degradation_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_degradation_loc_conf_t  *conf = child;
 
     ngx_conf_merge_uint_value(conf->degrade, prev->degrade, 0);
+    ngx_conf_merge_ptr_value(conf->priority, prev->priority, NULL);
 
     return NGX_CONF_OK;
 }
@@ -198,32 +302,146 @@ ngx_http_degradation(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_degradation_main_conf_t  *dmcf = conf;
 
-    ngx_str_t  *value, s;
+    ngx_int_t    n;
+    ngx_str_t   *value, s;
+    ngx_msec_t   lag;
+    ngx_uint_t   i;
 
     value = cf->args->elts;
 
-    if (ngx_strncmp(value[1].data, "sbrk=", 5) == 0) {
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "lag=", 4) == 0) {
+
+            s.len = value[i].len - 4;
+            s.data = value[i].data + 4;
+
+            lag = ngx_parse_time(&s, 0);
+            if (lag == (ngx_msec_t) NGX_ERROR || lag == 0) {
+                goto invalid;
+            }
+
+            dmcf->lag = lag;
 
-        s.len = value[1].len - 5;
-        s.data = value[1].data + 5;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "events=", 7) == 0) {
+
+            n = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            dmcf->events = n;
+
+            continue;
+        }
 
-        dmcf->sbrk_size = ngx_parse_size(&s);
-        if (dmcf->sbrk_size == (size_t) NGX_ERROR) {
+        if (ngx_strncmp(value[i].data, "accept_queue=", 13) == 0) {
+
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+
+            n = ngx_atoi(value[i].data + 13, value[i].len - 13);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            dmcf->accept_queue = n;
+
+            continue;
+
+#else
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "invalid sbrk size \"%V\"", &value[1]);
+                               "the \"accept_queue\" parameter "
+                               "is not supported on this platform");
             return NGX_CONF_ERROR;
+#endif
         }
 
-        return NGX_CONF_OK;
+        if (ngx_strncmp(value[i].data, "sbrk=", 5) == 0) {
+            ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                               "the \"sbrk\" parameter is obsolete, ignored");
+            continue;
+        }
+
+        goto invalid;
     }
 
+    return NGX_CONF_OK;
+
+invalid:
+
     ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                       "invalid parameter \"%V\"", &value[1]);
+                       "invalid parameter \"%V\"", &value[i]);
 
     return NGX_CONF_ERROR;
 }
 
 
+static char *
+ngx_http_degradation_degrade(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_degradation_loc_conf_t *dlcf = conf;
+
+    ngx_str_t                         *value, s;
+    ngx_uint_t                         i;
+    ngx_http_compile_complex_value_t   ccv;
+
+    if (dlcf->degrade != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    for (i = 0; ngx_http_degrade[i].name.len; i++) {
+        if (ngx_http_degrade[i].name.len == value[1].len
+            && ngx_strcmp(ngx_http_degrade[i].name.data, value[1].data) == 0)
+        {
+            dlcf->degrade = ngx_http_degrade[i].value;
+            break;
+        }
+    }
+
+    if (ngx_http_degrade[i].name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (cf->args->nelts == 2) {
+        dlcf->priority = NULL;
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[2].data, "priority=", 9) != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    s.len = value[2].len - 9;
+    s.data = value[2].data + 9;
+
+    dlcf->priority = ngx_palloc(cf->pool, sizeof(ngx_http_complex_value_t));
+    if (dlcf->priority == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &s;
+    ccv.complex_value = dlcf->priority;
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
 static ngx_int_t
 ngx_http_degradation_init(ngx_conf_t *cf)
 {
@@ -232,6 +450,19 @@ ngx_http_degradation_init(ngx_conf_t *cf)
 
     cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
 
+    /*
+     * "degrade" set on the server level is checked as soon as
+     * the request header is read, before any rewrites and location
+     * processing; a location's own setting is checked again later
+     */
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_POST_READ_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_degradation_handler;
+
     h = ngx_array_push(&cmcf->phases[NGX_HTTP_PREACCESS_PHASE].handlers);
     if (h == NULL) {
         return NGX_ERROR;
@@ -241,3 +472,19 @@ ngx_http_degradation_init(ngx_conf_t *cf)
 
     return NGX_OK;
 }
+
+
+static ngx_int_t
+ngx_http_degradation_init_process(ngx_cycle_t *cycle)
+{
+    ngx_http_degradation_main_conf_t  *dmcf;
+
+    dmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_degradation_module);
+
+    if (dmcf && (dmcf->lag || dmcf->events)) {
+        ngx_event_loop_timing = 1;
+    }
+
+    return NGX_OK;
+}
@@ -48,7 +48,7 @@ typedef struct {
 #endif
     ngx_rbtree_t                     rbtree;
     ngx_rbtree_node_t                sentinel;
-    ngx_array_t                     *proxies;
+    ngx_cidr_tree_t                 *proxies;
     ngx_pool_t                      *pool;
     ngx_pool_t                      *temp_pool;
 
@@ -72,7 +72,7 @@ typedef struct {
         ngx_http_geo_high_ranges_t   high;
     } u;
 
-    ngx_array_t                     *proxies;
+    ngx_cidr_tree_t                 *proxies;
     unsigned                         proxy_recursive:1;
 
     ngx_int_t                        index;
@@ -1299,22 +1299,17 @@ static char *
 ngx_http_geo_add_proxy(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
     ngx_cidr_t *cidr)
 {
-    ngx_cidr_t  *c;
-
     if (ctx->proxies == NULL) {
-        ctx->proxies = ngx_array_create(ctx->pool, 4, sizeof(ngx_cidr_t));
+        ctx->proxies = ngx_cidr_tree_create(ctx->pool);
         if (ctx->proxies == NULL) {
             return NGX_CONF_ERROR;
         }
     }
 
-    c = ngx_array_push(ctx->proxies);
-    if (c == NULL) {
+    if (ngx_cidr_tree_add(ctx->proxies, cidr) != NGX_OK) {
         return NGX_CONF_ERROR;
     }
 
-    *c = *cidr;
-
     return NGX_CONF_OK;
 }
 
@@ -19,15 +19,15 @@
 
 
 typedef struct {
-    GeoIP        *country;
-    GeoIP        *org;
-    GeoIP        *city;
-    ngx_array_t  *proxies;    /* array of ngx_cidr_t */
-    ngx_flag_t    proxy_recursive;
+    GeoIP            *country;
+    GeoIP            *org;
+    GeoIP            *city;
+    ngx_cidr_tree_t  *proxies;
+    ngx_flag_t        proxy_recursive;
 #if (NGX_HAVE_GEOIP_V6)
-    unsigned      country_v6:1;
-    unsigned      org_v6:1;
-    unsigned      city_v6:1;
+    unsigned          country_v6:1;
+    unsigned          org_v6:1;
+    unsigned          city_v6:1;
 #endif
 } ngx_http_geoip_conf_t;
 
@@ -852,7 +852,7 @@ ngx_http_geoip_proxy(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_geoip_conf_t  *gcf = conf;
 
     ngx_str_t   *value;
-    ngx_cidr_t  cidr, *c;
+    ngx_cidr_t   cidr;
 
     value = cf->args->elts;
 
@@ -861,19 +861,16 @@ ngx_http_geoip_proxy(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     if (gcf->proxies == NULL) {
-        gcf->proxies = ngx_array_create(cf->pool, 4, sizeof(ngx_cidr_t));
+        gcf->proxies = ngx_cidr_tree_create(cf->pool);
         if (gcf->proxies == NULL) {
             return NGX_CONF_ERROR;
         }
     }
 
-    c = ngx_array_push(gcf->proxies);
-    if (c == NULL) {
+    if (ngx_cidr_tree_add(gcf->proxies, &cidr) != NGX_OK) {
         return NGX_CONF_ERROR;
     }
 
-    *c = cidr;
-
     return NGX_CONF_OK;
 }
 
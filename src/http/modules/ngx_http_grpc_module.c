@@ -19,25 +19,28 @@ typedef struct {
 
 
 typedef struct {
-    ngx_http_upstream_conf_t   upstream;
+    ngx_http_upstream_conf_t       upstream;
 
-    ngx_http_grpc_headers_t    headers;
-    ngx_array_t               *headers_source;
+    ngx_http_grpc_headers_t        headers;
+    ngx_array_t                   *headers_source;
 
-    ngx_str_t                  host;
-    ngx_uint_t                 host_set;
+    ngx_str_t                      host;
+    ngx_uint_t                     host_set;
 
-    ngx_array_t               *grpc_lengths;
-    ngx_array_t               *grpc_values;
+    ngx_array_t                   *grpc_lengths;
+    ngx_array_t                   *grpc_values;
+
+    ngx_flag_t                     multiplex;
+    ngx_http_upstream_mux_conf_t   mux;
 
 #if (NGX_HTTP_SSL)
-    ngx_uint_t                 ssl;
-    ngx_uint_t                 ssl_protocols;
-    ngx_str_t                  ssl_ciphers;
-    ngx_uint_t                 ssl_verify_depth;
-    ngx_str_t                  ssl_trusted_certificate;
-    ngx_str_t                  ssl_crl;
-    ngx_array_t               *ssl_conf_commands;
+    ngx_uint_t                     ssl;
+    ngx_uint_t                     ssl_protocols;
+    ngx_str_t                      ssl_ciphers;
+    ngx_uint_t                     ssl_verify_depth;
+    ngx_str_t                      ssl_trusted_certificate;
+    ngx_str_t                      ssl_crl;
+    ngx_array_t                   *ssl_conf_commands;
 #endif
 } ngx_http_grpc_loc_conf_t;
 
@@ -58,74 +61,67 @@ typedef enum {
 
 
 typedef struct {
-    size_t                     init_window;
-    size_t                     send_window;
-    size_t                     recv_window;
-    ngx_uint_t                 last_stream_id;
-} ngx_http_grpc_conn_t;
-
-
-typedef struct {
-    ngx_http_grpc_state_e      state;
-    ngx_uint_t                 frame_state;
-    ngx_uint_t                 fragment_state;
+    ngx_http_grpc_state_e            state;
+    ngx_uint_t                       frame_state;
+    ngx_uint_t                       fragment_state;
 
-    ngx_chain_t               *in;
-    ngx_chain_t               *out;
-    ngx_chain_t               *free;
-    ngx_chain_t               *busy;
+    ngx_chain_t                     *in;
+    ngx_chain_t                     *out;
+    ngx_chain_t                     *free;
+    ngx_chain_t                     *busy;
 
-    ngx_http_grpc_conn_t      *connection;
+    ngx_http_upstream_mux_conn_t    *connection;
+    ngx_http_upstream_mux_stream_t  *stream;
 
-    ngx_uint_t                 id;
+    ngx_uint_t                       id;
 
-    ngx_uint_t                 pings;
-    ngx_uint_t                 settings;
+    ngx_uint_t                       pings;
+    ngx_uint_t                       settings;
 
-    off_t                      length;
+    off_t                            length;
 
-    ssize_t                    send_window;
-    size_t                     recv_window;
+    ssize_t                          send_window;
+    size_t                           recv_window;
 
-    size_t                     rest;
-    ngx_uint_t                 stream_id;
-    u_char                     type;
-    u_char                     flags;
-    u_char                     padding;
+    size_t                           rest;
+    ngx_uint_t                       stream_id;
+    u_char                           type;
+    u_char                           flags;
+    u_char                           padding;
 
-    ngx_uint_t                 error;
-    ngx_uint_t                 window_update;
+    ngx_uint_t                       error;
+    ngx_uint_t                       window_update;
 
-    ngx_uint_t                 setting_id;
-    ngx_uint_t                 setting_value;
+    ngx_uint_t                       setting_id;
+    ngx_uint_t                       setting_value;
 
-    u_char                     ping_data[8];
+    u_char                           ping_data[8];
 
-    ngx_uint_t                 index;
-    ngx_str_t                  name;
-    ngx_str_t                  value;
+    ngx_uint_t                       index;
+    ngx_str_t                        name;
+    ngx_str_t                        value;
 
-    u_char                    *field_end;
-    size_t                     field_length;
-    size_t                     field_rest;
-    u_char                     field_state;
+    u_char                          *field_end;
+    size_t                           field_length;
+    size_t                           field_rest;
+    u_char                           field_state;
 
-    unsigned                   literal:1;
-    unsigned                   field_huffman:1;
+    unsigned                         literal:1;
+    unsigned                         field_huffman:1;
 
-    unsigned                   header_sent:1;
-    unsigned                   output_closed:1;
-    unsigned                   output_blocked:1;
-    unsigned                   parsing_headers:1;
-    unsigned                   end_stream:1;
-    unsigned                   done:1;
-    unsigned                   status:1;
-    unsigned                   rst:1;
-    unsigned                   goaway:1;
+    unsigned                         header_sent:1;
+    unsigned                         output_closed:1;
+    unsigned                         output_blocked:1;
+    unsigned                         parsing_headers:1;
+    unsigned                         end_stream:1;
+    unsigned                         done:1;
+    unsigned                         status:1;
+    unsigned                         rst:1;
+    unsigned                         goaway:1;
 
-    ngx_http_request_t        *request;
+    ngx_http_request_t              *request;
 
-    ngx_str_t                  host;
+    ngx_str_t                        host;
 } ngx_http_grpc_ctx_t;
 
 
@@ -186,6 +182,8 @@ static ngx_int_t ngx_http_grpc_get_connection_data(ngx_http_request_t *r,
     ngx_http_grpc_ctx_t *ctx, ngx_peer_connection_t *pc);
 static void ngx_http_grpc_cleanup(void *data);
 
+static ngx_int_t ngx_http_grpc_init_peer(ngx_http_request_t *r);
+
 static void ngx_http_grpc_abort_request(ngx_http_request_t *r);
 static void ngx_http_grpc_finalize_request(ngx_http_request_t *r,
     ngx_int_t rc);
@@ -272,6 +270,34 @@ static ngx_command_t  ngx_http_grpc_commands[] = {
       offsetof(ngx_http_grpc_loc_conf_t, upstream.socket_keepalive),
       NULL },
 
+    { ngx_string("grpc_multiplex"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_grpc_loc_conf_t, multiplex),
+      NULL },
+
+    { ngx_string("grpc_multiplex_streams"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_grpc_loc_conf_t, mux.streams),
+      NULL },
+
+    { ngx_string("grpc_multiplex_window"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_grpc_loc_conf_t, mux.window),
+      NULL },
+
+    { ngx_string("grpc_multiplex_timeout"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_grpc_loc_conf_t, mux.timeout),
+      NULL },
+
     { ngx_string("grpc_connect_timeout"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_msec_slot,
@@ -594,6 +620,13 @@ ngx_http_grpc_handler(ngx_http_request_t *r)
     u->input_filter = ngx_http_grpc_filter;
     u->input_filter_ctx = ctx;
 
+    if (glcf->multiplex
+        && !u->ssl
+        && (ngx_event_flags & NGX_USE_CLEAR_EVENT))
+    {
+        u->init_peer = ngx_http_grpc_init_peer;
+    }
+
     r->request_body_no_buffering = 1;
 
     rc = ngx_http_read_client_request_body(r, ngx_http_upstream_init);
@@ -1260,10 +1293,10 @@ ngx_http_grpc_body_output_filter(void *data, ngx_chain_t *in)
 
         ctx->header_sent = 1;
 
-        if (ctx->id != 1) {
+        if (ctx->id != 1 || ctx->stream) {
             /*
-             * keepalive connection: skip connection preface,
-             * update stream identifiers
+             * keepalive or multiplexed connection: skip connection
+             * preface, update stream identifiers
              */
 
             b = ctx->in->buf;
@@ -2086,7 +2119,9 @@ ngx_http_grpc_filter(void *data, ssize_t bytes)
                     return NGX_ERROR;
                 }
 
-                if (ctx->rest > ctx->connection->recv_window) {
+                if (ctx->stream == NULL
+                    && ctx->rest > ctx->connection->recv_window)
+                {
                     ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
                                   "upstream violated connection flow control, "
                                   "received %uz data frame with window %uz",
@@ -2095,10 +2130,17 @@ ngx_http_grpc_filter(void *data, ssize_t bytes)
                 }
 
                 ctx->recv_window -= ctx->rest;
-                ctx->connection->recv_window -= ctx->rest;
 
-                if (ctx->connection->recv_window < NGX_HTTP_V2_MAX_WINDOW / 4
-                    || ctx->recv_window < NGX_HTTP_V2_MAX_WINDOW / 4)
+                if (ctx->stream == NULL) {
+                    /* multiplexed connections are accounted by the mux */
+                    ctx->connection->recv_window -= ctx->rest;
+                }
+
+                if ((ctx->stream == NULL
+                     && ctx->connection->recv_window
+                        < NGX_HTTP_V2_MAX_WINDOW / 4)
+                    || ctx->recv_window
+                       < ctx->connection->recv_init_window / 4)
                 {
                     if (ngx_http_grpc_send_window_update(r, ctx) != NGX_OK) {
                         return NGX_ERROR;
@@ -4072,26 +4114,28 @@ ngx_http_grpc_send_window_update(ngx_http_request_t *r,
         return NGX_ERROR;
     }
 
-    f = (ngx_http_grpc_frame_t *) cl->buf->last;
-    cl->buf->last += sizeof(ngx_http_grpc_frame_t);
+    if (ctx->stream == NULL) {
+        f = (ngx_http_grpc_frame_t *) cl->buf->last;
+        cl->buf->last += sizeof(ngx_http_grpc_frame_t);
 
-    f->length_0 = 0;
-    f->length_1 = 0;
-    f->length_2 = 4;
-    f->type = NGX_HTTP_V2_WINDOW_UPDATE_FRAME;
-    f->flags = 0;
-    f->stream_id_0 = 0;
-    f->stream_id_1 = 0;
-    f->stream_id_2 = 0;
-    f->stream_id_3 = 0;
+        f->length_0 = 0;
+        f->length_1 = 0;
+        f->length_2 = 4;
+        f->type = NGX_HTTP_V2_WINDOW_UPDATE_FRAME;
+        f->flags = 0;
+        f->stream_id_0 = 0;
+        f->stream_id_1 = 0;
+        f->stream_id_2 = 0;
+        f->stream_id_3 = 0;
 
-    n = NGX_HTTP_V2_MAX_WINDOW - ctx->connection->recv_window;
-    ctx->connection->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+        n = NGX_HTTP_V2_MAX_WINDOW - ctx->connection->recv_window;
+        ctx->connection->recv_window = NGX_HTTP_V2_MAX_WINDOW;
 
-    *cl->buf->last++ = (u_char) ((n >> 24) & 0xff);
-    *cl->buf->last++ = (u_char) ((n >> 16) & 0xff);
-    *cl->buf->last++ = (u_char) ((n >> 8) & 0xff);
-    *cl->buf->last++ = (u_char) (n & 0xff);
+        *cl->buf->last++ = (u_char) ((n >> 24) & 0xff);
+        *cl->buf->last++ = (u_char) ((n >> 16) & 0xff);
+        *cl->buf->last++ = (u_char) ((n >> 8) & 0xff);
+        *cl->buf->last++ = (u_char) (n & 0xff);
+    }
 
     f = (ngx_http_grpc_frame_t *) cl->buf->last;
     cl->buf->last += sizeof(ngx_http_grpc_frame_t);
@@ -4106,8 +4150,8 @@ ngx_http_grpc_send_window_update(ngx_http_request_t *r,
     f->stream_id_2 = (u_char) ((ctx->id >> 8) & 0xff);
     f->stream_id_3 = (u_char) (ctx->id & 0xff);
 
-    n = NGX_HTTP_V2_MAX_WINDOW - ctx->recv_window;
-    ctx->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+    n = ctx->connection->recv_init_window - ctx->recv_window;
+    ctx->recv_window = ctx->connection->recv_init_window;
 
     *cl->buf->last++ = (u_char) ((n >> 24) & 0xff);
     *cl->buf->last++ = (u_char) ((n >> 16) & 0xff);
@@ -4191,6 +4235,18 @@ ngx_http_grpc_get_connection_data(ngx_http_request_t *r,
     ngx_connection_t    *c;
     ngx_pool_cleanup_t  *cln;
 
+    if (ctx->stream) {
+        ctx->connection = &ctx->stream->mux->conn;
+
+        ctx->send_window = ctx->connection->init_window;
+        ctx->recv_window = ctx->connection->recv_init_window;
+
+        ctx->id = ngx_http_upstream_mux_open(ctx->stream, &ctx->send_window,
+                                             &ctx->in);
+
+        return NGX_OK;
+    }
+
     c = pc->connection;
 
     if (pc->cached) {
@@ -4215,7 +4271,7 @@ ngx_http_grpc_get_connection_data(ngx_http_request_t *r,
         }
 
         ctx->send_window = ctx->connection->init_window;
-        ctx->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+        ctx->recv_window = ctx->connection->recv_init_window;
 
         ctx->connection->last_stream_id += 2;
         ctx->id = ctx->connection->last_stream_id;
@@ -4223,7 +4279,8 @@ ngx_http_grpc_get_connection_data(ngx_http_request_t *r,
         return NGX_OK;
     }
 
-    cln = ngx_pool_cleanup_add(c->pool, sizeof(ngx_http_grpc_conn_t));
+    cln = ngx_pool_cleanup_add(c->pool,
+                               sizeof(ngx_http_upstream_mux_conn_t));
     if (cln == NULL) {
         return NGX_ERROR;
     }
@@ -4234,6 +4291,7 @@ ngx_http_grpc_get_connection_data(ngx_http_request_t *r,
     ctx->connection->init_window = NGX_HTTP_V2_DEFAULT_WINDOW;
     ctx->connection->send_window = NGX_HTTP_V2_DEFAULT_WINDOW;
     ctx->connection->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+    ctx->connection->recv_init_window = NGX_HTTP_V2_MAX_WINDOW;
 
     ctx->send_window = NGX_HTTP_V2_DEFAULT_WINDOW;
     ctx->recv_window = NGX_HTTP_V2_MAX_WINDOW;
@@ -4256,6 +4314,19 @@ ngx_http_grpc_cleanup(void *data)
 }
 
 
+static ngx_int_t
+ngx_http_grpc_init_peer(ngx_http_request_t *r)
+{
+    ngx_http_grpc_ctx_t       *ctx;
+    ngx_http_grpc_loc_conf_t  *glcf;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_grpc_module);
+    glcf = ngx_http_get_module_loc_conf(r, ngx_http_grpc_module);
+
+    return ngx_http_upstream_mux_init_peer(r, &glcf->mux, &ctx->stream);
+}
+
+
 static void
 ngx_http_grpc_abort_request(ngx_http_request_t *r)
 {
@@ -4356,6 +4427,11 @@ ngx_http_grpc_create_loc_conf(ngx_conf_t *cf)
 
     conf->upstream.local = NGX_CONF_UNSET_PTR;
     conf->upstream.socket_keepalive = NGX_CONF_UNSET;
+
+    conf->multiplex = NGX_CONF_UNSET;
+    conf->mux.streams = NGX_CONF_UNSET_UINT;
+    conf->mux.window = NGX_CONF_UNSET_SIZE;
+    conf->mux.timeout = NGX_CONF_UNSET_MSEC;
     conf->upstream.next_upstream_tries = NGX_CONF_UNSET_UINT;
     conf->upstream.connect_timeout = NGX_CONF_UNSET_MSEC;
     conf->upstream.send_timeout = NGX_CONF_UNSET_MSEC;
@@ -4420,6 +4496,31 @@ ngx_http_grpc_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->upstream.socket_keepalive,
                               prev->upstream.socket_keepalive, 0);
 
+    ngx_conf_merge_value(conf->multiplex, prev->multiplex, 0);
+
+    ngx_conf_merge_uint_value(conf->mux.streams, prev->mux.streams, 128);
+
+    ngx_conf_merge_size_value(conf->mux.window, prev->mux.window, 65536);
+
+    ngx_conf_merge_msec_value(conf->mux.timeout, prev->mux.timeout, 60000);
+
+    if (conf->mux.streams == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"grpc_multiplex_streams\" must be positive");
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->mux.window < NGX_HTTP_V2_DEFAULT_FRAME_SIZE
+        || conf->mux.window > NGX_HTTP_V2_MAX_WINDOW)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"grpc_multiplex_window\" must be between "
+                           "%uz and %uz",
+                           (size_t) NGX_HTTP_V2_DEFAULT_FRAME_SIZE,
+                           (size_t) NGX_HTTP_V2_MAX_WINDOW);
+        return NGX_CONF_ERROR;
+    }
+
     ngx_conf_merge_uint_value(conf->upstream.next_upstream_tries,
                               prev->upstream.next_upstream_tries, 0);
 
@@ -114,6 +114,10 @@ typedef struct {
 
     ngx_uint_t                     http_version;
 
+#if (NGX_HTTP_V2)
+    ngx_http_upstream_mux_conf_t   mux;
+#endif
+
     ngx_uint_t                     headers_hash_max_size;
     ngx_uint_t                     headers_hash_bucket_size;
 
@@ -129,6 +133,47 @@ typedef struct {
 } ngx_http_proxy_loc_conf_t;
 
 
+#if (NGX_HTTP_V2)
+
+typedef struct {
+    ngx_http_upstream_mux_stream_t  *stream;
+    ngx_http_upstream_mux_conn_t    *connection;
+    ngx_uint_t                       id;
+
+    ssize_t                          send_window;
+    size_t                           recv_window;
+
+    ngx_chain_t                     *in;
+    ngx_chain_t                     *out;
+    ngx_chain_t                     *free;
+    ngx_chain_t                     *busy;
+
+    /* the frame being parsed */
+    ngx_uint_t                       state;
+    size_t                           received;
+    size_t                           rest;
+    size_t                           padding;
+    ngx_uint_t                       type;
+    ngx_uint_t                       flags;
+    u_char                           head[NGX_HTTP_V2_FRAME_HEADER_SIZE];
+    u_char                           frame[4];
+
+    /* the header block being received */
+    ngx_buf_t                       *header;
+
+    off_t                            length;
+
+    unsigned                         header_sent:1;
+    unsigned                         output_closed:1;
+    unsigned                         output_blocked:1;
+    unsigned                         parsing_headers:1;
+    unsigned                         end_stream:1;
+    unsigned                         done:1;
+} ngx_http_proxy_v2_ctx_t;
+
+#endif
+
+
 typedef struct {
     ngx_http_status_t              status;
     ngx_http_chunked_t             chunked;
@@ -138,9 +183,14 @@ typedef struct {
     ngx_chain_t                   *free;
     ngx_chain_t                   *busy;
 
+#if (NGX_HTTP_V2)
+    ngx_http_proxy_v2_ctx_t        v2;
+#endif
+
     unsigned                       head:1;
     unsigned                       internal_chunked:1;
     unsigned                       header_sent:1;
+    unsigned                       http2:1;
 } ngx_http_proxy_ctx_t;
 
 
@@ -167,6 +217,36 @@ static void ngx_http_proxy_abort_request(ngx_http_request_t *r);
 static void ngx_http_proxy_finalize_request(ngx_http_request_t *r,
     ngx_int_t rc);
 
+#if (NGX_HTTP_V2)
+static ngx_int_t ngx_http_proxy_v2_init_peer(ngx_http_request_t *r);
+static ngx_int_t ngx_http_proxy_v2_create_request(ngx_http_request_t *r,
+    ngx_str_t *method, ngx_http_proxy_headers_t *headers);
+static ngx_int_t ngx_http_proxy_v2_body_output_filter(void *data,
+    ngx_chain_t *in);
+static ngx_int_t ngx_http_proxy_v2_process_header(ngx_http_request_t *r);
+static ngx_int_t ngx_http_proxy_v2_filter_init(void *data);
+static ngx_int_t ngx_http_proxy_v2_filter(ngx_event_pipe_t *p,
+    ngx_buf_t *buf);
+static ngx_int_t ngx_http_proxy_v2_non_buffered_filter(void *data,
+    ssize_t bytes);
+static ngx_int_t ngx_http_proxy_v2_parse(ngx_http_request_t *r,
+    ngx_http_proxy_ctx_t *ctx, ngx_buf_t *b, ngx_str_t *data);
+static ngx_int_t ngx_http_proxy_v2_parse_field(ngx_http_request_t *r,
+    u_char **pos, u_char *last, ngx_str_t *name, ngx_str_t *value);
+static ngx_int_t ngx_http_proxy_v2_parse_int(u_char **pos, u_char *last,
+    ngx_uint_t prefix);
+static ngx_int_t ngx_http_proxy_v2_parse_string(ngx_http_request_t *r,
+    u_char **pos, u_char *last, ngx_str_t *s);
+static ngx_uint_t ngx_http_proxy_v2_connection_header(u_char *name,
+    size_t len);
+static ngx_int_t ngx_http_proxy_v2_send_window_update(ngx_http_request_t *r,
+    ngx_http_proxy_ctx_t *ctx);
+static ngx_chain_t *ngx_http_proxy_v2_get_buf(ngx_http_request_t *r,
+    ngx_http_proxy_ctx_t *ctx);
+static u_char *ngx_http_proxy_v2_frame_head(u_char *p, size_t length,
+    ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid);
+#endif
+
 static ngx_int_t ngx_http_proxy_host_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_proxy_port_variable(ngx_http_request_t *r,
@@ -285,6 +365,9 @@ static ngx_conf_post_t  ngx_http_proxy_ssl_conf_command_post =
 static ngx_conf_enum_t  ngx_http_proxy_http_version[] = {
     { ngx_string("1.0"), NGX_HTTP_VERSION_10 },
     { ngx_string("1.1"), NGX_HTTP_VERSION_11 },
+#if (NGX_HTTP_V2)
+    { ngx_string("2"), NGX_HTTP_VERSION_20 },
+#endif
     { ngx_null_string, 0 }
 };
 
@@ -683,6 +766,31 @@ static ngx_command_t  ngx_http_proxy_commands[] = {
       offsetof(ngx_http_proxy_loc_conf_t, http_version),
       &ngx_http_proxy_http_version },
 
+#if (NGX_HTTP_V2)
+
+    { ngx_string("proxy_multiplex_streams"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, mux.streams),
+      NULL },
+
+    { ngx_string("proxy_multiplex_window"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, mux.window),
+      NULL },
+
+    { ngx_string("proxy_multiplex_timeout"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, mux.timeout),
+      NULL },
+
+#endif
+
 #if (NGX_HTTP_SSL)
 
     { ngx_string("proxy_ssl_session_reuse"),
@@ -1010,10 +1118,34 @@ ngx_http_proxy_handler(ngx_http_request_t *r)
 
     u->accel = 1;
 
+#if (NGX_HTTP_V2)
+
+    /*
+     * HTTP/2 streams are only multiplexed over plain connections,
+     * HTTP/1.1 is used otherwise
+     */
+
+    if (plcf->http_version == NGX_HTTP_VERSION_20
+        && !u->ssl
+        && (ngx_event_flags & NGX_USE_CLEAR_EVENT))
+    {
+        ctx->http2 = 1;
+
+        u->init_peer = ngx_http_proxy_v2_init_peer;
+        u->process_header = ngx_http_proxy_v2_process_header;
+
+        u->pipe->input_filter = ngx_http_proxy_v2_filter;
+
+        u->input_filter_init = ngx_http_proxy_v2_filter_init;
+        u->input_filter = ngx_http_proxy_v2_non_buffered_filter;
+    }
+
+#endif
+
     if (!plcf->upstream.request_buffering
         && plcf->body_values == NULL && plcf->upstream.pass_request_body
         && (!r->headers_in.chunked
-            || plcf->http_version == NGX_HTTP_VERSION_11))
+            || plcf->http_version >= NGX_HTTP_VERSION_11))
     {
         r->request_body_no_buffering = 1;
     }
@@ -1343,6 +1475,12 @@ ngx_http_proxy_create_request(ngx_http_request_t *r)
         ctx->internal_body_length = r->headers_in.content_length_n;
     }
 
+#if (NGX_HTTP_V2)
+    if (ctx->http2) {
+        return ngx_http_proxy_v2_create_request(r, &method, headers);
+    }
+#endif
+
     le.ip = headers->lengths->elts;
     le.request = r;
     le.flushed = 1;
@@ -1442,7 +1580,7 @@ ngx_http_proxy_create_request(ngx_http_request_t *r)
 
     u->uri.len = b->last - u->uri.data;
 
-    if (plcf->http_version == NGX_HTTP_VERSION_11) {
+    if (plcf->http_version >= NGX_HTTP_VERSION_11) {
         b->last = ngx_cpymem(b->last, ngx_http_proxy_version_11,
                              sizeof(ngx_http_proxy_version_11) - 1);
 
@@ -1614,6 +1752,30 @@ ngx_http_proxy_reinit_request(ngx_http_request_t *r)
         return NGX_OK;
     }
 
+#if (NGX_HTTP_V2)
+
+    if (ctx->http2) {
+        ctx->v2.connection = NULL;
+        ctx->v2.id = 0;
+        ctx->v2.in = NULL;
+        ctx->v2.out = NULL;
+        ctx->v2.busy = NULL;
+        ctx->v2.state = 0;
+        ctx->v2.received = 0;
+        ctx->v2.header_sent = 0;
+        ctx->v2.output_closed = 0;
+        ctx->v2.output_blocked = 0;
+        ctx->v2.parsing_headers = 0;
+        ctx->v2.end_stream = 0;
+        ctx->v2.done = 0;
+
+        r->upstream->process_header = ngx_http_proxy_v2_process_header;
+
+        return NGX_OK;
+    }
+
+#endif
+
     ctx->status.code = 0;
     ctx->status.count = 0;
     ctx->status.start = NULL;
@@ -2509,173 +2671,2186 @@ ngx_http_proxy_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
 }
 
 
+#if (NGX_HTTP_V2)
+
 static ngx_int_t
-ngx_http_proxy_host_variable(ngx_http_request_t *r,
-    ngx_http_variable_value_t *v, uintptr_t data)
+ngx_http_proxy_v2_init_peer(ngx_http_request_t *r)
 {
-    ngx_http_proxy_ctx_t  *ctx;
+    ngx_http_proxy_ctx_t       *ctx;
+    ngx_http_proxy_loc_conf_t  *plcf;
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_proxy_module);
 
-    if (ctx == NULL) {
-        v->not_found = 1;
-        return NGX_OK;
-    }
-
-    v->len = ctx->vars.host_header.len;
-    v->valid = 1;
-    v->no_cacheable = 0;
-    v->not_found = 0;
-    v->data = ctx->vars.host_header.data;
-
-    return NGX_OK;
+    return ngx_http_upstream_mux_init_peer(r, &plcf->mux, &ctx->v2.stream);
 }
 
 
 static ngx_int_t
-ngx_http_proxy_port_variable(ngx_http_request_t *r,
-    ngx_http_variable_value_t *v, uintptr_t data)
+ngx_http_proxy_v2_create_request(ngx_http_request_t *r, ngx_str_t *method,
+    ngx_http_proxy_headers_t *headers)
 {
-    ngx_http_proxy_ctx_t  *ctx;
+    u_char                       *p, *tmp, *key_tmp, *val_tmp, *headers_frame;
+    size_t                        len, tmp_len, key_len, val_len, uri_len,
+                                  loc_len;
+    uintptr_t                     escape;
+    ngx_buf_t                    *b;
+    ngx_uint_t                    i, next, unparsed_uri;
+    ngx_chain_t                  *cl, *body;
+    ngx_list_part_t              *part;
+    ngx_table_elt_t              *header;
+    ngx_http_upstream_t          *u;
+    ngx_http_proxy_ctx_t         *ctx;
+    ngx_http_script_code_pt       code;
+    ngx_http_script_engine_t      e, le;
+    ngx_http_proxy_loc_conf_t    *plcf;
+    ngx_http_script_len_code_pt   lcode;
+
+    u = r->upstream;
 
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_proxy_module);
     ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
 
-    if (ctx == NULL) {
-        v->not_found = 1;
-        return NGX_OK;
+    len = NGX_HTTP_V2_FRAME_HEADER_SIZE;               /* headers frame */
+
+    /* :method header */
+
+    if ((method->len == 3 && ngx_strncmp(method->data, "GET", 3) == 0)
+        || (method->len == 4 && ngx_strncmp(method->data, "POST", 4) == 0))
+    {
+        len += 1;
+        tmp_len = 0;
+
+    } else {
+        len += 1 + NGX_HTTP_V2_INT_OCTETS + method->len;
+        tmp_len = method->len;
     }
 
-    v->len = ctx->vars.port.len;
-    v->valid = 1;
-    v->no_cacheable = 0;
-    v->not_found = 0;
-    v->data = ctx->vars.port.data;
+    /* :scheme header */
 
-    return NGX_OK;
-}
+    len += 1;
 
+    /* :path header */
 
-static ngx_int_t
-ngx_http_proxy_add_x_forwarded_for_variable(ngx_http_request_t *r,
-    ngx_http_variable_value_t *v, uintptr_t data)
-{
-    size_t             len;
-    u_char            *p;
-    ngx_uint_t         i, n;
-    ngx_table_elt_t  **h;
+    escape = 0;
+    loc_len = 0;
+    unparsed_uri = 0;
 
-    v->valid = 1;
-    v->no_cacheable = 0;
-    v->not_found = 0;
+    if (plcf->proxy_lengths && ctx->vars.uri.len) {
+        uri_len = ctx->vars.uri.len;
 
-    n = r->headers_in.x_forwarded_for.nelts;
-    h = r->headers_in.x_forwarded_for.elts;
+    } else if (ctx->vars.uri.len == 0 && r->valid_unparsed_uri) {
+        unparsed_uri = 1;
+        uri_len = r->unparsed_uri.len;
 
-    len = 0;
+    } else {
+        loc_len = (r->valid_location && ctx->vars.uri.len) ?
+                      plcf->location.len : 0;
 
-    for (i = 0; i < n; i++) {
-        len += h[i]->value.len + sizeof(", ") - 1;
-    }
+        if (r->quoted_uri || r->internal) {
+            escape = 2 * ngx_escape_uri(NULL, r->uri.data + loc_len,
+                                        r->uri.len - loc_len, NGX_ESCAPE_URI);
+        }
 
-    if (len == 0) {
-        v->len = r->connection->addr_text.len;
-        v->data = r->connection->addr_text.data;
-        return NGX_OK;
+        uri_len = ctx->vars.uri.len + r->uri.len - loc_len + escape
+                  + sizeof("?") - 1 + r->args.len;
     }
 
-    len += r->connection->addr_text.len;
-
-    p = ngx_pnalloc(r->pool, len);
-    if (p == NULL) {
+    if (uri_len == 0) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "zero length URI to proxy");
         return NGX_ERROR;
     }
 
-    v->len = len;
-    v->data = p;
+    len += 1 + NGX_HTTP_V2_INT_OCTETS + uri_len;
 
-    for (i = 0; i < n; i++) {
-        p = ngx_copy(p, h[i]->value.data, h[i]->value.len);
-        *p++ = ','; *p++ = ' ';
+    if (tmp_len < uri_len) {
+        tmp_len = uri_len;
     }
 
-    ngx_memcpy(p, r->connection->addr_text.data, r->connection->addr_text.len);
+    /* other headers */
 
-    return NGX_OK;
-}
+    le.ip = headers->lengths->elts;
+    le.request = r;
+    le.flushed = 1;
 
+    while (*(uintptr_t *) le.ip) {
 
-static ngx_int_t
-ngx_http_proxy_internal_body_length_variable(ngx_http_request_t *r,
-    ngx_http_variable_value_t *v, uintptr_t data)
-{
-    ngx_http_proxy_ctx_t  *ctx;
+        lcode = *(ngx_http_script_len_code_pt *) le.ip;
+        key_len = lcode(&le);
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+        for (val_len = 0; *(uintptr_t *) le.ip; val_len += lcode(&le)) {
+            lcode = *(ngx_http_script_len_code_pt *) le.ip;
+        }
+        le.ip += sizeof(uintptr_t);
 
-    if (ctx == NULL || ctx->internal_body_length < 0) {
-        v->not_found = 1;
-        return NGX_OK;
-    }
+        if (val_len == 0) {
+            continue;
+        }
 
-    v->valid = 1;
-    v->no_cacheable = 0;
-    v->not_found = 0;
+        len += 1 + NGX_HTTP_V2_INT_OCTETS + key_len
+                 + NGX_HTTP_V2_INT_OCTETS + val_len;
 
-    v->data = ngx_pnalloc(r->pool, NGX_OFF_T_LEN);
+        if (tmp_len < key_len) {
+            tmp_len = key_len;
+        }
 
-    if (v->data == NULL) {
-        return NGX_ERROR;
+        if (tmp_len < val_len) {
+            tmp_len = val_len;
+        }
     }
 
-    v->len = ngx_sprintf(v->data, "%O", ctx->internal_body_length) - v->data;
-
-    return NGX_OK;
-}
+    if (plcf->upstream.pass_request_headers) {
+        part = &r->headers_in.headers.part;
+        header = part->elts;
 
+        for (i = 0; /* void */; i++) {
 
-static ngx_int_t
-ngx_http_proxy_internal_chunked_variable(ngx_http_request_t *r,
-    ngx_http_variable_value_t *v, uintptr_t data)
-{
-    ngx_http_proxy_ctx_t  *ctx;
+            if (i >= part->nelts) {
+                if (part->next == NULL) {
+                    break;
+                }
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+                part = part->next;
+                header = part->elts;
+                i = 0;
+            }
 
-    if (ctx == NULL || !ctx->internal_chunked) {
-        v->not_found = 1;
-        return NGX_OK;
-    }
+            if (ngx_hash_find(&headers->hash, header[i].hash,
+                              header[i].lowcase_key, header[i].key.len))
+            {
+                continue;
+            }
 
-    v->valid = 1;
-    v->no_cacheable = 0;
-    v->not_found = 0;
+            len += 1 + NGX_HTTP_V2_INT_OCTETS + header[i].key.len
+                     + NGX_HTTP_V2_INT_OCTETS + header[i].value.len;
 
-    v->data = (u_char *) "chunked";
-    v->len = sizeof("chunked") - 1;
+            if (tmp_len < header[i].key.len) {
+                tmp_len = header[i].key.len;
+            }
 
-    return NGX_OK;
-}
+            if (tmp_len < header[i].value.len) {
+                tmp_len = header[i].value.len;
+            }
+        }
+    }
 
+    /* continuation frames */
 
-static ngx_int_t
-ngx_http_proxy_rewrite_redirect(ngx_http_request_t *r, ngx_table_elt_t *h,
-    size_t prefix)
-{
-    size_t                      len;
-    ngx_int_t                   rc;
-    ngx_uint_t                  i;
-    ngx_http_proxy_rewrite_t   *pr;
-    ngx_http_proxy_loc_conf_t  *plcf;
+    len += NGX_HTTP_V2_FRAME_HEADER_SIZE
+           * (len / NGX_HTTP_V2_DEFAULT_FRAME_SIZE);
 
-    plcf = ngx_http_get_module_loc_conf(r, ngx_http_proxy_module);
 
-    pr = plcf->redirects->elts;
+    b = ngx_create_temp_buf(r->pool, len);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
 
-    if (pr == NULL) {
-        return NGX_DECLINED;
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NGX_ERROR;
     }
 
-    len = h->value.len - prefix;
+    cl->buf = b;
+    cl->next = NULL;
+
+    tmp = ngx_palloc(r->pool, tmp_len * 3);
+    if (tmp == NULL) {
+        return NGX_ERROR;
+    }
+
+    key_tmp = tmp + tmp_len;
+    val_tmp = tmp + 2 * tmp_len;
+
+    /*
+     * the stream identifier is not known until the stream is opened
+     * by the output filter, which updates it in all frames
+     */
+
+    headers_frame = b->last;
+
+    b->last = ngx_http_proxy_v2_frame_head(b->last, 0,
+                                           NGX_HTTP_V2_HEADERS_FRAME, 0, 0);
+
+    if (method->len == 3 && ngx_strncmp(method->data, "GET", 3) == 0) {
+        *b->last++ = ngx_http_v2_indexed(NGX_HTTP_V2_METHOD_GET_INDEX);
+
+    } else if (method->len == 4 && ngx_strncmp(method->data, "POST", 4) == 0)
+    {
+        *b->last++ = ngx_http_v2_indexed(NGX_HTTP_V2_METHOD_POST_INDEX);
+
+    } else {
+        *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_METHOD_INDEX);
+        b->last = ngx_http_v2_write_value(b->last, method->data, method->len,
+                                          tmp);
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http proxy header: \":method: %V\"", method);
+
+    *b->last++ = ngx_http_v2_indexed(NGX_HTTP_V2_SCHEME_HTTP_INDEX);
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http proxy header: \":scheme: http\"");
+
+    u->uri.data = ngx_pnalloc(r->pool, uri_len);
+    if (u->uri.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = u->uri.data;
+
+    if (plcf->proxy_lengths && ctx->vars.uri.len) {
+        p = ngx_copy(p, ctx->vars.uri.data, ctx->vars.uri.len);
+
+    } else if (unparsed_uri) {
+        p = ngx_copy(p, r->unparsed_uri.data, r->unparsed_uri.len);
+
+    } else {
+        if (r->valid_location) {
+            p = ngx_copy(p, ctx->vars.uri.data, ctx->vars.uri.len);
+        }
+
+        if (escape) {
+            ngx_escape_uri(p, r->uri.data + loc_len,
+                           r->uri.len - loc_len, NGX_ESCAPE_URI);
+            p += r->uri.len - loc_len + escape;
+
+        } else {
+            p = ngx_copy(p, r->uri.data + loc_len, r->uri.len - loc_len);
+        }
+
+        if (r->args.len > 0) {
+            *p++ = '?';
+            p = ngx_copy(p, r->args.data, r->args.len);
+        }
+    }
+
+    u->uri.len = p - u->uri.data;
+
+    if (u->uri.len == 1 && u->uri.data[0] == '/') {
+        *b->last++ = ngx_http_v2_indexed(NGX_HTTP_V2_PATH_ROOT_INDEX);
+
+    } else {
+        *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_PATH_INDEX);
+        b->last = ngx_http_v2_write_value(b->last, u->uri.data, u->uri.len,
+                                          tmp);
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http proxy header: \":path: %V\"", &u->uri);
+
+    ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
+
+    e.ip = headers->values->elts;
+    e.request = r;
+    e.flushed = 1;
+
+    le.ip = headers->lengths->elts;
+
+    while (*(uintptr_t *) le.ip) {
+
+        lcode = *(ngx_http_script_len_code_pt *) le.ip;
+        key_len = lcode(&le);
+
+        for (val_len = 0; *(uintptr_t *) le.ip; val_len += lcode(&le)) {
+            lcode = *(ngx_http_script_len_code_pt *) le.ip;
+        }
+        le.ip += sizeof(uintptr_t);
+
+        e.pos = key_tmp;
+
+        code = *(ngx_http_script_code_pt *) e.ip;
+        code((ngx_http_script_engine_t *) &e);
+
+        if (val_len == 0
+            || ngx_http_proxy_v2_connection_header(key_tmp, key_len))
+        {
+            e.skip = 1;
+
+            while (*(uintptr_t *) e.ip) {
+                code = *(ngx_http_script_code_pt *) e.ip;
+                code((ngx_http_script_engine_t *) &e);
+            }
+            e.ip += sizeof(uintptr_t);
+
+            e.skip = 0;
+
+            continue;
+        }
+
+        e.pos = val_tmp;
+
+        while (*(uintptr_t *) e.ip) {
+            code = *(ngx_http_script_code_pt *) e.ip;
+            code((ngx_http_script_engine_t *) &e);
+        }
+        e.ip += sizeof(uintptr_t);
+
+        /* the "Host" header is sent as the ":authority" pseudo-header */
+
+        if (key_len == 4 && ngx_strncasecmp(key_tmp, (u_char *) "host", 4)
+                            == 0)
+        {
+            *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_AUTHORITY_INDEX);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http proxy header: \":authority: %*s\"",
+                           val_len, val_tmp);
+
+        } else {
+            *b->last++ = 0;
+            b->last = ngx_http_v2_write_name(b->last, key_tmp, key_len, tmp);
+
+            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http proxy header: \"%*s: %*s\"",
+                           key_len, key_tmp, val_len, val_tmp);
+        }
+
+        b->last = ngx_http_v2_write_value(b->last, val_tmp, val_len, tmp);
+    }
+
+    if (plcf->upstream.pass_request_headers) {
+        part = &r->headers_in.headers.part;
+        header = part->elts;
+
+        for (i = 0; /* void */; i++) {
+
+            if (i >= part->nelts) {
+                if (part->next == NULL) {
+                    break;
+                }
+
+                part = part->next;
+                header = part->elts;
+                i = 0;
+            }
+
+            if (ngx_hash_find(&headers->hash, header[i].hash,
+                              header[i].lowcase_key, header[i].key.len))
+            {
+                continue;
+            }
+
+            if (ngx_http_proxy_v2_connection_header(header[i].key.data,
+                                                    header[i].key.len))
+            {
+                continue;
+            }
+
+            *b->last++ = 0;
+
+            b->last = ngx_http_v2_write_name(b->last, header[i].key.data,
+                                             header[i].key.len, tmp);
+
+            b->last = ngx_http_v2_write_value(b->last, header[i].value.data,
+                                              header[i].value.len, tmp);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http proxy header: \"%V: %V\"",
+                           &header[i].key, &header[i].value);
+        }
+    }
+
+    /* update headers frame length, create continuation frames */
+
+    p = headers_frame;
+    len = b->last - p - NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+    for ( ;; ) {
+
+        if (len > NGX_HTTP_V2_DEFAULT_FRAME_SIZE) {
+            len = NGX_HTTP_V2_DEFAULT_FRAME_SIZE;
+            next = 1;
+
+        } else {
+            next = 0;
+        }
+
+        p[0] = (u_char) ((len >> 16) & 0xff);
+        p[1] = (u_char) ((len >> 8) & 0xff);
+        p[2] = (u_char) (len & 0xff);
+
+        if (!next) {
+            break;
+        }
+
+        p += NGX_HTTP_V2_FRAME_HEADER_SIZE + NGX_HTTP_V2_DEFAULT_FRAME_SIZE;
+        len = b->last - p;
+
+        ngx_memmove(p + NGX_HTTP_V2_FRAME_HEADER_SIZE, p, len);
+        b->last += NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+        (void) ngx_http_proxy_v2_frame_head(p, len,
+                                            NGX_HTTP_V2_CONTINUATION_FRAME,
+                                            0, 0);
+    }
+
+    p[4] |= NGX_HTTP_V2_END_HEADERS_FLAG;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http proxy header: %*xs%s, len: %uz",
+                   (size_t) ngx_min(b->last - b->pos, 256), b->pos,
+                   b->last - b->pos > 256 ? "..." : "",
+                   b->last - b->pos);
+
+    if (r->request_body_no_buffering) {
+
+        u->request_bufs = cl;
+
+    } else {
+
+        if (plcf->body_values == NULL && plcf->upstream.pass_request_body) {
+            body = u->request_bufs;
+
+        } else {
+            body = NULL;
+        }
+
+        u->request_bufs = cl;
+
+        if (plcf->body_values && ctx->internal_body_length) {
+            b = ngx_create_temp_buf(r->pool,
+                                    (size_t) ctx->internal_body_length);
+            if (b == NULL) {
+                return NGX_ERROR;
+            }
+
+            e.ip = plcf->body_values->elts;
+            e.pos = b->last;
+            e.skip = 0;
+
+            while (*(uintptr_t *) e.ip) {
+                code = *(ngx_http_script_code_pt *) e.ip;
+                code((ngx_http_script_engine_t *) &e);
+            }
+
+            b->last = e.pos;
+
+            cl->next = ngx_alloc_chain_link(r->pool);
+            if (cl->next == NULL) {
+                return NGX_ERROR;
+            }
+
+            cl = cl->next;
+            cl->buf = b;
+        }
+
+        while (body) {
+            b = ngx_alloc_buf(r->pool);
+            if (b == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_memcpy(b, body->buf, sizeof(ngx_buf_t));
+
+            cl->next = ngx_alloc_chain_link(r->pool);
+            if (cl->next == NULL) {
+                return NGX_ERROR;
+            }
+
+            cl = cl->next;
+            cl->buf = b;
+
+            body = body->next;
+        }
+
+        if (cl == u->request_bufs) {
+            headers_frame[4] |= NGX_HTTP_V2_END_STREAM_FLAG;
+        }
+
+        b->last_buf = 1;
+    }
+
+    u->output.output_filter = ngx_http_proxy_v2_body_output_filter;
+    u->output.filter_ctx = r;
+
+    b->flush = 1;
+    cl->next = NULL;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_body_output_filter(void *data, ngx_chain_t *in)
+{
+    ngx_http_request_t  *r = data;
+
+    off_t                     file_pos;
+    u_char                   *p, *f, *pos, *start;
+    size_t                    len, limit;
+    ngx_buf_t                *b;
+    ngx_int_t                 rc;
+    ngx_uint_t                next, last;
+    ngx_chain_t              *cl, *out, **ll;
+    ngx_http_proxy_ctx_t     *ctx;
+    ngx_http_proxy_v2_ctx_t  *v2;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http proxy output filter");
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    v2 = &ctx->v2;
+
+    if (in) {
+        if (ngx_chain_add_copy(r->pool, &v2->in, in) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    out = NULL;
+    ll = &out;
+
+    if (!v2->header_sent) {
+
+        if (v2->in == NULL) {
+            return NGX_OK;
+        }
+
+        /* first buffer contains headers */
+
+        v2->header_sent = 1;
+
+        v2->connection = &v2->stream->mux->conn;
+        v2->send_window = v2->connection->init_window;
+        v2->recv_window = v2->connection->recv_init_window;
+
+        v2->id = ngx_http_upstream_mux_open(v2->stream, &v2->send_window,
+                                            &v2->in);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http proxy output header, stream %ui", v2->id);
+
+        b = v2->in->buf;
+
+        for (p = b->pos; p < b->last; /* void */) {
+            (void) ngx_http_v2_write_sid(p + 5, v2->id);
+            p += NGX_HTTP_V2_FRAME_HEADER_SIZE + ((p[0] << 16) | (p[1] << 8)
+                                                  | p[2]);
+        }
+
+        if (b->last_buf) {
+            v2->output_closed = 1;
+        }
+
+        *ll = v2->in;
+        ll = &v2->in->next;
+
+        v2->in = v2->in->next;
+    }
+
+    if (v2->out) {
+        /* queued window updates */
+
+        *ll = v2->out;
+
+        for (cl = v2->out, ll = &cl->next; cl; cl = cl->next) {
+            ll = &cl->next;
+        }
+
+        v2->out = NULL;
+    }
+
+    f = NULL;
+    last = 0;
+
+    limit = ngx_max(0, v2->send_window);
+
+    if (limit > v2->connection->send_window) {
+        limit = v2->connection->send_window;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http proxy output limit: %uz w:%z:%uz",
+                   limit, v2->send_window, v2->connection->send_window);
+
+#if (NGX_SUPPRESS_WARN)
+    file_pos = 0;
+    pos = NULL;
+    cl = NULL;
+#endif
+
+    in = v2->in;
+
+    while (in && limit > 0) {
+
+        if (ngx_buf_special(in->buf)) {
+            goto next;
+        }
+
+        if (in->buf->in_file) {
+            file_pos = in->buf->file_pos;
+
+        } else {
+            pos = in->buf->pos;
+        }
+
+        next = 0;
+
+        do {
+
+            cl = ngx_http_proxy_v2_get_buf(r, ctx);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            f = cl->buf->last;
+            cl->buf->last += NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+            *ll = cl;
+            ll = &cl->next;
+
+            cl = ngx_chain_get_free_buf(r->pool, &v2->free);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            b = cl->buf;
+            start = b->start;
+
+            ngx_memcpy(b, in->buf, sizeof(ngx_buf_t));
+
+            /*
+             * restore b->start to preserve memory allocated in the buffer,
+             * to reuse it later for frame headers
+             */
+
+            b->start = start;
+
+            if (in->buf->in_file) {
+                b->file_pos = file_pos;
+                file_pos += ngx_min(NGX_HTTP_V2_DEFAULT_FRAME_SIZE, limit);
+
+                if (file_pos >= in->buf->file_last) {
+                    file_pos = in->buf->file_last;
+                    next = 1;
+                }
+
+                b->file_last = file_pos;
+                len = (size_t) (file_pos - b->file_pos);
+
+            } else {
+                b->pos = pos;
+                pos += ngx_min(NGX_HTTP_V2_DEFAULT_FRAME_SIZE, limit);
+
+                if (pos >= in->buf->last) {
+                    pos = in->buf->last;
+                    next = 1;
+                }
+
+                b->last = pos;
+                len = (size_t) (pos - b->pos);
+            }
+
+            b->tag = (ngx_buf_tag_t) &ngx_http_proxy_v2_body_output_filter;
+            b->shadow = in->buf;
+            b->last_shadow = next;
+
+            b->last_buf = 0;
+            b->last_in_chain = 0;
+
+            *ll = cl;
+            ll = &cl->next;
+
+            (void) ngx_http_proxy_v2_frame_head(f, len,
+                                                NGX_HTTP_V2_DATA_FRAME, 0,
+                                                v2->id);
+
+            limit -= len;
+            v2->send_window -= len;
+            v2->connection->send_window -= len;
+
+        } while (!next && limit > 0);
+
+        if (!next) {
+            /*
+             * if the buffer wasn't fully sent due to flow control limits,
+             * preserve position for future use
+             */
+
+            if (in->buf->in_file) {
+                in->buf->file_pos = file_pos;
+
+            } else {
+                in->buf->pos = pos;
+            }
+
+            break;
+        }
+
+    next:
+
+        if (in->buf->last_buf) {
+            last = 1;
+        }
+
+        in = in->next;
+    }
+
+    v2->in = in;
+
+    if (last) {
+
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http proxy output last");
+
+        v2->output_closed = 1;
+
+        if (f) {
+            f[4] |= NGX_HTTP_V2_END_STREAM_FLAG;
+
+        } else {
+            cl = ngx_http_proxy_v2_get_buf(r, ctx);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            cl->buf->last = ngx_http_proxy_v2_frame_head(cl->buf->last, 0,
+                                                NGX_HTTP_V2_DATA_FRAME,
+                                                NGX_HTTP_V2_END_STREAM_FLAG,
+                                                v2->id);
+
+            *ll = cl;
+            ll = &cl->next;
+        }
+
+        cl->buf->last_buf = 1;
+    }
+
+    *ll = NULL;
+
+    rc = ngx_chain_writer(&r->upstream->writer, out);
+
+    ngx_chain_update_chains(r->pool, &v2->free, &v2->busy, &out,
+                            (ngx_buf_tag_t) &ngx_http_proxy_v2_body_output_filter);
+
+    for (cl = v2->free; cl; cl = cl->next) {
+
+        /* mark original buffers as sent */
+
+        if (cl->buf->shadow) {
+            if (cl->buf->last_shadow) {
+                b = cl->buf->shadow;
+                b->pos = b->last;
+            }
+
+            cl->buf->shadow = NULL;
+        }
+    }
+
+    if (rc == NGX_OK && v2->in) {
+        rc = NGX_AGAIN;
+    }
+
+    if (rc == NGX_AGAIN) {
+        v2->output_blocked = 1;
+
+    } else {
+        v2->output_blocked = 0;
+    }
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_process_header(ngx_http_request_t *r)
+{
+    u_char                         *p, *last;
+    ngx_int_t                       rc, status;
+    ngx_str_t                       name, value;
+    ngx_buf_t                      *b;
+    ngx_table_elt_t                *h;
+    ngx_http_upstream_t            *u;
+    ngx_http_proxy_ctx_t           *ctx;
+    ngx_http_upstream_header_t     *hh;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    u = r->upstream;
+    b = &u->buffer;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    for ( ;; ) {
+
+        rc = ngx_http_proxy_v2_parse(r, ctx, b, &value);
+
+        if (rc == NGX_AGAIN) {
+
+            /*
+             * there can be a lot of window update frames, so the buffer
+             * is reset if it is empty and no frame is partially parsed
+             */
+
+            if (!ctx->v2.parsing_headers
+                && ctx->v2.state == 0
+                && ctx->v2.received == 0)
+            {
+                b->pos = b->start;
+
+#if (NGX_HTTP_CACHE)
+                if (r->cache) {
+                    b->pos += r->cache->header_start;
+                }
+#endif
+
+                b->last = b->pos;
+            }
+
+            return NGX_AGAIN;
+        }
+
+        if (rc == NGX_ERROR) {
+            return NGX_HTTP_UPSTREAM_INVALID_HEADER;
+        }
+
+        /* a whole header block has been received */
+
+        status = 0;
+
+        p = ctx->v2.header->pos;
+        last = ctx->v2.header->last;
+
+        for ( ;; ) {
+
+            rc = ngx_http_proxy_v2_parse_field(r, &p, last, &name, &value);
+
+            if (rc == NGX_DONE) {
+                break;
+            }
+
+            if (rc == NGX_ERROR) {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream sent invalid header");
+                return NGX_HTTP_UPSTREAM_INVALID_HEADER;
+            }
+
+            if (name.len && name.data[0] == ':') {
+
+                if (status
+                    || name.len != sizeof(":status") - 1
+                    || ngx_strncmp(name.data, ":status", name.len) != 0)
+                {
+                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                                  "upstream sent invalid header \"%V: %V\"",
+                                  &name, &value);
+                    return NGX_HTTP_UPSTREAM_INVALID_HEADER;
+                }
+
+                if (value.len != 3) {
+                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                                  "upstream sent invalid :status \"%V\"",
+                                  &value);
+                    return NGX_HTTP_UPSTREAM_INVALID_HEADER;
+                }
+
+                status = ngx_atoi(value.data, 3);
+
+                if (status < NGX_HTTP_CONTINUE
+                    || status == NGX_HTTP_SWITCHING_PROTOCOLS)
+                {
+                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                                  "upstream sent invalid :status \"%V\"",
+                                  &value);
+                    return NGX_HTTP_UPSTREAM_INVALID_HEADER;
+                }
+
+                continue;
+            }
+
+            if (status == 0) {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream sent no :status header");
+                return NGX_HTTP_UPSTREAM_INVALID_HEADER;
+            }
+
+            if (status < NGX_HTTP_OK) {
+                /* headers of informational responses are ignored */
+                continue;
+            }
+
+            if (ngx_http_proxy_v2_connection_header(name.data, name.len)) {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream sent connection-specific header "
+                              "\"%V: %V\"", &name, &value);
+                return NGX_HTTP_UPSTREAM_INVALID_HEADER;
+            }
+
+            h = ngx_list_push(&u->headers_in.headers);
+            if (h == NULL) {
+                return NGX_ERROR;
+            }
+
+            h->key = name;
+            h->value = value;
+            h->lowcase_key = name.data;
+            h->hash = ngx_hash_key(name.data, name.len);
+
+            hh = ngx_hash_find(&umcf->headers_in_hash, h->hash,
+                               h->lowcase_key, h->key.len);
+
+            if (hh && hh->handler(r, h, hh->offset) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http proxy header: \"%V: %V\"",
+                           &h->key, &h->value);
+        }
+
+        if (status == 0) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "upstream sent no :status header");
+            return NGX_HTTP_UPSTREAM_INVALID_HEADER;
+        }
+
+        if (status < NGX_HTTP_OK) {
+
+            if (ctx->v2.done) {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream sent informational response "
+                              "with end stream flag");
+                return NGX_HTTP_UPSTREAM_INVALID_HEADER;
+            }
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http proxy informational response: %i", status);
+
+            continue;
+        }
+
+        break;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http proxy header done, status: %i", status);
+
+    u->headers_in.status_n = status;
+
+    if (u->state && u->state->status == 0) {
+        u->state->status = status;
+    }
+
+    /*
+     * if no "Server" and "Date" in header line,
+     * then add the special empty headers
+     */
+
+    if (u->headers_in.server == NULL) {
+        h = ngx_list_push(&u->headers_in.headers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        h->hash = ngx_hash(ngx_hash(ngx_hash(ngx_hash(
+                            ngx_hash('s', 'e'), 'r'), 'v'), 'e'), 'r');
+
+        ngx_str_set(&h->key, "Server");
+        ngx_str_null(&h->value);
+        h->lowcase_key = (u_char *) "server";
+    }
+
+    if (u->headers_in.date == NULL) {
+        h = ngx_list_push(&u->headers_in.headers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        h->hash = ngx_hash(ngx_hash(ngx_hash('d', 'a'), 't'), 'e');
+
+        ngx_str_set(&h->key, "Date");
+        ngx_str_null(&h->value);
+        h->lowcase_key = (u_char *) "date";
+    }
+
+    if (ctx->v2.done) {
+
+        /* the response has no body */
+
+        if (u->headers_in.content_length_n == -1
+            && status != NGX_HTTP_NO_CONTENT
+            && status != NGX_HTTP_NOT_MODIFIED
+            && !ctx->head)
+        {
+            u->headers_in.content_length_n = 0;
+        }
+
+        /*
+         * set u->keepalive to close the stream without resetting it
+         * in case of r->header_only or X-Accel-Redirect
+         */
+
+        if (ctx->v2.in == NULL
+            && ctx->v2.output_closed
+            && !ctx->v2.output_blocked)
+        {
+            u->keepalive = 1;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_filter_init(void *data)
+{
+    ngx_http_request_t  *r = data;
+
+    ngx_http_upstream_t   *u;
+    ngx_http_proxy_ctx_t  *ctx;
+
+    u = r->upstream;
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (u->headers_in.status_n == NGX_HTTP_NO_CONTENT
+        || u->headers_in.status_n == NGX_HTTP_NOT_MODIFIED
+        || ctx->head)
+    {
+        ctx->v2.length = 0;
+
+    } else {
+        ctx->v2.length = u->headers_in.content_length_n;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http proxy filter init l:%O d:%ui",
+                   ctx->v2.length, (ngx_uint_t) ctx->v2.done);
+
+    if (ctx->v2.done) {
+
+        if (ctx->v2.length > 0) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "upstream prematurely closed stream");
+            return NGX_ERROR;
+        }
+
+        u->pipe->length = 0;
+        u->length = 0;
+
+    } else {
+
+        /* the end of the response is known from the end stream flag */
+
+        u->pipe->length = 1;
+        u->length = 1;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_filter(ngx_event_pipe_t *p, ngx_buf_t *buf)
+{
+    ngx_int_t              rc;
+    ngx_str_t              data;
+    ngx_buf_t             *b, **prev;
+    ngx_chain_t           *cl;
+    ngx_http_request_t    *r;
+    ngx_http_upstream_t   *u;
+    ngx_http_proxy_ctx_t  *ctx;
+
+    if (buf->pos == buf->last) {
+        return NGX_OK;
+    }
+
+    r = p->input_ctx;
+    u = r->upstream;
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (p->upstream_done || p->length == 0) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, p->log, 0,
+                       "http proxy data after close");
+        return NGX_OK;
+    }
+
+    b = NULL;
+    prev = &buf->shadow;
+
+    for ( ;; ) {
+
+        rc = ngx_http_proxy_v2_parse(r, ctx, buf, &data);
+
+        if (rc == NGX_OK) {
+
+            if (ctx->v2.length != -1) {
+
+                if ((off_t) data.len > ctx->v2.length) {
+                    ngx_log_error(NGX_LOG_ERR, p->log, 0,
+                                  "upstream sent response body larger "
+                                  "than indicated content length");
+                    return NGX_ERROR;
+                }
+
+                ctx->v2.length -= data.len;
+            }
+
+            cl = ngx_chain_get_free_buf(p->pool, &p->free);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            b = cl->buf;
+
+            ngx_memzero(b, sizeof(ngx_buf_t));
+
+            b->pos = data.data;
+            b->last = data.data + data.len;
+            b->start = buf->start;
+            b->end = buf->end;
+            b->tag = p->tag;
+            b->temporary = 1;
+            b->recycled = 1;
+
+            *prev = b;
+            prev = &b->shadow;
+
+            if (p->in) {
+                *p->last_in = cl;
+            } else {
+                p->in = cl;
+            }
+            p->last_in = &cl->next;
+
+            /* STUB */ b->num = buf->num;
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                           "input buf #%d %p", b->num, b->pos);
+
+            continue;
+        }
+
+        if (rc == NGX_DONE) {
+
+            /* a whole response has been parsed successfully */
+
+            if (ctx->v2.length > 0) {
+                ngx_log_error(NGX_LOG_ERR, p->log, 0,
+                              "upstream prematurely closed stream");
+                return NGX_ERROR;
+            }
+
+            p->length = 0;
+
+            if (ctx->v2.in == NULL
+                && ctx->v2.output_closed
+                && !ctx->v2.output_blocked)
+            {
+                u->keepalive = 1;
+            }
+
+            break;
+        }
+
+        if (rc == NGX_AGAIN) {
+            break;
+        }
+
+        if (rc == NGX_HTTP_PARSE_HEADER_DONE) {
+            ngx_log_error(NGX_LOG_ERR, p->log, 0,
+                          "upstream sent trailer without end stream flag");
+        }
+
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, p->log, 0,
+                   "http proxy v2 state %ui, length %O",
+                   ctx->v2.state, p->length);
+
+    if (b) {
+        b->shadow = buf;
+        b->last_shadow = 1;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                       "input buf %p %z", b->pos, b->last - b->pos);
+
+        return NGX_OK;
+    }
+
+    /* there is no data record in the buf, add it to free chain */
+
+    if (ngx_event_pipe_add_free_buf(p, buf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_non_buffered_filter(void *data, ssize_t bytes)
+{
+    ngx_http_request_t   *r = data;
+
+    ngx_int_t              rc;
+    ngx_str_t              part;
+    ngx_buf_t             *b, *buf;
+    ngx_chain_t           *cl, **ll;
+    ngx_http_upstream_t   *u;
+    ngx_http_proxy_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    u = r->upstream;
+    buf = &u->buffer;
+
+    buf->pos = buf->last;
+    buf->last += bytes;
+
+    for (cl = u->out_bufs, ll = &u->out_bufs; cl; cl = cl->next) {
+        ll = &cl->next;
+    }
+
+    for ( ;; ) {
+
+        rc = ngx_http_proxy_v2_parse(r, ctx, buf, &part);
+
+        if (rc == NGX_OK) {
+
+            if (ctx->v2.length != -1) {
+
+                if ((off_t) part.len > ctx->v2.length) {
+                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                                  "upstream sent response body larger "
+                                  "than indicated content length");
+                    return NGX_ERROR;
+                }
+
+                ctx->v2.length -= part.len;
+            }
+
+            cl = ngx_chain_get_free_buf(r->pool, &u->free_bufs);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            *ll = cl;
+            ll = &cl->next;
+
+            b = cl->buf;
+
+            b->flush = 1;
+            b->memory = 1;
+
+            b->pos = part.data;
+            b->last = part.data + part.len;
+            b->tag = u->output.tag;
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http proxy out buf %p %z",
+                           b->pos, b->last - b->pos);
+
+            continue;
+        }
+
+        if (rc == NGX_DONE) {
+
+            /* a whole response has been parsed successfully */
+
+            if (ctx->v2.length > 0) {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream prematurely closed stream");
+                return NGX_ERROR;
+            }
+
+            u->length = 0;
+
+            if (ctx->v2.in == NULL
+                && ctx->v2.output_closed
+                && !ctx->v2.output_blocked)
+            {
+                u->keepalive = 1;
+            }
+
+            break;
+        }
+
+        if (rc == NGX_AGAIN) {
+            break;
+        }
+
+        if (rc == NGX_HTTP_PARSE_HEADER_DONE) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "upstream sent trailer without end stream flag");
+        }
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_parse(ngx_http_request_t *r, ngx_http_proxy_ctx_t *ctx,
+    ngx_buf_t *b, ngx_str_t *data)
+{
+    u_char                   *p;
+    size_t                    n, size;
+    ngx_uint_t                value;
+    ngx_http_upstream_t      *u;
+    ngx_http_proxy_v2_ctx_t  *v2;
+    enum {
+        sw_head = 0,
+        sw_pad_length,
+        sw_priority,
+        sw_payload,
+        sw_padding
+    } state;
+
+    u = r->upstream;
+    v2 = &ctx->v2;
+    state = v2->state;
+
+    for ( ;; ) {
+
+        switch (state) {
+
+        case sw_head:
+
+            n = ngx_min((size_t) (b->last - b->pos),
+                        NGX_HTTP_V2_FRAME_HEADER_SIZE - v2->received);
+
+            ngx_memcpy(v2->head + v2->received, b->pos, n);
+
+            b->pos += n;
+            v2->received += n;
+
+            if (v2->received < NGX_HTTP_V2_FRAME_HEADER_SIZE) {
+                goto again;
+            }
+
+            v2->received = 0;
+
+            p = v2->head;
+
+            v2->rest = (p[0] << 16) | (p[1] << 8) | p[2];
+            v2->type = p[3];
+            v2->flags = p[4];
+            v2->padding = 0;
+
+            ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http proxy frame: %ui, len: %uz, f:%ui",
+                           v2->type, v2->rest, v2->flags);
+
+            if (v2->rest > NGX_HTTP_V2_DEFAULT_FRAME_SIZE) {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream sent too large http2 frame: %uz",
+                              v2->rest);
+                return NGX_ERROR;
+            }
+
+            if (v2->parsing_headers
+                != (v2->type == NGX_HTTP_V2_CONTINUATION_FRAME))
+            {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream sent unexpected http2 frame: %ui",
+                              v2->type);
+                return NGX_ERROR;
+            }
+
+            switch (v2->type) {
+
+            case NGX_HTTP_V2_DATA_FRAME:
+
+                if (u->headers_in.status_n == 0) {
+                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                                  "upstream sent data frame "
+                                  "before response header");
+                    return NGX_ERROR;
+                }
+
+                if (v2->rest > v2->recv_window) {
+                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                                  "upstream violated stream flow control, "
+                                  "received %uz data frame with window %uz",
+                                  v2->rest, v2->recv_window);
+                    return NGX_ERROR;
+                }
+
+                v2->recv_window -= v2->rest;
+
+                if (v2->recv_window < v2->connection->recv_init_window / 4) {
+
+                    if (ngx_http_proxy_v2_send_window_update(r, ctx)
+                        != NGX_OK)
+                    {
+                        return NGX_ERROR;
+                    }
+
+                    ngx_post_event(u->peer.connection->write,
+                                   &ngx_posted_events);
+                }
+
+                break;
+
+            case NGX_HTTP_V2_HEADERS_FRAME:
+
+                v2->end_stream = (v2->flags & NGX_HTTP_V2_END_STREAM_FLAG)
+                                 ? 1 : 0;
+
+                if (v2->header == NULL) {
+                    v2->header = ngx_create_temp_buf(r->pool,
+                                                     u->conf->buffer_size);
+                    if (v2->header == NULL) {
+                        return NGX_ERROR;
+                    }
+                }
+
+                v2->header->pos = v2->header->start;
+                v2->header->last = v2->header->start;
+
+                break;
+
+            case NGX_HTTP_V2_RST_STREAM_FRAME:
+            case NGX_HTTP_V2_WINDOW_UPDATE_FRAME:
+
+                if (v2->rest != 4) {
+                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                                  "upstream sent http2 frame %ui "
+                                  "with invalid length: %uz",
+                                  v2->type, v2->rest);
+                    return NGX_ERROR;
+                }
+
+                break;
+
+            case NGX_HTTP_V2_PUSH_PROMISE_FRAME:
+
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream sent unexpected push promise frame");
+                return NGX_ERROR;
+            }
+
+            if ((v2->type == NGX_HTTP_V2_DATA_FRAME
+                 || v2->type == NGX_HTTP_V2_HEADERS_FRAME)
+                && (v2->flags & NGX_HTTP_V2_PADDED_FLAG))
+            {
+                state = sw_pad_length;
+                break;
+            }
+
+            state = sw_priority;
+            break;
+
+        case sw_pad_length:
+
+            if (v2->rest == 0) {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream sent http2 frame %ui "
+                              "with invalid length: %uz",
+                              v2->type, v2->rest);
+                return NGX_ERROR;
+            }
+
+            if (b->pos == b->last) {
+                goto again;
+            }
+
+            v2->padding = *b->pos++;
+            v2->rest--;
+
+            if (v2->padding > v2->rest) {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream sent http2 frame %ui "
+                              "with invalid padding: %uz",
+                              v2->type, v2->padding);
+                return NGX_ERROR;
+            }
+
+            state = sw_priority;
+            break;
+
+        case sw_priority:
+
+            if (v2->type != NGX_HTTP_V2_HEADERS_FRAME
+                || !(v2->flags & NGX_HTTP_V2_PRIORITY_FLAG))
+            {
+                state = sw_payload;
+                break;
+            }
+
+            /* stream dependency and weight are ignored */
+
+            if (v2->received == 0 && v2->rest - v2->padding < 5) {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream sent http2 frame %ui "
+                              "with invalid length: %uz",
+                              v2->type, v2->rest);
+                return NGX_ERROR;
+            }
+
+            n = ngx_min((size_t) (b->last - b->pos),
+                        5 - v2->received);
+
+            b->pos += n;
+            v2->rest -= n;
+            v2->received += n;
+
+            if (v2->received < 5) {
+                goto again;
+            }
+
+            v2->received = 0;
+
+            state = sw_payload;
+            break;
+
+        case sw_payload:
+
+            size = v2->rest - v2->padding;
+            n = ngx_min((size_t) (b->last - b->pos), size);
+
+            switch (v2->type) {
+
+            case NGX_HTTP_V2_DATA_FRAME:
+
+                if (n) {
+                    data->data = b->pos;
+                    data->len = n;
+
+                    b->pos += n;
+                    v2->rest -= n;
+
+                    v2->state = state;
+
+                    return NGX_OK;
+                }
+
+                break;
+
+            case NGX_HTTP_V2_HEADERS_FRAME:
+            case NGX_HTTP_V2_CONTINUATION_FRAME:
+
+                if (n > (size_t) (v2->header->end - v2->header->last)) {
+                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                                  "upstream sent too big header");
+                    return NGX_ERROR;
+                }
+
+                v2->header->last = ngx_cpymem(v2->header->last, b->pos, n);
+                break;
+
+            case NGX_HTTP_V2_RST_STREAM_FRAME:
+            case NGX_HTTP_V2_WINDOW_UPDATE_FRAME:
+
+                ngx_memcpy(v2->frame + 4 - size, b->pos, n);
+                break;
+            }
+
+            b->pos += n;
+            v2->rest -= n;
+
+            if (n < size) {
+                goto again;
+            }
+
+            state = sw_padding;
+            break;
+
+        case sw_padding:
+
+            n = ngx_min((size_t) (b->last - b->pos), v2->rest);
+
+            b->pos += n;
+            v2->rest -= n;
+
+            if (v2->rest) {
+                goto again;
+            }
+
+            state = sw_head;
+
+            switch (v2->type) {
+
+            case NGX_HTTP_V2_DATA_FRAME:
+
+                if (v2->flags & NGX_HTTP_V2_END_STREAM_FLAG) {
+                    v2->done = 1;
+                    v2->state = state;
+
+                    return NGX_DONE;
+                }
+
+                break;
+
+            case NGX_HTTP_V2_HEADERS_FRAME:
+            case NGX_HTTP_V2_CONTINUATION_FRAME:
+
+                if (!(v2->flags & NGX_HTTP_V2_END_HEADERS_FLAG)) {
+                    v2->parsing_headers = 1;
+                    break;
+                }
+
+                v2->parsing_headers = 0;
+                v2->state = state;
+
+                if (v2->end_stream) {
+                    v2->done = 1;
+                    return NGX_DONE;
+                }
+
+                return NGX_HTTP_PARSE_HEADER_DONE;
+
+            case NGX_HTTP_V2_RST_STREAM_FRAME:
+
+                value = ngx_http_v2_parse_uint32(v2->frame);
+
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream rejected request with error %ui",
+                              value);
+                return NGX_ERROR;
+
+            case NGX_HTTP_V2_WINDOW_UPDATE_FRAME:
+
+                value = ngx_http_v2_parse_window(v2->frame);
+
+                ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                               "http proxy window update: %ui, window: %z",
+                               value, v2->send_window);
+
+                if (value > (size_t) NGX_HTTP_V2_MAX_WINDOW
+                            - v2->send_window)
+                {
+                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                                  "upstream sent too large window update");
+                    return NGX_ERROR;
+                }
+
+                v2->send_window += value;
+
+                if (v2->in && u->peer.connection) {
+                    ngx_post_event(u->peer.connection->write,
+                                   &ngx_posted_events);
+                }
+
+                break;
+            }
+
+            break;
+        }
+    }
+
+again:
+
+    v2->state = state;
+
+    return NGX_AGAIN;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_parse_field(ngx_http_request_t *r, u_char **pos,
+    u_char *last, ngx_str_t *name, ngx_str_t *value)
+{
+    u_char      ch, *p;
+    size_t      i;
+    ngx_int_t   index;
+    ngx_uint_t  prefix;
+
+    p = *pos;
+
+    for ( ;; ) {
+
+        if (p == last) {
+            return NGX_DONE;
+        }
+
+        if ((*p & 0xe0) != 0x20) {
+            break;
+        }
+
+        /* the dynamic table is not used, its size can be only set to 0 */
+
+        if (ngx_http_proxy_v2_parse_int(&p, last, 5) != 0) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "upstream sent invalid dynamic table size update");
+            return NGX_ERROR;
+        }
+    }
+
+    if (*p & 0x80) {
+        /* indexed header field */
+        prefix = 7;
+
+    } else if (*p & 0x40) {
+        /* literal header field with incremental indexing */
+        prefix = 6;
+
+    } else {
+        /* literal header field without indexing or never indexed */
+        prefix = 4;
+    }
+
+    ch = *p;
+
+    index = ngx_http_proxy_v2_parse_int(&p, last, prefix);
+
+    if (index == NGX_ERROR
+        || index > 61
+        || (index == 0 && (ch & 0x80)))
+    {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "upstream sent invalid http2 table index: %i", index);
+        return NGX_ERROR;
+    }
+
+    if (ch & 0x80) {
+        *name = *ngx_http_v2_get_static_name(index);
+        *value = *ngx_http_v2_get_static_value(index);
+        *pos = p;
+
+        return NGX_OK;
+    }
+
+    if (index) {
+        *name = *ngx_http_v2_get_static_name(index);
+
+    } else {
+        if (ngx_http_proxy_v2_parse_string(r, &p, last, name) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (name->len == 0) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < name->len; i++) {
+            ch = name->data[i];
+
+            if ((ch == ':' && i > 0)
+                || (ch >= 'A' && ch <= 'Z')
+                || ch <= 0x20 || ch == 0x7f)
+            {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    if (ngx_http_proxy_v2_parse_string(r, &p, last, value) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < value->len; i++) {
+        ch = value->data[i];
+
+        if (ch == '\0' || ch == CR || ch == LF) {
+            return NGX_ERROR;
+        }
+    }
+
+    *pos = p;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_parse_int(u_char **pos, u_char *last, ngx_uint_t prefix)
+{
+    u_char      *p, *end;
+    ngx_uint_t   value, octet, shift;
+
+    p = *pos;
+
+    if (p == last) {
+        return NGX_ERROR;
+    }
+
+    prefix = ngx_http_v2_prefix(prefix);
+
+    value = *p++ & prefix;
+
+    if (value == prefix) {
+
+        end = p + NGX_HTTP_V2_INT_OCTETS - 1;
+
+        for (shift = 0; /* void */; shift += 7) {
+
+            if (p == last || p == end) {
+                return NGX_ERROR;
+            }
+
+            octet = *p++;
+
+            value += (octet & 0x7f) << shift;
+
+            if (octet < 128) {
+                break;
+            }
+        }
+    }
+
+    *pos = p;
+
+    return value;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_parse_string(ngx_http_request_t *r, u_char **pos,
+    u_char *last, ngx_str_t *s)
+{
+    u_char     *p, *end, state;
+    ngx_int_t   len;
+    ngx_uint_t  huff;
+
+    p = *pos;
+
+    if (p == last) {
+        return NGX_ERROR;
+    }
+
+    huff = *p & 0x80;
+
+    len = ngx_http_proxy_v2_parse_int(&p, last, 7);
+
+    if (len == NGX_ERROR || len > last - p) {
+        return NGX_ERROR;
+    }
+
+    if (huff) {
+        s->data = ngx_pnalloc(r->pool, len * 8 / 5 + 1);
+        if (s->data == NULL) {
+            return NGX_ERROR;
+        }
+
+        state = 0;
+        end = s->data;
+
+        if (ngx_http_huff_decode(&state, p, len, &end, 1, r->connection->log)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        s->len = end - s->data;
+
+    } else {
+        s->data = ngx_pnalloc(r->pool, len + 1);
+        if (s->data == NULL) {
+            return NGX_ERROR;
+        }
+
+        s->len = ngx_cpymem(s->data, p, len) - s->data;
+    }
+
+    s->data[s->len] = '\0';
+
+    *pos = p + len;
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_proxy_v2_connection_header(u_char *name, size_t len)
+{
+    ngx_str_t  *h;
+
+    static ngx_str_t  headers[] = {
+        ngx_string("connection"),
+        ngx_string("keep-alive"),
+        ngx_string("proxy-connection"),
+        ngx_string("te"),
+        ngx_string("transfer-encoding"),
+        ngx_string("upgrade"),
+        ngx_null_string
+    };
+
+    for (h = headers; h->len; h++) {
+        if (len == h->len && ngx_strncasecmp(name, h->data, len) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_send_window_update(ngx_http_request_t *r,
+    ngx_http_proxy_ctx_t *ctx)
+{
+    size_t        n;
+    ngx_chain_t  *cl, **ll;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http proxy send window update: %uz", ctx->v2.recv_window);
+
+    for (cl = ctx->v2.out, ll = &ctx->v2.out; cl; cl = cl->next) {
+        ll = &cl->next;
+    }
+
+    cl = ngx_http_proxy_v2_get_buf(r, ctx);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = ctx->v2.connection->recv_init_window - ctx->v2.recv_window;
+    ctx->v2.recv_window = ctx->v2.connection->recv_init_window;
+
+    cl->buf->last = ngx_http_proxy_v2_frame_head(cl->buf->last, 4,
+                                           NGX_HTTP_V2_WINDOW_UPDATE_FRAME,
+                                           0, ctx->v2.id);
+
+    cl->buf->last = ngx_http_v2_write_uint32(cl->buf->last, n);
+
+    *ll = cl;
+
+    return NGX_OK;
+}
+
+
+static ngx_chain_t *
+ngx_http_proxy_v2_get_buf(ngx_http_request_t *r, ngx_http_proxy_ctx_t *ctx)
+{
+    u_char       *start;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    cl = ngx_chain_get_free_buf(r->pool, &ctx->v2.free);
+    if (cl == NULL) {
+        return NULL;
+    }
+
+    b = cl->buf;
+    start = b->start;
+
+    if (start == NULL) {
+
+        /* each buffer is large enough to hold a window update frame */
+
+        start = ngx_palloc(r->pool, NGX_HTTP_V2_FRAME_HEADER_SIZE + 4);
+        if (start == NULL) {
+            return NULL;
+        }
+    }
+
+    ngx_memzero(b, sizeof(ngx_buf_t));
+
+    b->start = start;
+    b->pos = start;
+    b->last = start;
+    b->end = start + NGX_HTTP_V2_FRAME_HEADER_SIZE + 4;
+
+    b->tag = (ngx_buf_tag_t) &ngx_http_proxy_v2_body_output_filter;
+    b->temporary = 1;
+    b->flush = 1;
+
+    return cl;
+}
+
+
+static u_char *
+ngx_http_proxy_v2_frame_head(u_char *p, size_t length, ngx_uint_t type,
+    ngx_uint_t flags, ngx_uint_t sid)
+{
+    *p++ = (u_char) ((length >> 16) & 0xff);
+    *p++ = (u_char) ((length >> 8) & 0xff);
+    *p++ = (u_char) (length & 0xff);
+    *p++ = (u_char) type;
+    *p++ = (u_char) flags;
+
+    return ngx_http_v2_write_sid(p, sid);
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_proxy_host_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_proxy_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->len = ctx->vars.host_header.len;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = ctx->vars.host_header.data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_port_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_proxy_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->len = ctx->vars.port.len;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = ctx->vars.port.data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_add_x_forwarded_for_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    size_t             len;
+    u_char            *p;
+    ngx_uint_t         i, n;
+    ngx_table_elt_t  **h;
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    n = r->headers_in.x_forwarded_for.nelts;
+    h = r->headers_in.x_forwarded_for.elts;
+
+    len = 0;
+
+    for (i = 0; i < n; i++) {
+        len += h[i]->value.len + sizeof(", ") - 1;
+    }
+
+    if (len == 0) {
+        v->len = r->connection->addr_text.len;
+        v->data = r->connection->addr_text.data;
+        return NGX_OK;
+    }
+
+    len += r->connection->addr_text.len;
+
+    p = ngx_pnalloc(r->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = len;
+    v->data = p;
+
+    for (i = 0; i < n; i++) {
+        p = ngx_copy(p, h[i]->value.data, h[i]->value.len);
+        *p++ = ','; *p++ = ' ';
+    }
+
+    ngx_memcpy(p, r->connection->addr_text.data, r->connection->addr_text.len);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_internal_body_length_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_proxy_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL || ctx->internal_body_length < 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    v->data = ngx_pnalloc(r->pool, NGX_OFF_T_LEN);
+
+    if (v->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(v->data, "%O", ctx->internal_body_length) - v->data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_internal_chunked_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_proxy_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL || !ctx->internal_chunked) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    v->data = (u_char *) "chunked";
+    v->len = sizeof("chunked") - 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_rewrite_redirect(ngx_http_request_t *r, ngx_table_elt_t *h,
+    size_t prefix)
+{
+    size_t                      len;
+    ngx_int_t                   rc;
+    ngx_uint_t                  i;
+    ngx_http_proxy_rewrite_t   *pr;
+    ngx_http_proxy_loc_conf_t  *plcf;
+
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_proxy_module);
+
+    pr = plcf->redirects->elts;
+
+    if (pr == NULL) {
+        return NGX_DECLINED;
+    }
+
+    len = h->value.len - prefix;
 
     for (i = 0; i < plcf->redirects->nelts; i++) {
         rc = pr[i].handler(r, &h->value, prefix, len, &pr[i]);
@@ -3423,6 +5598,12 @@ ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
 
     conf->http_version = NGX_CONF_UNSET_UINT;
 
+#if (NGX_HTTP_V2)
+    conf->mux.streams = NGX_CONF_UNSET_UINT;
+    conf->mux.window = NGX_CONF_UNSET_SIZE;
+    conf->mux.timeout = NGX_CONF_UNSET_MSEC;
+#endif
+
     conf->headers_hash_max_size = NGX_CONF_UNSET_UINT;
     conf->headers_hash_bucket_size = NGX_CONF_UNSET_UINT;
 
@@ -3820,6 +6001,38 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_uint_value(conf->http_version, prev->http_version,
                               NGX_HTTP_VERSION_10);
 
+#if (NGX_HTTP_V2)
+
+    ngx_conf_merge_uint_value(conf->mux.streams, prev->mux.streams, 128);
+
+    ngx_conf_merge_size_value(conf->mux.window, prev->mux.window, 65536);
+
+    ngx_conf_merge_msec_value(conf->mux.timeout, prev->mux.timeout, 60000);
+
+    if (conf->mux.streams == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"proxy_multiplex_streams\" must be positive");
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->mux.window < NGX_HTTP_V2_DEFAULT_FRAME_SIZE
+        || conf->mux.window > NGX_HTTP_V2_MAX_WINDOW)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"proxy_multiplex_window\" must be between "
+                           "%uz and %uz",
+                           (size_t) NGX_HTTP_V2_DEFAULT_FRAME_SIZE,
+                           (size_t) NGX_HTTP_V2_MAX_WINDOW);
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->http_version == NGX_HTTP_VERSION_20) {
+        /* window updates are sent after the request */
+        conf->upstream.preserve_output = 1;
+    }
+
+#endif
+
     ngx_conf_merge_uint_value(conf->headers_hash_max_size,
                               prev->headers_hash_max_size, 512);
 
@@ -21,6 +21,7 @@ typedef struct {
 
     ngx_flag_t                      prefer_server_ciphers;
     ngx_flag_t                      early_data;
+    ngx_flag_t                      ktls;
     ngx_flag_t                      reject_handshake;
 
     ngx_uint_t                      protocols;
@@ -55,6 +56,7 @@ typedef struct {
 
     ngx_flag_t                      session_tickets;
     ngx_array_t                    *session_ticket_keys;
+    ngx_flag_t                      session_ticket_rotation;
 
     ngx_uint_t                      ocsp;
     ngx_str_t                       ocsp_responder;
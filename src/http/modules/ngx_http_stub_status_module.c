@@ -11,6 +11,8 @@
 
 
 static ngx_int_t ngx_http_stub_status_handler(ngx_http_request_t *r);
+static void ngx_http_stub_status_slab_cache(ngx_cycle_t *cycle,
+    ngx_uint_t *hits, ngx_uint_t *reqs, ngx_uint_t *cached);
 static ngx_int_t ngx_http_stub_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_stub_status_add_variables(ngx_conf_t *cf);
@@ -83,11 +85,18 @@ static ngx_http_variable_t  ngx_http_stub_status_vars[] = {
 static ngx_int_t
 ngx_http_stub_status_handler(ngx_http_request_t *r)
 {
-    size_t             size;
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_atomic_int_t   ap, hn, ac, rq, rd, wr, wa;
+    size_t                          size;
+    ngx_int_t                       rc;
+    ngx_buf_t                      *b;
+    ngx_chain_t                     out;
+    ngx_uint_t                      sh, sr, sc;
+    ngx_atomic_int_t                ap, hn, ac, rq, rd, wr, wa, ki, kh, km, kp;
+    ngx_core_conf_t                *ccf;
+    ngx_http_upstream_main_conf_t  *umcf;
+#if (NGX_SSL)
+    ngx_uint_t                      ktls;
+    ngx_atomic_int_t                ks, kr;
+#endif
 
     if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
         return NGX_HTTP_NOT_ALLOWED;
@@ -108,6 +117,29 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
            + 6 + 3 * NGX_ATOMIC_T_LEN
            + sizeof("Reading:  Writing:  Waiting:  \n") + 3 * NGX_ATOMIC_T_LEN;
 
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    if (umcf->keepalive) {
+        size += sizeof("Upstream keepalive idle:  reused:  missed:  passed:  \n")
+                + 4 * NGX_ATOMIC_T_LEN;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                           ngx_core_module);
+
+    if (ccf->slab_cache) {
+        size += sizeof("Slab cache hits:  requests:  cached:  \n")
+                + 3 * NGX_INT_T_LEN;
+    }
+
+#if (NGX_SSL)
+    ktls = ngx_ssl_ktls_enabled((ngx_cycle_t *) ngx_cycle);
+
+    if (ktls) {
+        size += sizeof("kTLS send:  recv:  \n") + 2 * NGX_ATOMIC_T_LEN;
+    }
+#endif
+
     b = ngx_create_temp_buf(r->pool, size);
     if (b == NULL) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
@@ -123,6 +155,15 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
     rd = *ngx_stat_reading;
     wr = *ngx_stat_writing;
     wa = *ngx_stat_waiting;
+    ki = *ngx_stat_keepalive_idle;
+    kh = *ngx_stat_keepalive_reused;
+    km = *ngx_stat_keepalive_missed;
+    kp = *ngx_stat_keepalive_passed;
+
+#if (NGX_SSL)
+    ks = *ngx_stat_ktls_send;
+    kr = *ngx_stat_ktls_recv;
+#endif
 
     b->last = ngx_sprintf(b->last, "Active connections: %uA \n", ac);
 
@@ -134,6 +175,31 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
     b->last = ngx_sprintf(b->last, "Reading: %uA Writing: %uA Waiting: %uA \n",
                           rd, wr, wa);
 
+    if (umcf->keepalive) {
+        b->last = ngx_sprintf(b->last, "Upstream keepalive idle: %uA "
+                              "reused: %uA missed: %uA passed: %uA \n",
+                              ki, kh, km, kp);
+    }
+
+    if (ccf->slab_cache) {
+        sh = 0;
+        sr = 0;
+        sc = 0;
+
+        ngx_http_stub_status_slab_cache((ngx_cycle_t *) ngx_cycle,
+                                        &sh, &sr, &sc);
+
+        b->last = ngx_sprintf(b->last, "Slab cache hits: %ui requests: %ui "
+                              "cached: %ui \n", sh, sr, sc);
+    }
+
+#if (NGX_SSL)
+    if (ktls) {
+        b->last = ngx_sprintf(b->last, "kTLS send: %uA recv: %uA \n",
+                              ks, kr);
+    }
+#endif
+
     r->headers_out.status = NGX_HTTP_OK;
     r->headers_out.content_length_n = b->last - b->pos;
 
@@ -150,6 +216,34 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
 }
 
 
+static void
+ngx_http_stub_status_slab_cache(ngx_cycle_t *cycle, ngx_uint_t *hits,
+    ngx_uint_t *reqs, ngx_uint_t *cached)
+{
+    ngx_uint_t        i;
+    ngx_shm_zone_t   *shm_zone;
+    ngx_list_part_t  *part;
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        ngx_slab_cache_stat((ngx_slab_pool_t *) shm_zone[i].shm.addr,
+                            hits, reqs, cached);
+    }
+}
+
+
 static ngx_int_t
 ngx_http_stub_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
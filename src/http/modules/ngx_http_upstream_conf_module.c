@@ -0,0 +1,1271 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#if (NGX_HTTP_UPSTREAM_CONF_STREAM)
+#include <ngx_stream.h>
+#endif
+
+
+typedef struct {
+    ngx_str_t                        upstream;
+    ngx_str_t                        server;
+    ngx_addr_t                       addr;
+
+    ngx_int_t                        id;
+    ngx_int_t                        weight;
+    ngx_int_t                        max_conns;
+    ngx_int_t                        max_fails;
+    time_t                           fail_timeout;
+    ngx_msec_t                       slow_start;
+    ngx_int_t                        down;
+
+    unsigned                         stream:1;
+    unsigned                         add:1;
+    unsigned                         remove:1;
+    unsigned                         backup:1;
+
+    char                            *error;
+} ngx_http_upstream_conf_op_t;
+
+
+#define NGX_HTTP_UPSTREAM_CONF_LINE                                           \
+    (sizeof("server  weight= max_conns= max_fails= fail_timeout=s"            \
+            " slow_start=ms backup down; # id= unhealthy\n") - 1               \
+     + NGX_SOCKADDR_STRLEN + 5 * NGX_INT_T_LEN + NGX_TIME_T_LEN)
+
+
+static ngx_int_t ngx_http_upstream_conf_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_upstream_conf_parse(ngx_http_request_t *r,
+    ngx_http_upstream_conf_op_t *op);
+static ngx_int_t ngx_http_upstream_conf_flag(ngx_http_request_t *r,
+    char *name);
+static ngx_int_t ngx_http_upstream_conf_number(ngx_http_request_t *r,
+    char *name, ngx_int_t min, ngx_int_t *np);
+
+static ngx_int_t ngx_http_upstream_conf_http(ngx_http_request_t *r,
+    ngx_http_upstream_conf_op_t *op, ngx_buf_t **bp);
+static ngx_int_t ngx_http_upstream_conf_http_add(
+    ngx_http_upstream_conf_op_t *op, ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t **peerp);
+static ngx_int_t ngx_http_upstream_conf_http_remove(
+    ngx_http_upstream_conf_op_t *op, ngx_http_upstream_rr_peers_t *peers);
+static ngx_int_t ngx_http_upstream_conf_http_modify(
+    ngx_http_upstream_conf_op_t *op, ngx_http_upstream_rr_peer_t *peer);
+static ngx_http_upstream_rr_peer_t *ngx_http_upstream_conf_http_find(
+    ngx_http_upstream_rr_peers_t *peers, ngx_uint_t id,
+    ngx_http_upstream_rr_peers_t **listp);
+static void ngx_http_upstream_conf_http_update(
+    ngx_http_upstream_rr_peers_t *peers, ngx_uint_t changed);
+static u_char *ngx_http_upstream_conf_http_peer(u_char *p,
+    ngx_http_upstream_rr_peer_t *peer, ngx_uint_t backup);
+
+#if (NGX_HTTP_UPSTREAM_CONF_STREAM)
+static ngx_int_t ngx_http_upstream_conf_stream(ngx_http_request_t *r,
+    ngx_http_upstream_conf_op_t *op, ngx_buf_t **bp);
+static ngx_int_t ngx_http_upstream_conf_stream_add(
+    ngx_http_upstream_conf_op_t *op, ngx_stream_upstream_rr_peers_t *peers,
+    ngx_stream_upstream_rr_peer_t **peerp);
+static ngx_int_t ngx_http_upstream_conf_stream_remove(
+    ngx_http_upstream_conf_op_t *op, ngx_stream_upstream_rr_peers_t *peers);
+static ngx_int_t ngx_http_upstream_conf_stream_modify(
+    ngx_http_upstream_conf_op_t *op, ngx_stream_upstream_rr_peer_t *peer);
+static ngx_stream_upstream_rr_peer_t *ngx_http_upstream_conf_stream_find(
+    ngx_stream_upstream_rr_peers_t *peers, ngx_uint_t id,
+    ngx_stream_upstream_rr_peers_t **listp);
+static void ngx_http_upstream_conf_stream_update(
+    ngx_stream_upstream_rr_peers_t *peers, ngx_uint_t changed);
+static u_char *ngx_http_upstream_conf_stream_peer(u_char *p,
+    ngx_stream_upstream_rr_peer_t *peer, ngx_uint_t backup);
+#endif
+
+static char *ngx_http_upstream_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_conf_commands[] = {
+
+    { ngx_string("upstream_conf"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_upstream_conf,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_conf_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_conf_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_conf_module_ctx,    /* module context */
+    ngx_http_upstream_conf_commands,       /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_conf_handler(ngx_http_request_t *r)
+{
+    size_t                        len;
+    ngx_int_t                     rc, status;
+    ngx_buf_t                    *b;
+    ngx_chain_t                   out;
+    ngx_http_upstream_conf_op_t   op;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    ngx_memzero(&op, sizeof(ngx_http_upstream_conf_op_t));
+
+    b = NULL;
+
+    status = ngx_http_upstream_conf_parse(r, &op);
+
+    if (status == NGX_OK) {
+
+#if (NGX_HTTP_UPSTREAM_CONF_STREAM)
+        if (op.stream) {
+            status = ngx_http_upstream_conf_stream(r, &op, &b);
+
+        } else
+#endif
+        {
+            status = ngx_http_upstream_conf_http(r, &op, &b);
+        }
+    }
+
+    if (status == NGX_HTTP_INTERNAL_SERVER_ERROR && op.error == NULL) {
+        return status;
+    }
+
+    if (op.error) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "upstream_conf: %s", op.error);
+
+        len = ngx_strlen(op.error);
+
+        b = ngx_create_temp_buf(r->pool, len + 1);
+        if (b == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        b->last = ngx_cpymem(b->last, op.error, len);
+        *b->last++ = LF;
+    }
+
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_lowcase = NULL;
+
+    r->headers_out.status = status;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_parse(ngx_http_request_t *r,
+    ngx_http_upstream_conf_op_t *op)
+{
+    u_char     *p, *dst, *src;
+    ngx_int_t   n, rc;
+    ngx_str_t   value;
+
+    if (ngx_http_arg(r, (u_char *) "upstream", 8, &op->upstream) != NGX_OK
+        || op->upstream.len == 0)
+    {
+        op->error = "upstream name is required";
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    op->stream = ngx_http_upstream_conf_flag(r, "stream");
+    op->add = ngx_http_upstream_conf_flag(r, "add");
+    op->remove = ngx_http_upstream_conf_flag(r, "remove");
+    op->backup = ngx_http_upstream_conf_flag(r, "backup");
+
+    op->id = NGX_CONF_UNSET;
+    op->weight = NGX_CONF_UNSET;
+    op->max_conns = NGX_CONF_UNSET;
+    op->max_fails = NGX_CONF_UNSET;
+    op->fail_timeout = NGX_CONF_UNSET;
+    op->slow_start = NGX_CONF_UNSET_MSEC;
+    op->down = NGX_CONF_UNSET;
+
+    if (ngx_http_upstream_conf_number(r, "id", 0, &op->id) != NGX_OK
+        || ngx_http_upstream_conf_number(r, "weight", 1, &op->weight)
+           != NGX_OK
+        || ngx_http_upstream_conf_number(r, "max_conns", 0, &op->max_conns)
+           != NGX_OK
+        || ngx_http_upstream_conf_number(r, "max_fails", 0, &op->max_fails)
+           != NGX_OK)
+    {
+        op->error = "invalid number";
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "fail_timeout", 12, &value) == NGX_OK) {
+        op->fail_timeout = ngx_parse_time(&value, 1);
+
+        if (op->fail_timeout == (time_t) NGX_ERROR) {
+            op->error = "invalid \"fail_timeout\" value";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+    }
+
+    if (ngx_http_arg(r, (u_char *) "slow_start", 10, &value) == NGX_OK) {
+        n = ngx_parse_time(&value, 0);
+
+        if (n == NGX_ERROR) {
+            op->error = "invalid \"slow_start\" value";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        op->slow_start = (ngx_msec_t) n;
+    }
+
+    if (ngx_http_upstream_conf_flag(r, "down")) {
+        op->down = 1;
+    }
+
+    if (ngx_http_upstream_conf_flag(r, "up")) {
+        if (op->down == 1) {
+            op->error = "\"down\" and \"up\" are mutually exclusive";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        op->down = 0;
+    }
+
+    if (op->add && op->remove) {
+        op->error = "\"add\" and \"remove\" are mutually exclusive";
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    if (op->add) {
+
+        if (op->id != NGX_CONF_UNSET) {
+            op->error = "\"id\" cannot be used with \"add\"";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        if (ngx_http_arg(r, (u_char *) "server", 6, &value) != NGX_OK
+            || value.len == 0)
+        {
+            op->error = "server address is required";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        p = ngx_pnalloc(r->pool, value.len);
+        if (p == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        src = value.data;
+        dst = p;
+
+        ngx_unescape_uri(&dst, &src, value.len, 0);
+
+        op->server.data = p;
+        op->server.len = dst - p;
+
+        /* only addresses are accepted, names are not resolved at run time */
+
+        rc = ngx_parse_addr_port(r->pool, &op->addr, op->server.data,
+                                 op->server.len);
+
+        if (rc == NGX_ERROR) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        if (rc == NGX_DECLINED) {
+            op->error = "invalid server address";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        if (ngx_inet_get_port(op->addr.sockaddr) == 0) {
+
+            /* as in the "server" directive, there is no default stream port */
+
+            if (op->stream) {
+                op->error = "no port in server address";
+                return NGX_HTTP_BAD_REQUEST;
+            }
+
+            ngx_inet_set_port(op->addr.sockaddr, 80);
+        }
+
+        return NGX_OK;
+    }
+
+    if (op->backup) {
+        op->error = "\"backup\" can only be used with \"add\"";
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    if (op->id == NGX_CONF_UNSET
+        && (op->remove
+            || op->weight != NGX_CONF_UNSET
+            || op->max_conns != NGX_CONF_UNSET
+            || op->max_fails != NGX_CONF_UNSET
+            || op->fail_timeout != NGX_CONF_UNSET
+            || op->slow_start != NGX_CONF_UNSET_MSEC
+            || op->down != NGX_CONF_UNSET))
+    {
+        op->error = "server id is required";
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_flag(ngx_http_request_t *r, char *name)
+{
+    ngx_str_t  value;
+
+    return ngx_http_arg(r, (u_char *) name, ngx_strlen(name), &value)
+           == NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_number(ngx_http_request_t *r, char *name,
+    ngx_int_t min, ngx_int_t *np)
+{
+    ngx_int_t  n;
+    ngx_str_t  value;
+
+    if (ngx_http_arg(r, (u_char *) name, ngx_strlen(name), &value) != NGX_OK)
+    {
+        return NGX_OK;
+    }
+
+    n = ngx_atoi(value.data, value.len);
+
+    if (n == NGX_ERROR || n < min) {
+        return NGX_ERROR;
+    }
+
+    *np = n;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_http(ngx_http_request_t *r,
+    ngx_http_upstream_conf_op_t *op, ngx_buf_t **bp)
+{
+    ngx_int_t                        rc;
+    ngx_buf_t                       *b;
+    ngx_uint_t                       i, n, flags;
+    ngx_http_upstream_rr_peer_t     *peer;
+    ngx_http_upstream_rr_peers_t    *peers, *list;
+    ngx_http_upstream_srv_conf_t    *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t   *umcf;
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    uscf = NULL;
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->shm_zone
+            && uscfp[i]->host.len == op->upstream.len
+            && ngx_strncasecmp(uscfp[i]->host.data, op->upstream.data,
+                               op->upstream.len)
+               == 0)
+        {
+            uscf = uscfp[i];
+            break;
+        }
+    }
+
+    if (uscf == NULL) {
+        op->error = "upstream not found";
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    flags = 0;
+
+    if (op->weight != NGX_CONF_UNSET) {
+        flags |= NGX_HTTP_UPSTREAM_WEIGHT;
+    }
+
+    if (op->max_conns != NGX_CONF_UNSET) {
+        flags |= NGX_HTTP_UPSTREAM_MAX_CONNS;
+    }
+
+    if (op->max_fails != NGX_CONF_UNSET) {
+        flags |= NGX_HTTP_UPSTREAM_MAX_FAILS;
+    }
+
+    if (op->fail_timeout != NGX_CONF_UNSET) {
+        flags |= NGX_HTTP_UPSTREAM_FAIL_TIMEOUT;
+    }
+
+    if (op->slow_start != NGX_CONF_UNSET_MSEC) {
+        flags |= NGX_HTTP_UPSTREAM_SLOW_START;
+    }
+
+    if (op->down != NGX_CONF_UNSET) {
+        flags |= NGX_HTTP_UPSTREAM_DOWN;
+    }
+
+    if (op->backup) {
+        flags |= NGX_HTTP_UPSTREAM_BACKUP;
+    }
+
+    if ((uscf->flags & flags) != flags) {
+        op->error = "parameter is not supported by the balancer";
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    peers = uscf->peer.data;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    if (peers->next) {
+        ngx_http_upstream_rr_peers_wlock(peers->next);
+    }
+
+    peer = NULL;
+    list = NULL;
+
+    if (op->add) {
+        rc = ngx_http_upstream_conf_http_add(op, peers, &peer);
+
+    } else if (op->remove) {
+        rc = ngx_http_upstream_conf_http_remove(op, peers);
+
+    } else if (op->id != NGX_CONF_UNSET) {
+        peer = ngx_http_upstream_conf_http_find(peers, op->id, &list);
+
+        if (peer == NULL) {
+            op->error = "server not found";
+            rc = NGX_HTTP_NOT_FOUND;
+
+        } else {
+            rc = ngx_http_upstream_conf_http_modify(op, peer);
+
+            if (rc == NGX_OK) {
+                ngx_http_upstream_conf_http_update(peers,
+                                             op->weight != NGX_CONF_UNSET);
+            }
+        }
+
+    } else {
+        rc = NGX_OK;
+    }
+
+    if (rc != NGX_OK) {
+        goto done;
+    }
+
+    if (peer) {
+        n = 1;
+
+    } else {
+        n = peers->number + (peers->next ? peers->next->number : 0);
+    }
+
+    b = ngx_create_temp_buf(r->pool, n * NGX_HTTP_UPSTREAM_CONF_LINE + 1);
+    if (b == NULL) {
+        rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+        goto done;
+    }
+
+    if (peer) {
+        if (list == NULL) {
+            list = op->backup ? peers->next : peers;
+        }
+
+        b->last = ngx_http_upstream_conf_http_peer(b->last, peer,
+                                                   list != peers);
+
+    } else {
+        for (list = peers; list; list = list->next) {
+            for (peer = list->peer; peer; peer = peer->next) {
+                b->last = ngx_http_upstream_conf_http_peer(b->last, peer,
+                                                           list != peers);
+            }
+        }
+    }
+
+    *bp = b;
+
+    rc = NGX_HTTP_OK;
+
+done:
+
+    if (peers->next) {
+        ngx_http_upstream_rr_peers_unlock(peers->next);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_http_add(ngx_http_upstream_conf_op_t *op,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t **peerp)
+{
+    ngx_http_upstream_rr_peer_t   *peer, **pp;
+    ngx_http_upstream_rr_peers_t  *list;
+
+    if (op->backup) {
+        if (peers->next == NULL) {
+            op->error = "upstream has no backup servers";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        list = peers->next;
+
+    } else {
+        list = peers;
+    }
+
+    ngx_shmtx_lock(&peers->shpool->mutex);
+
+    peer = ngx_http_upstream_zone_copy_peer(list, NULL);
+
+    if (peer) {
+        peer->server.data = ngx_slab_alloc_locked(peers->shpool,
+                                                  op->server.len);
+        if (peer->server.data == NULL) {
+            ngx_http_upstream_zone_free_peer(list, peer);
+            peer = NULL;
+        }
+    }
+
+    ngx_shmtx_unlock(&peers->shpool->mutex);
+
+    if (peer == NULL) {
+        op->error = "no memory in upstream zone";
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ngx_memcpy(peer->sockaddr, op->addr.sockaddr, op->addr.socklen);
+    peer->socklen = op->addr.socklen;
+
+    peer->name.len = ngx_sock_ntop(peer->sockaddr, peer->socklen,
+                                   peer->name.data, NGX_SOCKADDR_STRLEN, 1);
+
+    ngx_memcpy(peer->server.data, op->server.data, op->server.len);
+    peer->server.len = op->server.len;
+
+    peer->weight = (op->weight != NGX_CONF_UNSET) ? op->weight : 1;
+    peer->effective_weight = peer->weight;
+    peer->max_conns = (op->max_conns != NGX_CONF_UNSET) ? op->max_conns : 0;
+    peer->max_fails = (op->max_fails != NGX_CONF_UNSET) ? op->max_fails : 1;
+    peer->fail_timeout = (op->fail_timeout != NGX_CONF_UNSET)
+                         ? op->fail_timeout : 10;
+    peer->down = (op->down == 1);
+
+    if (op->slow_start != NGX_CONF_UNSET_MSEC) {
+        peer->slow_start = op->slow_start;
+        peer->start_time = ngx_current_msec;
+    }
+
+    peer->id = peers->next_id++;
+
+    for (pp = &list->peer; *pp; pp = &(*pp)->next) {
+
+        /*
+         * the added peer has no per-worker weights, so the list is
+         * selected under the write lock until the configuration is reloaded
+         */
+
+        (*pp)->local = NULL;
+    }
+
+    *pp = peer;
+
+    ngx_http_upstream_conf_http_update(peers, 1);
+
+    *peerp = peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_http_remove(ngx_http_upstream_conf_op_t *op,
+    ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_http_upstream_rr_peer_t   *peer, **pp;
+    ngx_http_upstream_rr_peers_t  *list;
+
+    for (list = peers; list; list = list->next) {
+
+        for (pp = &list->peer; *pp; pp = &(*pp)->next) {
+
+            peer = *pp;
+
+            if (peer->id != (ngx_uint_t) op->id) {
+                continue;
+            }
+
+            if (list->number == 1) {
+                op->error = "cannot remove the last server";
+                return NGX_HTTP_CONFLICT;
+            }
+
+            *pp = peer->next;
+
+            /*
+             * a peer still in use is freed by the last request
+             * releasing it, see ngx_http_upstream_free_round_robin_peer()
+             */
+
+            if (peer->conns) {
+                peer->zombie = 1;
+
+            } else {
+                ngx_shmtx_lock(&peers->shpool->mutex);
+                ngx_http_upstream_zone_free_peer(list, peer);
+                ngx_shmtx_unlock(&peers->shpool->mutex);
+            }
+
+            ngx_http_upstream_conf_http_update(peers, 1);
+
+            return NGX_OK;
+        }
+    }
+
+    op->error = "server not found";
+
+    return NGX_HTTP_NOT_FOUND;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_http_modify(ngx_http_upstream_conf_op_t *op,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    if (op->weight != NGX_CONF_UNSET) {
+        peer->weight = op->weight;
+        peer->effective_weight = op->weight;
+        peer->current_weight = 0;
+    }
+
+    if (op->max_conns != NGX_CONF_UNSET) {
+        peer->max_conns = op->max_conns;
+    }
+
+    if (op->max_fails != NGX_CONF_UNSET) {
+        peer->max_fails = op->max_fails;
+    }
+
+    if (op->fail_timeout != NGX_CONF_UNSET) {
+        peer->fail_timeout = op->fail_timeout;
+    }
+
+    if (op->slow_start != NGX_CONF_UNSET_MSEC) {
+        peer->slow_start = op->slow_start;
+    }
+
+    if (op->down == 1) {
+        peer->down |= 1;
+
+    } else if (op->down == 0 && (peer->down & 1)) {
+        peer->down &= ~1;
+        peer->fails = 0;
+
+        if (peer->slow_start) {
+            peer->start_time = ngx_current_msec;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_http_upstream_rr_peer_t *
+ngx_http_upstream_conf_http_find(ngx_http_upstream_rr_peers_t *peers,
+    ngx_uint_t id, ngx_http_upstream_rr_peers_t **listp)
+{
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *list;
+
+    for (list = peers; list; list = list->next) {
+        for (peer = list->peer; peer; peer = peer->next) {
+            if (peer->id == id) {
+                *listp = list;
+                return peer;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_upstream_conf_http_update(ngx_http_upstream_rr_peers_t *peers,
+    ngx_uint_t changed)
+{
+    ngx_uint_t                     n, w, t;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *list;
+
+    for (list = peers; list; list = list->next) {
+
+        n = 0;
+        w = 0;
+        t = 0;
+
+        for (peer = list->peer; peer; peer = peer->next) {
+            n++;
+            w += peer->weight;
+
+            if (!(peer->down & ~NGX_HTTP_UPSTREAM_RR_UNHEALTHY)) {
+                t++;
+            }
+        }
+
+        list->number = n;
+        list->total_weight = w;
+        list->weighted = (w != n);
+        list->tries = t;
+
+        if (changed) {
+            list->config++;
+        }
+    }
+
+    peers->single = (peers->number == 1 && peers->next == NULL);
+}
+
+
+static u_char *
+ngx_http_upstream_conf_http_peer(u_char *p, ngx_http_upstream_rr_peer_t *peer,
+    ngx_uint_t backup)
+{
+    p = ngx_sprintf(p, "server %V weight=%i max_conns=%ui max_fails=%ui "
+                    "fail_timeout=%Ts",
+                    &peer->name, peer->weight, peer->max_conns,
+                    peer->max_fails, peer->fail_timeout);
+
+    if (peer->slow_start) {
+        p = ngx_sprintf(p, " slow_start=%Mms", peer->slow_start);
+    }
+
+    if (backup) {
+        p = ngx_cpymem(p, " backup", sizeof(" backup") - 1);
+    }
+
+    if (peer->down & ~NGX_HTTP_UPSTREAM_RR_UNHEALTHY) {
+        p = ngx_cpymem(p, " down", sizeof(" down") - 1);
+    }
+
+    p = ngx_sprintf(p, "; # id=%ui", peer->id);
+
+    if (peer->down & NGX_HTTP_UPSTREAM_RR_UNHEALTHY) {
+        p = ngx_cpymem(p, " unhealthy", sizeof(" unhealthy") - 1);
+    }
+
+    *p++ = LF;
+
+    return p;
+}
+
+
+#if (NGX_HTTP_UPSTREAM_CONF_STREAM)
+
+static ngx_int_t
+ngx_http_upstream_conf_stream(ngx_http_request_t *r,
+    ngx_http_upstream_conf_op_t *op, ngx_buf_t **bp)
+{
+    ngx_int_t                          rc;
+    ngx_buf_t                         *b;
+    ngx_uint_t                         i, n, flags;
+    ngx_stream_upstream_rr_peer_t     *peer;
+    ngx_stream_upstream_rr_peers_t    *peers, *list;
+    ngx_stream_upstream_srv_conf_t    *uscf, **uscfp;
+    ngx_stream_upstream_main_conf_t   *umcf;
+
+    umcf = ngx_stream_cycle_get_module_main_conf(ngx_cycle,
+                                                 ngx_stream_upstream_module);
+
+    if (umcf == NULL) {
+        op->error = "upstream not found";
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    uscf = NULL;
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->shm_zone
+            && uscfp[i]->host.len == op->upstream.len
+            && ngx_strncasecmp(uscfp[i]->host.data, op->upstream.data,
+                               op->upstream.len)
+               == 0)
+        {
+            uscf = uscfp[i];
+            break;
+        }
+    }
+
+    if (uscf == NULL) {
+        op->error = "upstream not found";
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    flags = 0;
+
+    if (op->weight != NGX_CONF_UNSET) {
+        flags |= NGX_STREAM_UPSTREAM_WEIGHT;
+    }
+
+    if (op->max_conns != NGX_CONF_UNSET) {
+        flags |= NGX_STREAM_UPSTREAM_MAX_CONNS;
+    }
+
+    if (op->max_fails != NGX_CONF_UNSET) {
+        flags |= NGX_STREAM_UPSTREAM_MAX_FAILS;
+    }
+
+    if (op->fail_timeout != NGX_CONF_UNSET) {
+        flags |= NGX_STREAM_UPSTREAM_FAIL_TIMEOUT;
+    }
+
+    if (op->slow_start != NGX_CONF_UNSET_MSEC) {
+        flags |= NGX_STREAM_UPSTREAM_SLOW_START;
+    }
+
+    if (op->down != NGX_CONF_UNSET) {
+        flags |= NGX_STREAM_UPSTREAM_DOWN;
+    }
+
+    if (op->backup) {
+        flags |= NGX_STREAM_UPSTREAM_BACKUP;
+    }
+
+    if ((uscf->flags & flags) != flags) {
+        op->error = "parameter is not supported by the balancer";
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    peers = uscf->peer.data;
+
+    ngx_stream_upstream_rr_peers_wlock(peers);
+
+    if (peers->next) {
+        ngx_stream_upstream_rr_peers_wlock(peers->next);
+    }
+
+    peer = NULL;
+    list = NULL;
+
+    if (op->add) {
+        rc = ngx_http_upstream_conf_stream_add(op, peers, &peer);
+
+    } else if (op->remove) {
+        rc = ngx_http_upstream_conf_stream_remove(op, peers);
+
+    } else if (op->id != NGX_CONF_UNSET) {
+        peer = ngx_http_upstream_conf_stream_find(peers, op->id, &list);
+
+        if (peer == NULL) {
+            op->error = "server not found";
+            rc = NGX_HTTP_NOT_FOUND;
+
+        } else {
+            rc = ngx_http_upstream_conf_stream_modify(op, peer);
+
+            if (rc == NGX_OK) {
+                ngx_http_upstream_conf_stream_update(peers,
+                                             op->weight != NGX_CONF_UNSET);
+            }
+        }
+
+    } else {
+        rc = NGX_OK;
+    }
+
+    if (rc != NGX_OK) {
+        goto done;
+    }
+
+    if (peer) {
+        n = 1;
+
+    } else {
+        n = peers->number + (peers->next ? peers->next->number : 0);
+    }
+
+    b = ngx_create_temp_buf(r->pool, n * NGX_HTTP_UPSTREAM_CONF_LINE + 1);
+    if (b == NULL) {
+        rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+        goto done;
+    }
+
+    if (peer) {
+        if (list == NULL) {
+            list = op->backup ? peers->next : peers;
+        }
+
+        b->last = ngx_http_upstream_conf_stream_peer(b->last, peer,
+                                                     list != peers);
+
+    } else {
+        for (list = peers; list; list = list->next) {
+            for (peer = list->peer; peer; peer = peer->next) {
+                b->last = ngx_http_upstream_conf_stream_peer(b->last, peer,
+                                                             list != peers);
+            }
+        }
+    }
+
+    *bp = b;
+
+    rc = NGX_HTTP_OK;
+
+done:
+
+    if (peers->next) {
+        ngx_stream_upstream_rr_peers_unlock(peers->next);
+    }
+
+    ngx_stream_upstream_rr_peers_unlock(peers);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_stream_add(ngx_http_upstream_conf_op_t *op,
+    ngx_stream_upstream_rr_peers_t *peers,
+    ngx_stream_upstream_rr_peer_t **peerp)
+{
+    ngx_stream_upstream_rr_peer_t   *peer, **pp;
+    ngx_stream_upstream_rr_peers_t  *list;
+
+    if (op->backup) {
+        if (peers->next == NULL) {
+            op->error = "upstream has no backup servers";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        list = peers->next;
+
+    } else {
+        list = peers;
+    }
+
+    ngx_shmtx_lock(&peers->shpool->mutex);
+
+    peer = ngx_stream_upstream_zone_copy_peer(list, NULL);
+
+    if (peer) {
+        peer->server.data = ngx_slab_alloc_locked(peers->shpool,
+                                                  op->server.len);
+        if (peer->server.data == NULL) {
+            ngx_stream_upstream_zone_free_peer(list, peer);
+            peer = NULL;
+        }
+    }
+
+    ngx_shmtx_unlock(&peers->shpool->mutex);
+
+    if (peer == NULL) {
+        op->error = "no memory in upstream zone";
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ngx_memcpy(peer->sockaddr, op->addr.sockaddr, op->addr.socklen);
+    peer->socklen = op->addr.socklen;
+
+    peer->name.len = ngx_sock_ntop(peer->sockaddr, peer->socklen,
+                                   peer->name.data, NGX_SOCKADDR_STRLEN, 1);
+
+    ngx_memcpy(peer->server.data, op->server.data, op->server.len);
+    peer->server.len = op->server.len;
+
+    peer->weight = (op->weight != NGX_CONF_UNSET) ? op->weight : 1;
+    peer->effective_weight = peer->weight;
+    peer->max_conns = (op->max_conns != NGX_CONF_UNSET) ? op->max_conns : 0;
+    peer->max_fails = (op->max_fails != NGX_CONF_UNSET) ? op->max_fails : 1;
+    peer->fail_timeout = (op->fail_timeout != NGX_CONF_UNSET)
+                         ? op->fail_timeout : 10;
+    peer->down = (op->down == 1);
+
+    if (op->slow_start != NGX_CONF_UNSET_MSEC) {
+        peer->slow_start = op->slow_start;
+        peer->start_time = ngx_current_msec;
+    }
+
+    peer->id = peers->next_id++;
+
+    for (pp = &list->peer; *pp; pp = &(*pp)->next) {
+
+        /*
+         * the added peer has no per-worker weights, so the list is
+         * selected under the write lock until the configuration is reloaded
+         */
+
+        (*pp)->local = NULL;
+    }
+
+    *pp = peer;
+
+    ngx_http_upstream_conf_stream_update(peers, 1);
+
+    *peerp = peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_stream_remove(ngx_http_upstream_conf_op_t *op,
+    ngx_stream_upstream_rr_peers_t *peers)
+{
+    ngx_stream_upstream_rr_peer_t   *peer, **pp;
+    ngx_stream_upstream_rr_peers_t  *list;
+
+    for (list = peers; list; list = list->next) {
+
+        for (pp = &list->peer; *pp; pp = &(*pp)->next) {
+
+            peer = *pp;
+
+            if (peer->id != (ngx_uint_t) op->id) {
+                continue;
+            }
+
+            if (list->number == 1) {
+                op->error = "cannot remove the last server";
+                return NGX_HTTP_CONFLICT;
+            }
+
+            *pp = peer->next;
+
+            /*
+             * a peer still in use is freed by the last session
+             * releasing it, see ngx_stream_upstream_free_round_robin_peer()
+             */
+
+            if (peer->conns) {
+                peer->zombie = 1;
+
+            } else {
+                ngx_shmtx_lock(&peers->shpool->mutex);
+                ngx_stream_upstream_zone_free_peer(list, peer);
+                ngx_shmtx_unlock(&peers->shpool->mutex);
+            }
+
+            ngx_http_upstream_conf_stream_update(peers, 1);
+
+            return NGX_OK;
+        }
+    }
+
+    op->error = "server not found";
+
+    return NGX_HTTP_NOT_FOUND;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_stream_modify(ngx_http_upstream_conf_op_t *op,
+    ngx_stream_upstream_rr_peer_t *peer)
+{
+    if (op->weight != NGX_CONF_UNSET) {
+        peer->weight = op->weight;
+        peer->effective_weight = op->weight;
+        peer->current_weight = 0;
+    }
+
+    if (op->max_conns != NGX_CONF_UNSET) {
+        peer->max_conns = op->max_conns;
+    }
+
+    if (op->max_fails != NGX_CONF_UNSET) {
+        peer->max_fails = op->max_fails;
+    }
+
+    if (op->fail_timeout != NGX_CONF_UNSET) {
+        peer->fail_timeout = op->fail_timeout;
+    }
+
+    if (op->slow_start != NGX_CONF_UNSET_MSEC) {
+        peer->slow_start = op->slow_start;
+    }
+
+    if (op->down == 1) {
+        peer->down |= 1;
+
+    } else if (op->down == 0 && (peer->down & 1)) {
+        peer->down &= ~1;
+        peer->fails = 0;
+
+        if (peer->slow_start) {
+            peer->start_time = ngx_current_msec;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_stream_upstream_rr_peer_t *
+ngx_http_upstream_conf_stream_find(ngx_stream_upstream_rr_peers_t *peers,
+    ngx_uint_t id, ngx_stream_upstream_rr_peers_t **listp)
+{
+    ngx_stream_upstream_rr_peer_t   *peer;
+    ngx_stream_upstream_rr_peers_t  *list;
+
+    for (list = peers; list; list = list->next) {
+        for (peer = list->peer; peer; peer = peer->next) {
+            if (peer->id == id) {
+                *listp = list;
+                return peer;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_upstream_conf_stream_update(ngx_stream_upstream_rr_peers_t *peers,
+    ngx_uint_t changed)
+{
+    ngx_uint_t                       n, w, t;
+    ngx_stream_upstream_rr_peer_t   *peer;
+    ngx_stream_upstream_rr_peers_t  *list;
+
+    for (list = peers; list; list = list->next) {
+
+        n = 0;
+        w = 0;
+        t = 0;
+
+        for (peer = list->peer; peer; peer = peer->next) {
+            n++;
+            w += peer->weight;
+
+            if (!(peer->down & ~NGX_STREAM_UPSTREAM_RR_UNHEALTHY)) {
+                t++;
+            }
+        }
+
+        list->number = n;
+        list->total_weight = w;
+        list->weighted = (w != n);
+        list->tries = t;
+
+        if (changed) {
+            list->config++;
+        }
+    }
+
+    peers->single = (peers->number == 1 && peers->next == NULL);
+}
+
+
+static u_char *
+ngx_http_upstream_conf_stream_peer(u_char *p,
+    ngx_stream_upstream_rr_peer_t *peer, ngx_uint_t backup)
+{
+    p = ngx_sprintf(p, "server %V weight=%i max_conns=%ui max_fails=%ui "
+                    "fail_timeout=%Ts",
+                    &peer->name, peer->weight, peer->max_conns,
+                    peer->max_fails, peer->fail_timeout);
+
+    if (peer->slow_start) {
+        p = ngx_sprintf(p, " slow_start=%Mms", peer->slow_start);
+    }
+
+    if (backup) {
+        p = ngx_cpymem(p, " backup", sizeof(" backup") - 1);
+    }
+
+    if (peer->down & ~NGX_STREAM_UPSTREAM_RR_UNHEALTHY) {
+        p = ngx_cpymem(p, " down", sizeof(" down") - 1);
+    }
+
+    p = ngx_sprintf(p, "; # id=%ui", peer->id);
+
+    if (peer->down & NGX_STREAM_UPSTREAM_RR_UNHEALTHY) {
+        p = ngx_cpymem(p, " unhealthy", sizeof(" unhealthy") - 1);
+    }
+
+    *p++ = LF;
+
+    return p;
+}
+
+#endif
+
+
+static char *
+ngx_http_upstream_conf(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_upstream_conf_handler;
+
+    return NGX_CONF_OK;
+}
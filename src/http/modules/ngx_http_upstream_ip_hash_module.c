@@ -163,7 +163,10 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_rlock(iphp->rrp.peers);
 
-    if (iphp->tries > 20 || iphp->rrp.peers->single) {
+    if (iphp->tries > 20
+        || iphp->rrp.peers->single
+        || ngx_http_upstream_rr_peers_changed(&iphp->rrp))
+    {
         ngx_http_upstream_rr_peers_unlock(iphp->rrp.peers);
         return iphp->get_rr_peer(pc, &iphp->rrp);
     }
@@ -237,7 +240,7 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
     pc->socklen = peer->socklen;
     pc->name = &peer->name;
 
-    peer->conns++;
+    ngx_http_upstream_rr_peer_inc_conns(iphp->rrp.peers, peer);
 
     if (now - peer->checked > peer->fail_timeout) {
         peer->checked = now;
@@ -9,6 +9,28 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if !(NGX_WIN32)
+#include <ngx_channel.h>
+#endif
+
+
+typedef struct {
+    ngx_atomic_t                       pid;
+    ngx_atomic_t                       slot;
+    ngx_atomic_t                       idle;
+    ngx_atomic_t                       want;
+} ngx_http_upstream_keepalive_worker_t;
+
+
+typedef struct {
+    ngx_http_upstream_keepalive_worker_t  workers[NGX_MAX_PROCESSES];
+} ngx_http_upstream_keepalive_shctx_t;
+
+
+typedef struct {
+    ngx_array_t                        shared;
+} ngx_http_upstream_keepalive_main_conf_t;
+
 
 typedef struct {
     ngx_uint_t                         max_cached;
@@ -19,6 +41,13 @@ typedef struct {
     ngx_queue_t                        cache;
     ngx_queue_t                        free;
 
+    ngx_flag_t                         shared;
+    ngx_uint_t                         index;
+    ngx_uint_t                         nworkers;
+    ngx_shm_zone_t                    *shm_zone;
+    ngx_http_upstream_keepalive_shctx_t   *sh;
+    ngx_http_upstream_keepalive_worker_t  *worker;
+
     ngx_http_upstream_init_pt          original_init_upstream;
     ngx_http_upstream_init_peer_pt     original_init_peer;
 
@@ -62,9 +91,21 @@ static ngx_int_t ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc,
 static void ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
 
+static void ngx_http_upstream_keepalive_save(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf, ngx_connection_t *c,
+    struct sockaddr *sockaddr, socklen_t socklen);
 static void ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close(ngx_connection_t *c);
+static void ngx_http_upstream_keepalive_count(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf, ngx_atomic_int_t n);
+
+#if !(NGX_WIN32)
+static ngx_int_t ngx_http_upstream_keepalive_pass(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf, ngx_connection_t *c,
+    ngx_peer_connection_t *pc);
+static void ngx_http_upstream_keepalive_receive(ngx_channel_t *ch);
+#endif
 
 #if (NGX_HTTP_SSL)
 static ngx_int_t ngx_http_upstream_keepalive_set_session(
@@ -73,9 +114,13 @@ static void ngx_http_upstream_keepalive_save_session(ngx_peer_connection_t *pc,
     void *data);
 #endif
 
+static ngx_int_t ngx_http_upstream_keepalive_init_zone(
+    ngx_shm_zone_t *shm_zone, void *data);
+static void *ngx_http_upstream_keepalive_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf);
 static char *ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static ngx_int_t ngx_http_upstream_keepalive_init_process(ngx_cycle_t *cycle);
 
 
 static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
@@ -108,6 +153,13 @@ static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
       offsetof(ngx_http_upstream_keepalive_srv_conf_t, requests),
       NULL },
 
+    { ngx_string("keepalive_shared"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_keepalive_srv_conf_t, shared),
+      NULL },
+
       ngx_null_command
 };
 
@@ -116,7 +168,8 @@ static ngx_http_module_t  ngx_http_upstream_keepalive_module_ctx = {
     NULL,                                  /* preconfiguration */
     NULL,                                  /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
+    ngx_http_upstream_keepalive_create_main_conf,
+                                           /* create main configuration */
     NULL,                                  /* init main configuration */
 
     ngx_http_upstream_keepalive_create_conf, /* create server configuration */
@@ -134,7 +187,7 @@ ngx_module_t  ngx_http_upstream_keepalive_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_upstream_keepalive_init_process, /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -147,19 +200,28 @@ static ngx_int_t
 ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us)
 {
-    ngx_uint_t                               i;
-    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
-    ngx_http_upstream_keepalive_cache_t     *cached;
+    ngx_str_t                                 name;
+    ngx_uint_t                                i;
+    ngx_http_upstream_keepalive_srv_conf_t  **kcfp, *kcf;
+    ngx_http_upstream_main_conf_t            *umcf;
+    ngx_http_upstream_keepalive_cache_t      *cached;
+    ngx_http_upstream_keepalive_main_conf_t  *kmcf;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
                    "init keepalive");
 
+    /* let stub_status know that keepalive statistics are collected */
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+    umcf->keepalive = 1;
+
     kcf = ngx_http_conf_upstream_srv_conf(us,
                                           ngx_http_upstream_keepalive_module);
 
     ngx_conf_init_msec_value(kcf->time, 3600000);
     ngx_conf_init_msec_value(kcf->timeout, 60000);
     ngx_conf_init_uint_value(kcf->requests, 1000);
+    ngx_conf_init_value(kcf->shared, 0);
 
     if (kcf->original_init_upstream(cf, us) != NGX_OK) {
         return NGX_ERROR;
@@ -185,6 +247,54 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
         cached[i].conf = kcf;
     }
 
+    if (!kcf->shared) {
+        return NGX_OK;
+    }
+
+#if (NGX_WIN32)
+
+    ngx_log_error(NGX_LOG_WARN, cf->log, 0,
+                  "\"keepalive_shared\" is not supported "
+                  "on this platform, ignored");
+
+    kcf->shared = 0;
+
+#else
+
+    /* a zone with per-worker counters, connections are passed via channels */
+
+    kmcf = ngx_http_conf_get_module_main_conf(cf,
+                                          ngx_http_upstream_keepalive_module);
+
+    name.len = sizeof("upstream_keepalive_") - 1 + us->host.len;
+    name.data = ngx_pnalloc(cf->pool, name.len);
+    if (name.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(name.data, "upstream_keepalive_%V", &us->host);
+
+    kcf->shm_zone = ngx_shared_memory_add(cf, &name,
+                               8 * ngx_pagesize
+                               + sizeof(ngx_http_upstream_keepalive_shctx_t),
+                               &ngx_http_upstream_keepalive_module);
+    if (kcf->shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    kcf->shm_zone->init = ngx_http_upstream_keepalive_init_zone;
+    kcf->shm_zone->data = kcf;
+
+    kcfp = ngx_array_push(&kmcf->shared);
+    if (kcfp == NULL) {
+        return NGX_ERROR;
+    }
+
+    kcf->index = kmcf->shared.nelts - 1;
+    *kcfp = kcf;
+
+#endif
+
     return NGX_OK;
 }
 
@@ -275,6 +385,18 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
         }
     }
 
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_keepalive_missed, 1);
+#endif
+
+    if (kp->conf->worker
+        && (ngx_pid_t) kp->conf->worker->pid == ngx_pid
+        && kp->conf->worker->want < kp->conf->max_cached)
+    {
+        /* ask other workers to pass idle connections */
+        (void) ngx_atomic_fetch_add(&kp->conf->worker->want, 1);
+    }
+
     return NGX_OK;
 
 found:
@@ -282,6 +404,12 @@ found:
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get keepalive peer: using connection %p", c);
 
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_keepalive_reused, 1);
+#endif
+
+    ngx_http_upstream_keepalive_count(kp->conf, -1);
+
     c->idle = 0;
     c->sent = 0;
     c->data = NULL;
@@ -306,9 +434,7 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_uint_t state)
 {
     ngx_http_upstream_keepalive_peer_data_t  *kp = data;
-    ngx_http_upstream_keepalive_cache_t      *item;
 
-    ngx_queue_t          *q;
     ngx_connection_t     *c;
     ngx_http_upstream_t  *u;
 
@@ -351,6 +477,17 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         goto invalid;
     }
 
+#if !(NGX_WIN32)
+
+    if (kp->conf->worker
+        && ngx_http_upstream_keepalive_pass(kp->conf, c, pc) == NGX_OK)
+    {
+        pc->connection = NULL;
+        goto invalid;
+    }
+
+#endif
+
     if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
         goto invalid;
     }
@@ -358,9 +495,26 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "free keepalive peer: saving connection %p", c);
 
-    if (ngx_queue_empty(&kp->conf->free)) {
+    pc->connection = NULL;
+
+    ngx_http_upstream_keepalive_save(kp->conf, c, pc->sockaddr, pc->socklen);
+
+invalid:
+
+    kp->original_free_peer(pc, kp->data, state);
+}
+
+
+static void
+ngx_http_upstream_keepalive_save(ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_connection_t *c, struct sockaddr *sockaddr, socklen_t socklen)
+{
+    ngx_queue_t                          *q;
+    ngx_http_upstream_keepalive_cache_t  *item;
 
-        q = ngx_queue_last(&kp->conf->cache);
+    if (ngx_queue_empty(&kcf->free)) {
+
+        q = ngx_queue_last(&kcf->cache);
         ngx_queue_remove(q);
 
         item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
@@ -368,20 +522,20 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         ngx_http_upstream_keepalive_close(item->connection);
 
     } else {
-        q = ngx_queue_head(&kp->conf->free);
+        q = ngx_queue_head(&kcf->free);
         ngx_queue_remove(q);
 
         item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+
+        ngx_http_upstream_keepalive_count(kcf, 1);
     }
 
-    ngx_queue_insert_head(&kp->conf->cache, q);
+    ngx_queue_insert_head(&kcf->cache, q);
 
     item->connection = c;
 
-    pc->connection = NULL;
-
     c->read->delayed = 0;
-    ngx_add_timer(c->read, kp->conf->timeout);
+    ngx_add_timer(c->read, kcf->timeout);
 
     if (c->write->timer_set) {
         ngx_del_timer(c->write);
@@ -397,16 +551,12 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     c->write->log = ngx_cycle->log;
     c->pool->log = ngx_cycle->log;
 
-    item->socklen = pc->socklen;
-    ngx_memcpy(&item->sockaddr, pc->sockaddr, pc->socklen);
+    item->socklen = socklen;
+    ngx_memcpy(&item->sockaddr, sockaddr, socklen);
 
     if (c->read->ready) {
         ngx_http_upstream_keepalive_close_handler(c->read);
     }
-
-invalid:
-
-    kp->original_free_peer(pc, kp->data, state);
 }
 
 
@@ -458,6 +608,8 @@ close:
 
     ngx_queue_remove(&item->queue);
     ngx_queue_insert_head(&conf->free, &item->queue);
+
+    ngx_http_upstream_keepalive_count(conf, -1);
 }
 
 
@@ -484,6 +636,256 @@ ngx_http_upstream_keepalive_close(ngx_connection_t *c)
 }
 
 
+static void
+ngx_http_upstream_keepalive_count(ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_atomic_int_t n)
+{
+    ngx_http_upstream_keepalive_worker_t  *w;
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_keepalive_idle, n);
+#endif
+
+    w = kcf->worker;
+
+    if (w == NULL || (ngx_pid_t) w->pid != ngx_pid) {
+        return;
+    }
+
+    (void) ngx_atomic_fetch_add(&w->idle, n);
+
+    if (n > 0) {
+        /* the worker has idle connections again */
+        w->want = 0;
+    }
+}
+
+
+#if !(NGX_WIN32)
+
+static ngx_int_t
+ngx_http_upstream_keepalive_pass(ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_connection_t *c, ngx_peer_connection_t *pc)
+{
+    ngx_int_t                              rc, slot;
+    ngx_uint_t                             i;
+    ngx_channel_t                          ch;
+    ngx_atomic_uint_t                      want;
+    ngx_http_upstream_keepalive_worker_t  *self, *w;
+
+    /*
+     * only plain connections without per-connection state
+     * can be passed to another worker
+     */
+
+    if (pc->sockaddr->sa_family == AF_UNIX
+        || c->pool->cleanup
+#if (NGX_HTTP_SSL)
+        || c->ssl
+#endif
+       )
+    {
+        return NGX_DECLINED;
+    }
+
+    self = kcf->worker;
+
+    if ((ngx_pid_t) self->pid != ngx_pid || self->idle == 0) {
+        return NGX_DECLINED;
+    }
+
+    for (i = 0; i < kcf->nworkers; i++) {
+        w = &kcf->sh->workers[i];
+
+        if (w == self || w->pid == 0) {
+            continue;
+        }
+
+        want = w->want;
+
+        if (want == 0 || w->idle >= self->idle) {
+            continue;
+        }
+
+        slot = w->slot;
+
+        if (slot < 0
+            || slot >= NGX_MAX_PROCESSES
+            || ngx_processes[slot].pid != (ngx_pid_t) w->pid
+            || ngx_processes[slot].channel[0] == -1)
+        {
+            continue;
+        }
+
+        if (!ngx_atomic_cmp_set(&w->want, want, want - 1)) {
+            continue;
+        }
+
+        /*
+         * the events are registered for the file description rather than
+         * for the descriptor, and the description stays open in the other
+         * worker, so they must be deleted before the connection is closed
+         * with NGX_CLOSE_EVENT
+         */
+
+        rc = NGX_OK;
+
+        if (ngx_del_conn) {
+            if (c->read->active || c->write->active) {
+                rc = ngx_del_conn(c, 0);
+            }
+
+        } else {
+            if (c->read->active || c->read->disabled) {
+                rc = ngx_del_event(c->read, NGX_READ_EVENT, 0);
+            }
+
+            if (rc == NGX_OK && (c->write->active || c->write->disabled)) {
+                rc = ngx_del_event(c->write, NGX_WRITE_EVENT, 0);
+            }
+        }
+
+        if (rc != NGX_OK) {
+            (void) ngx_atomic_fetch_add(&w->want, 1);
+            return NGX_DECLINED;
+        }
+
+        ch.command = NGX_CMD_PASS_CONNECTION;
+        ch.pid = ngx_pid;
+        ch.slot = kcf->index;
+        ch.fd = c->fd;
+
+        if (ngx_write_channel(ngx_processes[slot].channel[0], &ch,
+                              sizeof(ngx_channel_t), c->log)
+            != NGX_OK)
+        {
+            (void) ngx_atomic_fetch_add(&w->want, 1);
+            return NGX_DECLINED;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "free keepalive peer: passed connection %p to %P",
+                       c, (ngx_pid_t) w->pid);
+
+        ngx_http_upstream_keepalive_close(c);
+
+        return NGX_OK;
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_http_upstream_keepalive_receive(ngx_channel_t *ch)
+{
+    socklen_t                                 socklen;
+    ngx_uint_t                                i;
+    ngx_sockaddr_t                            sa;
+    ngx_connection_t                         *c;
+    ngx_http_upstream_keepalive_srv_conf_t   *kcf;
+    ngx_http_upstream_keepalive_main_conf_t  *kmcf;
+
+    kmcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
+                                          ngx_http_upstream_keepalive_module);
+
+    if (ngx_exiting
+        || ngx_terminate
+        || kmcf == NULL
+        || ch->slot < 0
+        || (ngx_uint_t) ch->slot >= kmcf->shared.nelts)
+    {
+        goto failed;
+    }
+
+    kcf = ((ngx_http_upstream_keepalive_srv_conf_t **)
+                                               kmcf->shared.elts)[ch->slot];
+
+    if (kcf->worker == NULL) {
+        goto failed;
+    }
+
+    /* the sender must be a worker with the same configuration */
+
+    for (i = 0; i < kcf->nworkers; i++) {
+        if ((ngx_pid_t) kcf->sh->workers[i].pid == ch->pid) {
+            break;
+        }
+    }
+
+    if (i == kcf->nworkers) {
+        goto failed;
+    }
+
+    socklen = sizeof(ngx_sockaddr_t);
+
+    if (getpeername(ch->fd, &sa.sockaddr, &socklen) == -1) {
+        ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, ngx_socket_errno,
+                      "getpeername() of passed connection failed");
+        goto failed;
+    }
+
+    c = ngx_get_connection(ch->fd, ngx_cycle->log);
+    if (c == NULL) {
+        goto failed;
+    }
+
+    c->pool = ngx_create_pool(128, ngx_cycle->log);
+    if (c->pool == NULL) {
+        ngx_close_connection(c);
+        return;
+    }
+
+    c->type = SOCK_STREAM;
+    c->recv = ngx_recv;
+    c->send = ngx_send;
+    c->recv_chain = ngx_recv_chain;
+    c->send_chain = ngx_send_chain;
+    c->sendfile = 1;
+    c->log_error = NGX_ERROR_ERR;
+
+    c->read->log = c->log;
+    c->write->log = c->log;
+    c->write->ready = 1;
+
+    c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+    c->start_time = ngx_current_msec;
+
+    if (ngx_add_conn) {
+        if (ngx_add_conn(c) == NGX_ERROR) {
+            ngx_http_upstream_keepalive_close(c);
+            return;
+        }
+    }
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_http_upstream_keepalive_close(c);
+        return;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "keepalive connection %p fd:%d passed from %P",
+                   c, ch->fd, ch->pid);
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_keepalive_passed, 1);
+#endif
+
+    ngx_http_upstream_keepalive_save(kcf, c, &sa.sockaddr, socklen);
+
+    return;
+
+failed:
+
+    if (close(ch->fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "close() passed connection failed");
+    }
+}
+
+#endif
+
+
 #if (NGX_HTTP_SSL)
 
 static ngx_int_t
@@ -529,11 +931,68 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
     conf->time = NGX_CONF_UNSET_MSEC;
     conf->timeout = NGX_CONF_UNSET_MSEC;
     conf->requests = NGX_CONF_UNSET_UINT;
+    conf->shared = NGX_CONF_UNSET;
 
     return conf;
 }
 
 
+static void *
+ngx_http_upstream_keepalive_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_keepalive_main_conf_t  *kmcf;
+
+    kmcf = ngx_pcalloc(cf->pool,
+                       sizeof(ngx_http_upstream_keepalive_main_conf_t));
+    if (kmcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&kmcf->shared, cf->pool, 1,
+                       sizeof(ngx_http_upstream_keepalive_srv_conf_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return kmcf;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_upstream_keepalive_srv_conf_t  *okcf = data;
+
+    ngx_slab_pool_t                         *shpool;
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+
+    kcf = shm_zone->data;
+
+    if (okcf) {
+        kcf->sh = okcf->sh;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        kcf->sh = shpool->data;
+        return NGX_OK;
+    }
+
+    kcf->sh = ngx_slab_calloc(shpool,
+                              sizeof(ngx_http_upstream_keepalive_shctx_t));
+    if (kcf->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = kcf->sh;
+
+    return NGX_OK;
+}
+
+
 static char *
 ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -574,3 +1033,53 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     return NGX_CONF_OK;
 }
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_init_process(ngx_cycle_t *cycle)
+{
+#if !(NGX_WIN32)
+
+    ngx_uint_t                                i;
+    ngx_core_conf_t                          *ccf;
+    ngx_http_upstream_keepalive_worker_t     *w;
+    ngx_http_upstream_keepalive_srv_conf_t  **kcfp;
+    ngx_http_upstream_keepalive_main_conf_t  *kmcf;
+
+    kmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                          ngx_http_upstream_keepalive_module);
+
+    if (kmcf == NULL
+        || kmcf->shared.nelts == 0
+        || ngx_process != NGX_PROCESS_WORKER)
+    {
+        return NGX_OK;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if (ngx_worker >= NGX_MAX_PROCESSES) {
+        return NGX_OK;
+    }
+
+    kcfp = kmcf->shared.elts;
+
+    for (i = 0; i < kmcf->shared.nelts; i++) {
+        w = &kcfp[i]->sh->workers[ngx_worker];
+
+        w->idle = 0;
+        w->want = 0;
+        w->slot = ngx_process_slot;
+        w->pid = ngx_pid;
+
+        kcfp[i]->worker = w;
+        kcfp[i]->nworkers = ngx_min((ngx_uint_t) ccf->worker_processes,
+                                    NGX_MAX_PROCESSES);
+    }
+
+    ngx_channel_pass_handler = ngx_http_upstream_keepalive_receive;
+
+#endif
+
+    return NGX_OK;
+}
@@ -104,7 +104,7 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
     time_t                         now;
     uintptr_t                      m;
     ngx_int_t                      rc, total;
-    ngx_uint_t                     i, n, p, many;
+    ngx_uint_t                     i, n, p, r, many, ramp, held;
     ngx_http_upstream_rr_peer_t   *peer, *best;
     ngx_http_upstream_rr_peers_t  *peers;
 
@@ -124,14 +124,24 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_wlock(peers);
 
-    best = NULL;
-    total = 0;
+    if (ngx_http_upstream_rr_peers_changed(rrp)) {
+        goto busy;
+    }
+
+    r = ngx_random();
+    ramp = 1;
 
 #if (NGX_SUPPRESS_WARN)
     many = 0;
     p = 0;
 #endif
 
+again:
+
+    best = NULL;
+    total = 0;
+    held = 0;
+
     for (peer = peers->peer, i = 0;
          peer;
          peer = peer->next, i++)
@@ -158,6 +168,11 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
             continue;
         }
 
+        if (ramp && ngx_http_upstream_rr_peer_slow(peer, r)) {
+            held = 1;
+            continue;
+        }
+
         /*
          * select peer with least number of connections; if there are
          * multiple peers with the same number of connections, select
@@ -176,6 +191,11 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
         }
     }
 
+    if (best == NULL && held) {
+        ramp = 0;
+        goto again;
+    }
+
     if (best == NULL) {
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                        "get least conn peer, no peer found");
@@ -217,6 +237,10 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
                 continue;
             }
 
+            if (ramp && ngx_http_upstream_rr_peer_slow(peer, r)) {
+                continue;
+            }
+
             peer->current_weight += peer->effective_weight;
             total += peer->effective_weight;
 
@@ -280,6 +304,8 @@ failed:
         ngx_http_upstream_rr_peers_wlock(peers);
     }
 
+busy:
+
     ngx_http_upstream_rr_peers_unlock(peers);
 
     pc->name = peers->name;
@@ -308,7 +334,8 @@ ngx_http_upstream_least_conn(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                   |NGX_HTTP_UPSTREAM_MAX_FAILS
                   |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
                   |NGX_HTTP_UPSTREAM_DOWN
-                  |NGX_HTTP_UPSTREAM_BACKUP;
+                  |NGX_HTTP_UPSTREAM_BACKUP
+                  |NGX_HTTP_UPSTREAM_SLOW_START;
 
     return NGX_CONF_OK;
 }
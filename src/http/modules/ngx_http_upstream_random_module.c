@@ -17,7 +17,12 @@ typedef struct {
 
 typedef struct {
     ngx_uint_t                            two;
+    ngx_uint_t                            peak_ewma;
+    ngx_msec_t                            decay;
     ngx_http_upstream_random_range_t     *ranges;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                            config;
+#endif
 } ngx_http_upstream_random_srv_conf_t;
 
 
@@ -26,6 +31,7 @@ typedef struct {
     ngx_http_upstream_rr_peer_data_t      rrp;
 
     ngx_http_upstream_random_srv_conf_t  *conf;
+    ngx_http_upstream_t                  *upstream;
     u_char                                tries;
 } ngx_http_upstream_random_peer_data_t;
 
@@ -41,9 +47,13 @@ static ngx_int_t ngx_http_upstream_get_random_peer(ngx_peer_connection_t *pc,
     void *data);
 static ngx_int_t ngx_http_upstream_get_random2_peer(ngx_peer_connection_t *pc,
     void *data);
+static void ngx_http_upstream_free_random_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
 static ngx_uint_t ngx_http_upstream_peek_random_peer(
     ngx_http_upstream_rr_peers_t *peers,
     ngx_http_upstream_random_peer_data_t *rp);
+static uint64_t ngx_http_upstream_peak_ewma_cost(
+    ngx_http_upstream_rr_peer_t *peer, ngx_msec_t decay);
 static void *ngx_http_upstream_random_create_conf(ngx_conf_t *cf);
 static char *ngx_http_upstream_random(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -52,7 +62,7 @@ static char *ngx_http_upstream_random(ngx_conf_t *cf, ngx_command_t *cmd,
 static ngx_command_t  ngx_http_upstream_random_commands[] = {
 
     { ngx_string("random"),
-      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE12,
+      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE123,
       ngx_http_upstream_random,
       NGX_HTTP_SRV_CONF_OFFSET,
       0,
@@ -136,6 +146,14 @@ ngx_http_upstream_update_random(ngx_pool_t *pool,
         return NGX_ERROR;
     }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (pool == NULL && rcf->ranges) {
+        ngx_free(rcf->ranges);
+    }
+
+    rcf->config = peers->config;
+#endif
+
     total_weight = 0;
 
     for (peer = peers->peer, i = 0; peer; peer = peer->next, i++) {
@@ -180,13 +198,20 @@ ngx_http_upstream_init_random_peer(ngx_http_request_t *r,
         r->upstream->peer.get = ngx_http_upstream_get_random_peer;
     }
 
+    if (rcf->peak_ewma) {
+        r->upstream->peer.free = ngx_http_upstream_free_random_peer;
+    }
+
     rp->conf = rcf;
+    rp->upstream = r->upstream;
     rp->tries = 0;
 
     ngx_http_upstream_rr_peers_rlock(rp->rrp.peers);
 
 #if (NGX_HTTP_UPSTREAM_ZONE)
-    if (rp->rrp.peers->shpool && rcf->ranges == NULL) {
+    if (rp->rrp.peers->shpool
+        && (rcf->ranges == NULL || rcf->config != rp->rrp.peers->config))
+    {
         if (ngx_http_upstream_update_random(NULL, us) != NGX_OK) {
             ngx_http_upstream_rr_peers_unlock(rp->rrp.peers);
             return NGX_ERROR;
@@ -220,7 +245,10 @@ ngx_http_upstream_get_random_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_rlock(peers);
 
-    if (rp->tries > 20 || peers->single) {
+    if (rp->tries > 20
+        || peers->single
+        || ngx_http_upstream_rr_peers_changed(rrp))
+    {
         ngx_http_upstream_rr_peers_unlock(peers);
         return ngx_http_upstream_get_round_robin_peer(pc, rrp);
     }
@@ -283,7 +311,7 @@ ngx_http_upstream_get_random_peer(ngx_peer_connection_t *pc, void *data)
     pc->socklen = peer->socklen;
     pc->name = &peer->name;
 
-    peer->conns++;
+    ngx_http_upstream_rr_peer_inc_conns(peers, peer);
 
     ngx_http_upstream_rr_peer_unlock(peers, peer);
     ngx_http_upstream_rr_peers_unlock(peers);
@@ -314,7 +342,10 @@ ngx_http_upstream_get_random2_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_wlock(peers);
 
-    if (rp->tries > 20 || peers->single) {
+    if (rp->tries > 20
+        || peers->single
+        || ngx_http_upstream_rr_peers_changed(rrp))
+    {
         ngx_http_upstream_rr_peers_unlock(peers);
         return ngx_http_upstream_get_round_robin_peer(pc, rrp);
     }
@@ -363,7 +394,13 @@ ngx_http_upstream_get_random2_peer(ngx_peer_connection_t *pc, void *data)
         }
 
         if (prev) {
-            if (peer->conns * prev->weight > prev->conns * peer->weight) {
+            if (rp->conf->peak_ewma
+                ? ngx_http_upstream_peak_ewma_cost(peer, rp->conf->decay)
+                  * prev->weight
+                  > ngx_http_upstream_peak_ewma_cost(prev, rp->conf->decay)
+                    * peer->weight
+                : peer->conns * prev->weight > prev->conns * peer->weight)
+            {
                 peer = prev;
                 n = p / (8 * sizeof(uintptr_t));
                 m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
@@ -403,6 +440,101 @@ ngx_http_upstream_get_random2_peer(ngx_peer_connection_t *pc, void *data)
 }
 
 
+static void
+ngx_http_upstream_free_random_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_upstream_random_peer_data_t  *rp = data;
+
+    uint64_t                       ewma;
+    ngx_msec_t                     sample;
+    ngx_msec_int_t                 elapsed;
+    ngx_http_upstream_t           *u;
+    ngx_http_upstream_rr_peer_t   *peer;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_http_upstream_rr_peers_t  *peers;
+#endif
+
+    u = rp->upstream;
+    peer = rp->rrp.current;
+
+    if (peer == NULL || (state & NGX_PEER_FAILED) || u->state == NULL) {
+        goto done;
+    }
+
+    /* time to the response header, or to the end of an unfinished try */
+
+    if (u->state->header_time != (ngx_msec_t) -1) {
+        sample = u->state->header_time;
+
+    } else {
+        sample = ngx_current_msec - u->start_time;
+    }
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    peers = rp->rrp.peers;
+#endif
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+    ngx_http_upstream_rr_peer_lock(peers, peer);
+
+    /*
+     * peak EWMA: a slower sample replaces the average at once, faster
+     * samples are weighted by the time elapsed since the previous one
+     */
+
+    ewma = (uint64_t) sample << 8;
+
+    if (ewma < peer->ewma) {
+        elapsed = (ngx_msec_int_t) (ngx_current_msec - peer->ewma_time);
+
+        if (elapsed < 0) {
+            elapsed = 0;
+        }
+
+        ewma = ((uint64_t) peer->ewma * rp->conf->decay + ewma * elapsed)
+               / (rp->conf->decay + elapsed);
+    }
+
+    peer->ewma = (ngx_uint_t) ewma;
+    peer->ewma_time = ngx_current_msec;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free random peer %V, sample:%M ewma:%ui",
+                   &peer->name, sample, peer->ewma >> 8);
+
+    ngx_http_upstream_rr_peer_unlock(peers, peer);
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+done:
+
+    ngx_http_upstream_free_round_robin_peer(pc, data, state);
+}
+
+
+static uint64_t
+ngx_http_upstream_peak_ewma_cost(ngx_http_upstream_rr_peer_t *peer,
+    ngx_msec_t decay)
+{
+    uint64_t        ewma;
+    ngx_msec_int_t  elapsed;
+
+    /* stale measurements decay towards zero */
+
+    elapsed = (ngx_msec_int_t) (ngx_current_msec - peer->ewma_time);
+
+    if (elapsed < 0) {
+        elapsed = 0;
+    }
+
+    ewma = (uint64_t) peer->ewma * decay / (decay + elapsed);
+
+    /* one millisecond is added so that idle peers still compare by load */
+
+    return (ewma + 256) * (peer->conns + 1);
+}
+
+
 static ngx_uint_t
 ngx_http_upstream_peek_random_peer(ngx_http_upstream_rr_peers_t *peers,
     ngx_http_upstream_random_peer_data_t *rp)
@@ -443,8 +575,11 @@ ngx_http_upstream_random_create_conf(ngx_conf_t *cf)
      * set by ngx_pcalloc():
      *
      *     conf->two = 0;
+     *     conf->peak_ewma = 0;
      */
 
+    conf->decay = 10000;
+
     return conf;
 }
 
@@ -454,7 +589,7 @@ ngx_http_upstream_random(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_upstream_random_srv_conf_t  *rcf = conf;
 
-    ngx_str_t                     *value;
+    ngx_str_t                     *value, s;
     ngx_http_upstream_srv_conf_t  *uscf;
 
     uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
@@ -492,11 +627,36 @@ ngx_http_upstream_random(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_OK;
     }
 
-    if (ngx_strcmp(value[2].data, "least_conn") != 0) {
+    if (ngx_strcmp(value[2].data, "peak_ewma") == 0) {
+        rcf->peak_ewma = 1;
+
+    } else if (ngx_strcmp(value[2].data, "least_conn") != 0) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[2]);
         return NGX_CONF_ERROR;
     }
 
-    return NGX_CONF_OK;
+    if (cf->args->nelts == 3) {
+        return NGX_CONF_OK;
+    }
+
+    if (rcf->peak_ewma && ngx_strncmp(value[3].data, "decay=", 6) == 0) {
+
+        s.len = value[3].len - 6;
+        s.data = value[3].data + 6;
+
+        rcf->decay = ngx_parse_time(&s, 0);
+
+        if (rcf->decay == (ngx_msec_t) NGX_ERROR || rcf->decay == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid decay \"%V\"", &value[3]);
+            return NGX_CONF_ERROR;
+        }
+
+        return NGX_CONF_OK;
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[3]);
+    return NGX_CONF_ERROR;
 }
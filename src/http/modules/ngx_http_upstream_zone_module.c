@@ -16,8 +16,6 @@ static ngx_int_t ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone,
     void *data);
 static ngx_http_upstream_rr_peers_t *ngx_http_upstream_zone_copy_peers(
     ngx_slab_pool_t *shpool, ngx_http_upstream_srv_conf_t *uscf);
-static ngx_http_upstream_rr_peer_t *ngx_http_upstream_zone_copy_peer(
-    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *src);
 
 
 static ngx_command_t  ngx_http_upstream_zone_commands[] = {
@@ -188,6 +186,7 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
     ngx_http_upstream_srv_conf_t *uscf)
 {
     ngx_str_t                     *name;
+    ngx_uint_t                     id;
     ngx_http_upstream_rr_peer_t   *peer, **peerp;
     ngx_http_upstream_rr_peers_t  *peers, *backup;
 
@@ -215,6 +214,8 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
 
     peers->shpool = shpool;
 
+    id = 0;
+
     for (peerp = &peers->peer; *peerp; peerp = &peer->next) {
         /* pool is unlocked */
         peer = ngx_http_upstream_zone_copy_peer(peers, *peerp);
@@ -222,6 +223,8 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
             return NULL;
         }
 
+        peer->id = id++;
+
         *peerp = peer;
     }
 
@@ -247,6 +250,8 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
             return NULL;
         }
 
+        peer->id = id++;
+
         *peerp = peer;
     }
 
@@ -254,13 +259,17 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
 
 done:
 
+    /* identifiers of peers added at run time */
+
+    peers->next_id = id;
+
     uscf->peer.data = peers;
 
     return peers;
 }
 
 
-static ngx_http_upstream_rr_peer_t *
+ngx_http_upstream_rr_peer_t *
 ngx_http_upstream_zone_copy_peer(ngx_http_upstream_rr_peers_t *peers,
     ngx_http_upstream_rr_peer_t *src)
 {
@@ -279,6 +288,15 @@ ngx_http_upstream_zone_copy_peer(ngx_http_upstream_rr_peers_t *peers,
         dst->sockaddr = NULL;
         dst->name.data = NULL;
         dst->server.data = NULL;
+
+#if !(NGX_WIN32)
+        /*
+         * the configuration copy of the peer is inherited by each worker
+         * process at the same address, and keeps per-worker weights
+         */
+
+        dst->local = src;
+#endif
     }
 
     dst->sockaddr = ngx_slab_calloc_locked(pool, sizeof(ngx_sockaddr_t));
@@ -323,3 +341,28 @@ failed:
 
     return NULL;
 }
+
+
+void
+ngx_http_upstream_zone_free_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    ngx_slab_pool_t  *pool;
+
+    pool = peers->shpool;
+
+    if (peer->server.data) {
+        ngx_slab_free_locked(pool, peer->server.data);
+    }
+
+    ngx_slab_free_locked(pool, peer->name.data);
+    ngx_slab_free_locked(pool, peer->sockaddr);
+
+#if (NGX_HTTP_SSL)
+    if (peer->ssl_session) {
+        ngx_slab_free_locked(pool, peer->ssl_session);
+    }
+#endif
+
+    ngx_slab_free_locked(pool, peer);
+}
@@ -37,6 +37,7 @@ typedef u_char *(*ngx_http_log_handler_pt)(ngx_http_request_t *r,
 
 #if (NGX_HTTP_V2)
 #include <ngx_http_v2.h>
+#include <ngx_http_upstream_mux.h>
 #endif
 #if (NGX_HTTP_CACHE)
 #include <ngx_http_cache.h>
@@ -168,6 +169,7 @@ ngx_uint_t  ngx_http_degraded(ngx_http_request_t *);
 
 
 #if (NGX_HTTP_V2)
+void ngx_http_huff_decode_init(void);
 ngx_int_t ngx_http_huff_decode(u_char *state, u_char *src, size_t len,
     u_char **dst, ngx_uint_t last, ngx_log_t *log);
 size_t ngx_http_huff_encode(u_char *src, size_t len, u_char *dst,
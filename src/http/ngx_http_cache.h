@@ -36,6 +36,22 @@ typedef struct {
 } ngx_http_cache_valid_t;
 
 
+/* worker process slots which can be notified about a cache fill */
+#define NGX_HTTP_CACHE_FILL_SLOTS    64
+
+
+typedef struct {
+    ngx_str_t                        name;
+    off_t                            length;
+    uint64_t                         waiters;
+    ngx_uint_t                       count;
+
+    unsigned                         published:1;
+    unsigned                         done:1;
+    unsigned                         error:1;
+} ngx_http_file_cache_fill_t;
+
+
 typedef struct {
     ngx_rbtree_node_t                node;
     ngx_queue_t                      queue;
@@ -59,6 +75,7 @@ typedef struct {
     size_t                           body_start;
     off_t                            fs_size;
     ngx_msec_t                       lock_time;
+    ngx_http_file_cache_fill_t      *fill;
 } ngx_http_file_cache_node_t;
 
 
@@ -106,6 +123,9 @@ struct ngx_http_cache_s {
     ngx_msec_t                       wait_time;
 
     ngx_event_t                      wait_event;
+    ngx_queue_t                      wait_queue;
+
+    ngx_http_file_cache_fill_t      *fill;
 
     unsigned                         lock:1;
     unsigned                         waiting:1;
@@ -122,6 +142,9 @@ struct ngx_http_cache_s {
 
     unsigned                         stale_updating:1;
     unsigned                         stale_error:1;
+
+    unsigned                         hot:1;
+    unsigned                         fill_missed:1;
 };
 
 
@@ -156,10 +179,46 @@ typedef struct {
 } ngx_http_file_cache_sh_t;
 
 
+typedef struct {
+    ngx_rbtree_node_t                node;
+    ngx_queue_t                      queue;
+
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN
+                                         - sizeof(ngx_rbtree_key_t)];
+
+    ngx_file_uniq_t                  uniq;
+    size_t                           len;
+    u_char                           data[1];
+} ngx_http_file_cache_hot_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                     rbtree;
+    ngx_rbtree_node_t                sentinel;
+    ngx_queue_t                      queue;
+    void                            *keys;
+    size_t                           size;
+    ngx_uint_t                       count;
+} ngx_http_file_cache_hot_sh_t;
+
+
+typedef struct {
+    ngx_http_file_cache_sh_t        *sh;
+    ngx_slab_pool_t                 *shpool;
+} ngx_http_file_cache_shard_t;
+
+
 struct ngx_http_file_cache_s {
     ngx_http_file_cache_sh_t        *sh;
     ngx_slab_pool_t                 *shpool;
 
+    ngx_http_file_cache_shard_t     *shards;
+    ngx_uint_t                       nshards;
+    ngx_uint_t                       next_shard;
+
+    ngx_http_file_cache_hot_sh_t    *hot_sh;
+    ngx_slab_pool_t                 *hot_shpool;
+
     ngx_path_t                      *path;
 
     off_t                            min_free;
@@ -175,6 +234,8 @@ struct ngx_http_file_cache_s {
     ngx_msec_t                       last;
     ngx_msec_t                       loader_sleep;
     ngx_msec_t                       loader_threshold;
+    ngx_uint_t                       loader_threads;
+    ngx_flag_t                       snapshot;
 
     ngx_uint_t                       manager_files;
     ngx_msec_t                       manager_sleep;
@@ -182,6 +243,10 @@ struct ngx_http_file_cache_s {
 
     ngx_shm_zone_t                  *shm_zone;
 
+    ngx_shm_zone_t                  *hot_zone;
+    size_t                           hot_max_size;
+    ngx_uint_t                       hot_min_uses;
+
     ngx_uint_t                       use_temp_path;
                                      /* unsigned use_temp_path:1 */
 };
@@ -193,6 +258,7 @@ void ngx_http_file_cache_create_key(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_open(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf);
 void ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf);
+void ngx_http_file_cache_progress(ngx_http_request_t *r, ngx_temp_file_t *tf);
 void ngx_http_file_cache_update_header(ngx_http_request_t *r);
 ngx_int_t ngx_http_cache_send(ngx_http_request_t *);
 void ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf);
@@ -138,6 +138,18 @@ ngx_http_copy_filter(ngx_http_request_t *r, ngx_chain_t *in)
         }
     }
 
+#if (NGX_HTTP_SSL)
+    if (c->ssl && !c->ssl->sendfile && !ctx->need_in_memory) {
+
+        /*
+         * SSL_sendfile() has failed, the rest of the response
+         * is read into memory, see ngx_ssl_sendfile()
+         */
+
+        ctx->need_in_memory = 1;
+    }
+#endif
+
 #if (NGX_HAVE_FILE_AIO || NGX_THREADS)
     ctx->aio = r->aio;
 #endif
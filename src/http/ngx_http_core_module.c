@@ -81,7 +81,7 @@ static char *ngx_http_gzip_disable(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 #endif
 static ngx_int_t ngx_http_get_forwarded_addr_internal(ngx_http_request_t *r,
-    ngx_addr_t *addr, u_char *xff, size_t xfflen, ngx_array_t *proxies,
+    ngx_addr_t *addr, u_char *xff, size_t xfflen, ngx_cidr_tree_t *proxies,
     int recursive);
 #if (NGX_HAVE_OPENAT)
 static char *ngx_http_disable_symlinks(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -2712,7 +2712,7 @@ ngx_http_set_disable_symlinks(ngx_http_request_t *r,
 
 ngx_int_t
 ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
-    ngx_array_t *headers, ngx_str_t *value, ngx_array_t *proxies,
+    ngx_array_t *headers, ngx_str_t *value, ngx_cidr_tree_t *proxies,
     int recursive)
 {
     ngx_int_t          rc;
@@ -2759,7 +2759,7 @@ ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
 
 static ngx_int_t
 ngx_http_get_forwarded_addr_internal(ngx_http_request_t *r, ngx_addr_t *addr,
-    u_char *xff, size_t xfflen, ngx_array_t *proxies, int recursive)
+    u_char *xff, size_t xfflen, ngx_cidr_tree_t *proxies, int recursive)
 {
     u_char      *p;
     ngx_addr_t   paddr;
@@ -2769,7 +2769,7 @@ ngx_http_get_forwarded_addr_internal(ngx_http_request_t *r, ngx_addr_t *addr,
 
     do {
 
-        if (ngx_cidr_match(addr->sockaddr, proxies) != NGX_OK) {
+        if (ngx_cidr_tree_match(addr->sockaddr, proxies) != NGX_OK) {
             return found ? NGX_DONE : NGX_DECLINED;
         }
 
@@ -10,12 +10,88 @@
 #include <ngx_http.h>
 #include <ngx_md5.h>
 
+#if !(NGX_WIN32)
+#include <ngx_channel.h>
+#endif
+
+
+#define NGX_HTTP_FILE_CACHE_SNAPSHOT_MAGIC    0x53434e47  /* "NGCS" */
+#define NGX_HTTP_FILE_CACHE_SNAPSHOT_VERSION  1
+#define NGX_HTTP_FILE_CACHE_SNAPSHOT_BATCH    512
+
+
+typedef struct {
+    ngx_http_file_cache_t           *cache;
+    ngx_array_t                     *dirs;
+    ngx_uint_t                       files;
+    ngx_msec_t                       last;
+} ngx_http_file_cache_loader_ctx_t;
+
+
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_http_file_cache_t           *cache;
+    ngx_array_t                     *dirs;
+    ngx_uint_t                       next;
+    ngx_uint_t                       abort;
+    ngx_thread_mutex_t               mutex;
+} ngx_http_file_cache_loader_work_t;
+
+#endif
+
+
+typedef struct {
+    uint32_t                         magic;
+    uint32_t                         version;
+    uint32_t                         node_size;
+    uint32_t                         bsize;
+    uint64_t                         count;
+} ngx_http_file_cache_snapshot_header_t;
+
+
+typedef struct {
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_file_uniq_t                  uniq;
+    time_t                           expire;
+    time_t                           valid_sec;
+    off_t                            fs_size;
+    size_t                           body_start;
+    ngx_uint_t                       uses;
+    ngx_uint_t                       valid_msec;
+} ngx_http_file_cache_snapshot_node_t;
+
 
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
 static void ngx_http_file_cache_lock_wait(ngx_http_request_t *r,
     ngx_http_cache_t *c);
+static ngx_int_t ngx_http_file_cache_fill_open(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_fill_handler(ngx_event_t *ev);
+static void ngx_http_file_cache_fill_writer(ngx_http_request_t *r);
+static void ngx_http_file_cache_fill_send(ngx_http_request_t *r);
+static ngx_uint_t ngx_http_file_cache_fill_wait_locked(
+    ngx_http_file_cache_shard_t *shard, ngx_http_file_cache_node_t *fcn);
+static ngx_uint_t ngx_http_file_cache_fill_subscribe(
+    ngx_http_file_cache_fill_t *fill);
+static uint64_t ngx_http_file_cache_fill_finish_locked(
+    ngx_http_file_cache_shard_t *shard, ngx_http_cache_t *c, ngx_uint_t error);
+static uint64_t ngx_http_file_cache_fill_release_locked(
+    ngx_http_file_cache_shard_t *shard, ngx_http_file_cache_node_t *fcn,
+    ngx_http_file_cache_fill_t *fill);
+static void ngx_http_file_cache_fill_detach_locked(
+    ngx_http_file_cache_shard_t *shard, ngx_http_cache_t *c);
+static void ngx_http_file_cache_fill_free_locked(
+    ngx_http_file_cache_shard_t *shard, ngx_http_file_cache_fill_t *fill);
+static void ngx_http_file_cache_fill_notify(uint64_t waiters);
+static void ngx_http_file_cache_wake(void);
+#if !(NGX_WIN32)
+static void ngx_http_file_cache_notify(ngx_channel_t *ch);
+#endif
+static void ngx_http_file_cache_wait_add(ngx_http_cache_t *c);
+static void ngx_http_file_cache_wait_delete(ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_read(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
@@ -33,7 +109,7 @@ static ngx_int_t ngx_http_file_cache_exists(ngx_http_file_cache_t *cache,
 static ngx_int_t ngx_http_file_cache_name(ngx_http_request_t *r,
     ngx_path_t *path);
 static ngx_http_file_cache_node_t *
-    ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key);
+    ngx_http_file_cache_lookup(ngx_http_file_cache_shard_t *shard, u_char *key);
 static void ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 static void ngx_http_file_cache_vary(ngx_http_request_t *r, u_char *vary,
@@ -45,11 +121,25 @@ static ngx_int_t ngx_http_file_cache_reopen(ngx_http_request_t *r,
 static ngx_int_t ngx_http_file_cache_update_variant(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_cleanup(void *data);
-static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache);
-static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache);
+static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard);
+static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard);
 static void ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
-    ngx_queue_t *q, u_char *name);
-static void ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache);
+    ngx_http_file_cache_shard_t *shard, ngx_queue_t *q, u_char *name);
+static void ngx_http_file_cache_loader_init_tree(ngx_tree_ctx_t *tree,
+    ngx_http_file_cache_loader_ctx_t *lctx, ngx_http_file_cache_t *cache);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_file_cache_loader_threads(
+    ngx_http_file_cache_t *cache, ngx_tree_ctx_t *tree);
+static void *ngx_http_file_cache_loader_thread(void *data);
+static void ngx_http_file_cache_loader_walk(
+    ngx_http_file_cache_loader_work_t *work);
+static ngx_int_t ngx_http_file_cache_collect_directory(ngx_tree_ctx_t *ctx,
+    ngx_str_t *path);
+#endif
+static void ngx_http_file_cache_loader_sleep(
+    ngx_http_file_cache_loader_ctx_t *lctx);
 static ngx_int_t ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
 static ngx_int_t ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx,
@@ -62,7 +152,34 @@ static ngx_int_t ngx_http_file_cache_add(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
-static void ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_set_watermark(
+    ngx_http_file_cache_shard_t *shard);
+static ngx_int_t ngx_http_file_cache_snapshot_name(ngx_http_file_cache_t *cache,
+    ngx_str_t *name, ngx_str_t *temp, ngx_log_t *log);
+static void ngx_http_file_cache_snapshot_save(void *data);
+static ngx_int_t ngx_http_file_cache_snapshot_load(
+    ngx_http_file_cache_t *cache, ngx_log_t *log);
+static ngx_int_t ngx_http_file_cache_snapshot_add(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard,
+    ngx_http_file_cache_snapshot_node_t *sn);
+
+static ngx_int_t ngx_http_file_cache_shard_init(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_http_file_cache_hot_init(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_http_file_cache_hot_open(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_hot_add(ngx_http_request_t *r,
+    ngx_http_cache_t *c, size_t n);
+static void ngx_http_file_cache_hot_delete(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_http_file_cache_hot_node_t *
+    ngx_http_file_cache_hot_lookup(ngx_http_file_cache_t *cache, u_char *key);
+static void ngx_http_file_cache_hot_rbtree_insert_value(
+    ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel);
+static void ngx_http_file_cache_hot_free_locked(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_hot_node_t *hn);
 
 
 ngx_str_t  ngx_http_cache_status[] = {
@@ -79,6 +196,31 @@ ngx_str_t  ngx_http_cache_status[] = {
 static u_char  ngx_http_file_cache_key[] = { LF, 'K', 'E', 'Y', ':', ' ' };
 
 
+/* requests of the worker waiting for cache fills */
+static ngx_queue_t  ngx_http_file_cache_waiters;
+
+
+/*
+ * the rbtree key is taken from the start of the md5 key,
+ * so the shard is selected by its last bytes
+ */
+
+static ngx_inline ngx_http_file_cache_shard_t *
+ngx_http_file_cache_shard(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_uint_t  n;
+
+    if (cache->nshards == 1) {
+        return &cache->shards[0];
+    }
+
+    n = (key[NGX_HTTP_CACHE_KEY_LEN - 2] << 8)
+        | key[NGX_HTTP_CACHE_KEY_LEN - 1];
+
+    return &cache->shards[n % cache->nshards];
+}
+
+
 static ngx_int_t
 ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
@@ -90,6 +232,12 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     cache = shm_zone->data;
 
+    ngx_queue_init(&ngx_http_file_cache_waiters);
+
+#if !(NGX_WIN32)
+    ngx_channel_notify_handler = ngx_http_file_cache_notify;
+#endif
+
     if (ocache) {
         if (ngx_strcmp(cache->path->name.data, ocache->path->name.data) != 0) {
             ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
@@ -110,11 +258,21 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
             }
         }
 
+        if (cache->nshards != ocache->nshards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache \"%V\" had previously different shards",
+                          &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
         cache->sh = ocache->sh;
 
         cache->shpool = ocache->shpool;
         cache->bsize = ocache->bsize;
 
+        cache->shards[0].sh = cache->sh;
+        cache->shards[0].shpool = cache->shpool;
+
         cache->max_size /= cache->bsize;
 
         if (!cache->sh->cold || cache->sh->loading) {
@@ -131,6 +289,9 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
         cache->bsize = ngx_fs_bsize(cache->path->name.data);
         cache->max_size /= cache->bsize;
 
+        cache->shards[0].sh = cache->sh;
+        cache->shards[0].shpool = cache->shpool;
+
         return NGX_OK;
     }
 
@@ -168,6 +329,147 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     cache->shpool->log_nomem = 0;
 
+    cache->shards[0].sh = cache->sh;
+    cache->shards[0].shpool = cache->shpool;
+
+    /* the other shards are initialized earlier, see set_slot() */
+
+    if (cache->snapshot && !ngx_test_config
+        && ngx_http_file_cache_snapshot_load(cache, shm_zone->shm.log)
+           == NGX_OK)
+    {
+        cache->sh->cold = 0;
+        cache->path->loader = NULL;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_shard_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_file_cache_shard_t  *oshard = data;
+
+    size_t                        len;
+    ngx_http_file_cache_shard_t  *shard;
+
+    shard = shm_zone->data;
+
+    if (oshard) {
+        shard->sh = oshard->sh;
+        shard->shpool = oshard->shpool;
+        return NGX_OK;
+    }
+
+    shard->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shard->sh = shard->shpool->data;
+        return NGX_OK;
+    }
+
+    shard->sh = ngx_slab_calloc(shard->shpool,
+                                sizeof(ngx_http_file_cache_sh_t));
+    if (shard->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shard->shpool->data = shard->sh;
+
+    ngx_rbtree_init(&shard->sh->rbtree, &shard->sh->sentinel,
+                    ngx_http_file_cache_rbtree_insert_value);
+
+    ngx_queue_init(&shard->sh->queue);
+
+    shard->sh->watermark = (ngx_uint_t) -1;
+
+    len = sizeof(" in cache keys zone \"\"") + shm_zone->shm.name.len;
+
+    shard->shpool->log_ctx = ngx_slab_alloc(shard->shpool, len);
+    if (shard->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shard->shpool->log_ctx, " in cache keys zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    shard->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_hot_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_file_cache_t  *ocache = data;
+
+    size_t                  len;
+    ngx_queue_t            *q;
+    ngx_http_file_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache && ocache->hot_zone) {
+        cache->hot_sh = ocache->hot_sh;
+        cache->hot_shpool = ocache->hot_shpool;
+
+    } else {
+        cache->hot_shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+        if (shm_zone->shm.exists) {
+            cache->hot_sh = cache->hot_shpool->data;
+            return NGX_OK;
+        }
+
+        cache->hot_sh = ngx_slab_alloc(cache->hot_shpool,
+                                       sizeof(ngx_http_file_cache_hot_sh_t));
+        if (cache->hot_sh == NULL) {
+            return NGX_ERROR;
+        }
+
+        cache->hot_shpool->data = cache->hot_sh;
+
+        ngx_rbtree_init(&cache->hot_sh->rbtree, &cache->hot_sh->sentinel,
+                        ngx_http_file_cache_hot_rbtree_insert_value);
+
+        ngx_queue_init(&cache->hot_sh->queue);
+
+        cache->hot_sh->keys = NULL;
+        cache->hot_sh->size = 0;
+        cache->hot_sh->count = 0;
+
+        len = sizeof(" in cache hot zone \"\"") + shm_zone->shm.name.len;
+
+        cache->hot_shpool->log_ctx = ngx_slab_alloc(cache->hot_shpool, len);
+        if (cache->hot_shpool->log_ctx == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_sprintf(cache->hot_shpool->log_ctx, " in cache hot zone \"%V\"%Z",
+                    &shm_zone->shm.name);
+
+        cache->hot_shpool->log_nomem = 0;
+    }
+
+    if (cache->hot_sh->keys != cache->sh) {
+
+        /* copies of files of the previous keys zone cannot be verified */
+
+        ngx_shmtx_lock(&cache->hot_shpool->mutex);
+
+        while (!ngx_queue_empty(&cache->hot_sh->queue)) {
+            q = ngx_queue_head(&cache->hot_sh->queue);
+            ngx_http_file_cache_hot_free_locked(cache,
+                   ngx_queue_data(q, ngx_http_file_cache_hot_node_t, queue));
+        }
+
+        cache->hot_sh->keys = cache->sh;
+
+        ngx_shmtx_unlock(&cache->hot_shpool->mutex);
+    }
+
     return NGX_OK;
 }
 
@@ -264,6 +566,7 @@ ngx_http_file_cache_create_key(ngx_http_request_t *r)
 ngx_int_t
 ngx_http_file_cache_open(ngx_http_request_t *r)
 {
+    size_t                     len;
     ngx_int_t                  rc, rv;
     ngx_uint_t                 test;
     ngx_http_cache_t          *c;
@@ -345,6 +648,18 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         goto done;
     }
 
+    if (cache->hot_zone && c->exists) {
+        rc = ngx_http_file_cache_hot_open(r, c);
+
+        if (rc == NGX_OK) {
+            return ngx_http_file_cache_read(r, c);
+        }
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     ngx_memzero(&of, sizeof(ngx_open_file_info_t));
@@ -384,7 +699,18 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
     c->length = of.size;
     c->fs_size = (of.fs_size + cache->bsize - 1) / cache->bsize;
 
-    c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+    len = c->body_start;
+
+    if (cache->hot_zone
+        && c->length > (off_t) len
+        && c->length <= (off_t) cache->hot_max_size
+        && c->node->uses >= cache->hot_min_uses)
+    {
+        /* read the whole file at once to add it to the hot zone */
+        len = (size_t) c->length;
+    }
+
+    c->buf = ngx_create_temp_buf(r->pool, len);
     if (c->buf == NULL) {
         return NGX_ERROR;
     }
@@ -404,8 +730,11 @@ done:
 static ngx_int_t
 ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_msec_t                 now, timer;
-    ngx_http_file_cache_t     *cache;
+    uint64_t                      waiters;
+    ngx_msec_t                    now, timer, lock;
+    ngx_uint_t                    notified;
+    ngx_http_file_cache_fill_t   *fill;
+    ngx_http_file_cache_shard_t  *shard;
 
     if (!c->lock) {
         return NGX_DECLINED;
@@ -413,24 +742,53 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     now = ngx_current_msec;
 
-    cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(c->file_cache, c->key);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    waiters = 0;
+    notified = 0;
 
-    timer = c->node->lock_time - now;
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    lock = c->node->lock_time - now;
+
+    if (!c->node->updating || (ngx_msec_int_t) lock <= 0) {
+
+        /* waiters of the previous lock owner's fill, if any, recheck */
+
+        if (c->node->fill) {
+            waiters = ngx_http_file_cache_fill_release_locked(shard, c->node,
+                                                              c->node->fill);
+        }
 
-    if (!c->node->updating || (ngx_msec_int_t) timer <= 0) {
         c->node->updating = 1;
         c->node->lock_time = now + c->lock_age;
         c->updating = 1;
         c->lock_time = c->node->lock_time;
+
+    } else if (c->lock_timeout) {
+
+        fill = c->node->fill;
+
+        if (fill && fill->published && !fill->error && !c->fill_missed
+            && r == r->main)
+        {
+            /* read the response while it is being written */
+
+            fill->count++;
+            c->fill = fill;
+
+        } else {
+            notified = ngx_http_file_cache_fill_wait_locked(shard, c->node);
+        }
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache lock u:%d wt:%M",
-                   c->updating, c->wait_time);
+    ngx_http_file_cache_fill_notify(waiters);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache lock u:%d f:%p wt:%M",
+                   c->updating, c->fill, c->wait_time);
 
     if (c->updating) {
         return NGX_DECLINED;
@@ -440,19 +798,34 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
         return NGX_HTTP_CACHE_SCARCE;
     }
 
+    if (c->fill) {
+        return ngx_http_file_cache_fill_open(r, c);
+    }
+
     c->waiting = 1;
 
     if (c->wait_time == 0) {
         c->wait_time = now + c->lock_timeout;
-
-        c->wait_event.handler = ngx_http_file_cache_lock_wait_handler;
-        c->wait_event.data = r;
-        c->wait_event.log = r->connection->log;
     }
 
+    c->wait_event.handler = ngx_http_file_cache_lock_wait_handler;
+    c->wait_event.data = r;
+    c->wait_event.log = r->connection->log;
+
     timer = c->wait_time - now;
 
-    ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
+    if (timer > lock) {
+        timer = lock;
+    }
+
+    if (notified) {
+        ngx_http_file_cache_wait_add(c);
+
+    } else if (timer > 500) {
+        timer = 500;
+    }
+
+    ngx_add_timer(&c->wait_event, timer);
 
     r->main->blocked++;
 
@@ -474,6 +847,10 @@ ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev)
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "http file cache wait: \"%V?%V\"", &r->uri, &r->args);
 
+    if (ev->timer_set) {
+        ngx_del_timer(ev);
+    }
+
     ngx_http_file_cache_lock_wait(r, r->cache);
 
     ngx_http_run_posted_requests(c);
@@ -483,9 +860,10 @@ ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev)
 static void
 ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_uint_t              wait;
-    ngx_msec_t              now, timer;
-    ngx_http_file_cache_t  *cache;
+    ngx_uint_t                    wait, notified;
+    ngx_msec_t                    now, timer, lock;
+    ngx_http_file_cache_fill_t   *fill;
+    ngx_http_file_cache_shard_t  *shard;
 
     now = ngx_current_msec;
 
@@ -498,26 +876,50 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
         goto wakeup;
     }
 
-    cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(c->file_cache, c->key);
     wait = 0;
+    notified = 0;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
-    timer = c->node->lock_time - now;
+    lock = c->node->lock_time - now;
 
-    if (c->node->updating && (ngx_msec_int_t) timer > 0) {
-        wait = 1;
+    if (c->node->updating && (ngx_msec_int_t) lock > 0) {
+
+        fill = c->node->fill;
+
+        /* a published fill is read after the wakeup */
+
+        if (fill == NULL || !fill->published || fill->error
+            || c->fill_missed || r != r->main)
+        {
+            wait = 1;
+            notified = ngx_http_file_cache_fill_wait_locked(shard, c->node);
+        }
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     if (wait) {
-        ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
+        if (timer > lock) {
+            timer = lock;
+        }
+
+        if (notified) {
+            ngx_http_file_cache_wait_add(c);
+
+        } else if (timer > 500) {
+            timer = 500;
+        }
+
+        ngx_add_timer(&c->wait_event, timer);
         return;
     }
 
 wakeup:
 
+    ngx_http_file_cache_wait_delete(c);
+
     c->waiting = 0;
     r->main->blocked--;
     r->write_event_handler(r);
@@ -525,1766 +927,3447 @@ wakeup:
 
 
 static ngx_int_t
-ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
+ngx_http_file_cache_fill_open(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    u_char                        *p;
-    time_t                         now;
-    ssize_t                        n;
-    ngx_str_t                     *key;
-    ngx_int_t                      rc;
-    ngx_uint_t                     i;
-    ngx_http_file_cache_t         *cache;
-    ngx_http_file_cache_header_t  *h;
+    u_char                       *name;
+    ngx_open_file_info_t          of;
+    ngx_http_core_loc_conf_t     *clcf;
+    ngx_http_file_cache_fill_t   *fill;
+    ngx_http_file_cache_shard_t  *shard;
 
-    n = ngx_http_file_cache_aio_read(r, c);
+    fill = c->fill;
+    shard = ngx_http_file_cache_shard(c->file_cache, c->key);
 
-    if (n < 0) {
-        return n;
+    name = ngx_pnalloc(r->pool, fill->name.len + 1);
+    if (name == NULL) {
+        return NGX_ERROR;
     }
 
-    if ((size_t) n < c->header_start) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      "cache file \"%s\" is too small", c->file.name.data);
-        return NGX_DECLINED;
-    }
+    ngx_memcpy(name, fill->name.data, fill->name.len + 1);
 
-    h = (ngx_http_file_cache_header_t *) c->buf->pos;
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
-    if (h->version != NGX_HTTP_CACHE_VERSION) {
-        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
-                      "cache file \"%s\" version mismatch", c->file.name.data);
-        return NGX_DECLINED;
-    }
+    c->length = fill->length;
 
-    if (h->crc32 != c->crc32 || (size_t) h->header_start != c->header_start) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      "cache file \"%s\" has md5 collision", c->file.name.data);
-        return NGX_DECLINED;
-    }
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
-    p = c->buf->pos + sizeof(ngx_http_file_cache_header_t)
-        + sizeof(ngx_http_file_cache_key);
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache fill: \"%s\" %O", name, c->length);
 
-    key = c->keys.elts;
-    for (i = 0; i < c->keys.nelts; i++) {
-        if (ngx_memcmp(p, key[i].data, key[i].len) != 0) {
-            ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                          "cache file \"%s\" has md5 collision",
-                          c->file.name.data);
-            return NGX_DECLINED;
-        }
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-        p += key[i].len;
-    }
+    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
 
-    if ((size_t) h->body_start > c->body_start) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      "cache file \"%s\" has too long header",
-                      c->file.name.data);
-        return NGX_DECLINED;
-    }
+    of.directio = NGX_OPEN_FILE_DIRECTIO_OFF;
+    of.read_ahead = clcf->read_ahead;
 
-    if (h->vary_len > NGX_HTTP_CACHE_VARY_LEN) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      "cache file \"%s\" has incorrect vary length",
-                      c->file.name.data);
-        return NGX_DECLINED;
-    }
+    c->file.name.len = fill->name.len;
+    c->file.name.data = name;
 
-    if (h->vary_len) {
-        ngx_http_file_cache_vary(r, h->vary, h->vary_len, c->variant);
+    if (ngx_open_cached_file(NULL, &c->file.name, &of, r->pool) != NGX_OK) {
 
-        if (ngx_memcmp(c->variant, h->variant, NGX_HTTP_CACHE_KEY_LEN) != 0) {
-            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                           "http file cache vary mismatch");
-            return ngx_http_file_cache_reopen(r, c);
-        }
-    }
+        ngx_shmtx_lock(&shard->shpool->mutex);
+        ngx_http_file_cache_fill_detach_locked(shard, c);
+        ngx_shmtx_unlock(&shard->shpool->mutex);
 
-    c->buf->last += n;
+        c->file.name.len = 0;
 
-    c->valid_sec = h->valid_sec;
-    c->updating_sec = h->updating_sec;
-    c->error_sec = h->error_sec;
-    c->last_modified = h->last_modified;
-    c->date = h->date;
-    c->valid_msec = h->valid_msec;
-    c->body_start = h->body_start;
-    c->etag.len = h->etag_len;
-    c->etag.data = h->etag;
+        switch (of.err) {
 
-    r->cached = 1;
+        case 0:
+            return NGX_ERROR;
 
-    cache = c->file_cache;
+        case NGX_ENOENT:
+        case NGX_ENOTDIR:
+            break;
 
-    if (cache->sh->cold) {
+        default:
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, of.err,
+                          ngx_open_file_n " \"%s\" failed", name);
+            return NGX_ERROR;
+        }
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        /*
+         * the fill has been completed or abandoned meanwhile, and
+         * the request waits for the lock instead of reading the fill
+         * again while the node is not yet updated
+         */
 
-        if (!c->node->exists) {
-            c->node->uses = 1;
-            c->node->body_start = c->body_start;
-            c->node->exists = 1;
-            c->node->uniq = c->uniq;
-            c->node->fs_size = c->fs_size;
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, of.err,
+                       "http file cache fill open: \"%s\" failed", name);
 
-            cache->sh->size += c->fs_size;
-        }
+        c->fill_missed = 1;
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return ngx_http_file_cache_open(r);
     }
 
-    now = ngx_time();
+    c->file.fd = of.fd;
+    c->file.log = r->connection->log;
+    c->uniq = of.uniq;
 
-    if (c->valid_sec < now) {
-        c->stale_updating = c->valid_sec + c->updating_sec >= now;
-        c->stale_error = c->valid_sec + c->error_sec >= now;
+    c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+    if (c->buf == NULL) {
+        return NGX_ERROR;
+    }
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+    return ngx_http_file_cache_read(r, c);
+}
 
-        if (c->node->updating) {
-            rc = NGX_HTTP_CACHE_UPDATING;
 
-        } else {
-            c->node->updating = 1;
-            c->updating = 1;
-            c->lock_time = c->node->lock_time;
-            rc = NGX_HTTP_CACHE_STALE;
-        }
+static void
+ngx_http_file_cache_fill_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+    r = ev->data;
+    c = r->connection;
 
-        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "http file cache expired: %i %T %T",
-                       rc, c->valid_sec, now);
+    ngx_http_set_log_request(c->log, r);
 
-        return rc;
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http file cache fill handler: \"%V?%V\"",
+                   &r->uri, &r->args);
+
+    if (ev->timer_set) {
+        ngx_del_timer(ev);
     }
 
-    return NGX_OK;
+    if (r->buffered || r->postponed || c->buffered || r->aio
+        || c->write->delayed)
+    {
+        /* the writer sends the rest when the output is flushed */
+        return;
+    }
+
+    ngx_http_file_cache_fill_send(r);
+
+    ngx_http_run_posted_requests(c);
 }
 
 
-static ssize_t
-ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
+static void
+ngx_http_file_cache_fill_writer(ngx_http_request_t *r)
 {
-#if (NGX_HAVE_FILE_AIO || NGX_THREADS)
-    ssize_t                    n;
+    ngx_int_t                  rc;
+    ngx_event_t               *wev;
+    ngx_connection_t          *c;
     ngx_http_core_loc_conf_t  *clcf;
 
-    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
-#endif
+    c = r->connection;
+    wev = c->write;
 
-#if (NGX_HAVE_FILE_AIO)
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, wev->log, 0,
+                   "http file cache fill writer: \"%V?%V\"",
+                   &r->uri, &r->args);
 
-    if (clcf->aio == NGX_HTTP_AIO_ON && ngx_file_aio) {
-        n = ngx_file_aio_read(&c->file, c->buf->pos, c->body_start, 0, r->pool);
+    clcf = ngx_http_get_module_loc_conf(r->main, ngx_http_core_module);
 
-        if (n != NGX_AGAIN) {
-            c->reading = 0;
-            return n;
-        }
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT,
+                      "client timed out");
+        c->timedout = 1;
 
-        c->reading = 1;
+        ngx_http_finalize_request(r, NGX_HTTP_REQUEST_TIME_OUT);
+        return;
+    }
 
-        c->file.aio->data = r;
-        c->file.aio->handler = ngx_http_cache_aio_event_handler;
+    if (wev->delayed || r->aio) {
 
-        r->main->blocked++;
-        r->aio = 1;
+        if (!wev->delayed) {
+            ngx_add_timer(wev, clcf->send_timeout);
+        }
 
-        return NGX_AGAIN;
+        if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+        }
+
+        return;
     }
 
-#endif
+    rc = ngx_http_output_filter(r, NULL);
 
-#if (NGX_THREADS)
+    if (rc == NGX_ERROR) {
+        ngx_http_finalize_request(r, rc);
+        return;
+    }
 
-    if (clcf->aio == NGX_HTTP_AIO_THREADS) {
-        c->file.thread_task = c->thread_task;
-        c->file.thread_handler = ngx_http_cache_thread_handler;
-        c->file.thread_ctx = r;
+    if (r->buffered || r->postponed || c->buffered) {
 
-        n = ngx_thread_read(&c->file, c->buf->pos, c->body_start, 0, r->pool);
+        if (!wev->delayed) {
+            ngx_add_timer(wev, clcf->send_timeout);
+        }
 
-        c->thread_task = c->file.thread_task;
-        c->reading = (n == NGX_AGAIN);
+        if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+        }
 
-        return n;
+        return;
     }
 
-#endif
-
-    return ngx_read_file(&c->file, c->buf->pos, c->body_start, 0);
+    ngx_http_file_cache_fill_send(r);
 }
 
 
-#if (NGX_HAVE_FILE_AIO)
-
 static void
-ngx_http_cache_aio_event_handler(ngx_event_t *ev)
+ngx_http_file_cache_fill_send(ngx_http_request_t *r)
 {
-    ngx_event_aio_t     *aio;
-    ngx_connection_t    *c;
-    ngx_http_request_t  *r;
+    off_t                         length;
+    ngx_int_t                     rc;
+    ngx_buf_t                    *b;
+    ngx_uint_t                    done, error, notified;
+    ngx_chain_t                   out;
+    ngx_event_t                  *wev;
+    ngx_http_cache_t             *c;
+    ngx_http_core_loc_conf_t     *clcf;
+    ngx_http_file_cache_fill_t   *fill;
+    ngx_http_file_cache_shard_t  *shard;
 
-    aio = ev->data;
-    r = aio->data;
-    c = r->connection;
+    c = r->cache;
+    fill = c->fill;
+    wev = r->connection->write;
 
-    ngx_http_set_log_request(c->log, r);
+    shard = ngx_http_file_cache_shard(c->file_cache, c->key);
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
-                   "http file cache aio: \"%V?%V\"", &r->uri, &r->args);
+    for ( ;; ) {
 
-    r->main->blocked--;
-    r->aio = 0;
+        notified = 0;
 
-    r->write_event_handler(r);
+        ngx_shmtx_lock(&shard->shpool->mutex);
 
-    ngx_http_run_posted_requests(c);
-}
+        length = fill->length;
+        done = fill->done;
+        error = fill->error;
 
-#endif
+        if (length == c->length && !done && !error) {
+            notified = ngx_http_file_cache_fill_subscribe(fill);
+        }
 
+        ngx_shmtx_unlock(&shard->shpool->mutex);
 
-#if (NGX_THREADS)
+        ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache fill send: %O-%O d:%ui e:%ui",
+                       c->length, length, done, error);
 
-static ngx_int_t
-ngx_http_cache_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
-{
-    ngx_str_t                  name;
-    ngx_thread_pool_t         *tp;
-    ngx_http_request_t        *r;
-    ngx_http_core_loc_conf_t  *clcf;
+        if (error) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "cache file \"%s\" was not completed",
+                          c->file.name.data);
 
-    r = file->thread_ctx;
+            ngx_http_file_cache_wait_delete(c);
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
 
-    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
-    tp = clcf->thread_pool;
+        if (length == c->length && !done) {
 
-    if (tp == NULL) {
-        if (ngx_http_complex_value(r, clcf->thread_pool_value, &name)
-            != NGX_OK)
-        {
-            return NGX_ERROR;
-        }
+            if (wev->timer_set && !wev->delayed) {
+                ngx_del_timer(wev);
+            }
 
-        tp = ngx_thread_pool_get((ngx_cycle_t *) ngx_cycle, &name);
+            if (notified) {
+                ngx_http_file_cache_wait_add(c);
+            }
 
-        if (tp == NULL) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                          "thread pool \"%V\" not found", &name);
-            return NGX_ERROR;
+            ngx_add_timer(&c->wait_event,
+                          (notified && c->lock_age > 500) ? c->lock_age : 500);
+            return;
         }
-    }
 
-    task->event.data = r;
-    task->event.handler = ngx_http_cache_thread_event_handler;
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
 
-    if (ngx_thread_task_post(tp, task) != NGX_OK) {
-        return NGX_ERROR;
-    }
+        b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
 
-    r->main->blocked++;
-    r->aio = 1;
+        b->file_pos = c->length;
+        b->file_last = length;
+        b->in_file = (length - c->length) ? 1 : 0;
 
-    return NGX_OK;
-}
+        b->file->fd = c->file.fd;
+        b->file->name = c->file.name;
+        b->file->log = r->connection->log;
 
+        b->flush = done ? 0 : 1;
+        b->last_buf = done;
+        b->last_in_chain = 1;
 
-static void
-ngx_http_cache_thread_event_handler(ngx_event_t *ev)
-{
-    ngx_connection_t    *c;
-    ngx_http_request_t  *r;
+        c->length = length;
 
-    r = ev->data;
-    c = r->connection;
+        out.buf = b;
+        out.next = NULL;
 
-    ngx_http_set_log_request(c->log, r);
+        rc = ngx_http_output_filter(r, &out);
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
-                   "http file cache thread: \"%V?%V\"", &r->uri, &r->args);
+        if (done) {
+            ngx_http_file_cache_wait_delete(c);
 
-    r->main->blocked--;
-    r->aio = 0;
+            r->write_event_handler = ngx_http_request_empty_handler;
 
-    r->write_event_handler(r);
+            ngx_http_finalize_request(r, rc);
+            return;
+        }
 
-    ngx_http_run_posted_requests(c);
-}
+        if (rc == NGX_ERROR) {
+            ngx_http_finalize_request(r, rc);
+            return;
+        }
 
-#endif
+        if (r->buffered || r->postponed || r->connection->buffered
+            || wev->delayed || r->aio)
+        {
+            clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
+            if (!wev->delayed) {
+                ngx_add_timer(wev, clcf->send_timeout);
+            }
 
-static ngx_int_t
-ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
-{
-    ngx_int_t                    rc;
-    ngx_http_file_cache_node_t  *fcn;
+            if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+                ngx_http_finalize_request(r, NGX_ERROR);
+            }
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+            return;
+        }
+    }
+}
 
-    fcn = c->node;
 
-    if (fcn == NULL) {
-        fcn = ngx_http_file_cache_lookup(cache, c->key);
+static ngx_uint_t
+ngx_http_file_cache_fill_wait_locked(ngx_http_file_cache_shard_t *shard,
+    ngx_http_file_cache_node_t *fcn)
+{
+    if (fcn->fill == NULL) {
+        fcn->fill = ngx_slab_calloc_locked(shard->shpool,
+                                           sizeof(ngx_http_file_cache_fill_t));
+        if (fcn->fill == NULL) {
+            return 0;
+        }
     }
 
-    if (fcn) {
-        ngx_queue_remove(&fcn->queue);
+    return ngx_http_file_cache_fill_subscribe(fcn->fill);
+}
 
-        if (c->node == NULL) {
-            fcn->uses++;
-            fcn->count++;
-        }
 
-        if (fcn->error) {
+static ngx_uint_t
+ngx_http_file_cache_fill_subscribe(ngx_http_file_cache_fill_t *fill)
+{
+    if (ngx_process_slot < 0 || ngx_process_slot >= NGX_HTTP_CACHE_FILL_SLOTS) {
+        return 0;
+    }
 
-            if (fcn->valid_sec < ngx_time()) {
-                goto renew;
-            }
+    fill->waiters |= (uint64_t) 1 << ngx_process_slot;
 
-            rc = NGX_OK;
+    return 1;
+}
 
-            goto done;
-        }
 
-        if (fcn->exists || fcn->uses >= c->min_uses) {
+static uint64_t
+ngx_http_file_cache_fill_finish_locked(ngx_http_file_cache_shard_t *shard,
+    ngx_http_cache_t *c, ngx_uint_t error)
+{
+    ngx_http_file_cache_fill_t  *fill;
 
-            c->exists = fcn->exists;
-            if (fcn->body_start && !c->update_variant) {
-                c->body_start = fcn->body_start;
-            }
+    fill = c->fill;
 
-            rc = NGX_OK;
+    if (fill) {
+        fill->count--;
+        c->fill = NULL;
 
-            goto done;
-        }
+    } else if (c->node->lock_time == c->lock_time) {
+        fill = c->node->fill;
+    }
 
-        rc = NGX_AGAIN;
+    if (fill == NULL) {
+        return 0;
+    }
 
-        goto done;
+    if (error) {
+        fill->error = 1;
+
+    } else {
+        fill->done = 1;
     }
 
-    fcn = ngx_slab_calloc_locked(cache->shpool,
-                                 sizeof(ngx_http_file_cache_node_t));
-    if (fcn == NULL) {
-        ngx_http_file_cache_set_watermark(cache);
+    return ngx_http_file_cache_fill_release_locked(shard, c->node, fill);
+}
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
 
-        (void) ngx_http_file_cache_forced_expire(cache);
+static uint64_t
+ngx_http_file_cache_fill_release_locked(ngx_http_file_cache_shard_t *shard,
+    ngx_http_file_cache_node_t *fcn, ngx_http_file_cache_fill_t *fill)
+{
+    uint64_t  waiters;
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+    waiters = fill->waiters;
+    fill->waiters = 0;
 
-        fcn = ngx_slab_calloc_locked(cache->shpool,
-                                     sizeof(ngx_http_file_cache_node_t));
-        if (fcn == NULL) {
-            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                          "could not allocate node%s", cache->shpool->log_ctx);
-            rc = NGX_ERROR;
-            goto failed;
-        }
+    if (fcn->fill == fill) {
+        fcn->fill = NULL;
     }
 
-    cache->sh->count++;
+    if (fill->count == 0) {
+        ngx_http_file_cache_fill_free_locked(shard, fill);
+    }
 
-    ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+    return waiters;
+}
 
-    ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
-               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-    ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+static void
+ngx_http_file_cache_fill_detach_locked(ngx_http_file_cache_shard_t *shard,
+    ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_fill_t  *fill;
 
-    fcn->uses = 1;
-    fcn->count = 1;
+    fill = c->fill;
+    c->fill = NULL;
 
-renew:
+    fill->count--;
 
-    rc = NGX_DECLINED;
+    if (fill->count == 0 && c->node->fill != fill) {
+        ngx_http_file_cache_fill_free_locked(shard, fill);
+    }
+}
 
-    fcn->valid_msec = 0;
-    fcn->error = 0;
-    fcn->exists = 0;
-    fcn->valid_sec = 0;
-    fcn->uniq = 0;
-    fcn->body_start = 0;
-    fcn->fs_size = 0;
 
-done:
+static void
+ngx_http_file_cache_fill_free_locked(ngx_http_file_cache_shard_t *shard,
+    ngx_http_file_cache_fill_t *fill)
+{
+    if (fill->name.data) {
+        ngx_slab_free_locked(shard->shpool, fill->name.data);
+    }
 
-    fcn->expire = ngx_time() + cache->inactive;
+    ngx_slab_free_locked(shard->shpool, fill);
+}
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
 
-    c->uniq = fcn->uniq;
-    c->error = fcn->error;
-    c->node = fcn;
+static void
+ngx_http_file_cache_fill_notify(uint64_t waiters)
+{
+#if !(NGX_WIN32)
+    ngx_int_t      slot;
+    ngx_channel_t  ch;
+#endif
 
-failed:
+    if (waiters == 0) {
+        return;
+    }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    if (ngx_process_slot >= 0
+        && ngx_process_slot < NGX_HTTP_CACHE_FILL_SLOTS
+        && (waiters & ((uint64_t) 1 << ngx_process_slot)))
+    {
+        waiters &= ~((uint64_t) 1 << ngx_process_slot);
 
-    return rc;
-}
+        ngx_http_file_cache_wake();
+    }
 
+#if !(NGX_WIN32)
 
-static ngx_int_t
-ngx_http_file_cache_name(ngx_http_request_t *r, ngx_path_t *path)
-{
-    u_char            *p;
-    ngx_http_cache_t  *c;
+    ngx_memzero(&ch, sizeof(ngx_channel_t));
 
-    c = r->cache;
+    ch.command = NGX_CMD_NOTIFY;
+    ch.pid = ngx_pid;
+    ch.slot = ngx_process_slot;
+    ch.fd = -1;
 
-    if (c->file.name.len) {
-        return NGX_OK;
-    }
+    for (slot = 0; waiters; slot++) {
 
-    c->file.name.len = path->name.len + 1 + path->len
-                       + 2 * NGX_HTTP_CACHE_KEY_LEN;
+        if (!(waiters & ((uint64_t) 1 << slot))) {
+            continue;
+        }
 
-    c->file.name.data = ngx_pnalloc(r->pool, c->file.name.len + 1);
-    if (c->file.name.data == NULL) {
-        return NGX_ERROR;
-    }
+        waiters &= ~((uint64_t) 1 << slot);
 
-    ngx_memcpy(c->file.name.data, path->name.data, path->name.len);
+        /*
+         * ngx_last_process is not maintained in workers, processes
+         * spawned later are known from NGX_CMD_OPEN_CHANNEL only
+         */
 
-    p = c->file.name.data + path->name.len + 1 + path->len;
-    p = ngx_hex_dump(p, c->key, NGX_HTTP_CACHE_KEY_LEN);
-    *p = '\0';
+        if (ngx_processes[slot].pid <= 0
+            || ngx_processes[slot].channel[0] == -1)
+        {
+            continue;
+        }
 
-    ngx_create_hashed_filename(path, c->file.name.data, c->file.name.len);
+        /* a lost notification is recovered by the waiter's timer */
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "cache file: \"%s\"", c->file.name.data);
+        (void) ngx_write_channel(ngx_processes[slot].channel[0], &ch,
+                                 sizeof(ngx_channel_t), ngx_cycle->log);
+    }
 
-    return NGX_OK;
+#endif
 }
 
 
-static ngx_http_file_cache_node_t *
-ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
+static void
+ngx_http_file_cache_wake(void)
 {
-    ngx_int_t                    rc;
-    ngx_rbtree_key_t             node_key;
-    ngx_rbtree_node_t           *node, *sentinel;
-    ngx_http_file_cache_node_t  *fcn;
-
-    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
-
-    node = cache->sh->rbtree.root;
-    sentinel = cache->sh->rbtree.sentinel;
+    ngx_queue_t       *q;
+    ngx_http_cache_t  *c;
 
-    while (node != sentinel) {
+    for (q = ngx_queue_head(&ngx_http_file_cache_waiters);
+         q != ngx_queue_sentinel(&ngx_http_file_cache_waiters);
+         q = ngx_queue_next(q))
+    {
+        c = ngx_queue_data(q, ngx_http_cache_t, wait_queue);
 
-        if (node_key < node->key) {
-            node = node->left;
-            continue;
+        if (!c->wait_event.posted) {
+            ngx_post_event(&c->wait_event, &ngx_posted_events);
         }
+    }
+}
 
-        if (node_key > node->key) {
-            node = node->right;
-            continue;
-        }
 
-        /* node_key == node->key */
+#if !(NGX_WIN32)
 
-        fcn = (ngx_http_file_cache_node_t *) node;
+static void
+ngx_http_file_cache_notify(ngx_channel_t *ch)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache notify from %P", ch->pid);
 
-        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
-                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+    ngx_http_file_cache_wake();
+}
 
-        if (rc == 0) {
-            return fcn;
-        }
+#endif
 
-        node = (rc < 0) ? node->left : node->right;
+
+static void
+ngx_http_file_cache_wait_add(ngx_http_cache_t *c)
+{
+    if (c->wait_queue.next == NULL) {
+        ngx_queue_insert_tail(&ngx_http_file_cache_waiters, &c->wait_queue);
     }
+}
 
-    /* not found */
 
-    return NULL;
+static void
+ngx_http_file_cache_wait_delete(ngx_http_cache_t *c)
+{
+    if (c->wait_queue.next) {
+        ngx_queue_remove(&c->wait_queue);
+        c->wait_queue.next = NULL;
+    }
 }
 
 
-static void
-ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
-    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+static ngx_int_t
+ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_rbtree_node_t           **p;
-    ngx_http_file_cache_node_t   *cn, *cnt;
+    u_char                        *p;
+    time_t                         now;
+    ssize_t                        n;
+    ngx_str_t                     *key;
+    ngx_int_t                      rc;
+    ngx_uint_t                     i;
+    ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_shard_t   *shard;
+    ngx_http_file_cache_header_t  *h;
 
-    for ( ;; ) {
+    if (c->hot) {
+        n = (ssize_t) ngx_min(c->length, (off_t) c->body_start);
 
-        if (node->key < temp->key) {
+    } else {
+        n = ngx_http_file_cache_aio_read(r, c);
 
-            p = &temp->left;
+        if (n < 0) {
+            return n;
+        }
+    }
 
-        } else if (node->key > temp->key) {
+    if ((size_t) n < c->header_start) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" is too small", c->file.name.data);
+        return NGX_DECLINED;
+    }
 
-            p = &temp->right;
+    h = (ngx_http_file_cache_header_t *) c->buf->pos;
 
-        } else { /* node->key == temp->key */
+    if (h->version != NGX_HTTP_CACHE_VERSION) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "cache file \"%s\" version mismatch", c->file.name.data);
+        return NGX_DECLINED;
+    }
 
-            cn = (ngx_http_file_cache_node_t *) node;
-            cnt = (ngx_http_file_cache_node_t *) temp;
+    if (h->crc32 != c->crc32 || (size_t) h->header_start != c->header_start) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" has md5 collision", c->file.name.data);
+        return NGX_DECLINED;
+    }
 
-            p = (ngx_memcmp(cn->key, cnt->key,
-                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t))
-                 < 0)
-                    ? &temp->left : &temp->right;
-        }
+    p = c->buf->pos + sizeof(ngx_http_file_cache_header_t)
+        + sizeof(ngx_http_file_cache_key);
 
-        if (*p == sentinel) {
-            break;
+    key = c->keys.elts;
+    for (i = 0; i < c->keys.nelts; i++) {
+        if (ngx_memcmp(p, key[i].data, key[i].len) != 0) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                          "cache file \"%s\" has md5 collision",
+                          c->file.name.data);
+            return NGX_DECLINED;
         }
 
-        temp = *p;
+        p += key[i].len;
     }
 
-    *p = node;
-    node->parent = temp;
-    node->left = sentinel;
-    node->right = sentinel;
-    ngx_rbt_red(node);
-}
-
+    if ((size_t) h->body_start > c->body_start) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" has too long header",
+                      c->file.name.data);
+        return NGX_DECLINED;
+    }
 
-static void
-ngx_http_file_cache_vary(ngx_http_request_t *r, u_char *vary, size_t len,
-    u_char *hash)
-{
-    u_char     *p, *last;
-    ngx_str_t   name;
-    ngx_md5_t   md5;
-    u_char      buf[NGX_HTTP_CACHE_VARY_LEN];
+    if (h->vary_len > NGX_HTTP_CACHE_VARY_LEN) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" has incorrect vary length",
+                      c->file.name.data);
+        return NGX_DECLINED;
+    }
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache vary: \"%*s\"", len, vary);
+    if (h->vary_len) {
+        ngx_http_file_cache_vary(r, h->vary, h->vary_len, c->variant);
 
-    ngx_md5_init(&md5);
-    ngx_md5_update(&md5, r->cache->main, NGX_HTTP_CACHE_KEY_LEN);
+        if (ngx_memcmp(c->variant, h->variant, NGX_HTTP_CACHE_KEY_LEN) != 0) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http file cache vary mismatch");
+            return ngx_http_file_cache_reopen(r, c);
+        }
+    }
 
-    ngx_strlow(buf, vary, len);
+    c->buf->last += n;
 
-    p = buf;
-    last = buf + len;
+    c->valid_sec = h->valid_sec;
+    c->updating_sec = h->updating_sec;
+    c->error_sec = h->error_sec;
+    c->last_modified = h->last_modified;
+    c->date = h->date;
+    c->valid_msec = h->valid_msec;
+    c->body_start = h->body_start;
+    c->etag.len = h->etag_len;
+    c->etag.data = h->etag;
 
-    while (p < last) {
+    r->cached = 1;
 
-        while (p < last && (*p == ' ' || *p == ',')) { p++; }
+    if (c->fill) {
 
-        name.data = p;
+        /* the response is being written, it is neither stale nor hot */
 
-        while (p < last && *p != ',' && *p != ' ') { p++; }
+        return NGX_OK;
+    }
 
-        name.len = p - name.data;
+    cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(cache, c->key);
 
-        if (name.len == 0) {
-            break;
-        }
+    if (cache->sh->cold) {
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "http file cache vary: %V", &name);
+        ngx_shmtx_lock(&shard->shpool->mutex);
 
-        ngx_md5_update(&md5, name.data, name.len);
-        ngx_md5_update(&md5, (u_char *) ":", sizeof(":") - 1);
+        if (!c->node->exists) {
+            c->node->uses = 1;
+            c->node->body_start = c->body_start;
+            c->node->exists = 1;
+            c->node->uniq = c->uniq;
+            c->node->fs_size = c->fs_size;
 
-        ngx_http_file_cache_vary_header(r, &md5, &name);
+            shard->sh->size += c->fs_size;
+        }
 
-        ngx_md5_update(&md5, (u_char *) CRLF, sizeof(CRLF) - 1);
+        ngx_shmtx_unlock(&shard->shpool->mutex);
     }
 
-    ngx_md5_final(hash, &md5);
-}
+    now = ngx_time();
 
+    if (c->valid_sec < now) {
+        c->stale_updating = c->valid_sec + c->updating_sec >= now;
+        c->stale_error = c->valid_sec + c->error_sec >= now;
 
-static void
-ngx_http_file_cache_vary_header(ngx_http_request_t *r, ngx_md5_t *md5,
-    ngx_str_t *name)
-{
-    size_t            len;
-    u_char           *p, *start, *last;
-    ngx_uint_t        i, multiple, normalize;
-    ngx_list_part_t  *part;
-    ngx_table_elt_t  *header;
-
-    multiple = 0;
-    normalize = 0;
-
-    if (name->len == sizeof("Accept-Charset") - 1
-        && ngx_strncasecmp(name->data, (u_char *) "Accept-Charset",
-                           sizeof("Accept-Charset") - 1) == 0)
-    {
-        normalize = 1;
-
-    } else if (name->len == sizeof("Accept-Encoding") - 1
-        && ngx_strncasecmp(name->data, (u_char *) "Accept-Encoding",
-                           sizeof("Accept-Encoding") - 1) == 0)
-    {
-        normalize = 1;
+        ngx_shmtx_lock(&shard->shpool->mutex);
 
-    } else if (name->len == sizeof("Accept-Language") - 1
-        && ngx_strncasecmp(name->data, (u_char *) "Accept-Language",
-                           sizeof("Accept-Language") - 1) == 0)
-    {
-        normalize = 1;
-    }
+        if (c->node->updating) {
+            rc = NGX_HTTP_CACHE_UPDATING;
 
-    part = &r->headers_in.headers.part;
-    header = part->elts;
+        } else {
+            c->node->updating = 1;
+            c->updating = 1;
+            c->lock_time = c->node->lock_time;
+            rc = NGX_HTTP_CACHE_STALE;
+        }
 
-    for (i = 0; /* void */ ; i++) {
+        ngx_shmtx_unlock(&shard->shpool->mutex);
 
-        if (i >= part->nelts) {
-            if (part->next == NULL) {
-                break;
-            }
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache expired: %i %T %T",
+                       rc, c->valid_sec, now);
 
-            part = part->next;
-            header = part->elts;
-            i = 0;
-        }
+        return rc;
+    }
 
-        if (header[i].hash == 0) {
-            continue;
-        }
+    if (cache->hot_zone && !c->hot) {
+        ngx_http_file_cache_hot_add(r, c, n);
+    }
 
-        if (header[i].key.len != name->len) {
-            continue;
-        }
+    return NGX_OK;
+}
 
-        if (ngx_strncasecmp(header[i].key.data, name->data, name->len) != 0) {
-            continue;
-        }
 
-        if (!normalize) {
+static ssize_t
+ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+#if (NGX_HAVE_FILE_AIO || NGX_THREADS)
+    ssize_t                    n;
+    ngx_http_core_loc_conf_t  *clcf;
 
-            if (multiple) {
-                ngx_md5_update(md5, (u_char *) ",", sizeof(",") - 1);
-            }
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+#endif
 
-            ngx_md5_update(md5, header[i].value.data, header[i].value.len);
+#if (NGX_HAVE_FILE_AIO)
 
-            multiple = 1;
+    if (clcf->aio == NGX_HTTP_AIO_ON && ngx_file_aio) {
+        n = ngx_file_aio_read(&c->file, c->buf->pos, c->buf->end - c->buf->pos,
+                               0, r->pool);
 
-            continue;
+        if (n != NGX_AGAIN) {
+            c->reading = 0;
+            return n;
         }
 
-        /* normalize spaces */
-
-        p = header[i].value.data;
-        last = p + header[i].value.len;
+        c->reading = 1;
 
-        while (p < last) {
+        c->file.aio->data = r;
+        c->file.aio->handler = ngx_http_cache_aio_event_handler;
 
-            while (p < last && (*p == ' ' || *p == ',')) { p++; }
+        r->main->blocked++;
+        r->aio = 1;
 
-            start = p;
+        return NGX_AGAIN;
+    }
 
-            while (p < last && *p != ',' && *p != ' ') { p++; }
+#endif
 
-            len = p - start;
+#if (NGX_THREADS)
 
-            if (len == 0) {
-                break;
-            }
+    if (clcf->aio == NGX_HTTP_AIO_THREADS) {
+        c->file.thread_task = c->thread_task;
+        c->file.thread_handler = ngx_http_cache_thread_handler;
+        c->file.thread_ctx = r;
 
-            if (multiple) {
-                ngx_md5_update(md5, (u_char *) ",", sizeof(",") - 1);
-            }
+        n = ngx_thread_read(&c->file, c->buf->pos, c->buf->end - c->buf->pos,
+                            0, r->pool);
 
-            ngx_md5_update(md5, start, len);
+        c->thread_task = c->file.thread_task;
+        c->reading = (n == NGX_AGAIN);
 
-            multiple = 1;
-        }
+        return n;
     }
-}
 
+#endif
 
-static ngx_int_t
-ngx_http_file_cache_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
-{
-    ngx_http_file_cache_t  *cache;
+    return ngx_read_file(&c->file, c->buf->pos, c->buf->end - c->buf->pos, 0);
+}
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
-                   "http file cache reopen");
 
-    if (c->secondary) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      "cache file \"%s\" has incorrect vary hash",
-                      c->file.name.data);
-        return NGX_DECLINED;
-    }
+#if (NGX_HAVE_FILE_AIO)
 
-    cache = c->file_cache;
+static void
+ngx_http_cache_aio_event_handler(ngx_event_t *ev)
+{
+    ngx_event_aio_t     *aio;
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    aio = ev->data;
+    r = aio->data;
+    c = r->connection;
 
-    c->node->count--;
-    c->node = NULL;
+    ngx_http_set_log_request(c->log, r);
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http file cache aio: \"%V?%V\"", &r->uri, &r->args);
 
-    c->secondary = 1;
-    c->file.name.len = 0;
-    c->body_start = c->buffer_size;
+    r->main->blocked--;
+    r->aio = 0;
 
-    ngx_memcpy(c->key, c->variant, NGX_HTTP_CACHE_KEY_LEN);
+    r->write_event_handler(r);
 
-    return ngx_http_file_cache_open(r);
+    ngx_http_run_posted_requests(c);
 }
 
+#endif
 
-ngx_int_t
-ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
-{
-    ngx_http_file_cache_header_t  *h = (ngx_http_file_cache_header_t *) buf;
-
-    u_char            *p;
-    ngx_str_t         *key;
-    ngx_uint_t         i;
-    ngx_http_cache_t  *c;
-
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache set header");
 
-    c = r->cache;
+#if (NGX_THREADS)
 
-    ngx_memzero(h, sizeof(ngx_http_file_cache_header_t));
+static ngx_int_t
+ngx_http_cache_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
+{
+    ngx_str_t                  name;
+    ngx_thread_pool_t         *tp;
+    ngx_http_request_t        *r;
+    ngx_http_core_loc_conf_t  *clcf;
 
-    h->version = NGX_HTTP_CACHE_VERSION;
-    h->valid_sec = c->valid_sec;
-    h->updating_sec = c->updating_sec;
-    h->error_sec = c->error_sec;
-    h->last_modified = c->last_modified;
-    h->date = c->date;
-    h->crc32 = c->crc32;
-    h->valid_msec = (u_short) c->valid_msec;
-    h->header_start = (u_short) c->header_start;
-    h->body_start = (u_short) c->body_start;
+    r = file->thread_ctx;
 
-    if (c->etag.len <= NGX_HTTP_CACHE_ETAG_LEN) {
-        h->etag_len = (u_char) c->etag.len;
-        ngx_memcpy(h->etag, c->etag.data, c->etag.len);
-    }
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    tp = clcf->thread_pool;
 
-    if (c->vary.len) {
-        if (c->vary.len > NGX_HTTP_CACHE_VARY_LEN) {
-            /* should not happen */
-            c->vary.len = NGX_HTTP_CACHE_VARY_LEN;
+    if (tp == NULL) {
+        if (ngx_http_complex_value(r, clcf->thread_pool_value, &name)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
         }
 
-        h->vary_len = (u_char) c->vary.len;
-        ngx_memcpy(h->vary, c->vary.data, c->vary.len);
-
-        ngx_http_file_cache_vary(r, c->vary.data, c->vary.len, c->variant);
-        ngx_memcpy(h->variant, c->variant, NGX_HTTP_CACHE_KEY_LEN);
-    }
+        tp = ngx_thread_pool_get((ngx_cycle_t *) ngx_cycle, &name);
 
-    if (ngx_http_file_cache_update_variant(r, c) != NGX_OK) {
-        return NGX_ERROR;
+        if (tp == NULL) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "thread pool \"%V\" not found", &name);
+            return NGX_ERROR;
+        }
     }
 
-    p = buf + sizeof(ngx_http_file_cache_header_t);
-
-    p = ngx_cpymem(p, ngx_http_file_cache_key, sizeof(ngx_http_file_cache_key));
+    task->event.data = r;
+    task->event.handler = ngx_http_cache_thread_event_handler;
 
-    key = c->keys.elts;
-    for (i = 0; i < c->keys.nelts; i++) {
-        p = ngx_copy(p, key[i].data, key[i].len);
+    if (ngx_thread_task_post(tp, task) != NGX_OK) {
+        return NGX_ERROR;
     }
 
-    *p = LF;
+    r->main->blocked++;
+    r->aio = 1;
 
     return NGX_OK;
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
+static void
+ngx_http_cache_thread_event_handler(ngx_event_t *ev)
 {
-    ngx_http_file_cache_t  *cache;
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
 
-    if (!c->secondary) {
-        return NGX_OK;
-    }
+    r = ev->data;
+    c = r->connection;
 
-    if (c->vary.len
-        && ngx_memcmp(c->variant, c->key, NGX_HTTP_CACHE_KEY_LEN) == 0)
-    {
-        return NGX_OK;
-    }
+    ngx_http_set_log_request(c->log, r);
 
-    /*
-     * if the variant hash doesn't match one we used as a secondary
-     * cache key, switch back to the original key
-     */
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http file cache thread: \"%V?%V\"", &r->uri, &r->args);
 
-    cache = c->file_cache;
+    r->main->blocked--;
+    r->aio = 0;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache main key");
+    r->write_event_handler(r);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_http_run_posted_requests(c);
+}
 
-    c->node->count--;
-    c->node->updating = 0;
-    c->node = NULL;
+#endif
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    c->file.name.len = 0;
-    c->update_variant = 1;
+static ngx_int_t
+ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+{
+    ngx_int_t                     rc;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
 
-    ngx_memcpy(c->key, c->main, NGX_HTTP_CACHE_KEY_LEN);
+    shard = ngx_http_file_cache_shard(cache, c->key);
 
-    if (ngx_http_file_cache_exists(cache, c) == NGX_ERROR) {
-        return NGX_ERROR;
-    }
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
-    if (ngx_http_file_cache_name(r, cache->path) != NGX_OK) {
-        return NGX_ERROR;
+    fcn = c->node;
+
+    if (fcn == NULL) {
+        fcn = ngx_http_file_cache_lookup(shard, c->key);
     }
 
-    return NGX_OK;
-}
+    if (fcn) {
+        ngx_queue_remove(&fcn->queue);
 
+        if (c->node == NULL) {
+            fcn->uses++;
+            fcn->count++;
+        }
 
-void
-ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
-{
-    off_t                   fs_size;
-    ngx_int_t               rc;
-    ngx_file_uniq_t         uniq;
-    ngx_file_info_t         fi;
-    ngx_http_cache_t        *c;
-    ngx_ext_rename_file_t   ext;
-    ngx_http_file_cache_t  *cache;
+        if (fcn->error) {
 
-    c = r->cache;
+            if (fcn->valid_sec < ngx_time()) {
+                goto renew;
+            }
 
-    if (c->updated) {
-        return;
-    }
+            rc = NGX_OK;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache update");
+            goto done;
+        }
 
-    cache = c->file_cache;
+        if (fcn->exists || fcn->uses >= c->min_uses) {
 
-    c->updated = 1;
-    c->updating = 0;
+            c->exists = fcn->exists;
+            if (fcn->body_start && !c->update_variant) {
+                c->body_start = fcn->body_start;
+            }
 
-    uniq = 0;
-    fs_size = 0;
+            rc = NGX_OK;
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache rename: \"%s\" to \"%s\"",
-                   tf->file.name.data, c->file.name.data);
+            goto done;
+        }
 
-    ext.access = NGX_FILE_OWNER_ACCESS;
-    ext.path_access = NGX_FILE_OWNER_ACCESS;
-    ext.time = -1;
-    ext.create_path = 1;
-    ext.delete_file = 1;
-    ext.log = r->connection->log;
+        rc = NGX_AGAIN;
 
-    rc = ngx_ext_rename_file(&tf->file.name, &c->file.name, &ext);
+        goto done;
+    }
 
-    if (rc == NGX_OK) {
+    fcn = ngx_slab_calloc_locked(shard->shpool,
+                                 sizeof(ngx_http_file_cache_node_t));
+    if (fcn == NULL) {
+        ngx_http_file_cache_set_watermark(shard);
 
-        if (ngx_fd_info(tf->file.fd, &fi) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
-                          ngx_fd_info_n " \"%s\" failed", tf->file.name.data);
+        ngx_shmtx_unlock(&shard->shpool->mutex);
 
-            rc = NGX_ERROR;
+        (void) ngx_http_file_cache_forced_expire(cache, shard);
 
-        } else {
-            uniq = ngx_file_uniq(&fi);
-            fs_size = (ngx_file_fs_size(&fi) + cache->bsize - 1) / cache->bsize;
+        ngx_shmtx_lock(&shard->shpool->mutex);
+
+        fcn = ngx_slab_calloc_locked(shard->shpool,
+                                     sizeof(ngx_http_file_cache_node_t));
+        if (fcn == NULL) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                          "could not allocate node%s",
+                          shard->shpool->log_ctx);
+            rc = NGX_ERROR;
+            goto failed;
         }
     }
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    shard->sh->count++;
 
-    c->node->count--;
-    c->node->error = 0;
-    c->node->uniq = uniq;
-    c->node->body_start = c->body_start;
+    ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
 
-    cache->sh->size += fs_size - c->node->fs_size;
-    c->node->fs_size = fs_size;
+    ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-    if (rc == NGX_OK) {
-        c->node->exists = 1;
-    }
+    ngx_rbtree_insert(&shard->sh->rbtree, &fcn->node);
 
-    c->node->updating = 0;
+    fcn->uses = 1;
+    fcn->count = 1;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
-}
+renew:
 
+    rc = NGX_DECLINED;
 
-void
-ngx_http_file_cache_update_header(ngx_http_request_t *r)
-{
-    ssize_t                        n;
-    ngx_err_t                      err;
-    ngx_file_t                     file;
-    ngx_file_info_t                fi;
-    ngx_http_cache_t              *c;
-    ngx_http_file_cache_header_t   h;
+    fcn->valid_msec = 0;
+    fcn->error = 0;
+    fcn->exists = 0;
+    fcn->valid_sec = 0;
+    fcn->uniq = 0;
+    fcn->body_start = 0;
+    fcn->fs_size = 0;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache update header");
+done:
 
-    c = r->cache;
+    fcn->expire = ngx_time() + cache->inactive;
 
-    ngx_memzero(&file, sizeof(ngx_file_t));
+    ngx_queue_insert_head(&shard->sh->queue, &fcn->queue);
 
-    file.name = c->file.name;
-    file.log = r->connection->log;
-    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDWR, NGX_FILE_OPEN, 0);
+    c->uniq = fcn->uniq;
+    c->error = fcn->error;
+    c->node = fcn;
 
-    if (file.fd == NGX_INVALID_FILE) {
-        err = ngx_errno;
+failed:
 
-        /* cache file may have been deleted */
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
-        if (err == NGX_ENOENT) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                           "http file cache \"%s\" not found",
-                           file.name.data);
-            return;
-        }
+    return rc;
+}
 
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
-                      ngx_open_file_n " \"%s\" failed", file.name.data);
-        return;
-    }
 
-    /*
-     * make sure cache file wasn't replaced;
-     * if it was, do nothing
-     */
+static ngx_int_t
+ngx_http_file_cache_name(ngx_http_request_t *r, ngx_path_t *path)
+{
+    u_char            *p;
+    ngx_http_cache_t  *c;
 
-    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
-                      ngx_fd_info_n " \"%s\" failed", file.name.data);
-        goto done;
-    }
+    c = r->cache;
 
-    if (c->uniq != ngx_file_uniq(&fi)
-        || c->length != ngx_file_size(&fi))
-    {
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "http file cache \"%s\" changed",
-                       file.name.data);
-        goto done;
+    if (c->file.name.len) {
+        return NGX_OK;
     }
 
-    n = ngx_read_file(&file, (u_char *) &h,
-                      sizeof(ngx_http_file_cache_header_t), 0);
+    c->file.name.len = path->name.len + 1 + path->len
+                       + 2 * NGX_HTTP_CACHE_KEY_LEN;
 
-    if (n == NGX_ERROR) {
-        goto done;
+    c->file.name.data = ngx_pnalloc(r->pool, c->file.name.len + 1);
+    if (c->file.name.data == NULL) {
+        return NGX_ERROR;
     }
 
-    if ((size_t) n != sizeof(ngx_http_file_cache_header_t)) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      ngx_read_file_n " read only %z of %z from \"%s\"",
-                      n, sizeof(ngx_http_file_cache_header_t), file.name.data);
-        goto done;
-    }
+    ngx_memcpy(c->file.name.data, path->name.data, path->name.len);
 
-    if (h.version != NGX_HTTP_CACHE_VERSION
-        || h.last_modified != c->last_modified
-        || h.crc32 != c->crc32
-        || (size_t) h.header_start != c->header_start
-        || (size_t) h.body_start != c->body_start)
-    {
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "http file cache \"%s\" content changed",
-                       file.name.data);
-        goto done;
-    }
+    p = c->file.name.data + path->name.len + 1 + path->len;
+    p = ngx_hex_dump(p, c->key, NGX_HTTP_CACHE_KEY_LEN);
+    *p = '\0';
 
-    /*
-     * update cache file header with new data,
-     * notably h.valid_sec and h.date
-     */
+    ngx_create_hashed_filename(path, c->file.name.data, c->file.name.len);
 
-    ngx_memzero(&h, sizeof(ngx_http_file_cache_header_t));
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "cache file: \"%s\"", c->file.name.data);
 
-    h.version = NGX_HTTP_CACHE_VERSION;
-    h.valid_sec = c->valid_sec;
-    h.updating_sec = c->updating_sec;
-    h.error_sec = c->error_sec;
-    h.last_modified = c->last_modified;
-    h.date = c->date;
-    h.crc32 = c->crc32;
-    h.valid_msec = (u_short) c->valid_msec;
-    h.header_start = (u_short) c->header_start;
-    h.body_start = (u_short) c->body_start;
+    return NGX_OK;
+}
 
-    if (c->etag.len <= NGX_HTTP_CACHE_ETAG_LEN) {
-        h.etag_len = (u_char) c->etag.len;
-        ngx_memcpy(h.etag, c->etag.data, c->etag.len);
-    }
 
-    if (c->vary.len) {
-        if (c->vary.len > NGX_HTTP_CACHE_VARY_LEN) {
-            /* should not happen */
-            c->vary.len = NGX_HTTP_CACHE_VARY_LEN;
+static ngx_http_file_cache_node_t *
+ngx_http_file_cache_lookup(ngx_http_file_cache_shard_t *shard, u_char *key)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_key_t             node_key;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_file_cache_node_t  *fcn;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = shard->sh->rbtree.root;
+    sentinel = shard->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
         }
 
-        h.vary_len = (u_char) c->vary.len;
-        ngx_memcpy(h.vary, c->vary.data, c->vary.len);
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        fcn = (ngx_http_file_cache_node_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return fcn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+
+static void
+ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t           **p;
+    ngx_http_file_cache_node_t   *cn, *cnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            cn = (ngx_http_file_cache_node_t *) node;
+            cnt = (ngx_http_file_cache_node_t *) temp;
+
+            p = (ngx_memcmp(cn->key, cnt->key,
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t))
+                 < 0)
+                    ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+/*
+ * The hot zone keeps complete copies of small and frequently used cache
+ * files in shared memory, so cache hits on them are served without
+ * opening and reading the files.  The files stay authoritative: a copy is
+ * added only for the file currently known to the keys zone node, it is
+ * used only while the node refers to a file with the same uniq, and it is
+ * removed when the file is replaced, updated or deleted.  The hot zone
+ * mutex may be locked with the keys zone mutex held, but never otherwise.
+ */
+
+static ngx_int_t
+ngx_http_file_cache_hot_open(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    u_char                          *p;
+    ngx_http_file_cache_t           *cache;
+    ngx_http_file_cache_hot_node_t  *hn;
+
+    cache = c->file_cache;
+
+    ngx_shmtx_lock(&cache->hot_shpool->mutex);
+
+    hn = ngx_http_file_cache_hot_lookup(cache, c->key);
+
+    if (hn == NULL || hn->uniq != c->uniq) {
+        ngx_shmtx_unlock(&cache->hot_shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    p = ngx_pnalloc(r->pool, hn->len);
+    if (p == NULL) {
+        ngx_shmtx_unlock(&cache->hot_shpool->mutex);
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(p, hn->data, hn->len);
+
+    c->length = hn->len;
+
+    ngx_queue_remove(&hn->queue);
+    ngx_queue_insert_head(&cache->hot_sh->queue, &hn->queue);
+
+    ngx_shmtx_unlock(&cache->hot_shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache hot: %O", c->length);
+
+    c->buf = ngx_calloc_buf(r->pool);
+    if (c->buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    c->buf->start = p;
+    c->buf->pos = p;
+    c->buf->last = p;
+    c->buf->end = p + c->length;
+    c->buf->temporary = 1;
+
+    c->fs_size = c->node->fs_size;
+    c->hot = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_hot_add(ngx_http_request_t *r, ngx_http_cache_t *c,
+    size_t n)
+{
+    u_char                          *p;
+    size_t                           len;
+    ngx_uint_t                       tries;
+    ngx_queue_t                     *q;
+    ngx_http_file_cache_t           *cache;
+    ngx_http_file_cache_shard_t     *shard;
+    ngx_http_file_cache_hot_node_t  *hn;
+
+    cache = c->file_cache;
+
+    if (c->length > (off_t) cache->hot_max_size
+        || c->node->uses < cache->hot_min_uses)
+    {
+        return;
+    }
+
+    len = (size_t) c->length;
+
+    if (n < len) {
+
+        /* the file has not been read in whole */
+        return;
+    }
+
+    p = c->buf->pos;
+
+    shard = ngx_http_file_cache_shard(cache, c->key);
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    if (!c->node->exists || c->node->deleting || c->node->uniq != c->uniq) {
+        goto done;
+    }
+
+    ngx_shmtx_lock(&cache->hot_shpool->mutex);
+
+    hn = ngx_http_file_cache_hot_lookup(cache, c->key);
+
+    if (hn) {
+        if (hn->uniq == c->uniq) {
+            goto unlock;
+        }
+
+        ngx_http_file_cache_hot_free_locked(cache, hn);
+    }
+
+    for (tries = 0; /* void */ ; tries++) {
+
+        hn = ngx_slab_alloc_locked(cache->hot_shpool,
+                                   offsetof(ngx_http_file_cache_hot_node_t,
+                                            data)
+                                   + len);
+        if (hn) {
+            break;
+        }
+
+        /* evict the least recently used copies */
+
+        if (tries == 32 || ngx_queue_empty(&cache->hot_sh->queue)) {
+            goto unlock;
+        }
+
+        q = ngx_queue_last(&cache->hot_sh->queue);
+
+        ngx_http_file_cache_hot_free_locked(cache,
+                   ngx_queue_data(q, ngx_http_file_cache_hot_node_t, queue));
+    }
+
+    ngx_memcpy((u_char *) &hn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(hn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    hn->uniq = c->uniq;
+    hn->len = len;
+    ngx_memcpy(hn->data, p, len);
+
+    ngx_rbtree_insert(&cache->hot_sh->rbtree, &hn->node);
+    ngx_queue_insert_head(&cache->hot_sh->queue, &hn->queue);
+
+    cache->hot_sh->size += len;
+    cache->hot_sh->count++;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache hot add: %uz, count: %ui",
+                   len, cache->hot_sh->count);
+
+unlock:
+
+    ngx_shmtx_unlock(&cache->hot_shpool->mutex);
+
+done:
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+}
+
+
+static void
+ngx_http_file_cache_hot_delete(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_http_file_cache_hot_node_t  *hn;
+
+    ngx_shmtx_lock(&cache->hot_shpool->mutex);
+
+    hn = ngx_http_file_cache_hot_lookup(cache, key);
+
+    if (hn) {
+        ngx_http_file_cache_hot_free_locked(cache, hn);
+    }
+
+    ngx_shmtx_unlock(&cache->hot_shpool->mutex);
+}
+
+
+static void
+ngx_http_file_cache_hot_free_locked(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_hot_node_t *hn)
+{
+    ngx_queue_remove(&hn->queue);
+    ngx_rbtree_delete(&cache->hot_sh->rbtree, &hn->node);
+
+    cache->hot_sh->size -= hn->len;
+    cache->hot_sh->count--;
+
+    ngx_slab_free_locked(cache->hot_shpool, hn);
+}
+
+
+static ngx_http_file_cache_hot_node_t *
+ngx_http_file_cache_hot_lookup(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_int_t                        rc;
+    ngx_rbtree_key_t                 node_key;
+    ngx_rbtree_node_t               *node, *sentinel;
+    ngx_http_file_cache_hot_node_t  *hn;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = cache->hot_sh->rbtree.root;
+    sentinel = cache->hot_sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        hn = (ngx_http_file_cache_hot_node_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], hn->key,
+                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return hn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+
+static void
+ngx_http_file_cache_hot_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t               **p;
+    ngx_http_file_cache_hot_node_t   *hn, *hnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            hn = (ngx_http_file_cache_hot_node_t *) node;
+            hnt = (ngx_http_file_cache_hot_node_t *) temp;
+
+            p = (ngx_memcmp(hn->key, hnt->key,
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t))
+                 < 0)
+                    ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static void
+ngx_http_file_cache_vary(ngx_http_request_t *r, u_char *vary, size_t len,
+    u_char *hash)
+{
+    u_char     *p, *last;
+    ngx_str_t   name;
+    ngx_md5_t   md5;
+    u_char      buf[NGX_HTTP_CACHE_VARY_LEN];
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache vary: \"%*s\"", len, vary);
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, r->cache->main, NGX_HTTP_CACHE_KEY_LEN);
+
+    ngx_strlow(buf, vary, len);
+
+    p = buf;
+    last = buf + len;
+
+    while (p < last) {
+
+        while (p < last && (*p == ' ' || *p == ',')) { p++; }
+
+        name.data = p;
+
+        while (p < last && *p != ',' && *p != ' ') { p++; }
+
+        name.len = p - name.data;
+
+        if (name.len == 0) {
+            break;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache vary: %V", &name);
+
+        ngx_md5_update(&md5, name.data, name.len);
+        ngx_md5_update(&md5, (u_char *) ":", sizeof(":") - 1);
+
+        ngx_http_file_cache_vary_header(r, &md5, &name);
+
+        ngx_md5_update(&md5, (u_char *) CRLF, sizeof(CRLF) - 1);
+    }
+
+    ngx_md5_final(hash, &md5);
+}
+
+
+static void
+ngx_http_file_cache_vary_header(ngx_http_request_t *r, ngx_md5_t *md5,
+    ngx_str_t *name)
+{
+    size_t            len;
+    u_char           *p, *start, *last;
+    ngx_uint_t        i, multiple, normalize;
+    ngx_list_part_t  *part;
+    ngx_table_elt_t  *header;
+
+    multiple = 0;
+    normalize = 0;
+
+    if (name->len == sizeof("Accept-Charset") - 1
+        && ngx_strncasecmp(name->data, (u_char *) "Accept-Charset",
+                           sizeof("Accept-Charset") - 1) == 0)
+    {
+        normalize = 1;
+
+    } else if (name->len == sizeof("Accept-Encoding") - 1
+        && ngx_strncasecmp(name->data, (u_char *) "Accept-Encoding",
+                           sizeof("Accept-Encoding") - 1) == 0)
+    {
+        normalize = 1;
+
+    } else if (name->len == sizeof("Accept-Language") - 1
+        && ngx_strncasecmp(name->data, (u_char *) "Accept-Language",
+                           sizeof("Accept-Language") - 1) == 0)
+    {
+        normalize = 1;
+    }
+
+    part = &r->headers_in.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].hash == 0) {
+            continue;
+        }
+
+        if (header[i].key.len != name->len) {
+            continue;
+        }
+
+        if (ngx_strncasecmp(header[i].key.data, name->data, name->len) != 0) {
+            continue;
+        }
+
+        if (!normalize) {
+
+            if (multiple) {
+                ngx_md5_update(md5, (u_char *) ",", sizeof(",") - 1);
+            }
+
+            ngx_md5_update(md5, header[i].value.data, header[i].value.len);
+
+            multiple = 1;
+
+            continue;
+        }
+
+        /* normalize spaces */
+
+        p = header[i].value.data;
+        last = p + header[i].value.len;
+
+        while (p < last) {
+
+            while (p < last && (*p == ' ' || *p == ',')) { p++; }
+
+            start = p;
+
+            while (p < last && *p != ',' && *p != ' ') { p++; }
+
+            len = p - start;
+
+            if (len == 0) {
+                break;
+            }
+
+            if (multiple) {
+                ngx_md5_update(md5, (u_char *) ",", sizeof(",") - 1);
+            }
+
+            ngx_md5_update(md5, start, len);
+
+            multiple = 1;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_shard_t  *shard;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache reopen");
+
+    if (c->secondary) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" has incorrect vary hash",
+                      c->file.name.data);
+        return NGX_DECLINED;
+    }
+
+    shard = ngx_http_file_cache_shard(c->file_cache, c->key);
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    c->node->count--;
+    c->node = NULL;
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+
+    c->secondary = 1;
+    c->hot = 0;
+    c->file.name.len = 0;
+    c->body_start = c->buffer_size;
+
+    ngx_memcpy(c->key, c->variant, NGX_HTTP_CACHE_KEY_LEN);
+
+    return ngx_http_file_cache_open(r);
+}
+
+
+ngx_int_t
+ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
+{
+    ngx_http_file_cache_header_t  *h = (ngx_http_file_cache_header_t *) buf;
+
+    u_char            *p;
+    ngx_str_t         *key;
+    ngx_uint_t         i;
+    ngx_http_cache_t  *c;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache set header");
+
+    c = r->cache;
+
+    ngx_memzero(h, sizeof(ngx_http_file_cache_header_t));
+
+    h->version = NGX_HTTP_CACHE_VERSION;
+    h->valid_sec = c->valid_sec;
+    h->updating_sec = c->updating_sec;
+    h->error_sec = c->error_sec;
+    h->last_modified = c->last_modified;
+    h->date = c->date;
+    h->crc32 = c->crc32;
+    h->valid_msec = (u_short) c->valid_msec;
+    h->header_start = (u_short) c->header_start;
+    h->body_start = (u_short) c->body_start;
+
+    if (c->etag.len <= NGX_HTTP_CACHE_ETAG_LEN) {
+        h->etag_len = (u_char) c->etag.len;
+        ngx_memcpy(h->etag, c->etag.data, c->etag.len);
+    }
+
+    if (c->vary.len) {
+        if (c->vary.len > NGX_HTTP_CACHE_VARY_LEN) {
+            /* should not happen */
+            c->vary.len = NGX_HTTP_CACHE_VARY_LEN;
+        }
+
+        h->vary_len = (u_char) c->vary.len;
+        ngx_memcpy(h->vary, c->vary.data, c->vary.len);
+
+        ngx_http_file_cache_vary(r, c->vary.data, c->vary.len, c->variant);
+        ngx_memcpy(h->variant, c->variant, NGX_HTTP_CACHE_KEY_LEN);
+    }
+
+    if (ngx_http_file_cache_update_variant(r, c) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    p = buf + sizeof(ngx_http_file_cache_header_t);
+
+    p = ngx_cpymem(p, ngx_http_file_cache_key, sizeof(ngx_http_file_cache_key));
+
+    key = c->keys.elts;
+    for (i = 0; i < c->keys.nelts; i++) {
+        p = ngx_copy(p, key[i].data, key[i].len);
+    }
+
+    *p = LF;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    uint64_t                      waiters;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
+
+    if (!c->secondary) {
+        return NGX_OK;
+    }
+
+    if (c->vary.len
+        && ngx_memcmp(c->variant, c->key, NGX_HTTP_CACHE_KEY_LEN) == 0)
+    {
+        return NGX_OK;
+    }
+
+    /*
+     * if the variant hash doesn't match one we used as a secondary
+     * cache key, switch back to the original key
+     */
+
+    cache = c->file_cache;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache main key");
+
+    shard = ngx_http_file_cache_shard(cache, c->key);
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    waiters = ngx_http_file_cache_fill_finish_locked(shard, c, 1);
+
+    c->node->count--;
+    c->node->updating = 0;
+    c->node = NULL;
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+
+    ngx_http_file_cache_fill_notify(waiters);
+
+    c->file.name.len = 0;
+    c->update_variant = 1;
+
+    ngx_memcpy(c->key, c->main, NGX_HTTP_CACHE_KEY_LEN);
+
+    if (ngx_http_file_cache_exists(cache, c) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_file_cache_name(r, cache->path) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
+{
+    off_t                   fs_size;
+    uint64_t                waiters;
+    ngx_int_t               rc;
+    ngx_file_uniq_t         uniq;
+    ngx_file_info_t         fi;
+    ngx_http_cache_t        *c;
+    ngx_ext_rename_file_t         ext;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
+
+    c = r->cache;
+
+    if (c->updated) {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache update");
+
+    cache = c->file_cache;
+
+    c->updated = 1;
+    c->updating = 0;
+
+    uniq = 0;
+    fs_size = 0;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache rename: \"%s\" to \"%s\"",
+                   tf->file.name.data, c->file.name.data);
+
+    ext.access = NGX_FILE_OWNER_ACCESS;
+    ext.path_access = NGX_FILE_OWNER_ACCESS;
+    ext.time = -1;
+    ext.create_path = 1;
+    ext.delete_file = 1;
+    ext.log = r->connection->log;
+
+    rc = ngx_ext_rename_file(&tf->file.name, &c->file.name, &ext);
+
+    if (rc == NGX_OK) {
+
+        if (ngx_fd_info(tf->file.fd, &fi) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                          ngx_fd_info_n " \"%s\" failed", tf->file.name.data);
+
+            rc = NGX_ERROR;
+
+        } else {
+            uniq = ngx_file_uniq(&fi);
+            fs_size = (ngx_file_fs_size(&fi) + cache->bsize - 1) / cache->bsize;
+        }
+    }
+
+    shard = ngx_http_file_cache_shard(cache, c->key);
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    if (cache->hot_zone) {
+        ngx_http_file_cache_hot_delete(cache, c->key);
+    }
+
+    c->node->count--;
+    c->node->error = 0;
+    c->node->uniq = uniq;
+    c->node->body_start = c->body_start;
+
+    shard->sh->size += fs_size - c->node->fs_size;
+    c->node->fs_size = fs_size;
+
+    if (rc == NGX_OK) {
+        c->node->exists = 1;
+    }
+
+    c->node->updating = 0;
+
+    if (c->fill) {
+        c->fill->length = tf->offset;
+    }
+
+    waiters = ngx_http_file_cache_fill_finish_locked(shard, c, 0);
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+
+    ngx_http_file_cache_fill_notify(waiters);
+}
+
+
+void
+ngx_http_file_cache_progress(ngx_http_request_t *r, ngx_temp_file_t *tf)
+{
+    uint64_t                      waiters;
+    ngx_http_cache_t             *c;
+    ngx_http_file_cache_fill_t   *fill;
+    ngx_http_file_cache_shard_t  *shard;
+
+    c = r->cache;
+
+    if (!c->updating || c->updated || c->node == NULL
+        || tf == NULL || tf->file.fd == NGX_INVALID_FILE)
+    {
+        return;
+    }
+
+    if (c->fill == NULL && c->node->fill == NULL) {
+        /* nobody is waiting for the response */
+        return;
+    }
+
+    shard = ngx_http_file_cache_shard(c->file_cache, c->key);
+    waiters = 0;
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    fill = c->fill;
+
+    if (fill == NULL) {
+        fill = c->node->fill;
+
+        if (fill == NULL
+            || c->lock_time != c->node->lock_time
+            || c->vary.len
+            || tf->offset < (off_t) c->body_start)
+        {
+            goto done;
+        }
+
+        /* publish the temporary file to the waiters */
+
+        fill->name.data = ngx_slab_alloc_locked(shard->shpool,
+                                                tf->file.name.len + 1);
+        if (fill->name.data == NULL) {
+            goto done;
+        }
+
+        ngx_memcpy(fill->name.data, tf->file.name.data, tf->file.name.len + 1);
+        fill->name.len = tf->file.name.len;
+
+        fill->published = 1;
+        fill->count++;
+
+        c->fill = fill;
+    }
+
+    if (fill->length != tf->offset) {
+        fill->length = tf->offset;
+
+        waiters = fill->waiters;
+        fill->waiters = 0;
+    }
+
+done:
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+
+    ngx_http_file_cache_fill_notify(waiters);
+}
+
+
+void
+ngx_http_file_cache_update_header(ngx_http_request_t *r)
+{
+    ssize_t                        n;
+    ngx_err_t                      err;
+    ngx_file_t                     file;
+    ngx_file_info_t                fi;
+    ngx_http_cache_t              *c;
+    ngx_http_file_cache_header_t   h;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache update header");
+
+    c = r->cache;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = c->file.name;
+    file.log = r->connection->log;
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDWR, NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        /* cache file may have been deleted */
+
+        if (err == NGX_ENOENT) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http file cache \"%s\" not found",
+                           file.name.data);
+            return;
+        }
+
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
+                      ngx_open_file_n " \"%s\" failed", file.name.data);
+        return;
+    }
+
+    /*
+     * make sure cache file wasn't replaced;
+     * if it was, do nothing
+     */
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", file.name.data);
+        goto done;
+    }
+
+    if (c->uniq != ngx_file_uniq(&fi)
+        || c->length != ngx_file_size(&fi))
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache \"%s\" changed",
+                       file.name.data);
+        goto done;
+    }
+
+    n = ngx_read_file(&file, (u_char *) &h,
+                      sizeof(ngx_http_file_cache_header_t), 0);
+
+    if (n == NGX_ERROR) {
+        goto done;
+    }
+
+    if ((size_t) n != sizeof(ngx_http_file_cache_header_t)) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      ngx_read_file_n " read only %z of %z from \"%s\"",
+                      n, sizeof(ngx_http_file_cache_header_t), file.name.data);
+        goto done;
+    }
+
+    if (h.version != NGX_HTTP_CACHE_VERSION
+        || h.last_modified != c->last_modified
+        || h.crc32 != c->crc32
+        || (size_t) h.header_start != c->header_start
+        || (size_t) h.body_start != c->body_start)
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache \"%s\" content changed",
+                       file.name.data);
+        goto done;
+    }
+
+    /*
+     * update cache file header with new data,
+     * notably h.valid_sec and h.date
+     */
+
+    ngx_memzero(&h, sizeof(ngx_http_file_cache_header_t));
+
+    h.version = NGX_HTTP_CACHE_VERSION;
+    h.valid_sec = c->valid_sec;
+    h.updating_sec = c->updating_sec;
+    h.error_sec = c->error_sec;
+    h.last_modified = c->last_modified;
+    h.date = c->date;
+    h.crc32 = c->crc32;
+    h.valid_msec = (u_short) c->valid_msec;
+    h.header_start = (u_short) c->header_start;
+    h.body_start = (u_short) c->body_start;
+
+    if (c->etag.len <= NGX_HTTP_CACHE_ETAG_LEN) {
+        h.etag_len = (u_char) c->etag.len;
+        ngx_memcpy(h.etag, c->etag.data, c->etag.len);
+    }
+
+    if (c->vary.len) {
+        if (c->vary.len > NGX_HTTP_CACHE_VARY_LEN) {
+            /* should not happen */
+            c->vary.len = NGX_HTTP_CACHE_VARY_LEN;
+        }
+
+        h.vary_len = (u_char) c->vary.len;
+        ngx_memcpy(h.vary, c->vary.data, c->vary.len);
+
+        ngx_http_file_cache_vary(r, c->vary.data, c->vary.len, c->variant);
+        ngx_memcpy(h.variant, c->variant, NGX_HTTP_CACHE_KEY_LEN);
+    }
+
+    (void) ngx_write_file(&file, (u_char *) &h,
+                          sizeof(ngx_http_file_cache_header_t), 0);
+
+    if (c->file_cache->hot_zone) {
+        ngx_http_file_cache_hot_delete(c->file_cache, c->key);
+    }
+
+done:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+}
+
+
+ngx_int_t
+ngx_http_cache_send(ngx_http_request_t *r)
+{
+    ngx_int_t                  rc;
+    ngx_buf_t                 *b;
+    ngx_chain_t                out;
+    ngx_http_cache_t          *c;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    c = r->cache;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache send: %s", c->file.name.data);
+
+    if (r != r->main && c->length - c->body_start == 0) {
+        return ngx_http_send_header(r);
+    }
+
+    /* we need to allocate all before the header would be sent */
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (!c->hot) {
+        b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    if (c->hot) {
+
+        /* the response is in the copy taken from the hot zone */
+
+        b->pos = c->buf->start + c->body_start;
+        b->last = c->buf->start + c->length;
+        b->memory = (c->length - c->body_start) ? 1: 0;
+
+    } else {
+        b->file_pos = c->body_start;
+        b->file_last = c->length;
+
+        b->in_file = (c->length - c->body_start) ? 1: 0;
+
+        b->file->fd = c->file.fd;
+        b->file->name = c->file.name;
+        b->file->log = r->connection->log;
+    }
+
+    b->last_buf = (r == r->main && c->fill == NULL) ? 1: 0;
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    rc = ngx_http_output_filter(r, &out);
+
+    if (c->fill == NULL || rc == NGX_ERROR) {
+        return rc;
+    }
+
+    /* the rest of the response is sent as the cache fill progresses */
+
+    r->read_event_handler = ngx_http_test_reading;
+    r->write_event_handler = ngx_http_file_cache_fill_writer;
+
+    c->wait_event.handler = ngx_http_file_cache_fill_handler;
+    c->wait_event.data = r;
+    c->wait_event.log = r->connection->log;
+
+    if (r->buffered || r->postponed || r->connection->buffered) {
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        ngx_add_timer(r->connection->write, clcf->send_timeout);
+
+        if (ngx_handle_write_event(r->connection->write, clcf->send_lowat)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        return NGX_DONE;
+    }
+
+    ngx_http_file_cache_fill_send(r);
+
+    return NGX_DONE;
+}
+
+
+void
+ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
+{
+    uint64_t                      waiters;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
+
+    ngx_http_file_cache_wait_delete(c);
+
+    if (c->wait_event.posted) {
+        ngx_delete_posted_event(&c->wait_event);
+    }
+
+    if (c->updated || c->node == NULL) {
+        return;
+    }
+
+    shard = ngx_http_file_cache_shard(c->file_cache, c->key);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache free, fd: %d", c->file.fd);
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    fcn = c->node;
+    fcn->count--;
+
+    waiters = 0;
+
+    if (c->updating) {
+        waiters = ngx_http_file_cache_fill_finish_locked(shard, c, 1);
+
+    } else if (c->fill) {
+        ngx_http_file_cache_fill_detach_locked(shard, c);
+    }
+
+    if (c->updating && fcn->lock_time == c->lock_time) {
+        fcn->updating = 0;
+    }
+
+    if (c->error) {
+        fcn->error = c->error;
+
+        if (c->valid_sec) {
+            fcn->valid_sec = c->valid_sec;
+            fcn->valid_msec = c->valid_msec;
+        }
+
+    } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
+        ngx_queue_remove(&fcn->queue);
+        ngx_rbtree_delete(&shard->sh->rbtree, &fcn->node);
+        ngx_slab_free_locked(shard->shpool, fcn);
+        shard->sh->count--;
+        c->node = NULL;
+    }
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+
+    ngx_http_file_cache_fill_notify(waiters);
+
+    c->updated = 1;
+    c->updating = 0;
+
+    if (c->temp_file) {
+        if (tf && tf->file.fd != NGX_INVALID_FILE) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                           "http file cache incomplete: \"%s\"",
+                           tf->file.name.data);
+
+            if (ngx_delete_file(tf->file.name.data) == NGX_FILE_ERROR) {
+                ngx_log_error(NGX_LOG_CRIT, c->file.log, ngx_errno,
+                              ngx_delete_file_n " \"%s\" failed",
+                              tf->file.name.data);
+            }
+        }
+    }
+
+    if (c->wait_event.timer_set) {
+        ngx_del_timer(&c->wait_event);
+    }
+}
+
+
+static void
+ngx_http_file_cache_cleanup(void *data)
+{
+    ngx_http_cache_t  *c = data;
+
+    if (c->updated) {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache cleanup");
+
+    if (c->updating && !c->background) {
+        ngx_log_error(NGX_LOG_ALERT, c->file.log, 0,
+                      "stalled cache updating, error:%ui", c->error);
+    }
+
+    ngx_http_file_cache_free(c, NULL);
+}
+
+
+static time_t
+ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard)
+{
+    u_char                      *name, *p;
+    size_t                       len;
+    time_t                       wait;
+    ngx_uint_t                   tries;
+    ngx_path_t                  *path;
+    ngx_queue_t                 *q, *sentinel;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache forced expire");
+
+    path = cache->path;
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    name = ngx_alloc(len + 1, ngx_cycle->log);
+    if (name == NULL) {
+        return 10;
+    }
+
+    ngx_memcpy(name, path->name.data, path->name.len);
+
+    wait = 10;
+    tries = 20;
+    sentinel = NULL;
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    for ( ;; ) {
+        if (ngx_queue_empty(&shard->sh->queue)) {
+            break;
+        }
+
+        q = ngx_queue_last(&shard->sh->queue);
+
+        if (q == sentinel) {
+            break;
+        }
+
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                  "http file cache forced expire: #%d %d %02xd%02xd%02xd%02xd",
+                  fcn->count, fcn->exists,
+                  fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+
+        if (fcn->count == 0) {
+            ngx_http_file_cache_delete(cache, shard, q, name);
+            wait = 0;
+            break;
+        }
+
+        p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
+                         sizeof(ngx_rbtree_key_t));
+        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
+        (void) ngx_hex_dump(p, fcn->key, len);
+
+        /*
+         * abnormally exited workers may leave locked cache entries,
+         * and although it may be safe to remove them completely,
+         * we prefer to just move them to the top of the inactive queue
+         */
+
+        ngx_queue_remove(q);
+        fcn->expire = ngx_time() + cache->inactive;
+        ngx_queue_insert_head(&shard->sh->queue, &fcn->queue);
+
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "ignore long locked inactive cache entry %*s, count:%d",
+                      (size_t) 2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+
+        if (sentinel == NULL) {
+            sentinel = q;
+        }
+
+        if (--tries) {
+            continue;
+        }
+
+        wait = 1;
+        break;
+    }
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+
+    ngx_free(name);
+
+    return wait;
+}
+
+
+static time_t
+ngx_http_file_cache_expire(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard)
+{
+    u_char                      *name, *p;
+    size_t                       len;
+    time_t                       now, wait;
+    ngx_path_t                  *path;
+    ngx_msec_t                   elapsed;
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache expire");
+
+    path = cache->path;
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    name = ngx_alloc(len + 1, ngx_cycle->log);
+    if (name == NULL) {
+        return 10;
+    }
+
+    ngx_memcpy(name, path->name.data, path->name.len);
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    for ( ;; ) {
+
+        if (ngx_quit || ngx_terminate) {
+            wait = 1;
+            break;
+        }
+
+        if (ngx_queue_empty(&shard->sh->queue)) {
+            wait = 10;
+            break;
+        }
+
+        q = ngx_queue_last(&shard->sh->queue);
+
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        wait = fcn->expire - now;
+
+        if (wait > 0) {
+            wait = wait > 10 ? 10 : wait;
+            break;
+        }
+
+        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache expire: #%d %d %02xd%02xd%02xd%02xd",
+                       fcn->count, fcn->exists,
+                       fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+
+        if (fcn->count == 0) {
+            ngx_http_file_cache_delete(cache, shard, q, name);
+            goto next;
+        }
+
+        if (fcn->deleting) {
+            wait = 1;
+            break;
+        }
+
+        p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
+                         sizeof(ngx_rbtree_key_t));
+        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
+        (void) ngx_hex_dump(p, fcn->key, len);
+
+        /*
+         * abnormally exited workers may leave locked cache entries,
+         * and although it may be safe to remove them completely,
+         * we prefer to just move them to the top of the inactive queue
+         */
+
+        ngx_queue_remove(q);
+        fcn->expire = ngx_time() + cache->inactive;
+        ngx_queue_insert_head(&shard->sh->queue, &fcn->queue);
+
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "ignore long locked inactive cache entry %*s, count:%d",
+                      (size_t) 2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+
+next:
+
+        if (++cache->files >= cache->manager_files) {
+            wait = 0;
+            break;
+        }
+
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        if (elapsed >= cache->manager_threshold) {
+            wait = 0;
+            break;
+        }
+    }
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+
+    ngx_free(name);
+
+    return wait;
+}
+
+
+static void
+ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard, ngx_queue_t *q, u_char *name)
+{
+    u_char                      *p;
+    size_t                       len;
+    ngx_path_t                  *path;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
+
+    fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+    if (fcn->exists) {
+        shard->sh->size -= fcn->fs_size;
+
+        if (cache->hot_zone) {
+            ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+            ngx_http_file_cache_hot_delete(cache, key);
+        }
+
+        path = cache->path;
+        p = name + path->name.len + 1 + path->len;
+        p = ngx_hex_dump(p, (u_char *) &fcn->node.key,
+                         sizeof(ngx_rbtree_key_t));
+        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
+        p = ngx_hex_dump(p, fcn->key, len);
+        *p = '\0';
+
+        fcn->count++;
+        fcn->deleting = 1;
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+
+        len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+        ngx_create_hashed_filename(path, name, len);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache expire: \"%s\"", name);
+
+        if (ngx_delete_file(name) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", name);
+        }
+
+        ngx_shmtx_lock(&shard->shpool->mutex);
+        fcn->count--;
+        fcn->deleting = 0;
+    }
+
+    if (fcn->count == 0) {
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&shard->sh->rbtree, &fcn->node);
+        ngx_slab_free_locked(shard->shpool, fcn);
+        shard->sh->count--;
+    }
+}
+
+
+static ngx_msec_t
+ngx_http_file_cache_manager(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    off_t                         size, shard_size, largest_size, free;
+    time_t                        wait;
+    ngx_msec_t                    elapsed, next;
+    ngx_uint_t                    i, n, count, watermark;
+    ngx_http_file_cache_shard_t  *shard, *target, *largest;
+
+    cache->last = ngx_current_msec;
+    cache->files = 0;
+
+    /*
+     * the shards share the manager_files and manager_threshold limits,
+     * so the expiration starts from a different shard each time
+     */
+
+    next = 10 * 1000;
+    n = cache->next_shard;
+
+    cache->next_shard = (n + 1) % cache->nshards;
+
+    for (i = 0; i < cache->nshards; i++) {
+        shard = &cache->shards[(n + i) % cache->nshards];
+
+        wait = ngx_http_file_cache_expire(cache, shard);
+
+        if (wait == 0) {
+            next = cache->manager_sleep;
+            goto done;
+        }
+
+        next = ngx_min(next, (ngx_msec_t) wait * 1000);
+    }
+
+    for ( ;; ) {
+        size = 0;
+        largest_size = -1;
+        target = NULL;
+        largest = NULL;
+
+        for (i = 0; i < cache->nshards; i++) {
+            shard = &cache->shards[i];
+
+            ngx_shmtx_lock(&shard->shpool->mutex);
+
+            shard_size = shard->sh->size;
+            count = shard->sh->count;
+            watermark = shard->sh->watermark;
+
+            ngx_shmtx_unlock(&shard->shpool->mutex);
+
+            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                           "http file cache size: %O c:%ui w:%i s:%ui",
+                           shard_size, count, (ngx_int_t) watermark, i);
+
+            size += shard_size;
+
+            if (count >= watermark && target == NULL) {
+                target = shard;
+            }
+
+            if (shard_size > largest_size) {
+                largest_size = shard_size;
+                largest = shard;
+            }
+        }
+
+        if (target == NULL) {
+
+            if (size < cache->max_size) {
+
+                if (!cache->min_free) {
+                    break;
+                }
+
+                free = ngx_fs_available(cache->path->name.data);
+
+                ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                               "http file cache free: %O", free);
+
+                if (free > cache->min_free) {
+                    break;
+                }
+            }
+
+            /* the shard with the largest size approximates the global LRU */
+
+            target = largest;
+        }
+
+        wait = ngx_http_file_cache_forced_expire(cache, target);
+
+        if (wait > 0) {
+            next = (ngx_msec_t) wait * 1000;
+            break;
+        }
+
+        if (ngx_quit || ngx_terminate) {
+            break;
+        }
+
+        if (++cache->files >= cache->manager_files) {
+            next = cache->manager_sleep;
+            break;
+        }
+
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
 
-        ngx_http_file_cache_vary(r, c->vary.data, c->vary.len, c->variant);
-        ngx_memcpy(h.variant, c->variant, NGX_HTTP_CACHE_KEY_LEN);
+        if (elapsed >= cache->manager_threshold) {
+            next = cache->manager_sleep;
+            break;
+        }
     }
 
-    (void) ngx_write_file(&file, (u_char *) &h,
-                          sizeof(ngx_http_file_cache_header_t), 0);
-
 done:
 
-    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
-                      ngx_close_file_n " \"%s\" failed", file.name.data);
-    }
+    elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache manager: %ui e:%M n:%M",
+                   cache->files, elapsed, next);
+
+    return next;
 }
 
 
-ngx_int_t
-ngx_http_cache_send(ngx_http_request_t *r)
+static void
+ngx_http_file_cache_loader(void *data)
 {
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_http_cache_t  *c;
+    ngx_http_file_cache_t  *cache = data;
 
-    c = r->cache;
+    off_t                             size;
+    ngx_int_t                         rc;
+    ngx_uint_t                        i;
+    ngx_tree_ctx_t                    tree;
+    ngx_http_file_cache_loader_ctx_t  lctx;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache send: %s", c->file.name.data);
+    if (!cache->sh->cold || cache->sh->loading) {
+        return;
+    }
 
-    if (r != r->main && c->length - c->body_start == 0) {
-        return ngx_http_send_header(r);
+    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
+        return;
     }
 
-    /* we need to allocate all before the header would be sent */
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache loader");
 
-    b = ngx_calloc_buf(r->pool);
-    if (b == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
-    }
+    ngx_http_file_cache_loader_init_tree(&tree, &lctx, cache);
 
-    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
-    if (b->file == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
-    }
+#if (NGX_THREADS)
 
-    rc = ngx_http_send_header(r);
+    if (cache->loader_threads > 1 && cache->path->level[0]) {
+        rc = ngx_http_file_cache_loader_threads(cache, &tree);
 
-    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
-        return rc;
+    } else
+
+#endif
+    {
+        rc = ngx_walk_tree(&tree, &cache->path->name);
     }
 
-    b->file_pos = c->body_start;
-    b->file_last = c->length;
+    if (rc == NGX_ABORT) {
+        cache->sh->loading = 0;
+        return;
+    }
 
-    b->in_file = (c->length - c->body_start) ? 1: 0;
-    b->last_buf = (r == r->main) ? 1: 0;
-    b->last_in_chain = 1;
+    cache->sh->cold = 0;
+    cache->sh->loading = 0;
 
-    b->file->fd = c->file.fd;
-    b->file->name = c->file.name;
-    b->file->log = r->connection->log;
+    size = 0;
 
-    out.buf = b;
-    out.next = NULL;
+    for (i = 0; i < cache->nshards; i++) {
+        size += cache->shards[i].sh->size;
+    }
 
-    return ngx_http_output_filter(r, &out);
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache: %V %.3fM, bsize: %uz",
+                  &cache->path->name,
+                  ((double) size * cache->bsize) / (1024 * 1024),
+                  cache->bsize);
 }
 
 
-void
-ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
+static void
+ngx_http_file_cache_loader_init_tree(ngx_tree_ctx_t *tree,
+    ngx_http_file_cache_loader_ctx_t *lctx, ngx_http_file_cache_t *cache)
 {
-    ngx_http_file_cache_t       *cache;
-    ngx_http_file_cache_node_t  *fcn;
+    lctx->cache = cache;
+    lctx->dirs = NULL;
+    lctx->files = 0;
+    lctx->last = ngx_current_msec;
+
+    tree->init_handler = NULL;
+    tree->file_handler = ngx_http_file_cache_manage_file;
+    tree->pre_tree_handler = ngx_http_file_cache_manage_directory;
+    tree->post_tree_handler = ngx_http_file_cache_noop;
+    tree->spec_handler = ngx_http_file_cache_delete_file;
+    tree->data = lctx;
+    tree->alloc = 0;
+    tree->log = ngx_cycle->log;
+}
 
-    if (c->updated || c->node == NULL) {
-        return;
-    }
 
-    cache = c->file_cache;
+#if (NGX_THREADS)
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
-                   "http file cache free, fd: %d", c->file.fd);
+/*
+ * The top level of the cache is walked in the loader process itself
+ * to collect the first level directories, which are then shared between
+ * the loader threads.  Each thread walks whole directories and throttles
+ * itself with loader_files, loader_sleep, and loader_threshold.
+ */
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+static ngx_int_t
+ngx_http_file_cache_loader_threads(ngx_http_file_cache_t *cache,
+    ngx_tree_ctx_t *tree)
+{
+    ngx_err_t                           err;
+    ngx_int_t                           rc;
+    ngx_uint_t                          i, n;
+    pthread_t                          *tids;
+    ngx_pool_t                         *pool;
+    ngx_http_file_cache_loader_ctx_t   *lctx;
+    ngx_http_file_cache_loader_work_t   work;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
 
-    fcn = c->node;
-    fcn->count--;
+    lctx = tree->data;
 
-    if (c->updating && fcn->lock_time == c->lock_time) {
-        fcn->updating = 0;
+    lctx->dirs = ngx_array_create(pool, 256, sizeof(ngx_str_t));
+    if (lctx->dirs == NULL) {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
     }
 
-    if (c->error) {
-        fcn->error = c->error;
+    tree->pre_tree_handler = ngx_http_file_cache_collect_directory;
 
-        if (c->valid_sec) {
-            fcn->valid_sec = c->valid_sec;
-            fcn->valid_msec = c->valid_msec;
-        }
+    rc = ngx_walk_tree(tree, &cache->path->name);
 
-    } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
-        ngx_queue_remove(&fcn->queue);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
-        cache->sh->count--;
-        c->node = NULL;
+    if (rc != NGX_OK) {
+        ngx_destroy_pool(pool);
+        return rc;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    work.cache = cache;
+    work.dirs = lctx->dirs;
+    work.next = 0;
+    work.abort = 0;
 
-    c->updated = 1;
-    c->updating = 0;
+    if (ngx_thread_mutex_create(&work.mutex, ngx_cycle->log) != NGX_OK) {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
 
-    if (c->temp_file) {
-        if (tf && tf->file.fd != NGX_INVALID_FILE) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
-                           "http file cache incomplete: \"%s\"",
-                           tf->file.name.data);
+    n = ngx_min(cache->loader_threads, work.dirs->nelts);
 
-            if (ngx_delete_file(tf->file.name.data) == NGX_FILE_ERROR) {
-                ngx_log_error(NGX_LOG_CRIT, c->file.log, ngx_errno,
-                              ngx_delete_file_n " \"%s\" failed",
-                              tf->file.name.data);
-            }
-        }
+    tids = ngx_palloc(pool, n * sizeof(pthread_t));
+    if (tids == NULL) {
+        n = 1;
     }
 
-    if (c->wait_event.timer_set) {
-        ngx_del_timer(&c->wait_event);
+    /* the loader process itself is one of the threads */
+
+    for (i = 1; i < n; i++) {
+        err = pthread_create(&tids[i], NULL,
+                             ngx_http_file_cache_loader_thread, &work);
+        if (err) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                          "pthread_create() failed");
+            break;
+        }
     }
-}
 
+    n = i;
 
-static void
-ngx_http_file_cache_cleanup(void *data)
-{
-    ngx_http_cache_t  *c = data;
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache loader threads: %ui, dirs: %ui",
+                   n, work.dirs->nelts);
 
-    if (c->updated) {
-        return;
+    ngx_http_file_cache_loader_walk(&work);
+
+    for (i = 1; i < n; i++) {
+        err = pthread_join(tids[i], NULL);
+        if (err) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                          "pthread_join() failed");
+        }
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
-                   "http file cache cleanup");
+    (void) ngx_thread_mutex_destroy(&work.mutex, ngx_cycle->log);
 
-    if (c->updating && !c->background) {
-        ngx_log_error(NGX_LOG_ALERT, c->file.log, 0,
-                      "stalled cache updating, error:%ui", c->error);
-    }
+    ngx_destroy_pool(pool);
 
-    ngx_http_file_cache_free(c, NULL);
+    return work.abort ? NGX_ABORT : NGX_OK;
 }
 
 
-static time_t
-ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
+static void *
+ngx_http_file_cache_loader_thread(void *data)
 {
-    u_char                      *name, *p;
-    size_t                       len;
-    time_t                       wait;
-    ngx_uint_t                   tries;
-    ngx_path_t                  *path;
-    ngx_queue_t                 *q, *sentinel;
-    ngx_http_file_cache_node_t  *fcn;
-    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+    ngx_http_file_cache_loader_work_t  *work = data;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache forced expire");
+    int       err;
+    sigset_t  set;
 
-    path = cache->path;
-    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+    sigfillset(&set);
 
-    name = ngx_alloc(len + 1, ngx_cycle->log);
-    if (name == NULL) {
-        return 10;
+    sigdelset(&set, SIGILL);
+    sigdelset(&set, SIGFPE);
+    sigdelset(&set, SIGSEGV);
+    sigdelset(&set, SIGBUS);
+
+    err = pthread_sigmask(SIG_BLOCK, &set, NULL);
+    if (err) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                      "pthread_sigmask() failed");
+        return NULL;
     }
 
-    ngx_memcpy(name, path->name.data, path->name.len);
+    ngx_http_file_cache_loader_walk(work);
+
+    return NULL;
+}
 
-    wait = 10;
-    tries = 20;
-    sentinel = NULL;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+static void
+ngx_http_file_cache_loader_walk(ngx_http_file_cache_loader_work_t *work)
+{
+    ngx_str_t                         *dir;
+    ngx_tree_ctx_t                     tree;
+    ngx_http_file_cache_loader_ctx_t   lctx;
+
+    ngx_http_file_cache_loader_init_tree(&tree, &lctx, work->cache);
 
     for ( ;; ) {
-        if (ngx_queue_empty(&cache->sh->queue)) {
-            break;
-        }
 
-        q = ngx_queue_last(&cache->sh->queue);
+        if (ngx_thread_mutex_lock(&work->mutex, ngx_cycle->log) != NGX_OK) {
+            return;
+        }
 
-        if (q == sentinel) {
-            break;
+        if (work->abort || work->next == work->dirs->nelts) {
+            (void) ngx_thread_mutex_unlock(&work->mutex, ngx_cycle->log);
+            return;
         }
 
-        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+        dir = (ngx_str_t *) work->dirs->elts + work->next++;
 
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                  "http file cache forced expire: #%d %d %02xd%02xd%02xd%02xd",
-                  fcn->count, fcn->exists,
-                  fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+        (void) ngx_thread_mutex_unlock(&work->mutex, ngx_cycle->log);
 
-        if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
-            wait = 0;
-            break;
+        if (ngx_walk_tree(&tree, dir) == NGX_ABORT) {
+            (void) ngx_thread_mutex_lock(&work->mutex, ngx_cycle->log);
+            work->abort = 1;
+            (void) ngx_thread_mutex_unlock(&work->mutex, ngx_cycle->log);
+            return;
         }
+    }
+}
 
-        p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
-                         sizeof(ngx_rbtree_key_t));
-        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
-        (void) ngx_hex_dump(p, fcn->key, len);
-
-        /*
-         * abnormally exited workers may leave locked cache entries,
-         * and although it may be safe to remove them completely,
-         * we prefer to just move them to the top of the inactive queue
-         */
 
-        ngx_queue_remove(q);
-        fcn->expire = ngx_time() + cache->inactive;
-        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+static ngx_int_t
+ngx_http_file_cache_collect_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_str_t                         *dir;
+    ngx_http_file_cache_loader_ctx_t  *lctx;
 
-        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                      "ignore long locked inactive cache entry %*s, count:%d",
-                      (size_t) 2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+    if (ngx_http_file_cache_manage_directory(ctx, path) == NGX_DECLINED) {
+        return NGX_DECLINED;
+    }
 
-        if (sentinel == NULL) {
-            sentinel = q;
-        }
+    lctx = ctx->data;
 
-        if (--tries) {
-            continue;
-        }
+    dir = ngx_array_push(lctx->dirs);
+    if (dir == NULL) {
+        return NGX_ABORT;
+    }
 
-        wait = 1;
-        break;
+    dir->len = path->len;
+    dir->data = ngx_pnalloc(lctx->dirs->pool, path->len + 1);
+    if (dir->data == NULL) {
+        return NGX_ABORT;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_memcpy(dir->data, path->data, path->len + 1);
 
-    ngx_free(name);
+    /* the directory is walked later by one of the loader threads */
 
-    return wait;
+    return NGX_DECLINED;
 }
 
+#endif
+
 
-static time_t
-ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
+static ngx_int_t
+ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
 {
-    u_char                      *name, *p;
-    size_t                       len;
-    time_t                       now, wait;
-    ngx_path_t                  *path;
-    ngx_msec_t                   elapsed;
-    ngx_queue_t                 *q;
-    ngx_http_file_cache_node_t  *fcn;
-    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+    return NGX_OK;
+}
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache expire");
 
-    path = cache->path;
-    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+static ngx_int_t
+ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_msec_t                         elapsed;
+    ngx_http_file_cache_loader_ctx_t  *lctx;
 
-    name = ngx_alloc(len + 1, ngx_cycle->log);
-    if (name == NULL) {
-        return 10;
+    lctx = ctx->data;
+
+    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
+        (void) ngx_http_file_cache_delete_file(ctx, path);
     }
 
-    ngx_memcpy(name, path->name.data, path->name.len);
+    if (++lctx->files >= lctx->cache->loader_files) {
+        ngx_http_file_cache_loader_sleep(lctx);
 
-    now = ngx_time();
+    } else {
+        ngx_time_update();
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - lctx->last));
 
-    for ( ;; ) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache loader time elapsed: %M", elapsed);
 
-        if (ngx_quit || ngx_terminate) {
-            wait = 1;
-            break;
+        if (elapsed >= lctx->cache->loader_threshold) {
+            ngx_http_file_cache_loader_sleep(lctx);
         }
+    }
+
+    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
+}
 
-        if (ngx_queue_empty(&cache->sh->queue)) {
-            wait = 10;
-            break;
-        }
 
-        q = ngx_queue_last(&cache->sh->queue);
+static ngx_int_t
+ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    if (path->len >= 5
+        && ngx_strncmp(path->data + path->len - 5, "/temp", 5) == 0)
+    {
+        return NGX_DECLINED;
+    }
 
-        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+    return NGX_OK;
+}
 
-        wait = fcn->expire - now;
 
-        if (wait > 0) {
-            wait = wait > 10 ? 10 : wait;
-            break;
-        }
+static void
+ngx_http_file_cache_loader_sleep(ngx_http_file_cache_loader_ctx_t *lctx)
+{
+    ngx_msleep(lctx->cache->loader_sleep);
 
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache expire: #%d %d %02xd%02xd%02xd%02xd",
-                       fcn->count, fcn->exists,
-                       fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+    ngx_time_update();
 
-        if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
-            goto next;
-        }
+    lctx->last = ngx_current_msec;
+    lctx->files = 0;
+}
 
-        if (fcn->deleting) {
-            wait = 1;
-            break;
-        }
 
-        p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
-                         sizeof(ngx_rbtree_key_t));
-        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
-        (void) ngx_hex_dump(p, fcn->key, len);
+static ngx_int_t
+ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
+{
+    u_char                            *p;
+    ngx_int_t                          n;
+    ngx_uint_t                         i;
+    ngx_http_cache_t                   c;
+    ngx_http_file_cache_t             *cache;
+    ngx_http_file_cache_loader_ctx_t  *lctx;
 
-        /*
-         * abnormally exited workers may leave locked cache entries,
-         * and although it may be safe to remove them completely,
-         * we prefer to just move them to the top of the inactive queue
-         */
+    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
+        return NGX_ERROR;
+    }
 
-        ngx_queue_remove(q);
-        fcn->expire = ngx_time() + cache->inactive;
-        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    /*
+     * Temporary files in cache have a suffix consisting of a dot
+     * followed by 10 digits.
+     */
 
-        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                      "ignore long locked inactive cache entry %*s, count:%d",
-                      (size_t) 2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+    if (name->len >= 2 * NGX_HTTP_CACHE_KEY_LEN + 1 + 10
+        && name->data[name->len - 10 - 1] == '.')
+    {
+        return NGX_OK;
+    }
 
-next:
+    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
+                      "cache file \"%s\" is too small", name->data);
+        return NGX_ERROR;
+    }
 
-        if (++cache->files >= cache->manager_files) {
-            wait = 0;
-            break;
-        }
+    ngx_memzero(&c, sizeof(ngx_http_cache_t));
+    lctx = ctx->data;
+    cache = lctx->cache;
 
-        ngx_time_update();
+    c.length = ctx->size;
+    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
 
-        if (elapsed >= cache->manager_threshold) {
-            wait = 0;
-            break;
+    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
+        n = ngx_hextoi(p, 2);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
         }
-    }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+        p += 2;
 
-    ngx_free(name);
+        c.key[i] = (u_char) n;
+    }
 
-    return wait;
+    return ngx_http_file_cache_add(cache, &c);
 }
 
 
-static void
-ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
-    u_char *name)
+static ngx_int_t
+ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
-    u_char                      *p;
-    size_t                       len;
-    ngx_path_t                  *path;
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
 
-    fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+    shard = ngx_http_file_cache_shard(cache, c->key);
 
-    if (fcn->exists) {
-        cache->sh->size -= fcn->fs_size;
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
-        path = cache->path;
-        p = name + path->name.len + 1 + path->len;
-        p = ngx_hex_dump(p, (u_char *) &fcn->node.key,
-                         sizeof(ngx_rbtree_key_t));
-        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
-        p = ngx_hex_dump(p, fcn->key, len);
-        *p = '\0';
+    fcn = ngx_http_file_cache_lookup(shard, c->key);
 
-        fcn->count++;
-        fcn->deleting = 1;
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+    if (fcn == NULL) {
 
-        len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
-        ngx_create_hashed_filename(path, name, len);
+        fcn = ngx_slab_calloc_locked(shard->shpool,
+                                     sizeof(ngx_http_file_cache_node_t));
+        if (fcn == NULL) {
+            ngx_http_file_cache_set_watermark(shard);
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache expire: \"%s\"", name);
+            if (cache->fail_time != ngx_time()) {
+                cache->fail_time = ngx_time();
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                           "could not allocate node%s", shard->shpool->log_ctx);
+            }
 
-        if (ngx_delete_file(name) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
-                          ngx_delete_file_n " \"%s\" failed", name);
+            ngx_shmtx_unlock(&shard->shpool->mutex);
+            return NGX_ERROR;
         }
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
-        fcn->count--;
-        fcn->deleting = 0;
-    }
-
-    if (fcn->count == 0) {
-        ngx_queue_remove(q);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
-        cache->sh->count--;
-    }
-}
+        shard->sh->count++;
 
+        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
 
-static ngx_msec_t
-ngx_http_file_cache_manager(void *data)
-{
-    ngx_http_file_cache_t  *cache = data;
+        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-    off_t       size, free;
-    time_t      wait;
-    ngx_msec_t  elapsed, next;
-    ngx_uint_t  count, watermark;
+        ngx_rbtree_insert(&shard->sh->rbtree, &fcn->node);
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
+        fcn->uses = 1;
+        fcn->exists = 1;
+        fcn->fs_size = c->fs_size;
 
-    next = (ngx_msec_t) ngx_http_file_cache_expire(cache) * 1000;
+        shard->sh->size += c->fs_size;
 
-    if (next == 0) {
-        next = cache->manager_sleep;
-        goto done;
+    } else {
+        ngx_queue_remove(&fcn->queue);
     }
 
-    for ( ;; ) {
-        ngx_shmtx_lock(&cache->shpool->mutex);
-
-        size = cache->sh->size;
-        count = cache->sh->count;
-        watermark = cache->sh->watermark;
+    fcn->expire = ngx_time() + cache->inactive;
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_queue_insert_head(&shard->sh->queue, &fcn->queue);
 
-        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache size: %O c:%ui w:%i",
-                       size, count, (ngx_int_t) watermark);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
-        if (size < cache->max_size && count < watermark) {
+    return NGX_OK;
+}
 
-            if (!cache->min_free) {
-                break;
-            }
 
-            free = ngx_fs_available(cache->path->name.data);
+static ngx_int_t
+ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
+                   "http file cache delete: \"%s\"", path->data);
 
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                           "http file cache free: %O", free);
+    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", path->data);
+    }
 
-            if (free > cache->min_free) {
-                break;
-            }
-        }
+    return NGX_OK;
+}
 
-        wait = ngx_http_file_cache_forced_expire(cache);
 
-        if (wait > 0) {
-            next = (ngx_msec_t) wait * 1000;
-            break;
-        }
+static void
+ngx_http_file_cache_set_watermark(ngx_http_file_cache_shard_t *shard)
+{
+    shard->sh->watermark = shard->sh->count - shard->sh->count / 8;
 
-        if (ngx_quit || ngx_terminate) {
-            break;
-        }
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache watermark: %ui", shard->sh->watermark);
+}
 
-        if (++cache->files >= cache->manager_files) {
-            next = cache->manager_sleep;
-            break;
-        }
 
-        ngx_time_update();
+static ngx_int_t
+ngx_http_file_cache_snapshot_name(ngx_http_file_cache_t *cache,
+    ngx_str_t *name, ngx_str_t *temp, ngx_log_t *log)
+{
+    u_char  *p;
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+    name->len = cache->path->name.len + sizeof("/snapshot") - 1;
 
-        if (elapsed >= cache->manager_threshold) {
-            next = cache->manager_sleep;
-            break;
-        }
+    name->data = ngx_alloc(2 * (name->len + sizeof(".tmp")), log);
+    if (name->data == NULL) {
+        return NGX_ERROR;
     }
 
-done:
+    p = ngx_cpymem(name->data, cache->path->name.data, cache->path->name.len);
+    ngx_memcpy(p, "/snapshot", sizeof("/snapshot"));
 
-    elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+    temp->len = name->len + sizeof(".tmp") - 1;
+    temp->data = name->data + name->len + sizeof(".tmp");
 
-    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache manager: %ui e:%M n:%M",
-                   cache->files, elapsed, next);
+    p = ngx_cpymem(temp->data, name->data, name->len);
+    ngx_memcpy(p, ".tmp", sizeof(".tmp"));
 
-    return next;
+    return NGX_OK;
 }
 
 
+/*
+ * The snapshot is a header followed by fixed size records of all existing
+ * nodes, from the least recently used one to the most recently used one.
+ * It is saved by the master process on exit and consumed on the next
+ * start when the keys zone is created.
+ */
+
 static void
-ngx_http_file_cache_loader(void *data)
+ngx_http_file_cache_snapshot_save(void *data)
 {
     ngx_http_file_cache_t  *cache = data;
 
-    ngx_tree_ctx_t  tree;
+    off_t                                   offset;
+    size_t                                  n;
+    uint64_t                                count;
+    ngx_str_t                               name, temp;
+    ngx_uint_t                              i;
+    ngx_file_t                              file;
+    ngx_queue_t                            *q;
+    ngx_http_file_cache_node_t             *fcn;
+    ngx_http_file_cache_shard_t            *shard;
+    ngx_http_file_cache_snapshot_node_t    *buf, *sn;
+    ngx_http_file_cache_snapshot_header_t   header;
+
+    if (cache->sh == NULL || cache->sh->cold || cache->sh->loading) {
+        return;
+    }
 
-    if (!cache->sh->cold || cache->sh->loading) {
+    if (ngx_http_file_cache_snapshot_name(cache, &name, &temp, ngx_cycle->log)
+        != NGX_OK)
+    {
         return;
     }
 
-    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
+    buf = ngx_alloc(NGX_HTTP_FILE_CACHE_SNAPSHOT_BATCH
+                    * sizeof(ngx_http_file_cache_snapshot_node_t),
+                    ngx_cycle->log);
+    if (buf == NULL) {
+        ngx_free(name.data);
         return;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache loader");
+    ngx_memzero(&file, sizeof(ngx_file_t));
 
-    tree.init_handler = NULL;
-    tree.file_handler = ngx_http_file_cache_manage_file;
-    tree.pre_tree_handler = ngx_http_file_cache_manage_directory;
-    tree.post_tree_handler = ngx_http_file_cache_noop;
-    tree.spec_handler = ngx_http_file_cache_delete_file;
-    tree.data = cache;
-    tree.alloc = 0;
-    tree.log = ngx_cycle->log;
+    file.name = temp;
+    file.log = ngx_cycle->log;
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
+    file.fd = ngx_open_file(temp.data, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                            NGX_FILE_DEFAULT_ACCESS);
 
-    if (ngx_walk_tree(&tree, &cache->path->name) == NGX_ABORT) {
-        cache->sh->loading = 0;
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", temp.data);
+        ngx_free(buf);
+        ngx_free(name.data);
         return;
     }
 
-    cache->sh->cold = 0;
-    cache->sh->loading = 0;
+    n = 0;
+    count = 0;
+    offset = sizeof(header);
 
-    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
-                  "http file cache: %V %.3fM, bsize: %uz",
-                  &cache->path->name,
-                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
-                  cache->bsize);
-}
+    for (i = 0; i < cache->nshards; i++) {
+        shard = &cache->shards[i];
 
+        if (!ngx_shmtx_trylock(&shard->shpool->mutex)) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                          "could not lock keys zone%s, snapshot is not saved",
+                          shard->shpool->log_ctx);
+            goto failed;
+        }
 
-static ngx_int_t
-ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    return NGX_OK;
-}
+        for (q = ngx_queue_last(&shard->sh->queue);
+             q != ngx_queue_sentinel(&shard->sh->queue);
+             q = ngx_queue_prev(q))
+        {
+            fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+            if (!fcn->exists || fcn->deleting) {
+                continue;
+            }
+
+            sn = &buf[n++];
 
+            ngx_memcpy(sn->key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&sn->key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+            sn->uniq = fcn->uniq;
+            sn->expire = fcn->expire;
+            sn->valid_sec = fcn->valid_sec;
+            sn->fs_size = fcn->fs_size;
+            sn->body_start = fcn->body_start;
+            sn->uses = fcn->uses;
+            sn->valid_msec = fcn->valid_msec;
+
+            if (n < NGX_HTTP_FILE_CACHE_SNAPSHOT_BATCH) {
+                continue;
+            }
+
+            if (ngx_write_file(&file, (u_char *) buf, n * sizeof(*sn), offset)
+                == NGX_ERROR)
+            {
+                ngx_shmtx_unlock(&shard->shpool->mutex);
+                goto failed;
+            }
+
+            offset += n * sizeof(*sn);
+            count += n;
+            n = 0;
+        }
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+    }
+
+    if (n) {
+        if (ngx_write_file(&file, (u_char *) buf, n * sizeof(*sn), offset)
+            == NGX_ERROR)
+        {
+            goto failed;
+        }
+
+        count += n;
+    }
 
-static ngx_int_t
-ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    ngx_msec_t              elapsed;
-    ngx_http_file_cache_t  *cache;
+    header.magic = NGX_HTTP_FILE_CACHE_SNAPSHOT_MAGIC;
+    header.version = NGX_HTTP_FILE_CACHE_SNAPSHOT_VERSION;
+    header.node_size = sizeof(ngx_http_file_cache_snapshot_node_t);
+    header.bsize = (uint32_t) cache->bsize;
+    header.count = count;
 
-    cache = ctx->data;
+    if (ngx_write_file(&file, (u_char *) &header, sizeof(header), 0)
+        == NGX_ERROR)
+    {
+        goto failed;
+    }
 
-    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
-        (void) ngx_http_file_cache_delete_file(ctx, path);
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp.data);
     }
 
-    if (++cache->files >= cache->loader_files) {
-        ngx_http_file_cache_loader_sleep(cache);
+    if (ngx_rename_file(temp.data, name.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      temp.data, name.data);
+
+        (void) ngx_delete_file(temp.data);
 
     } else {
-        ngx_time_update();
+        ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                      "http file cache: %V snapshot saved, %uL entries",
+                      &cache->path->name, count);
+    }
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+    ngx_free(buf);
+    ngx_free(name.data);
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache loader time elapsed: %M", elapsed);
+    return;
 
-        if (elapsed >= cache->loader_threshold) {
-            ngx_http_file_cache_loader_sleep(cache);
-        }
+failed:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp.data);
     }
 
-    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
+    if (ngx_delete_file(temp.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", temp.data);
+    }
+
+    ngx_free(buf);
+    ngx_free(name.data);
 }
 
 
 static ngx_int_t
-ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+ngx_http_file_cache_snapshot_load(ngx_http_file_cache_t *cache,
+    ngx_log_t *log)
 {
-    if (path->len >= 5
-        && ngx_strncmp(path->data + path->len - 5, "/temp", 5) == 0)
-    {
-        return NGX_DECLINED;
+    off_t                                   offset;
+    size_t                                  i, n;
+    ssize_t                                 size;
+    uint64_t                                count;
+    ngx_int_t                               rc;
+    ngx_err_t                               err;
+    ngx_str_t                               name, temp;
+    ngx_file_t                              file;
+    ngx_file_info_t                         fi;
+    ngx_http_file_cache_shard_t            *shard;
+    ngx_http_file_cache_snapshot_node_t    *buf;
+    ngx_http_file_cache_snapshot_header_t   header;
+
+    if (ngx_http_file_cache_snapshot_name(cache, &name, &temp, log) != NGX_OK) {
+        return NGX_ERROR;
     }
 
-    return NGX_OK;
-}
+    ngx_memzero(&file, sizeof(ngx_file_t));
 
+    file.name = name;
+    file.log = log;
 
-static void
-ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
-{
-    ngx_msleep(cache->loader_sleep);
+    file.fd = ngx_open_file(name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
 
-    ngx_time_update();
+    if (file.fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
-}
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, log, err,
+                          ngx_open_file_n " \"%s\" failed", name.data);
+        }
 
+        ngx_free(name.data);
+        return NGX_DECLINED;
+    }
 
-static ngx_int_t
-ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
-{
-    u_char                 *p;
-    ngx_int_t               n;
-    ngx_uint_t              i;
-    ngx_http_cache_t        c;
-    ngx_http_file_cache_t  *cache;
+    buf = NULL;
+    rc = NGX_DECLINED;
 
-    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
-        return NGX_ERROR;
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name.data);
+        goto done;
     }
 
-    /*
-     * Temporary files in cache have a suffix consisting of a dot
-     * followed by 10 digits.
-     */
+    size = ngx_read_file(&file, (u_char *) &header, sizeof(header), 0);
 
-    if (name->len >= 2 * NGX_HTTP_CACHE_KEY_LEN + 1 + 10
-        && name->data[name->len - 10 - 1] == '.')
+    if (size == NGX_ERROR) {
+        goto done;
+    }
+
+    if ((size_t) size != sizeof(header)
+        || header.magic != NGX_HTTP_FILE_CACHE_SNAPSHOT_MAGIC
+        || header.version != NGX_HTTP_FILE_CACHE_SNAPSHOT_VERSION
+        || header.node_size != sizeof(ngx_http_file_cache_snapshot_node_t)
+        || header.bsize != cache->bsize
+        || (uint64_t) ngx_file_size(&fi)
+           != sizeof(header)
+              + header.count * sizeof(ngx_http_file_cache_snapshot_node_t))
     {
-        return NGX_OK;
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "cache snapshot \"%s\" is invalid, ignored", name.data);
+        goto done;
     }
 
-    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
-                      "cache file \"%s\" is too small", name->data);
-        return NGX_ERROR;
+    buf = ngx_alloc(NGX_HTTP_FILE_CACHE_SNAPSHOT_BATCH
+                    * sizeof(ngx_http_file_cache_snapshot_node_t), log);
+    if (buf == NULL) {
+        goto done;
     }
 
-    ngx_memzero(&c, sizeof(ngx_http_cache_t));
-    cache = ctx->data;
+    offset = sizeof(header);
 
-    c.length = ctx->size;
-    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
+    for (count = header.count; count; count -= n) {
 
-    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
+        n = ngx_min(count, NGX_HTTP_FILE_CACHE_SNAPSHOT_BATCH);
 
-    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
-        n = ngx_hextoi(p, 2);
+        size = ngx_read_file(&file, (u_char *) buf,
+                             n * sizeof(ngx_http_file_cache_snapshot_node_t),
+                             offset);
 
-        if (n == NGX_ERROR) {
-            return NGX_ERROR;
+        if (size == NGX_ERROR) {
+            goto done;
         }
 
-        p += 2;
-
-        c.key[i] = (u_char) n;
-    }
-
-    return ngx_http_file_cache_add(cache, &c);
-}
-
+        if ((size_t) size != n * sizeof(ngx_http_file_cache_snapshot_node_t)) {
+            ngx_log_error(NGX_LOG_CRIT, log, 0,
+                          ngx_read_file_n " read only %z of %uz from \"%s\"",
+                          size,
+                          n * sizeof(ngx_http_file_cache_snapshot_node_t),
+                          name.data);
+            goto done;
+        }
 
-static ngx_int_t
-ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
-{
-    ngx_http_file_cache_node_t  *fcn;
+        offset += size;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+        for (i = 0; i < n; i++) {
+            shard = ngx_http_file_cache_shard(cache, buf[i].key);
 
-    fcn = ngx_http_file_cache_lookup(cache, c->key);
+            ngx_shmtx_lock(&shard->shpool->mutex);
 
-    if (fcn == NULL) {
+            rc = ngx_http_file_cache_snapshot_add(cache, shard, &buf[i]);
 
-        fcn = ngx_slab_calloc_locked(cache->shpool,
-                                     sizeof(ngx_http_file_cache_node_t));
-        if (fcn == NULL) {
-            ngx_http_file_cache_set_watermark(cache);
+            ngx_shmtx_unlock(&shard->shpool->mutex);
 
-            if (cache->fail_time != ngx_time()) {
-                cache->fail_time = ngx_time();
-                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                           "could not allocate node%s", cache->shpool->log_ctx);
+            if (rc != NGX_OK) {
+                rc = NGX_DECLINED;
+                goto done;
             }
-
-            ngx_shmtx_unlock(&cache->shpool->mutex);
-            return NGX_ERROR;
         }
+    }
 
-        cache->sh->count++;
-
-        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
-
-        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
-                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+    rc = NGX_OK;
 
-        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "http file cache: %V snapshot loaded, %uL entries",
+                  &cache->path->name, header.count);
 
-        fcn->uses = 1;
-        fcn->exists = 1;
-        fcn->fs_size = c->fs_size;
+done:
 
-        cache->sh->size += c->fs_size;
+    if (buf) {
+        ngx_free(buf);
+    }
 
-    } else {
-        ngx_queue_remove(&fcn->queue);
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name.data);
     }
 
-    fcn->expire = ngx_time() + cache->inactive;
+    /* a snapshot is only valid until the cache is changed */
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    if (ngx_delete_file(name.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", name.data);
+    }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_free(name.data);
 
-    return NGX_OK;
+    return rc;
 }
 
 
 static ngx_int_t
-ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+ngx_http_file_cache_snapshot_add(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard, ngx_http_file_cache_snapshot_node_t *sn)
 {
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
-                   "http file cache delete: \"%s\"", path->data);
+    ngx_http_file_cache_node_t  *fcn;
 
-    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
-                      ngx_delete_file_n " \"%s\" failed", path->data);
+    if (ngx_http_file_cache_lookup(shard, sn->key)) {
+        return NGX_OK;
     }
 
-    return NGX_OK;
-}
+    fcn = ngx_slab_calloc_locked(shard->shpool,
+                                 sizeof(ngx_http_file_cache_node_t));
+    if (fcn == NULL) {
+        ngx_http_file_cache_set_watermark(shard);
 
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "could not allocate node%s", shard->shpool->log_ctx);
+        return NGX_ERROR;
+    }
 
-static void
-ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache)
-{
-    cache->sh->watermark = cache->sh->count - cache->sh->count / 8;
+    shard->sh->count++;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache watermark: %ui", cache->sh->watermark);
+    ngx_memcpy((u_char *) &fcn->node.key, sn->key, sizeof(ngx_rbtree_key_t));
+
+    ngx_memcpy(fcn->key, &sn->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    ngx_rbtree_insert(&shard->sh->rbtree, &fcn->node);
+
+    fcn->uses = sn->uses;
+    fcn->valid_msec = sn->valid_msec;
+    fcn->exists = 1;
+    fcn->uniq = sn->uniq;
+    fcn->expire = sn->expire;
+    fcn->valid_sec = sn->valid_sec;
+    fcn->body_start = sn->body_start;
+    fcn->fs_size = sn->fs_size;
+
+    shard->sh->size += sn->fs_size;
+
+    ngx_queue_insert_head(&shard->sh->queue, &fcn->queue);
+
+    return NGX_OK;
 }
 
 
@@ -2322,12 +4405,15 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     off_t                   max_size, min_free;
     u_char                 *last, *p;
     time_t                  inactive;
-    ssize_t                 size;
-    ngx_str_t               s, name, *value;
-    ngx_int_t               loader_files, manager_files;
+    ssize_t                 size, hot_size, hot_max_size;
+    ngx_str_t               s, name, hot_name, shard_name, *value;
+    ngx_int_t               loader_files, manager_files, hot_min_uses;
+    ngx_int_t               nshards;
+    ngx_shm_zone_t         *shm_zone;
     ngx_msec_t              loader_sleep, manager_sleep, loader_threshold,
                             manager_threshold;
-    ngx_uint_t              i, n, use_temp_path;
+    ngx_int_t               loader_threads;
+    ngx_uint_t              i, n, use_temp_path, snapshot;
     ngx_array_t            *caches;
     ngx_http_file_cache_t  *cache, **ce;
 
@@ -2348,6 +4434,11 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     loader_files = 100;
     loader_sleep = 50;
     loader_threshold = 200;
+    loader_threads = 1;
+
+    snapshot = 0;
+
+    nshards = 1;
 
     manager_files = 100;
     manager_sleep = 50;
@@ -2358,6 +4449,11 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     max_size = NGX_MAX_OFF_T_VALUE;
     min_free = 0;
 
+    hot_name.len = 0;
+    hot_size = 0;
+    hot_max_size = 16384;
+    hot_min_uses = 2;
+
     value = cf->args->elts;
 
     cache->path->name = value[1];
@@ -2462,6 +4558,79 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            nshards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (nshards == NGX_ERROR || nshards == 0 || nshards > 256) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid shards value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "hot_zone=", 9) == 0) {
+
+            hot_name.data = value[i].data + 9;
+
+            p = (u_char *) ngx_strchr(hot_name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid hot zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            hot_name.len = p - hot_name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            hot_size = ngx_parse_size(&s);
+
+            if (hot_size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid hot zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (hot_size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "hot zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "hot_max_size=", 13) == 0) {
+
+            s.len = value[i].len - 13;
+            s.data = value[i].data + 13;
+
+            hot_max_size = ngx_parse_size(&s);
+            if (hot_max_size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid hot_max_size value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "hot_min_uses=", 13) == 0) {
+
+            hot_min_uses = ngx_atoi(value[i].data + 13, value[i].len - 13);
+            if (hot_min_uses == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid hot_min_uses value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "inactive=", 9) == 0) {
 
             s.len = value[i].len - 9;
@@ -2557,6 +4726,44 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "loader_threads=", 15) == 0) {
+
+#if (NGX_THREADS)
+            loader_threads = ngx_atoi(value[i].data + 15, value[i].len - 15);
+            if (loader_threads == NGX_ERROR || loader_threads == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid loader_threads value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"loader_threads\" is not supported "
+                               "on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "snapshot=", 9) == 0) {
+
+            if (ngx_strcmp(&value[i].data[9], "on") == 0) {
+                snapshot = 1;
+
+            } else if (ngx_strcmp(&value[i].data[9], "off") == 0) {
+                snapshot = 0;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid snapshot value \"%V\", "
+                                   "it must be \"on\" or \"off\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "manager_files=", 14) == 0) {
 
             manager_files = ngx_atoi(value[i].data + 14, value[i].len - 14);
@@ -2613,12 +4820,15 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     cache->path->manager = ngx_http_file_cache_manager;
     cache->path->loader = ngx_http_file_cache_loader;
+    cache->path->saver = snapshot ? ngx_http_file_cache_snapshot_save : NULL;
     cache->path->data = cache;
     cache->path->conf_file = cf->conf_file->file.name.data;
     cache->path->line = cf->conf_file->line;
     cache->loader_files = loader_files;
     cache->loader_sleep = loader_sleep;
     cache->loader_threshold = loader_threshold;
+    cache->loader_threads = loader_threads;
+    cache->snapshot = snapshot;
     cache->manager_files = manager_files;
     cache->manager_sleep = manager_sleep;
     cache->manager_threshold = manager_threshold;
@@ -2627,7 +4837,53 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
-    cache->shm_zone = ngx_shared_memory_add(cf, &name, size, cmd->post);
+    if (size / nshards < (ssize_t) (2 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "keys zone \"%V\" is too small for %i shards",
+                           &name, nshards);
+        return NGX_CONF_ERROR;
+    }
+
+    cache->nshards = nshards;
+
+    cache->shards = ngx_pcalloc(cf->pool,
+                                nshards * sizeof(ngx_http_file_cache_shard_t));
+    if (cache->shards == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    /*
+     * every shard but the first one lives in its own zone, which is
+     * added before the main zone to be initialized earlier
+     */
+
+    for (n = 1; n < (ngx_uint_t) nshards; n++) {
+        shard_name.data = ngx_pnalloc(cf->pool, name.len + 1 + NGX_INT_T_LEN);
+        if (shard_name.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        shard_name.len = ngx_sprintf(shard_name.data, "%V#%ui", &name, n)
+                         - shard_name.data;
+
+        shm_zone = ngx_shared_memory_add(cf, &shard_name, size / nshards,
+                                         cmd->post);
+        if (shm_zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (shm_zone->data) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "duplicate zone \"%V\"", &shard_name);
+            return NGX_CONF_ERROR;
+        }
+
+        shm_zone->init = ngx_http_file_cache_shard_init;
+        shm_zone->data = &cache->shards[n];
+    }
+
+    cache->shm_zone = ngx_shared_memory_add(cf, &name, size / nshards,
+                                            cmd->post);
     if (cache->shm_zone == NULL) {
         return NGX_CONF_ERROR;
     }
@@ -2642,6 +4898,26 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->shm_zone->init = ngx_http_file_cache_init;
     cache->shm_zone->data = cache;
 
+    if (hot_name.len) {
+        cache->hot_zone = ngx_shared_memory_add(cf, &hot_name, hot_size,
+                                                cmd->post);
+        if (cache->hot_zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (cache->hot_zone->data) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "duplicate zone \"%V\"", &hot_name);
+            return NGX_CONF_ERROR;
+        }
+
+        cache->hot_zone->init = ngx_http_file_cache_hot_init;
+        cache->hot_zone->data = cache;
+
+        cache->hot_max_size = hot_max_size;
+        cache->hot_min_uses = hot_min_uses;
+    }
+
     cache->use_temp_path = use_temp_path;
 
     cache->inactive = inactive;
@@ -18,6 +18,18 @@ typedef struct {
 } ngx_http_huff_decode_code_t;
 
 
+typedef struct {
+    u_char  next;
+    u_char  flags;
+    u_char  sym[2];
+} ngx_http_huff_decode_byte_t;
+
+
+#define NGX_HTTP_HUFF_DECODE_EMIT    0x03
+#define NGX_HTTP_HUFF_DECODE_ENDING  0x04
+#define NGX_HTTP_HUFF_DECODE_ERROR   0x08
+
+
 static ngx_inline ngx_int_t ngx_http_huff_decode_bits(u_char *state,
     u_char *ending, ngx_uint_t bits, u_char **dst);
 
@@ -2639,58 +2651,123 @@ static ngx_http_huff_decode_code_t  ngx_http_huff_decode_codes[256][16] =
 };
 
 
+/*
+ * The byte table is derived from the 4-bit one above: each entry holds
+ * the result of feeding a whole octet from a given state, that is,
+ * up to two symbols, as the shortest code is 5 bits long.
+ */
+
+static ngx_http_huff_decode_byte_t  ngx_http_huff_decode_bytes[256][256];
+
+
+void
+ngx_http_huff_decode_init(void)
+{
+    u_char                        state, ending, *p;
+    ngx_uint_t                    i, ch;
+    ngx_http_huff_decode_byte_t  *code;
+
+    static ngx_uint_t  initialized;
+
+    if (initialized) {
+        return;
+    }
+
+    initialized = 1;
+
+    for (i = 0; i < 256; i++) {
+        for (ch = 0; ch < 256; ch++) {
+            code = &ngx_http_huff_decode_bytes[i][ch];
+
+            state = (u_char) i;
+            ending = 0;
+            p = code->sym;
+
+            if (ngx_http_huff_decode_bits(&state, &ending, ch >> 4, &p)
+                != NGX_OK
+                || ngx_http_huff_decode_bits(&state, &ending, ch & 0xf, &p)
+                   != NGX_OK)
+            {
+                code->flags = NGX_HTTP_HUFF_DECODE_ERROR;
+                continue;
+            }
+
+            code->next = state;
+            code->flags = (u_char) (p - code->sym);
+
+            if (ending) {
+                code->flags |= NGX_HTTP_HUFF_DECODE_ENDING;
+            }
+        }
+    }
+}
+
+
 ngx_int_t
 ngx_http_huff_decode(u_char *state, u_char *src, size_t len, u_char **dst,
     ngx_uint_t last, ngx_log_t *log)
 {
-    u_char  *end, ch, ending;
+    u_char                       *end, *p, ch, ending, current;
+    ngx_http_huff_decode_byte_t  *code;
 
     ch = 0;
     ending = 1;
 
+    current = *state;
+    p = *dst;
+
     end = src + len;
 
     while (src != end) {
         ch = *src++;
 
-        if (ngx_http_huff_decode_bits(state, &ending, ch >> 4, dst)
-            != NGX_OK)
-        {
+        code = &ngx_http_huff_decode_bytes[current][ch];
+
+        if (code->flags & NGX_HTTP_HUFF_DECODE_ERROR) {
             ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
                            "http2 huffman decoding error at state %d: "
-                           "bad code 0x%Xd", *state, ch >> 4);
+                           "bad code 0x%Xd", current, ch);
+
+            *state = current;
+            *dst = p;
 
             return NGX_ERROR;
         }
 
-        if (ngx_http_huff_decode_bits(state, &ending, ch & 0xf, dst)
-            != NGX_OK)
-        {
-            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
-                           "http2 huffman decoding error at state %d: "
-                           "bad code 0x%Xd", *state, ch & 0xf);
+        if (code->flags & NGX_HTTP_HUFF_DECODE_EMIT) {
+            *p++ = code->sym[0];
 
-            return NGX_ERROR;
+            if ((code->flags & NGX_HTTP_HUFF_DECODE_EMIT) == 2) {
+                *p++ = code->sym[1];
+            }
         }
+
+        ending = code->flags & NGX_HTTP_HUFF_DECODE_ENDING;
+        current = code->next;
     }
 
+    *dst = p;
+
     if (last) {
         if (!ending) {
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
                            "http2 huffman decoding error: "
                            "incomplete code 0x%Xd", ch);
 
+            *state = current;
+
             return NGX_ERROR;
         }
 
-        *state = 0;
+        current = 0;
     }
 
+    *state = current;
+
     return NGX_OK;
 }
 
 
-
 static ngx_inline ngx_int_t
 ngx_http_huff_decode_bits(u_char *state, u_char *ending, ngx_uint_t bits,
     u_char **dst)
@@ -9,6 +9,32 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_HAVE_SSE42)
+#include <nmmintrin.h>
+#endif
+
+
+#if (NGX_HAVE_SSE42)
+
+static u_char *ngx_http_parse_find_sse42(u_char *p, u_char *last,
+    const u_char *ranges, int n);
+static u_char *ngx_http_parse_skip_sse42(u_char *p, u_char *last,
+    const u_char *ranges, int n);
+
+
+/* byte ranges for _mm_cmpestri(), padded to 16 bytes */
+
+static const u_char  ngx_http_uri_ranges[16] =
+    "\x00\x20" "##" "\x7f\x7f";
+
+static const u_char  ngx_http_name_ranges[16] =
+    "--" "09" "AZ" "az";
+
+static const u_char  ngx_http_value_ranges[16] =
+    "\x00\x00" "\n\n" "\r\r" "  ";
+
+#endif
+
 
 static uint32_t  usual[] = {
     0x00000000, /* 0000 0000 0000 0000  0000 0000 0000 0000 */
@@ -605,6 +631,15 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         case sw_uri:
 
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
+
+#if (NGX_HAVE_SSE42)
+                if (ngx_cpu_sse42) {
+                    p = ngx_http_parse_find_sse42(p + 1, b->last,
+                                                  ngx_http_uri_ranges, 6);
+                    p--;
+                }
+#endif
+
                 break;
             }
 
@@ -821,6 +856,9 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 {
     u_char      c, ch, *p;
     ngx_uint_t  hash, i;
+#if (NGX_HAVE_SSE42)
+    u_char     *last;
+#endif
     enum {
         sw_start = 0,
         sw_name,
@@ -915,6 +953,21 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
                 hash = ngx_hash(hash, c);
                 r->lowcase_header[i++] = c;
                 i &= (NGX_HTTP_LC_HEADER_LEN - 1);
+
+#if (NGX_HAVE_SSE42)
+                if (ngx_cpu_sse42) {
+                    last = ngx_http_parse_skip_sse42(p + 1, b->last,
+                                                     ngx_http_name_ranges, 8);
+
+                    while (p + 1 < last) {
+                        c = lowcase[*++p];
+                        hash = ngx_hash(hash, c);
+                        r->lowcase_header[i++] = c;
+                        i &= (NGX_HTTP_LC_HEADER_LEN - 1);
+                    }
+                }
+#endif
+
                 break;
             }
 
@@ -1012,6 +1065,15 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
             case '\0':
                 r->header_end = p;
                 return NGX_HTTP_PARSE_INVALID_HEADER;
+#if (NGX_HAVE_SSE42)
+            default:
+                if (ngx_cpu_sse42) {
+                    p = ngx_http_parse_find_sse42(p + 1, b->last,
+                                                  ngx_http_value_ranges, 8);
+                    p--;
+                }
+                break;
+#endif
             }
             break;
 
@@ -2413,3 +2475,67 @@ invalid:
 
     return NGX_ERROR;
 }
+
+
+#if (NGX_HAVE_SSE42)
+
+/*
+ * The functions scan the buffer 16 bytes at a time and return a pointer
+ * to the first byte which is (or is not) in the given ranges.  The tail
+ * shorter than 16 bytes is left to the state machines.
+ */
+
+__attribute__((target("sse4.2")))
+static u_char *
+ngx_http_parse_find_sse42(u_char *p, u_char *last, const u_char *ranges,
+    int n)
+{
+    int      i;
+    __m128i  r, v;
+
+    r = _mm_loadu_si128((const __m128i *) ranges);
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+
+        i = _mm_cmpestri(r, n, v, 16, _SIDD_UBYTE_OPS|_SIDD_CMP_RANGES);
+
+        if (i != 16) {
+            return p + i;
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+
+__attribute__((target("sse4.2")))
+static u_char *
+ngx_http_parse_skip_sse42(u_char *p, u_char *last, const u_char *ranges,
+    int n)
+{
+    int      i;
+    __m128i  r, v;
+
+    r = _mm_loadu_si128((const __m128i *) ranges);
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+
+        i = _mm_cmpestri(r, n, v, 16,
+                         _SIDD_UBYTE_OPS|_SIDD_CMP_RANGES
+                         |_SIDD_NEGATIVE_POLARITY);
+
+        if (i != 16) {
+            return p + i;
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+#endif
@@ -0,0 +1,1630 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * HTTP/2 upstream connections shared by requests: each request gets
+ * a stream with a fake connection, whose recv() returns the frames received
+ * for the stream and whose send_chain() passes the stream's frames to the
+ * connection in turns; the stream's module creates and parses the frames
+ * as if the connection was its own, starting with stream identifiers
+ * returned by ngx_http_upstream_mux_open()
+ */
+
+
+#define NGX_HTTP_UPSTREAM_MUX_BUFFER_SIZE   4096
+#define NGX_HTTP_UPSTREAM_MUX_OUTPUT_SIZE   4096
+#define NGX_HTTP_UPSTREAM_MUX_MAX_ID        0x7fff0000
+#define NGX_HTTP_UPSTREAM_MUX_TURN_SIZE     65536
+#define NGX_HTTP_UPSTREAM_MUX_TURN_FRAMES   16
+
+
+typedef struct {
+    void                            *data;
+
+    ngx_event_get_peer_pt            original_get_peer;
+    ngx_event_free_peer_pt           original_free_peer;
+
+    ngx_http_request_t              *request;
+    ngx_http_upstream_mux_conf_t    *conf;
+    ngx_http_upstream_mux_stream_t **stream;
+} ngx_http_upstream_mux_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_mux_get_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_upstream_mux_free_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static ngx_int_t ngx_http_upstream_mux_connect(ngx_http_request_t *r,
+    ngx_peer_connection_t *pc, ngx_http_upstream_mux_conf_t *conf,
+    ngx_http_upstream_mux_t **muxp);
+static ngx_http_upstream_mux_stream_t *ngx_http_upstream_mux_attach(
+    ngx_http_upstream_mux_t *mux, ngx_http_request_t *r);
+static void ngx_http_upstream_mux_detach(ngx_http_upstream_mux_stream_t *s,
+    ngx_uint_t done);
+static void ngx_http_upstream_mux_close(ngx_http_upstream_mux_t *mux);
+static void ngx_http_upstream_mux_error(ngx_http_upstream_mux_stream_t *s);
+static ssize_t ngx_http_upstream_mux_recv(ngx_connection_t *fc, u_char *buf,
+    size_t size);
+static ssize_t ngx_http_upstream_mux_recv_chain(ngx_connection_t *fc,
+    ngx_chain_t *cl, off_t limit);
+static ngx_chain_t *ngx_http_upstream_mux_send_chain(ngx_connection_t *fc,
+    ngx_chain_t *in, off_t limit);
+static off_t ngx_http_upstream_mux_turn(ngx_http_upstream_mux_stream_t *s,
+    ngx_chain_t *in, off_t *ends, ngx_uint_t *nends);
+static ngx_http_upstream_mux_stream_t *ngx_http_upstream_mux_next(
+    ngx_http_upstream_mux_t *mux);
+static void ngx_http_upstream_mux_read_handler(ngx_event_t *rev);
+static void ngx_http_upstream_mux_write_handler(ngx_event_t *wev);
+static ngx_int_t ngx_http_upstream_mux_process(ngx_http_upstream_mux_t *mux,
+    u_char *p, u_char *last);
+static ngx_int_t ngx_http_upstream_mux_frame_start(
+    ngx_http_upstream_mux_t *mux);
+static ngx_int_t ngx_http_upstream_mux_control(ngx_http_upstream_mux_t *mux);
+static ngx_int_t ngx_http_upstream_mux_buffer(
+    ngx_http_upstream_mux_stream_t *s, u_char *p, size_t size);
+static u_char *ngx_http_upstream_mux_frame(ngx_http_upstream_mux_t *mux,
+    size_t length, ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid);
+static ngx_int_t ngx_http_upstream_mux_flush(ngx_http_upstream_mux_t *mux);
+
+
+static ngx_queue_t  ngx_http_upstream_muxes = {
+    &ngx_http_upstream_muxes, &ngx_http_upstream_muxes
+};
+
+
+ngx_int_t
+ngx_http_upstream_mux_init_peer(ngx_http_request_t *r,
+    ngx_http_upstream_mux_conf_t *conf, ngx_http_upstream_mux_stream_t **sp)
+{
+    ngx_http_upstream_t                *u;
+    ngx_http_upstream_mux_peer_data_t  *pd;
+
+    u = r->upstream;
+
+    if (u->peer.get == ngx_http_upstream_mux_get_peer) {
+        return NGX_OK;
+    }
+
+    pd = ngx_palloc(r->pool, sizeof(ngx_http_upstream_mux_peer_data_t));
+    if (pd == NULL) {
+        return NGX_ERROR;
+    }
+
+    pd->data = u->peer.data;
+    pd->original_get_peer = u->peer.get;
+    pd->original_free_peer = u->peer.free;
+    pd->request = r;
+    pd->conf = conf;
+    pd->stream = sp;
+
+    u->peer.data = pd;
+    u->peer.get = ngx_http_upstream_mux_get_peer;
+    u->peer.free = ngx_http_upstream_mux_free_peer;
+
+    return NGX_OK;
+}
+
+
+ngx_uint_t
+ngx_http_upstream_mux_open(ngx_http_upstream_mux_stream_t *s,
+    ssize_t *send_window, ngx_chain_t **output)
+{
+    ngx_http_upstream_mux_conn_t  *conn;
+
+    conn = &s->mux->conn;
+
+    conn->last_stream_id = conn->last_stream_id
+                           ? conn->last_stream_id + 2 : 1;
+
+    s->id = conn->last_stream_id;
+    s->send_window = send_window;
+    s->output = output;
+
+    return s->id;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_mux_get_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_mux_peer_data_t  *pd = data;
+
+    ngx_int_t                        rc;
+    ngx_queue_t                     *q;
+    ngx_http_upstream_mux_t         *mux;
+    ngx_http_upstream_mux_stream_t  *s;
+
+    rc = pd->original_get_peer(pc, pd->data);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    mux = NULL;
+
+    for (q = ngx_queue_head(&ngx_http_upstream_muxes);
+         q != ngx_queue_sentinel(&ngx_http_upstream_muxes);
+         q = ngx_queue_next(q))
+    {
+        mux = ngx_queue_data(q, ngx_http_upstream_mux_t, queue);
+
+        if (mux->nstreams < mux->max_streams
+            && mux->conn.last_stream_id < NGX_HTTP_UPSTREAM_MUX_MAX_ID
+            && mux->peer.local == pc->local
+            && ngx_cmp_sockaddr(mux->peer.sockaddr, mux->peer.socklen,
+                                pc->sockaddr, pc->socklen, 1)
+               == NGX_OK)
+        {
+            break;
+        }
+
+        mux = NULL;
+    }
+
+    if (mux == NULL) {
+        rc = ngx_http_upstream_mux_connect(pd->request, pc, pd->conf, &mux);
+
+        if (rc != NGX_OK) {
+            return rc;
+        }
+    }
+
+    s = ngx_http_upstream_mux_attach(mux, pd->request);
+    if (s == NULL) {
+        return NGX_ERROR;
+    }
+
+    *pd->stream = s;
+
+    pc->connection = &s->connection;
+    pc->cached = mux->connected;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "upstream mux get peer: %p, streams:%ui/%ui, "
+                   "connected:%d",
+                   mux, mux->nstreams, mux->max_streams, mux->connected);
+
+    return mux->connected ? NGX_DONE : NGX_AGAIN;
+}
+
+
+static void
+ngx_http_upstream_mux_free_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_upstream_mux_peer_data_t  *pd = data;
+
+    ngx_uint_t                       done;
+    ngx_http_upstream_mux_stream_t  *s;
+
+    s = *pd->stream;
+
+    if (s && pc->connection == &s->connection) {
+
+        done = pd->request->upstream->keepalive && !(state & NGX_PEER_FAILED);
+
+        ngx_http_upstream_mux_detach(s, done);
+
+        *pd->stream = NULL;
+        pc->connection = NULL;
+    }
+
+    pd->original_free_peer(pc, pd->data, state);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_mux_connect(ngx_http_request_t *r,
+    ngx_peer_connection_t *pc, ngx_http_upstream_mux_conf_t *conf,
+    ngx_http_upstream_mux_t **muxp)
+{
+    u_char                   *p;
+    ngx_int_t                 rc;
+    ngx_pool_t               *pool;
+    ngx_connection_t         *c;
+    ngx_http_upstream_mux_t  *mux;
+
+    pool = ngx_create_pool(1024, ngx_cycle->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    mux = ngx_pcalloc(pool, sizeof(ngx_http_upstream_mux_t));
+    if (mux == NULL) {
+        goto failed;
+    }
+
+    mux->pool = pool;
+    mux->log = *ngx_cycle->log;
+    pool->log = &mux->log;
+
+    mux->peer.sockaddr = ngx_palloc(pool, pc->socklen);
+    if (mux->peer.sockaddr == NULL) {
+        goto failed;
+    }
+
+    ngx_memcpy(mux->peer.sockaddr, pc->sockaddr, pc->socklen);
+    mux->peer.socklen = pc->socklen;
+
+    mux->peer.name = ngx_palloc(pool, sizeof(ngx_str_t) + pc->name->len);
+    if (mux->peer.name == NULL) {
+        goto failed;
+    }
+
+    mux->peer.name->len = pc->name->len;
+    mux->peer.name->data = (u_char *) mux->peer.name + sizeof(ngx_str_t);
+    ngx_memcpy(mux->peer.name->data, pc->name->data, pc->name->len);
+
+    mux->peer.get = ngx_event_get_peer;
+    mux->peer.local = pc->local;
+    mux->peer.so_keepalive = pc->so_keepalive;
+    mux->peer.log = &mux->log;
+    mux->peer.log_error = NGX_ERROR_ERR;
+
+    mux->buffer = ngx_create_temp_buf(pool, NGX_HTTP_V2_DEFAULT_FRAME_SIZE);
+    mux->out = ngx_create_temp_buf(pool, NGX_HTTP_UPSTREAM_MUX_OUTPUT_SIZE);
+
+    if (mux->buffer == NULL || mux->out == NULL) {
+        goto failed;
+    }
+
+    ngx_queue_init(&mux->streams);
+    ngx_queue_init(&mux->send);
+
+    mux->max_streams = conf->streams;
+    mux->timeout = conf->timeout;
+
+    mux->conn.init_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    mux->conn.send_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    mux->conn.recv_window = NGX_HTTP_V2_MAX_WINDOW;
+    mux->conn.recv_init_window = conf->window;
+
+    rc = ngx_event_connect_peer(&mux->peer);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "upstream mux connect: %i %V", rc, mux->peer.name);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_destroy_pool(pool);
+        return (rc == NGX_ERROR) ? NGX_ERROR : NGX_DECLINED;
+    }
+
+    /* rc == NGX_OK || rc == NGX_AGAIN */
+
+    c = mux->peer.connection;
+
+    c->data = mux;
+    c->pool = pool;
+    c->log = &mux->log;
+    c->read->log = c->log;
+    c->write->log = c->log;
+
+    c->read->handler = ngx_http_upstream_mux_read_handler;
+    c->write->handler = ngx_http_upstream_mux_write_handler;
+
+    c->sendfile = 0;
+
+    /* connection preface and settings */
+
+    p = ngx_cpymem(mux->out->last, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24);
+    mux->out->last = p;
+
+    p = ngx_http_upstream_mux_frame(mux, 3 * 6, NGX_HTTP_V2_SETTINGS_FRAME,
+                                    0, 0);
+
+    *p++ = 0; *p++ = 0x1;                  /* SETTINGS_HEADER_TABLE_SIZE */
+    p = ngx_http_v2_write_uint32(p, 0);
+
+    *p++ = 0; *p++ = 0x2;                  /* SETTINGS_ENABLE_PUSH */
+    p = ngx_http_v2_write_uint32(p, 0);
+
+    *p++ = 0; *p++ = 0x4;                  /* SETTINGS_INITIAL_WINDOW_SIZE */
+    p = ngx_http_v2_write_uint32(p, conf->window);
+
+    p = ngx_http_upstream_mux_frame(mux, 4, NGX_HTTP_V2_WINDOW_UPDATE_FRAME,
+                                    0, 0);
+
+    p = ngx_http_v2_write_uint32(p, NGX_HTTP_V2_MAX_WINDOW
+                                    - NGX_HTTP_V2_DEFAULT_WINDOW);
+
+    ngx_queue_insert_tail(&ngx_http_upstream_muxes, &mux->queue);
+
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, r->upstream->conf->connect_timeout);
+
+    } else {
+        ngx_post_event(c->write, &ngx_posted_events);
+    }
+
+    *muxp = mux;
+
+    return NGX_OK;
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_http_upstream_mux_stream_t *
+ngx_http_upstream_mux_attach(ngx_http_upstream_mux_t *mux,
+    ngx_http_request_t *r)
+{
+    ngx_connection_t                *c, *fc;
+    ngx_http_upstream_mux_stream_t  *s;
+
+    c = mux->peer.connection;
+
+    s = ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_mux_stream_t));
+    if (s == NULL) {
+        return NULL;
+    }
+
+    s->mux = mux;
+    s->pool = r->pool;
+
+    fc = &s->connection;
+
+    fc->data = r;
+    fc->fd = c->fd;
+    fc->log = r->connection->log;
+
+    fc->read = &s->read;
+    fc->write = &s->write;
+
+    fc->read->data = fc;
+    fc->read->log = fc->log;
+    fc->read->active = 1;
+
+    fc->write->data = fc;
+    fc->write->log = fc->log;
+    fc->write->write = 1;
+    fc->write->active = 1;
+    fc->write->ready = mux->connected;
+
+    fc->recv = ngx_http_upstream_mux_recv;
+    fc->recv_chain = ngx_http_upstream_mux_recv_chain;
+    fc->send_chain = ngx_http_upstream_mux_send_chain;
+
+    fc->type = SOCK_STREAM;
+    fc->sockaddr = mux->peer.sockaddr;
+    fc->socklen = mux->peer.socklen;
+    fc->local_sockaddr = c->local_sockaddr;
+    fc->local_socklen = c->local_socklen;
+
+    fc->sendfile = 0;
+    fc->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+    fc->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
+
+    ngx_queue_insert_tail(&mux->streams, &s->queue);
+    mux->nstreams++;
+
+    if (c->idle) {
+        c->idle = 0;
+
+        if (c->read->timer_set) {
+            ngx_del_timer(c->read);
+        }
+    }
+
+    return s;
+}
+
+
+static void
+ngx_http_upstream_mux_detach(ngx_http_upstream_mux_stream_t *s,
+    ngx_uint_t done)
+{
+    u_char                   *p;
+    ngx_connection_t         *c, *fc;
+    ngx_http_upstream_mux_t  *mux;
+
+    mux = s->mux;
+    fc = &s->connection;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                   "upstream mux detach: %p, stream:%ui, done:%ui",
+                   mux, s->id, done);
+
+    if (fc->read->timer_set) {
+        ngx_del_timer(fc->read);
+    }
+
+    if (fc->write->timer_set) {
+        ngx_del_timer(fc->write);
+    }
+
+    if (fc->read->posted) {
+        ngx_delete_posted_event(fc->read);
+    }
+
+    if (fc->write->posted) {
+        ngx_delete_posted_event(fc->write);
+    }
+
+    if (fc->pool) {
+        ngx_destroy_pool(fc->pool);
+        fc->pool = NULL;
+    }
+
+    ngx_queue_remove(&s->queue);
+    mux->nstreams--;
+
+    if (s->opened) {
+        mux->active--;
+    }
+
+    if (s->queued) {
+        ngx_queue_remove(&s->send);
+        s->queued = 0;
+    }
+
+    if (mux->stream == s) {
+        mux->stream = NULL;
+    }
+
+    c = mux->peer.connection;
+
+    if (c == NULL) {
+        if (mux->nstreams == 0) {
+            ngx_destroy_pool(mux->pool);
+        }
+
+        return;
+    }
+
+    if (mux->busy == s) {
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                      "upstream stream %ui closed with a partially sent "
+                      "frame", s->id);
+        ngx_http_upstream_mux_close(mux);
+        return;
+    }
+
+    if (!done && s->id && fc->sent) {
+        p = ngx_http_upstream_mux_frame(mux, 4, NGX_HTTP_V2_RST_STREAM_FRAME,
+                                        0, s->id);
+        if (p == NULL) {
+            ngx_http_upstream_mux_close(mux);
+            return;
+        }
+
+        /* CANCEL */
+        (void) ngx_http_v2_write_uint32(p, 0x8);
+    }
+
+    if (mux->out->pos != mux->out->last || !ngx_queue_empty(&mux->send)) {
+        ngx_post_event(c->write, &ngx_posted_events);
+    }
+
+    if (mux->nstreams) {
+        return;
+    }
+
+    if (mux->goaway) {
+        ngx_http_upstream_mux_close(mux);
+        return;
+    }
+
+    c->idle = 1;
+    ngx_add_timer(c->read, mux->timeout);
+}
+
+
+static void
+ngx_http_upstream_mux_close(ngx_http_upstream_mux_t *mux)
+{
+    ngx_queue_t                     *q;
+    ngx_http_upstream_mux_stream_t  *s;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, &mux->log, 0,
+                   "upstream mux close: %p, streams:%ui",
+                   mux, mux->nstreams);
+
+    if (!mux->goaway) {
+        mux->goaway = 1;
+        ngx_queue_remove(&mux->queue);
+    }
+
+    for (q = ngx_queue_head(&mux->streams);
+         q != ngx_queue_sentinel(&mux->streams);
+         q = ngx_queue_next(q))
+    {
+        s = ngx_queue_data(q, ngx_http_upstream_mux_stream_t, queue);
+        ngx_http_upstream_mux_error(s);
+    }
+
+    mux->busy = NULL;
+    mux->stream = NULL;
+
+    if (mux->peer.connection) {
+        ngx_close_connection(mux->peer.connection);
+        mux->peer.connection = NULL;
+    }
+
+    if (mux->nstreams == 0) {
+        ngx_destroy_pool(mux->pool);
+    }
+}
+
+
+static void
+ngx_http_upstream_mux_error(ngx_http_upstream_mux_stream_t *s)
+{
+    ngx_connection_t  *fc;
+
+    fc = &s->connection;
+
+    s->error = 1;
+
+    if (s->queued) {
+        ngx_queue_remove(&s->send);
+        s->queued = 0;
+    }
+
+    if (s->mux->peer.connection == NULL) {
+        fc->fd = (ngx_socket_t) -1;
+    }
+
+    fc->read->ready = 1;
+    fc->write->ready = 1;
+
+    ngx_post_event(fc->read, &ngx_posted_events);
+    ngx_post_event(fc->write, &ngx_posted_events);
+}
+
+
+static ssize_t
+ngx_http_upstream_mux_recv(ngx_connection_t *fc, u_char *buf, size_t size)
+{
+    size_t                           n;
+    ssize_t                          total;
+    ngx_buf_t                       *b;
+    ngx_chain_t                     *cl;
+    ngx_http_upstream_mux_stream_t  *s;
+
+    s = (ngx_http_upstream_mux_stream_t *) fc;
+
+    total = 0;
+
+    while (s->in && size) {
+        b = s->in->buf;
+
+        n = ngx_min((size_t) (b->last - b->pos), size);
+
+        buf = ngx_cpymem(buf, b->pos, n);
+        b->pos += n;
+        size -= n;
+        total += n;
+
+        if (b->pos == b->last) {
+            cl = s->in;
+            s->in = cl->next;
+
+            if (s->in == NULL) {
+                s->last = NULL;
+            }
+
+            b->pos = b->start;
+            b->last = b->start;
+
+            cl->next = s->free;
+            s->free = cl;
+        }
+    }
+
+    if (total) {
+        fc->read->ready = (s->in || s->error) ? 1 : 0;
+        return total;
+    }
+
+    if (s->error) {
+        fc->read->ready = 0;
+        fc->read->error = 1;
+        return NGX_ERROR;
+    }
+
+    fc->read->ready = 0;
+
+    return NGX_AGAIN;
+}
+
+
+static ssize_t
+ngx_http_upstream_mux_recv_chain(ngx_connection_t *fc, ngx_chain_t *cl,
+    off_t limit)
+{
+    size_t   size;
+    ssize_t  n, total;
+
+    /* like ngx_readv_chain(), the bufs are filled in order from their ends */
+
+    total = 0;
+
+    for ( /* void */ ; cl; cl = cl->next) {
+
+        size = cl->buf->end - cl->buf->last;
+
+        if (limit) {
+            if (total >= limit) {
+                break;
+            }
+
+            if ((off_t) size > limit - total) {
+                size = (size_t) (limit - total);
+            }
+        }
+
+        if (size == 0) {
+            continue;
+        }
+
+        n = ngx_http_upstream_mux_recv(fc, cl->buf->last, size);
+
+        if (n == NGX_AGAIN || n == NGX_ERROR) {
+            return total ? total : n;
+        }
+
+        total += n;
+
+        if ((size_t) n < size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+
+static ngx_chain_t *
+ngx_http_upstream_mux_send_chain(ngx_connection_t *fc, ngx_chain_t *in,
+    off_t limit)
+{
+    off_t                            sent, size;
+    off_t                            ends[NGX_HTTP_UPSTREAM_MUX_TURN_FRAMES];
+    ngx_uint_t                       i, n;
+    ngx_chain_t                     *out;
+    ngx_connection_t                *c;
+    ngx_http_upstream_mux_t         *mux;
+    ngx_http_upstream_mux_stream_t  *s;
+
+    s = (ngx_http_upstream_mux_stream_t *) fc;
+    mux = s->mux;
+    c = mux->peer.connection;
+
+    if (s->error || c == NULL) {
+        fc->write->error = 1;
+        return NGX_CHAIN_ERROR;
+    }
+
+    /*
+     * streams write in turns of whole frames, so a stream with a large
+     * body does not hold back the others; a stream can only be preempted
+     * between frames, and control frames are sent between turns
+     */
+
+    if (!s->queued) {
+        ngx_queue_insert_tail(&mux->send, &s->send);
+        s->queued = 1;
+    }
+
+    if (!mux->connected
+        || !mux->settings
+        || (mux->busy && mux->busy != s)
+        || (mux->busy == NULL
+            && (ngx_http_upstream_mux_flush(mux) != NGX_OK
+                || ngx_http_upstream_mux_next(mux) != s)))
+    {
+        if (mux->peer.connection == NULL) {
+            fc->write->error = 1;
+            return NGX_CHAIN_ERROR;
+        }
+
+        fc->write->ready = 0;
+
+        return in;
+    }
+
+    ngx_queue_remove(&s->send);
+    s->queued = 0;
+
+    if (!s->opened) {
+        s->opened = 1;
+        mux->active++;
+    }
+
+    size = ngx_http_upstream_mux_turn(s, in, ends, &n);
+
+    if (size == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, fc->log, 0,
+                      "upstream stream %ui output is not framed", s->id);
+        ngx_http_upstream_mux_close(mux);
+        return NGX_CHAIN_ERROR;
+    }
+
+    if (size && (limit == 0 || limit > size)) {
+        limit = size;
+    }
+
+    sent = c->sent;
+
+    out = c->send_chain(c, in, limit);
+
+    sent = c->sent - sent;
+    fc->sent += sent;
+
+    if (out == NGX_CHAIN_ERROR) {
+        c->error = 1;
+        ngx_http_upstream_mux_close(mux);
+        return NGX_CHAIN_ERROR;
+    }
+
+    for (i = 0; i < n && ends[i] <= sent; i++) { /* void */ }
+
+    s->frame_rest = (i < n) ? ends[i] - sent : 0;
+
+    if (out == NULL) {
+        mux->busy = NULL;
+
+        if (!ngx_queue_empty(&mux->send) || mux->out->pos != mux->out->last) {
+            ngx_post_event(c->write, &ngx_posted_events);
+        }
+
+        return NULL;
+    }
+
+    /* a partially sent frame is completed first, otherwise it is a new turn */
+
+    if (s->frame_rest) {
+        mux->busy = s;
+        ngx_queue_insert_head(&mux->send, &s->send);
+
+    } else {
+        mux->busy = NULL;
+        ngx_queue_insert_tail(&mux->send, &s->send);
+    }
+
+    s->queued = 1;
+
+    fc->write->ready = 0;
+
+    if (c->write->ready) {
+        ngx_post_event(c->write, &ngx_posted_events);
+
+    } else if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+        ngx_http_upstream_mux_close(mux);
+        return NGX_CHAIN_ERROR;
+    }
+
+    return out;
+}
+
+
+static off_t
+ngx_http_upstream_mux_turn(ngx_http_upstream_mux_stream_t *s,
+    ngx_chain_t *in, off_t *ends, ngx_uint_t *nends)
+{
+    u_char       head[NGX_HTTP_V2_FRAME_HEADER_SIZE], *p;
+    off_t        pos, start, size;
+    size_t       n, len;
+    ngx_buf_t   *b;
+    ngx_uint_t   k;
+    ngx_chain_t *cl, *hl;
+
+    /*
+     * the frames of this turn are found by their headers, which are
+     * always in memory; the offsets of frame ends are returned in "ends"
+     */
+
+    k = 0;
+    pos = s->frame_rest;
+
+    if (pos) {
+        ends[k++] = pos;
+    }
+
+    cl = in;
+    start = 0;
+
+    while (k < NGX_HTTP_UPSTREAM_MUX_TURN_FRAMES
+           && (k == 0 || ends[k - 1] < NGX_HTTP_UPSTREAM_MUX_TURN_SIZE))
+    {
+        while (cl) {
+            size = ngx_buf_size(cl->buf);
+
+            if (start + size > pos) {
+                break;
+            }
+
+            start += size;
+            cl = cl->next;
+        }
+
+        if (cl == NULL) {
+            break;
+        }
+
+        n = 0;
+        hl = cl;
+        p = NULL;
+
+        while (n < NGX_HTTP_V2_FRAME_HEADER_SIZE && hl) {
+            b = hl->buf;
+
+            if (!ngx_buf_in_memory(b)) {
+                return NGX_ERROR;
+            }
+
+            p = (hl == cl) ? b->pos + (pos - start) : b->pos;
+
+            len = ngx_min((size_t) (b->last - p),
+                          NGX_HTTP_V2_FRAME_HEADER_SIZE - n);
+
+            ngx_memcpy(head + n, p, len);
+            n += len;
+
+            hl = hl->next;
+        }
+
+        if (n < NGX_HTTP_V2_FRAME_HEADER_SIZE) {
+            return NGX_ERROR;
+        }
+
+        pos += NGX_HTTP_V2_FRAME_HEADER_SIZE
+               + ((head[0] << 16) | (head[1] << 8) | head[2]);
+
+        ends[k++] = pos;
+    }
+
+    *nends = k;
+
+    return k ? ends[k - 1] : 0;
+}
+
+
+static ngx_http_upstream_mux_stream_t *
+ngx_http_upstream_mux_next(ngx_http_upstream_mux_t *mux)
+{
+    ngx_queue_t                     *q;
+    ngx_http_upstream_mux_stream_t  *s;
+
+    /*
+     * the first stream waiting for its turn, new streams are opened
+     * in the order of their identifiers and within the peer's limit
+     * of concurrent streams
+     */
+
+    for (q = ngx_queue_head(&mux->send);
+         q != ngx_queue_sentinel(&mux->send);
+         q = ngx_queue_next(q))
+    {
+        s = ngx_queue_data(q, ngx_http_upstream_mux_stream_t, send);
+
+        if (s->opened || mux->active < mux->max_streams) {
+            return s;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_upstream_mux_write_handler(ngx_event_t *wev)
+{
+    int                              err;
+    socklen_t                        len;
+    ngx_int_t                        rc;
+    ngx_queue_t                     *q;
+    ngx_connection_t                *c, *fc;
+    ngx_http_upstream_mux_t         *mux;
+    ngx_http_upstream_mux_stream_t  *s;
+
+    c = wev->data;
+    mux = c->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "upstream mux write handler: %p", mux);
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "upstream timed out while connecting to %V",
+                      mux->peer.name);
+        ngx_http_upstream_mux_close(mux);
+        return;
+    }
+
+    if (!mux->connected) {
+
+#if (NGX_HAVE_KQUEUE)
+
+        if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
+            if (c->write->pending_eof || c->read->pending_eof) {
+                err = c->write->pending_eof ? c->write->kq_errno
+                                            : c->read->kq_errno;
+
+                (void) ngx_connection_error(c, err,
+                                    "kevent() reported that connect() failed");
+                ngx_http_upstream_mux_close(mux);
+                return;
+            }
+
+        } else
+#endif
+        {
+            err = 0;
+            len = sizeof(int);
+
+            if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+                == -1)
+            {
+                err = ngx_socket_errno;
+            }
+
+            if (err) {
+                (void) ngx_connection_error(c, err, "connect() failed");
+                ngx_http_upstream_mux_close(mux);
+                return;
+            }
+        }
+
+        mux->connected = 1;
+
+        if (wev->timer_set) {
+            ngx_del_timer(wev);
+        }
+
+        if (ngx_tcp_nodelay(c) != NGX_OK) {
+            ngx_http_upstream_mux_close(mux);
+            return;
+        }
+
+        for (q = ngx_queue_head(&mux->streams);
+             q != ngx_queue_sentinel(&mux->streams);
+             q = ngx_queue_next(q))
+        {
+            s = ngx_queue_data(q, ngx_http_upstream_mux_stream_t, queue);
+            fc = &s->connection;
+
+            fc->write->ready = 1;
+            ngx_post_event(fc->write, &ngx_posted_events);
+        }
+    }
+
+    rc = ngx_http_upstream_mux_flush(mux);
+
+    if (rc == NGX_ERROR) {
+        ngx_http_upstream_mux_close(mux);
+        return;
+    }
+
+    s = mux->busy;
+
+    if (s == NULL && rc == NGX_OK && mux->settings) {
+        s = ngx_http_upstream_mux_next(mux);
+    }
+
+    if (s) {
+        fc = &s->connection;
+
+        fc->write->ready = 1;
+        ngx_post_event(fc->write, &ngx_posted_events);
+    }
+
+    if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+        ngx_http_upstream_mux_close(mux);
+    }
+}
+
+
+static void
+ngx_http_upstream_mux_read_handler(ngx_event_t *rev)
+{
+    ssize_t                   n;
+    ngx_buf_t                *b;
+    ngx_connection_t         *c;
+    ngx_http_upstream_mux_t  *mux;
+
+    c = rev->data;
+    mux = c->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "upstream mux read handler: %p", mux);
+
+    if (c->close || rev->timedout) {
+        ngx_http_upstream_mux_close(mux);
+        return;
+    }
+
+    b = mux->buffer;
+
+    do {
+        n = c->recv(c, b->start, b->end - b->start);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+            if (mux->nstreams) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "upstream prematurely closed "
+                              "multiplexed connection to %V",
+                              mux->peer.name);
+            }
+
+            ngx_http_upstream_mux_close(mux);
+            return;
+        }
+
+        if (ngx_http_upstream_mux_process(mux, b->start, b->start + n)
+            != NGX_OK)
+        {
+            ngx_http_upstream_mux_close(mux);
+            return;
+        }
+
+    } while (rev->ready);
+
+    if (mux->out->pos != mux->out->last
+        && ngx_http_upstream_mux_flush(mux) == NGX_ERROR)
+    {
+        ngx_http_upstream_mux_close(mux);
+        return;
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_http_upstream_mux_close(mux);
+        return;
+    }
+
+    if (mux->goaway && mux->nstreams == 0) {
+        ngx_http_upstream_mux_close(mux);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_mux_process(ngx_http_upstream_mux_t *mux, u_char *p,
+    u_char *last)
+{
+    size_t                           n, rest;
+    ngx_http_upstream_mux_stream_t  *s;
+
+    for ( ;; ) {
+
+        if (mux->received < NGX_HTTP_V2_FRAME_HEADER_SIZE) {
+
+            if (p == last) {
+                return NGX_OK;
+            }
+
+            n = ngx_min((size_t) (last - p),
+                        NGX_HTTP_V2_FRAME_HEADER_SIZE - mux->received);
+
+            ngx_memcpy(mux->head + mux->received, p, n);
+            mux->received += n;
+            p += n;
+
+            if (mux->received < NGX_HTTP_V2_FRAME_HEADER_SIZE) {
+                return NGX_OK;
+            }
+
+            if (ngx_http_upstream_mux_frame_start(mux) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+        } else {
+            rest = mux->length
+                   - (mux->received - NGX_HTTP_V2_FRAME_HEADER_SIZE);
+
+            if (p == last) {
+                return NGX_OK;
+            }
+
+            n = ngx_min((size_t) (last - p), rest);
+
+            if (mux->stream_id == 0) {
+                rest = mux->received - NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+                if (rest < NGX_HTTP_UPSTREAM_MUX_FRAME_SIZE) {
+                    ngx_memcpy(mux->frame + rest, p,
+                               ngx_min(n, NGX_HTTP_UPSTREAM_MUX_FRAME_SIZE
+                                          - rest));
+                }
+
+            } else if (mux->stream) {
+                if (ngx_http_upstream_mux_buffer(mux->stream, p, n)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+            }
+
+            mux->received += n;
+            p += n;
+        }
+
+        if (mux->received < NGX_HTTP_V2_FRAME_HEADER_SIZE + mux->length) {
+            continue;
+        }
+
+        /* frame complete */
+
+        if (mux->stream_id == 0) {
+            if (ngx_http_upstream_mux_control(mux) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+        } else if (mux->stream) {
+            s = mux->stream;
+
+            s->connection.read->ready = 1;
+            ngx_post_event(s->connection.read, &ngx_posted_events);
+        }
+
+        mux->stream = NULL;
+        mux->received = 0;
+    }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_mux_frame_start(ngx_http_upstream_mux_t *mux)
+{
+    u_char                          *p;
+    ngx_queue_t                     *q;
+    ngx_http_upstream_mux_stream_t  *s;
+
+    p = mux->head;
+
+    mux->length = (p[0] << 16) | (p[1] << 8) | p[2];
+    mux->type = p[3];
+    mux->flags = p[4];
+    mux->stream_id = ngx_http_v2_parse_sid(&p[5]);
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, &mux->log, 0,
+                   "upstream mux frame: %ui len:%uz f:%ui sid:%ui",
+                   mux->type, mux->length, mux->flags, mux->stream_id);
+
+    if (mux->length > NGX_HTTP_V2_DEFAULT_FRAME_SIZE) {
+        ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                      "upstream sent frame with too long length: %uz",
+                      mux->length);
+        return NGX_ERROR;
+    }
+
+    if (mux->type == NGX_HTTP_V2_DATA_FRAME) {
+
+        if (mux->length > mux->conn.recv_window) {
+            ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                          "upstream violated connection flow control, "
+                          "received %uz data frame with window %uz",
+                          mux->length, mux->conn.recv_window);
+            return NGX_ERROR;
+        }
+
+        mux->conn.recv_window -= mux->length;
+
+        if (mux->conn.recv_window < NGX_HTTP_V2_MAX_WINDOW / 4) {
+            p = ngx_http_upstream_mux_frame(mux, 4,
+                                            NGX_HTTP_V2_WINDOW_UPDATE_FRAME,
+                                            0, 0);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            (void) ngx_http_v2_write_uint32(p, NGX_HTTP_V2_MAX_WINDOW
+                                               - mux->conn.recv_window);
+
+            mux->conn.recv_window = NGX_HTTP_V2_MAX_WINDOW;
+        }
+    }
+
+    if (mux->stream_id == 0) {
+
+        switch (mux->type) {
+
+        case NGX_HTTP_V2_DATA_FRAME:
+        case NGX_HTTP_V2_HEADERS_FRAME:
+        case NGX_HTTP_V2_PRIORITY_FRAME:
+        case NGX_HTTP_V2_RST_STREAM_FRAME:
+        case NGX_HTTP_V2_CONTINUATION_FRAME:
+            ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                          "upstream sent frame type %ui for stream 0",
+                          mux->type);
+            return NGX_ERROR;
+
+        case NGX_HTTP_V2_SETTINGS_FRAME:
+            if (mux->length > NGX_HTTP_UPSTREAM_MUX_FRAME_SIZE) {
+                ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                              "upstream sent too long settings frame: %uz",
+                              mux->length);
+                return NGX_ERROR;
+            }
+
+            break;
+        }
+
+        return NGX_OK;
+    }
+
+    for (q = ngx_queue_head(&mux->streams);
+         q != ngx_queue_sentinel(&mux->streams);
+         q = ngx_queue_next(q))
+    {
+        s = ngx_queue_data(q, ngx_http_upstream_mux_stream_t, queue);
+
+        if (s->id == mux->stream_id) {
+            mux->stream = s;
+            return ngx_http_upstream_mux_buffer(s, mux->head,
+                                                NGX_HTTP_V2_FRAME_HEADER_SIZE);
+        }
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, &mux->log, 0,
+                   "upstream mux frame for closed stream %ui ignored",
+                   mux->stream_id);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_mux_control(ngx_http_upstream_mux_t *mux)
+{
+    u_char                          *p, *end;
+    ssize_t                          window_update;
+    ngx_uint_t                       id, value, last_stream_id;
+    ngx_queue_t                     *q;
+    ngx_http_upstream_mux_stream_t  *s;
+
+    p = mux->frame;
+
+    switch (mux->type) {
+
+    case NGX_HTTP_V2_SETTINGS_FRAME:
+
+        if (mux->flags & NGX_HTTP_V2_ACK_FLAG) {
+            if (mux->length != 0) {
+                ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                              "upstream sent settings ack "
+                              "with non-zero length: %uz", mux->length);
+                return NGX_ERROR;
+            }
+
+            return NGX_OK;
+        }
+
+        if (mux->length % 6 != 0) {
+            ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                          "upstream sent settings frame "
+                          "with invalid length: %uz", mux->length);
+            return NGX_ERROR;
+        }
+
+        for (end = p + mux->length; p < end; p += 6) {
+            id = (p[0] << 8) | p[1];
+            value = ngx_http_v2_parse_uint32(&p[2]);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, &mux->log, 0,
+                           "upstream mux setting: %ui %ui", id, value);
+
+            if (id == 0x03) {
+                /* SETTINGS_MAX_CONCURRENT_STREAMS */
+
+                if (value < mux->max_streams) {
+                    mux->max_streams = value;
+                }
+
+                continue;
+            }
+
+            if (id != 0x04) {
+                continue;
+            }
+
+            /* SETTINGS_INITIAL_WINDOW_SIZE */
+
+            if (value > NGX_HTTP_V2_MAX_WINDOW) {
+                ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                              "upstream sent settings frame "
+                              "with too large initial window size: %ui",
+                              value);
+                return NGX_ERROR;
+            }
+
+            window_update = value - mux->conn.init_window;
+            mux->conn.init_window = value;
+
+            for (q = ngx_queue_head(&mux->streams);
+                 q != ngx_queue_sentinel(&mux->streams);
+                 q = ngx_queue_next(q))
+            {
+                s = ngx_queue_data(q, ngx_http_upstream_mux_stream_t, queue);
+
+                if (s->send_window == NULL) {
+                    continue;
+                }
+
+                if (*s->send_window > 0
+                    && window_update > (ssize_t) NGX_HTTP_V2_MAX_WINDOW
+                                       - *s->send_window)
+                {
+                    ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                                  "upstream sent settings frame "
+                                  "with too large initial window size: %ui",
+                                  value);
+                    return NGX_ERROR;
+                }
+
+                *s->send_window += window_update;
+
+                if (window_update > 0 && *s->output && !s->queued) {
+                    ngx_post_event(s->connection.write, &ngx_posted_events);
+                }
+            }
+        }
+
+        if (ngx_http_upstream_mux_frame(mux, 0, NGX_HTTP_V2_SETTINGS_FRAME,
+                                        NGX_HTTP_V2_ACK_FLAG, 0)
+            == NULL)
+        {
+            return NGX_ERROR;
+        }
+
+        /* streams are only opened once the peer's limits are known */
+
+        if (!mux->settings) {
+            mux->settings = 1;
+            ngx_post_event(mux->peer.connection->write, &ngx_posted_events);
+        }
+
+        return NGX_OK;
+
+    case NGX_HTTP_V2_PING_FRAME:
+
+        if (mux->length != 8) {
+            ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                          "upstream sent ping frame "
+                          "with invalid length: %uz", mux->length);
+            return NGX_ERROR;
+        }
+
+        if (mux->flags & NGX_HTTP_V2_ACK_FLAG) {
+            return NGX_OK;
+        }
+
+        p = ngx_http_upstream_mux_frame(mux, 8, NGX_HTTP_V2_PING_FRAME,
+                                        NGX_HTTP_V2_ACK_FLAG, 0);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(p, mux->frame, 8);
+
+        return NGX_OK;
+
+    case NGX_HTTP_V2_WINDOW_UPDATE_FRAME:
+
+        if (mux->length != 4) {
+            ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                          "upstream sent window update frame "
+                          "with invalid length: %uz", mux->length);
+            return NGX_ERROR;
+        }
+
+        value = ngx_http_v2_parse_window(p);
+
+        if (value == 0
+            || value > NGX_HTTP_V2_MAX_WINDOW - mux->conn.send_window)
+        {
+            ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                          "upstream sent invalid window update: %ui", value);
+            return NGX_ERROR;
+        }
+
+        mux->conn.send_window += value;
+
+        for (q = ngx_queue_head(&mux->streams);
+             q != ngx_queue_sentinel(&mux->streams);
+             q = ngx_queue_next(q))
+        {
+            s = ngx_queue_data(q, ngx_http_upstream_mux_stream_t, queue);
+
+            if (s->output && *s->output && !s->queued) {
+                ngx_post_event(s->connection.write, &ngx_posted_events);
+            }
+        }
+
+        return NGX_OK;
+
+    case NGX_HTTP_V2_GOAWAY_FRAME:
+
+        if (mux->length < 8) {
+            ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                          "upstream sent goaway frame "
+                          "with invalid length: %uz", mux->length);
+            return NGX_ERROR;
+        }
+
+        last_stream_id = ngx_http_v2_parse_sid(p);
+
+        ngx_log_error(NGX_LOG_INFO, &mux->log, 0,
+                      "upstream sent goaway with error %ui, last stream %ui",
+                      (ngx_uint_t) ngx_http_v2_parse_uint32(&p[4]),
+                      last_stream_id);
+
+        if (!mux->goaway) {
+            mux->goaway = 1;
+            ngx_queue_remove(&mux->queue);
+        }
+
+        for (q = ngx_queue_head(&mux->streams);
+             q != ngx_queue_sentinel(&mux->streams);
+             q = ngx_queue_next(q))
+        {
+            s = ngx_queue_data(q, ngx_http_upstream_mux_stream_t, queue);
+
+            if (s->id == 0 || s->id > last_stream_id) {
+                ngx_http_upstream_mux_error(s);
+            }
+        }
+
+        return NGX_OK;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_mux_buffer(ngx_http_upstream_mux_stream_t *s, u_char *p,
+    size_t size)
+{
+    size_t        n;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    while (size) {
+        cl = s->last;
+
+        if (cl == NULL || cl->buf->last == cl->buf->end) {
+
+            cl = s->free;
+
+            if (cl) {
+                s->free = cl->next;
+
+            } else {
+                cl = ngx_alloc_chain_link(s->pool);
+                if (cl == NULL) {
+                    return NGX_ERROR;
+                }
+
+                cl->buf = ngx_create_temp_buf(s->pool,
+                                            NGX_HTTP_UPSTREAM_MUX_BUFFER_SIZE);
+                if (cl->buf == NULL) {
+                    return NGX_ERROR;
+                }
+            }
+
+            cl->next = NULL;
+
+            if (s->last) {
+                s->last->next = cl;
+
+            } else {
+                s->in = cl;
+            }
+
+            s->last = cl;
+        }
+
+        b = cl->buf;
+
+        n = ngx_min(size, (size_t) (b->end - b->last));
+
+        b->last = ngx_cpymem(b->last, p, n);
+        p += n;
+        size -= n;
+    }
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_http_upstream_mux_frame(ngx_http_upstream_mux_t *mux, size_t length,
+    ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid)
+{
+    u_char     *p;
+    size_t      size;
+    ngx_buf_t  *b;
+
+    b = mux->out;
+
+    if ((size_t) (b->end - b->last) < NGX_HTTP_V2_FRAME_HEADER_SIZE + length)
+    {
+        size = b->last - b->pos;
+
+        if ((size_t) (b->end - b->start) - size
+            < NGX_HTTP_V2_FRAME_HEADER_SIZE + length)
+        {
+            ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                          "upstream mux control frames buffer overflow");
+            return NULL;
+        }
+
+        ngx_memmove(b->start, b->pos, size);
+        b->pos = b->start;
+        b->last = b->start + size;
+    }
+
+    p = b->last;
+
+    *p++ = (u_char) ((length >> 16) & 0xff);
+    *p++ = (u_char) ((length >> 8) & 0xff);
+    *p++ = (u_char) (length & 0xff);
+    *p++ = (u_char) type;
+    *p++ = (u_char) flags;
+
+    p = ngx_http_v2_write_sid(p, sid);
+
+    b->last = p + length;
+
+    return p;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_mux_flush(ngx_http_upstream_mux_t *mux)
+{
+    ssize_t            n;
+    ngx_buf_t         *b;
+    ngx_connection_t  *c;
+
+    b = mux->out;
+    c = mux->peer.connection;
+
+    if (b->pos == b->last) {
+        return NGX_OK;
+    }
+
+    if (mux->busy || !mux->connected || c == NULL) {
+        return NGX_AGAIN;
+    }
+
+    while (b->pos < b->last) {
+        n = c->send(c, b->pos, b->last - b->pos);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            return NGX_AGAIN;
+        }
+
+        b->pos += n;
+    }
+
+    b->pos = b->start;
+    b->last = b->start;
+
+    return NGX_OK;
+}
@@ -0,0 +1,112 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_HTTP_UPSTREAM_MUX_H_INCLUDED_
+#define _NGX_HTTP_UPSTREAM_MUX_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_MUX_FRAME_SIZE   256
+
+
+typedef struct ngx_http_upstream_mux_s         ngx_http_upstream_mux_t;
+typedef struct ngx_http_upstream_mux_stream_s  ngx_http_upstream_mux_stream_t;
+
+
+typedef struct {
+    ngx_uint_t                       streams;
+    size_t                           window;
+    ngx_msec_t                       timeout;
+} ngx_http_upstream_mux_conf_t;
+
+
+typedef struct {
+    size_t                           init_window;
+    size_t                           send_window;
+    size_t                           recv_window;
+    size_t                           recv_init_window;
+    ngx_uint_t                       last_stream_id;
+} ngx_http_upstream_mux_conn_t;
+
+
+struct ngx_http_upstream_mux_stream_s {
+    /* the fake upstream connection, must be first */
+    ngx_connection_t                 connection;
+    ngx_event_t                      read;
+    ngx_event_t                      write;
+
+    ngx_http_upstream_mux_t         *mux;
+    ngx_pool_t                      *pool;
+
+    ngx_uint_t                       id;
+
+    /* the send window and the unsent output of the stream's module */
+    ssize_t                         *send_window;
+    ngx_chain_t                    **output;
+
+    /* the rest of a partially sent frame */
+    off_t                            frame_rest;
+
+    ngx_chain_t                     *in;
+    ngx_chain_t                     *last;
+    ngx_chain_t                     *free;
+
+    ngx_queue_t                      queue;
+    ngx_queue_t                      send;
+
+    unsigned                         queued:1;
+    unsigned                         opened:1;
+    unsigned                         error:1;
+};
+
+
+struct ngx_http_upstream_mux_s {
+    ngx_http_upstream_mux_conn_t     conn;
+
+    ngx_peer_connection_t            peer;
+    ngx_log_t                        log;
+    ngx_pool_t                      *pool;
+
+    ngx_queue_t                      queue;
+    ngx_queue_t                      streams;
+    ngx_queue_t                      send;
+
+    ngx_uint_t                       nstreams;
+    ngx_uint_t                       active;
+    ngx_uint_t                       max_streams;
+    ngx_msec_t                       timeout;
+
+    ngx_http_upstream_mux_stream_t  *busy;
+
+    ngx_buf_t                       *buffer;
+    ngx_buf_t                       *out;
+
+    ngx_http_upstream_mux_stream_t  *stream;
+    size_t                           length;
+    size_t                           received;
+    ngx_uint_t                       stream_id;
+    ngx_uint_t                       type;
+    ngx_uint_t                       flags;
+    u_char                           head[NGX_HTTP_V2_FRAME_HEADER_SIZE];
+    u_char                           frame[NGX_HTTP_UPSTREAM_MUX_FRAME_SIZE];
+
+    unsigned                         connected:1;
+    unsigned                         settings:1;
+    unsigned                         goaway:1;
+};
+
+
+ngx_int_t ngx_http_upstream_mux_init_peer(ngx_http_request_t *r,
+    ngx_http_upstream_mux_conf_t *conf, ngx_http_upstream_mux_stream_t **sp);
+ngx_uint_t ngx_http_upstream_mux_open(ngx_http_upstream_mux_stream_t *s,
+    ssize_t *send_window, ngx_chain_t **output);
+
+
+#endif /* _NGX_HTTP_UPSTREAM_MUX_H_INCLUDED_ */
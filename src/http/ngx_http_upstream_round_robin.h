@@ -51,11 +51,29 @@ struct ngx_http_upstream_rr_peer_s {
 
     ngx_http_upstream_rr_peer_t    *next;
 
-    NGX_COMPAT_BEGIN(32)
+    ngx_uint_t                      ewma;
+    ngx_msec_t                      ewma_time;
+
+    ngx_uint_t                      check_fails;
+    ngx_uint_t                      check_passes;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_http_upstream_rr_peer_t    *local;
+    ngx_uint_t                      id;
+    ngx_uint_t                      zombie;
+
+    NGX_COMPAT_BEGIN(25)
+#else
+    NGX_COMPAT_BEGIN(28)
+#endif
     NGX_COMPAT_END
 };
 
 
+/* the "down" bit set by health checks, in addition to the configured one */
+#define NGX_HTTP_UPSTREAM_RR_UNHEALTHY  0x02
+
+
 typedef struct ngx_http_upstream_rr_peers_s  ngx_http_upstream_rr_peers_t;
 
 struct ngx_http_upstream_rr_peers_s {
@@ -78,6 +96,11 @@ struct ngx_http_upstream_rr_peers_s {
     ngx_http_upstream_rr_peers_t   *next;
 
     ngx_http_upstream_rr_peer_t    *peer;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                      config;
+    ngx_uint_t                      next_id;
+#endif
 };
 
 
@@ -114,6 +137,20 @@ struct ngx_http_upstream_rr_peers_s {
         ngx_rwlock_unlock(&peer->lock);                                       \
     }
 
+#define ngx_http_upstream_rr_peer_inc_conns(peers, peer)                      \
+                                                                              \
+    if (peers->shpool) {                                                      \
+        (void) ngx_atomic_fetch_add((ngx_atomic_t *) &peer->conns, 1);        \
+                                                                              \
+    } else {                                                                  \
+        peer->conns++;                                                        \
+    }
+
+/* the peers were changed at run time after the request was started */
+
+#define ngx_http_upstream_rr_peers_changed(rrp)                               \
+    ((rrp)->config != (rrp)->peers->config)
+
 #else
 
 #define ngx_http_upstream_rr_peers_rlock(peers)
@@ -121,10 +158,21 @@ struct ngx_http_upstream_rr_peers_s {
 #define ngx_http_upstream_rr_peers_unlock(peers)
 #define ngx_http_upstream_rr_peer_lock(peers, peer)
 #define ngx_http_upstream_rr_peer_unlock(peers, peer)
+#define ngx_http_upstream_rr_peer_inc_conns(peers, peer)  peer->conns++
+#define ngx_http_upstream_rr_peers_changed(rrp)  0
 
 #endif
 
 
+/*
+ * a peer in slow start is held back unless "n" falls into the share
+ * of selections that grows linearly over the slow start time
+ */
+
+#define ngx_http_upstream_rr_peer_slow(peer, n)                               \
+    ((peer)->start_time && ngx_http_upstream_rr_peer_ramp(peer, n))
+
+
 typedef struct {
     ngx_uint_t                      config;
     ngx_http_upstream_rr_peers_t   *peers;
@@ -142,9 +190,18 @@ ngx_int_t ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r,
     ngx_http_upstream_resolved_t *ur);
 ngx_int_t ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc,
     void *data);
+ngx_uint_t ngx_http_upstream_rr_peer_ramp(ngx_http_upstream_rr_peer_t *peer,
+    ngx_uint_t n);
 void ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+ngx_http_upstream_rr_peer_t *ngx_http_upstream_zone_copy_peer(
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *src);
+void ngx_http_upstream_zone_free_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t *peer);
+#endif
+
 #if (NGX_HTTP_SSL)
 ngx_int_t
     ngx_http_upstream_set_round_robin_peer_session(ngx_peer_connection_t *pc,
@@ -42,6 +42,7 @@ typedef struct {
 #define NGX_HTTP_V2_PING_SIZE                    8
 #define NGX_HTTP_V2_GOAWAY_SIZE                  8
 #define NGX_HTTP_V2_WINDOW_UPDATE_SIZE           4
+#define NGX_HTTP_V2_PRIORITY_UPDATE_SIZE         4
 
 #define NGX_HTTP_V2_SETTINGS_PARAM_SIZE          6
 
@@ -95,6 +96,8 @@ static u_char *ngx_http_v2_handle_continuation(ngx_http_v2_connection_t *h2c,
     u_char *pos, u_char *end, ngx_http_v2_handler_pt handler);
 static u_char *ngx_http_v2_state_priority(ngx_http_v2_connection_t *h2c,
     u_char *pos, u_char *end);
+static u_char *ngx_http_v2_state_priority_update(
+    ngx_http_v2_connection_t *h2c, u_char *pos, u_char *end);
 static u_char *ngx_http_v2_state_rst_stream(ngx_http_v2_connection_t *h2c,
     u_char *pos, u_char *end);
 static u_char *ngx_http_v2_state_settings(ngx_http_v2_connection_t *h2c,
@@ -167,6 +170,8 @@ static ngx_int_t ngx_http_v2_parse_authority(ngx_http_request_t *r,
 static ngx_int_t ngx_http_v2_parse_header(ngx_http_request_t *r,
     ngx_http_v2_parse_header_t *header, ngx_str_t *value);
 static ngx_int_t ngx_http_v2_construct_request_line(ngx_http_request_t *r);
+static void ngx_http_v2_parse_priority(ngx_http_v2_node_t *node,
+    ngx_str_t *value);
 static ngx_int_t ngx_http_v2_cookie(ngx_http_request_t *r,
     ngx_http_v2_header_t *header);
 static ngx_int_t ngx_http_v2_construct_cookie_header(ngx_http_request_t *r);
@@ -279,6 +284,8 @@ ngx_http_v2_init(ngx_event_t *rev)
     h2c->concurrent_pushes = h2scf->concurrent_pushes;
     h2c->priority_limit = ngx_max(h2scf->concurrent_streams, 100);
 
+    ngx_http_v2_table_init(h2c, h2scf->table_size);
+
     h2c->pool = ngx_create_pool(h2scf->pool_size, h2c->connection->log);
     if (h2c->pool == NULL) {
         ngx_http_close_connection(c);
@@ -520,6 +527,7 @@ ngx_int_t
 ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
 {
     int                        tcp_nodelay;
+    uint64_t                   vtag;
     ngx_chain_t               *cl;
     ngx_event_t               *wev;
     ngx_connection_t          *c;
@@ -586,12 +594,17 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
 
     for ( /* void */ ; out; out = fn) {
         fn = out->next;
+        vtag = out->vtag;
 
         if (out->handler(h2c, out) != NGX_OK) {
             out->blocked = 1;
             break;
         }
 
+        if (vtag > h2c->vtime) {
+            h2c->vtime = vtag;
+        }
+
         ngx_log_debug4(NGX_LOG_DEBUG_HTTP, c->log, 0,
                        "http2 frame sent: %p sid:%ui bl:%d len:%uz",
                        out, out->stream ? out->stream->node->id : 0,
@@ -938,6 +951,10 @@ ngx_http_v2_state_head(ngx_http_v2_connection_t *h2c, u_char *pos, u_char *end)
                    "http2 frame type:%ui f:%Xd l:%uz sid:%ui",
                    type, h2c->state.flags, h2c->state.length, h2c->state.sid);
 
+    if (type == NGX_HTTP_V2_PRIORITY_UPDATE_FRAME) {
+        return ngx_http_v2_state_priority_update(h2c, pos, end);
+    }
+
     if (type >= NGX_HTTP_V2_FRAME_STATES) {
         ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
                       "client sent frame with unknown type %ui", type);
@@ -1737,6 +1754,7 @@ ngx_http_v2_state_process_header(ngx_http_v2_connection_t *h2c, u_char *pos,
     ngx_http_core_main_conf_t  *cmcf;
 
     static ngx_str_t cookie = ngx_string("cookie");
+    static ngx_str_t priority = ngx_string("priority");
 
     header = &h2c->state.header;
 
@@ -1837,6 +1855,13 @@ ngx_http_v2_state_process_header(ngx_http_v2_connection_t *h2c, u_char *pos,
         }
     }
 
+    if (header->name.len == priority.len
+        && ngx_memcmp(header->name.data, priority.data, priority.len) == 0
+        && !h2c->state.stream->node->updated)
+    {
+        ngx_http_v2_parse_priority(h2c->state.stream->node, &header->value);
+    }
+
     if (header->name.len == cookie.len
         && ngx_memcmp(header->name.data, cookie.data, cookie.len) == 0)
     {
@@ -2074,6 +2099,99 @@ ngx_http_v2_state_priority(ngx_http_v2_connection_t *h2c, u_char *pos,
 }
 
 
+static u_char *
+ngx_http_v2_state_priority_update(ngx_http_v2_connection_t *h2c, u_char *pos,
+    u_char *end)
+{
+    ngx_str_t            value;
+    ngx_uint_t           sid, alloc;
+    ngx_http_v2_node_t  *node;
+
+    if (h2c->state.length < NGX_HTTP_V2_PRIORITY_UPDATE_SIZE) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent PRIORITY_UPDATE frame "
+                      "with incorrect length %uz", h2c->state.length);
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_SIZE_ERROR);
+    }
+
+    if (h2c->state.sid != 0) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent PRIORITY_UPDATE frame "
+                      "with incorrect identifier");
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR);
+    }
+
+    if ((size_t) (end - pos) < h2c->state.length) {
+
+        if (h2c->state.length > NGX_HTTP_V2_STATE_BUFFER_SIZE) {
+            ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                          "client sent too long PRIORITY_UPDATE frame, "
+                          "ignored");
+
+            return ngx_http_v2_state_skip(h2c, pos, end);
+        }
+
+        return ngx_http_v2_state_save(h2c, pos, end,
+                                      ngx_http_v2_state_priority_update);
+    }
+
+    if (--h2c->priority_limit == 0) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent too many PRIORITY_UPDATE frames");
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_ENHANCE_YOUR_CALM);
+    }
+
+    sid = ngx_http_v2_parse_sid(pos);
+
+    value.len = h2c->state.length - NGX_HTTP_V2_PRIORITY_UPDATE_SIZE;
+    value.data = pos + NGX_HTTP_V2_PRIORITY_UPDATE_SIZE;
+
+    pos += h2c->state.length;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 PRIORITY_UPDATE frame sid:%ui \"%V\"",
+                   sid, &value);
+
+    if (sid == 0) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent PRIORITY_UPDATE frame "
+                      "with incorrect prioritized identifier");
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR);
+    }
+
+    alloc = (sid % 2 == 1 && sid > h2c->last_sid);
+
+    node = ngx_http_v2_get_node_by_id(h2c, sid, alloc);
+
+    if (node == NULL) {
+        if (alloc) {
+            return ngx_http_v2_connection_error(h2c,
+                                                NGX_HTTP_V2_INTERNAL_ERROR);
+        }
+
+        return ngx_http_v2_state_complete(h2c, pos, end);
+    }
+
+    if (node->stream == NULL && node->parent == NULL) {
+        h2c->closed_nodes++;
+        ngx_queue_insert_tail(&h2c->closed, &node->reuse);
+
+        node->weight = NGX_HTTP_V2_DEFAULT_WEIGHT;
+        ngx_http_v2_set_dependency(h2c, node, 0, 0);
+    }
+
+    ngx_http_v2_parse_priority(node, &value);
+
+    node->updated = 1;
+
+    return ngx_http_v2_state_complete(h2c, pos, end);
+}
+
+
 static u_char *
 ngx_http_v2_state_rst_stream(ngx_http_v2_connection_t *h2c, u_char *pos,
     u_char *end)
@@ -2282,7 +2400,7 @@ ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
 
         case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
 
-            h2c->table_update = 1;
+            ngx_http_v2_table_limit(h2c, value);
             break;
 
         default:
@@ -3345,6 +3463,8 @@ ngx_http_v2_get_node_by_id(ngx_http_v2_connection_t *h2c, ngx_uint_t sid,
     }
 
     node->id = sid;
+    node->urgency = NGX_HTTP_V2_DEFAULT_URGENCY;
+    node->incremental = 1;
 
     ngx_queue_init(&node->children);
 
@@ -3822,6 +3942,101 @@ ngx_http_v2_construct_request_line(ngx_http_request_t *r)
 }
 
 
+static void
+ngx_http_v2_parse_priority(ngx_http_v2_node_t *node, ngx_str_t *value)
+{
+    u_char      *p, *end, *key, *val;
+    size_t       len, vlen;
+    ngx_uint_t   urgency, incremental, quoted;
+
+    /* RFC 9218 dictionary, "u=N" and "i" members; others are ignored */
+
+    urgency = NGX_HTTP_V2_DEFAULT_URGENCY;
+    incremental = 0;
+
+    p = value->data;
+    end = p + value->len;
+
+    while (p < end) {
+
+        if (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+            continue;
+        }
+
+        key = p;
+
+        while (p < end && *p != '=' && *p != ';' && *p != ','
+               && *p != ' ' && *p != '\t')
+        {
+            p++;
+        }
+
+        len = p - key;
+
+        val = NULL;
+        vlen = 0;
+
+        if (p < end && *p == '=') {
+            val = ++p;
+
+            while (p < end && *p != ';' && *p != ','
+                   && *p != ' ' && *p != '\t')
+            {
+                p++;
+            }
+
+            vlen = p - val;
+        }
+
+        /* skip parameters */
+
+        for (quoted = 0; p < end; p++) {
+
+            if (quoted) {
+                if (*p == '\\') {
+                    p++;
+
+                } else if (*p == '"') {
+                    quoted = 0;
+                }
+
+                continue;
+            }
+
+            if (*p == '"') {
+                quoted = 1;
+
+            } else if (*p == ',') {
+                break;
+            }
+        }
+
+        if (len != 1) {
+            continue;
+        }
+
+        if (key[0] == 'u') {
+            if (vlen == 1 && val[0] >= '0' && val[0] <= '7') {
+                urgency = val[0] - '0';
+            }
+
+        } else if (key[0] == 'i') {
+            if (val == NULL || (vlen == 2 && val[0] == '?' && val[1] == '1')) {
+                incremental = 1;
+
+            } else if (vlen == 2 && val[0] == '?' && val[1] == '0') {
+                incremental = 0;
+            }
+        }
+    }
+
+    node->urgency = urgency;
+    node->incremental = incremental;
+    node->extensible = 1;
+}
+
+
 static ngx_int_t
 ngx_http_v2_cookie(ngx_http_request_t *r, ngx_http_v2_header_t *header)
 {
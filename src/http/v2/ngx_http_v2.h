@@ -24,6 +24,9 @@
 #define NGX_HTTP_V2_MAX_FIELD                                                 \
     (127 + (1 << (NGX_HTTP_V2_INT_OCTETS - 1) * 7) - 1)
 
+#define NGX_HTTP_V2_TABLE_SIZE           4096
+#define NGX_HTTP_V2_MAX_TABLE_SIZE       65536
+
 #define NGX_HTTP_V2_STREAM_ID_SIZE       4
 
 #define NGX_HTTP_V2_FRAME_HEADER_SIZE    9
@@ -39,6 +42,7 @@
 #define NGX_HTTP_V2_GOAWAY_FRAME         0x7
 #define NGX_HTTP_V2_WINDOW_UPDATE_FRAME  0x8
 #define NGX_HTTP_V2_CONTINUATION_FRAME   0x9
+#define NGX_HTTP_V2_PRIORITY_UPDATE_FRAME 0x10
 
 /* frame flags */
 #define NGX_HTTP_V2_NO_FLAG              0x00
@@ -52,6 +56,7 @@
 #define NGX_HTTP_V2_DEFAULT_WINDOW       65535
 
 #define NGX_HTTP_V2_DEFAULT_WEIGHT       16
+#define NGX_HTTP_V2_DEFAULT_URGENCY      3
 
 
 typedef struct ngx_http_v2_connection_s   ngx_http_v2_connection_t;
@@ -114,6 +119,30 @@ typedef struct {
 } ngx_http_v2_hpack_t;
 
 
+typedef struct {
+    ngx_uint_t                       hash;
+    ngx_str_t                        name;
+    ngx_str_t                        value;
+} ngx_http_v2_hpack_field_t;
+
+
+typedef struct {
+    ngx_http_v2_hpack_field_t       *entries;
+
+    ngx_uint_t                       added;
+    ngx_uint_t                       deleted;
+    ngx_uint_t                       allocated;
+
+    size_t                           size;
+    size_t                           used;
+    size_t                           limit;
+    size_t                           lowest;
+    size_t                           max;
+    u_char                          *storage;
+    u_char                          *pos;
+} ngx_http_v2_hpack_enc_t;
+
+
 struct ngx_http_v2_connection_s {
     ngx_connection_t                *connection;
     ngx_http_connection_t           *http_connection;
@@ -140,6 +169,7 @@ struct ngx_http_v2_connection_s {
     ngx_http_v2_state_t              state;
 
     ngx_http_v2_hpack_t              hpack;
+    ngx_http_v2_hpack_enc_t          hpack_enc;
 
     ngx_pool_t                      *pool;
 
@@ -150,6 +180,8 @@ struct ngx_http_v2_connection_s {
 
     ngx_http_v2_out_frame_t         *last_out;
 
+    uint64_t                         vtime;
+
     ngx_queue_t                      dependencies;
     ngx_queue_t                      closed;
 
@@ -178,6 +210,11 @@ struct ngx_http_v2_node_s {
     ngx_uint_t                       weight;
     double                           rel_weight;
     ngx_http_v2_stream_t            *stream;
+
+    unsigned                         urgency:3;
+    unsigned                         incremental:1;
+    unsigned                         extensible:1;
+    unsigned                         updated:1;
 };
 
 
@@ -199,6 +236,8 @@ struct ngx_http_v2_stream_s {
 
     ngx_uint_t                       frames;
 
+    uint64_t                         vfinish;
+
     ngx_http_v2_out_frame_t         *free_frames;
     ngx_chain_t                     *free_frame_headers;
     ngx_chain_t                     *free_bufs;
@@ -230,27 +269,80 @@ struct ngx_http_v2_out_frame_s {
     ngx_http_v2_stream_t            *stream;
     size_t                           length;
 
+    uint64_t                         vtag;
+
     unsigned                         blocked:1;
     unsigned                         fin:1;
 };
 
 
+/*
+ * Streams are ordered by RFC 9218 urgency, then by the RFC 7540 dependency
+ * rank of streams that sent no extensible priority signal; non-incremental
+ * streams are served one by one in the order of their identifiers, while
+ * incremental ones share the connection by weighted fair queueing on the
+ * virtual finish time of their frames.
+ */
+
+static ngx_inline ngx_uint_t
+ngx_http_v2_precedes(ngx_http_v2_node_t *a, uint64_t va, ngx_http_v2_node_t *b,
+    uint64_t vb)
+{
+    ngx_uint_t  ra, rb;
+
+    if (a->urgency != b->urgency) {
+        return a->urgency < b->urgency;
+    }
+
+    ra = a->extensible ? 0 : a->rank;
+    rb = b->extensible ? 0 : b->rank;
+
+    if (ra != rb) {
+        return ra < rb;
+    }
+
+    if (a->incremental != b->incremental) {
+        return b->incremental;
+    }
+
+    if (a->incremental) {
+        return va < vb;
+    }
+
+    return a->id < b->id;
+}
+
+
 static ngx_inline void
 ngx_http_v2_queue_frame(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_out_frame_t *frame)
 {
+    ngx_uint_t                 weight;
+    ngx_http_v2_node_t        *node;
+    ngx_http_v2_stream_t      *stream;
     ngx_http_v2_out_frame_t  **out;
 
+    stream = frame->stream;
+    node = stream->node;
+
+    weight = node->extensible ? NGX_HTTP_V2_DEFAULT_WEIGHT : node->weight;
+
+    frame->vtag = ngx_max(h2c->vtime, stream->vfinish)
+                  + (frame->length + NGX_HTTP_V2_FRAME_HEADER_SIZE) * 256
+                    / weight;
+
+    stream->vfinish = frame->vtag;
+
     for (out = &h2c->last_out; *out; out = &(*out)->next) {
 
-        if ((*out)->blocked || (*out)->stream == NULL) {
+        if ((*out)->blocked || (*out)->stream == NULL
+            || (*out)->stream == stream)
+        {
             break;
         }
 
-        if ((*out)->stream->node->rank < frame->stream->node->rank
-            || ((*out)->stream->node->rank == frame->stream->node->rank
-                && (*out)->stream->node->rel_weight
-                   >= frame->stream->node->rel_weight))
+        if (!ngx_http_v2_precedes(node, frame->vtag, (*out)->stream->node,
+                                  (*out)->vtag))
         {
             break;
         }
@@ -274,6 +366,8 @@ ngx_http_v2_queue_blocked_frame(ngx_http_v2_connection_t *h2c,
         }
     }
 
+    frame->vtag = 0;
+
     frame->next = *out;
     *out = frame;
 }
@@ -283,6 +377,8 @@ static ngx_inline void
 ngx_http_v2_queue_ordered_frame(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_out_frame_t *frame)
 {
+    frame->vtag = 0;
+
     frame->next = h2c->last_out;
     h2c->last_out = frame;
 }
@@ -303,6 +399,7 @@ ngx_int_t ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c);
 
 ngx_str_t *ngx_http_v2_get_static_name(ngx_uint_t index);
 ngx_str_t *ngx_http_v2_get_static_value(ngx_uint_t index);
+ngx_uint_t ngx_http_v2_get_static_index(ngx_str_t *name);
 
 ngx_int_t ngx_http_v2_get_indexed_header(ngx_http_v2_connection_t *h2c,
     ngx_uint_t index, ngx_uint_t name_only);
@@ -376,6 +473,10 @@ ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 #define NGX_HTTP_V2_ENCODE_RAW            0
 #define NGX_HTTP_V2_ENCODE_HUFF           0x80
 
+#define NGX_HTTP_V2_FIELD_NOINDEX         0
+#define NGX_HTTP_V2_FIELD_INDEX           1
+#define NGX_HTTP_V2_FIELD_STATIC          2
+
 #define NGX_HTTP_V2_AUTHORITY_INDEX       1
 
 #define NGX_HTTP_V2_METHOD_INDEX          2
@@ -411,6 +512,13 @@ ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 
 u_char *ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len,
     u_char *tmp, ngx_uint_t lower);
+void ngx_http_v2_table_init(ngx_http_v2_connection_t *h2c, size_t max);
+void ngx_http_v2_table_limit(ngx_http_v2_connection_t *h2c, size_t size);
+void ngx_http_v2_table_reset(ngx_http_v2_connection_t *h2c);
+u_char *ngx_http_v2_table_update(ngx_http_v2_connection_t *h2c, u_char *pos);
+u_char *ngx_http_v2_field_encode(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, u_char *tmp,
+    ngx_uint_t flags);
 
 
 #endif /* _NGX_HTTP_V2_H_INCLUDED_ */
@@ -10,6 +10,18 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_V2_TABLE_ENTRY_SIZE     32
+
+/* the first dynamic table index follows the 61 static table entries */
+#define NGX_HTTP_V2_TABLE_DYNAMIC_INDEX  62
+
+
+static ngx_int_t ngx_http_v2_table_find(ngx_http_v2_hpack_enc_t *enc,
+    ngx_uint_t hash, ngx_str_t *name, ngx_str_t *value, ngx_uint_t *index);
+static ngx_int_t ngx_http_v2_table_add(ngx_http_v2_connection_t *h2c,
+    ngx_uint_t hash, ngx_str_t *name, ngx_str_t *value);
+static void ngx_http_v2_table_evict(ngx_http_v2_hpack_enc_t *enc,
+    size_t size);
 static u_char *ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix,
     ngx_uint_t value);
 
@@ -40,6 +52,317 @@ ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len, u_char *tmp,
 }
 
 
+void
+ngx_http_v2_table_init(ngx_http_v2_connection_t *h2c, size_t max)
+{
+    ngx_http_v2_hpack_enc_t  *enc;
+
+    enc = &h2c->hpack_enc;
+
+    enc->size = NGX_HTTP_V2_TABLE_SIZE;
+    enc->limit = NGX_HTTP_V2_TABLE_SIZE;
+    enc->lowest = NGX_HTTP_V2_TABLE_SIZE;
+    enc->max = max;
+
+    if (max < NGX_HTTP_V2_TABLE_SIZE) {
+        h2c->table_update = 1;
+    }
+}
+
+
+void
+ngx_http_v2_table_limit(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    ngx_http_v2_hpack_enc_t  *enc;
+
+    enc = &h2c->hpack_enc;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 hpack encoder limit: %uz was:%uz",
+                   size, enc->limit);
+
+    enc->limit = size;
+
+    if (size < enc->lowest) {
+        enc->lowest = size;
+    }
+
+    h2c->table_update = 1;
+}
+
+
+void
+ngx_http_v2_table_reset(ngx_http_v2_connection_t *h2c)
+{
+    ngx_http_v2_hpack_enc_t  *enc;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 hpack encoder reset");
+
+    enc = &h2c->hpack_enc;
+
+    /*
+     * the peer's copy of the table may no longer match ours,
+     * so it is flushed with a zero size update in the next header block
+     */
+
+    enc->deleted = enc->added;
+    enc->used = 0;
+    enc->pos = enc->storage;
+    enc->lowest = 0;
+
+    h2c->table_update = 1;
+}
+
+
+u_char *
+ngx_http_v2_table_update(ngx_http_v2_connection_t *h2c, u_char *pos)
+{
+    size_t                    size;
+    ngx_http_v2_hpack_enc_t  *enc;
+
+    enc = &h2c->hpack_enc;
+
+    h2c->table_update = 0;
+
+    size = ngx_min(enc->limit, enc->max);
+
+    /*
+     * if the limit was lowered and then raised again between
+     * header blocks, the lowest value has to be signalled first
+     */
+
+    if (enc->lowest < size && enc->lowest < enc->size) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 table size update: %uz", enc->lowest);
+
+        ngx_http_v2_table_evict(enc, enc->lowest);
+        enc->size = enc->lowest;
+
+        *pos = 32;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5), enc->size);
+    }
+
+    if (size != enc->size) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 table size update: %uz", size);
+
+        ngx_http_v2_table_evict(enc, size);
+        enc->size = size;
+
+        *pos = 32;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5), enc->size);
+    }
+
+    enc->lowest = enc->limit;
+
+    return pos;
+}
+
+
+u_char *
+ngx_http_v2_field_encode(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, u_char *tmp,
+    ngx_uint_t flags)
+{
+    ngx_uint_t                i, hash, found, prefix;
+    ngx_http_v2_hpack_enc_t  *enc;
+
+    enc = &h2c->hpack_enc;
+
+    if (name == NULL) {
+        name = ngx_http_v2_get_static_name(index);
+    }
+
+    hash = 0;
+    found = 0;
+
+    if (enc->size && !(flags & NGX_HTTP_V2_FIELD_STATIC)) {
+
+        for (i = 0; i < name->len; i++) {
+            hash = ngx_hash(hash, ngx_tolower(name->data[i]));
+        }
+
+        for (i = 0; i < value->len; i++) {
+            hash = ngx_hash(hash, value->data[i]);
+        }
+
+        if (ngx_http_v2_table_find(enc, hash, name, value, &found) == NGX_OK) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                           "http2 table hit: %ui", found);
+
+            *pos = 128;
+            return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7), found);
+        }
+    }
+
+    if (index == 0) {
+        index = ngx_http_v2_get_static_index(name);
+    }
+
+    /*
+     * a dynamic name reference is only used when the field is not added,
+     * as adding it may evict the very entry the name is taken from
+     */
+
+    if ((flags & NGX_HTTP_V2_FIELD_INDEX)
+        && NGX_HTTP_V2_TABLE_ENTRY_SIZE + name->len + value->len <= enc->size
+        && ngx_http_v2_table_add(h2c, hash, name, value) == NGX_OK)
+    {
+        *pos = 64;
+        prefix = ngx_http_v2_prefix(6);
+
+    } else {
+        if (index == 0) {
+            index = found;
+        }
+
+        *pos = 0;
+        prefix = ngx_http_v2_prefix(4);
+    }
+
+    if (index) {
+        pos = ngx_http_v2_write_int(pos, prefix, index);
+
+    } else {
+        pos = ngx_http_v2_write_name(pos + 1, name->data, name->len, tmp);
+    }
+
+    return ngx_http_v2_write_value(pos, value->data, value->len, tmp);
+}
+
+
+static ngx_int_t
+ngx_http_v2_table_find(ngx_http_v2_hpack_enc_t *enc, ngx_uint_t hash,
+    ngx_str_t *name, ngx_str_t *value, ngx_uint_t *index)
+{
+    ngx_uint_t                  i;
+    ngx_http_v2_hpack_field_t  *field;
+
+    for (i = enc->added; i != enc->deleted; i--) {
+        field = &enc->entries[(i - 1) % enc->allocated];
+
+        if (field->name.len != name->len
+            || ngx_strncasecmp(field->name.data, name->data, name->len) != 0)
+        {
+            continue;
+        }
+
+        if (field->hash == hash
+            && field->value.len == value->len
+            && ngx_memcmp(field->value.data, value->data, value->len) == 0)
+        {
+            *index = NGX_HTTP_V2_TABLE_DYNAMIC_INDEX + enc->added - i;
+            return NGX_OK;
+        }
+
+        if (*index == 0) {
+            *index = NGX_HTTP_V2_TABLE_DYNAMIC_INDEX + enc->added - i;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_v2_table_add(ngx_http_v2_connection_t *h2c, ngx_uint_t hash,
+    ngx_str_t *name, ngx_str_t *value)
+{
+    u_char                     *p;
+    size_t                      len, shift;
+    ngx_uint_t                  i;
+    ngx_http_v2_hpack_enc_t    *enc;
+    ngx_http_v2_hpack_field_t  *field;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 table add: \"%V: %V\"", name, value);
+
+    enc = &h2c->hpack_enc;
+
+    if (enc->entries == NULL) {
+        enc->allocated = enc->max / NGX_HTTP_V2_TABLE_ENTRY_SIZE;
+
+        enc->entries = ngx_palloc(h2c->connection->pool,
+                                  sizeof(ngx_http_v2_hpack_field_t)
+                                  * enc->allocated);
+        if (enc->entries == NULL) {
+            return NGX_ERROR;
+        }
+
+        enc->storage = ngx_palloc(h2c->connection->pool, enc->max);
+        if (enc->storage == NULL) {
+            enc->entries = NULL;
+            return NGX_ERROR;
+        }
+
+        enc->pos = enc->storage;
+    }
+
+    len = name->len + value->len;
+
+    ngx_http_v2_table_evict(enc,
+                            enc->size - NGX_HTTP_V2_TABLE_ENTRY_SIZE - len);
+
+    if ((size_t) (enc->storage + enc->max - enc->pos) < len) {
+
+        /*
+         * the entries are stored in insertion order, so the live ones
+         * are moved to the start of the storage to make room at its end
+         */
+
+        p = enc->entries[enc->deleted % enc->allocated].name.data;
+        shift = p - enc->storage;
+
+        ngx_memmove(enc->storage, p, enc->pos - p);
+        enc->pos -= shift;
+
+        for (i = enc->deleted; i != enc->added; i++) {
+            field = &enc->entries[i % enc->allocated];
+
+            field->name.data -= shift;
+            field->value.data -= shift;
+        }
+    }
+
+    field = &enc->entries[enc->added++ % enc->allocated];
+
+    field->hash = hash;
+
+    field->name.len = name->len;
+    field->name.data = enc->pos;
+
+    ngx_strlow(enc->pos, name->data, name->len);
+    enc->pos += name->len;
+
+    field->value.len = value->len;
+    field->value.data = enc->pos;
+
+    enc->pos = ngx_cpymem(enc->pos, value->data, value->len);
+
+    enc->used += NGX_HTTP_V2_TABLE_ENTRY_SIZE + len;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_v2_table_evict(ngx_http_v2_hpack_enc_t *enc, size_t size)
+{
+    ngx_http_v2_hpack_field_t  *field;
+
+    while (enc->used > size) {
+        field = &enc->entries[enc->deleted++ % enc->allocated];
+        enc->used -= NGX_HTTP_V2_TABLE_ENTRY_SIZE
+                     + field->name.len + field->value.len;
+    }
+
+    if (enc->deleted == enc->added) {
+        enc->pos = enc->storage;
+    }
+}
+
+
 static u_char *
 ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix, ngx_uint_t value)
 {
@@ -26,6 +26,7 @@ typedef struct {
     ngx_uint_t                      concurrent_pushes;
     size_t                          preread_size;
     ngx_uint_t                      streams_index_mask;
+    size_t                          table_size;
 } ngx_http_v2_srv_conf_t;
 
 
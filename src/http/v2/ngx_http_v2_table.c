@@ -10,9 +10,6 @@
 #include <ngx_http.h>
 
 
-#define NGX_HTTP_V2_TABLE_SIZE  4096
-
-
 static ngx_int_t ngx_http_v2_table_account(ngx_http_v2_connection_t *h2c,
     size_t size);
 
@@ -100,6 +97,27 @@ ngx_http_v2_get_static_value(ngx_uint_t index)
 }
 
 
+ngx_uint_t
+ngx_http_v2_get_static_index(ngx_str_t *name)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < NGX_HTTP_V2_STATIC_TABLE_ENTRIES; i++) {
+
+        if (name->len == ngx_http_v2_static_table[i].name.len
+            && ngx_strncasecmp(name->data,
+                               ngx_http_v2_static_table[i].name.data,
+                               name->len)
+               == 0)
+        {
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+
 ngx_int_t
 ngx_http_v2_get_indexed_header(ngx_http_v2_connection_t *h2c, ngx_uint_t index,
     ngx_uint_t name_only)
@@ -54,6 +54,7 @@ typedef struct {
 
     ngx_flag_t       session_tickets;
     ngx_array_t     *session_ticket_keys;
+    ngx_flag_t       session_ticket_rotation;
 
     u_char          *file;
     ngx_uint_t       line;
@@ -0,0 +1,214 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * The event timer benchmark: timers are armed, re-armed and deleted
+ * at random while the clock advances, once with the rbtree and once
+ * with the timer wheel, and the times at which every timer has expired
+ * are compared.  The clock may be started right before ngx_msec_t
+ * wraps around.
+ *
+ * The timer code is included, so the benchmark is built on its own
+ * from the source root after ./configure:
+ *
+ *     cc -O2 -I src/core -I src/event -I src/event/modules -I src/os/unix \
+ *         -I objs -o objs/ngx_event_timer_bench src/misc/ngx_event_timer_bench.c
+ *
+ *     objs/ngx_event_timer_bench [timers [steps [start]]]
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+#include "../core/ngx_rbtree.c"
+#include "../event/ngx_event_timer.c"
+
+
+typedef struct {
+    ngx_msec_t         *fired;
+    double              time;
+    ngx_uint_t          left;
+} ngx_timer_bench_result_t;
+
+
+static void ngx_timer_bench_run(ngx_uint_t wheel, ngx_uint_t n,
+    ngx_uint_t steps, ngx_msec_t start, ngx_timer_bench_result_t *res);
+static void ngx_timer_bench_handler(ngx_event_t *ev);
+static uint32_t ngx_timer_bench_random(void);
+static double ngx_timer_bench_now(void);
+
+
+volatile ngx_msec_t      ngx_current_msec;
+ngx_uint_t               ngx_events_handled;
+
+static ngx_event_t      *events;
+static ngx_msec_t       *fired;
+static uint64_t          seed;
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    ngx_uint_t                n, steps, i, mismatches;
+    ngx_msec_t                start;
+    ngx_timer_bench_result_t  rbtree, wheel;
+
+    n = (argc > 1) ? (ngx_uint_t) atoi(argv[1]) : 1000000;
+    steps = (argc > 2) ? (ngx_uint_t) atoi(argv[2]) : 100;
+    start = (argc > 3) ? (ngx_msec_t) strtoull(argv[3], NULL, 0)
+                       : (ngx_msec_t) -30000;
+
+    if (n == 0) {
+        fprintf(stderr, "invalid number of timers\n");
+        return 1;
+    }
+
+    ngx_timer_bench_run(0, n, steps, start, &rbtree);
+    ngx_timer_bench_run(1, n, steps, start, &wheel);
+
+    mismatches = 0;
+
+    for (i = 0; i < n; i++) {
+        if (rbtree.fired[i] != wheel.fired[i]) {
+            mismatches++;
+        }
+    }
+
+    printf("timers: %lu, steps: %lu, start: %lu, msec bits: %lu\n",
+           (unsigned long) n, (unsigned long) steps, (unsigned long) start,
+           (unsigned long) (8 * sizeof(ngx_msec_t)));
+    printf("rbtree: %.3fs, wheel: %.3fs\n", rbtree.time, wheel.time);
+    printf("mismatches: %lu, left: %lu %lu\n", (unsigned long) mismatches,
+           (unsigned long) rbtree.left, (unsigned long) wheel.left);
+
+    free(rbtree.fired);
+    free(wheel.fired);
+
+    return (mismatches || rbtree.left || wheel.left) ? 1 : 0;
+}
+
+
+static void
+ngx_timer_bench_run(ngx_uint_t wheel, ngx_uint_t n, ngx_uint_t steps,
+    ngx_msec_t start, ngx_timer_bench_result_t *res)
+{
+    double             t;
+    ngx_uint_t         i, s;
+    ngx_log_t          log;
+    ngx_event_t       *ev;
+    ngx_connection_t   c;
+
+    ngx_memzero(&log, sizeof(ngx_log_t));
+    ngx_memzero(&c, sizeof(ngx_connection_t));
+
+    ngx_event_timer_wheel = wheel;
+    ngx_current_msec = start;
+
+    (void) ngx_event_timer_init(&log);
+
+    events = calloc(n, sizeof(ngx_event_t));
+    fired = calloc(n, sizeof(ngx_msec_t));
+
+    if (events == NULL || fired == NULL) {
+        fprintf(stderr, "calloc() failed\n");
+        exit(1);
+    }
+
+    for (i = 0; i < n; i++) {
+        events[i].handler = ngx_timer_bench_handler;
+        events[i].log = &log;
+        events[i].data = &c;
+    }
+
+    seed = 42;
+
+    t = ngx_timer_bench_now();
+
+    for (i = 0; i < n; i++) {
+        ngx_add_timer(&events[i], 1000 + ngx_timer_bench_random() % 60000);
+    }
+
+    for (s = 0; s < steps; s++) {
+
+        /* re-arm or delete a tenth of the timers as reads and writes do */
+
+        for (i = 0; i < n / 10; i++) {
+            ev = &events[ngx_timer_bench_random() % n];
+
+            if (ngx_timer_bench_random() % 8 == 0) {
+                if (ev->timer_set) {
+                    ngx_del_timer(ev);
+                }
+
+                continue;
+            }
+
+            ngx_add_timer(ev, 1000 + ngx_timer_bench_random() % 60000);
+        }
+
+        ngx_current_msec += 1 + ngx_timer_bench_random() % 50;
+
+        (void) ngx_event_find_timer();
+        ngx_event_expire_timers();
+    }
+
+    res->time = ngx_timer_bench_now() - t;
+
+    /* expire the rest of the timers step by step */
+
+    while (ngx_event_find_timer() != NGX_TIMER_INFINITE) {
+        ngx_current_msec += 1 + ngx_timer_bench_random() % 5000;
+        ngx_event_expire_timers();
+    }
+
+    res->left = 0;
+
+    for (i = 0; i < n; i++) {
+        if (events[i].timer_set) {
+            res->left++;
+        }
+    }
+
+    res->fired = fired;
+
+    free(events);
+}
+
+
+static void
+ngx_timer_bench_handler(ngx_event_t *ev)
+{
+    fired[ev - events] = ngx_current_msec;
+}
+
+
+static uint32_t
+ngx_timer_bench_random(void)
+{
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+
+    return (uint32_t) (seed >> 33);
+}
+
+
+static double
+ngx_timer_bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void ngx_cdecl
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
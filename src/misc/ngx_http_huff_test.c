@@ -0,0 +1,292 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * The HPACK Huffman decoder tests and benchmark.  The octet-wide decoder
+ * is compared with the original one, which walks the 4-bit state machine
+ * twice per octet, for every state and every 2-octet input with and
+ * without "last", then random strings are encoded and decoded back in two
+ * parts split at random, and finally both decoders are timed on typical
+ * header values.
+ *
+ * The Huffman code is included, so the test is built on its own from
+ * the source root after ./configure --with-http_v2_module:
+ *
+ *     cc -O2 -I src/core -I src/event -I src/event/modules -I src/os/unix \
+ *         -I src/http -I src/http/modules -I src/http/v2 -I objs \
+ *         -o objs/ngx_http_huff_test src/misc/ngx_http_huff_test.c
+ *
+ *     objs/ngx_http_huff_test [rounds]
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include "../http/ngx_http_huff_decode.c"
+#include "../http/ngx_http_huff_encode.c"
+
+
+static ngx_int_t ngx_http_huff_decode_orig(u_char *state, u_char *src,
+    size_t len, u_char **dst, ngx_uint_t last);
+static ngx_uint_t ngx_http_huff_test_exhaustive(void);
+static ngx_uint_t ngx_http_huff_test_round_trip(ngx_uint_t rounds);
+static void ngx_http_huff_test_bench(ngx_uint_t rounds);
+static uint32_t ngx_http_huff_test_random(void);
+static double ngx_http_huff_test_now(void);
+
+
+static ngx_log_t         ngx_http_huff_test_log;
+static uint64_t          seed = 1;
+static volatile u_char   sink;
+
+static char             *ngx_http_huff_test_values[] = {
+    "text/html; charset=utf-8",
+    "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+        "(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36",
+    "gzip, deflate, br",
+    "/static/js/app.3f9a1c.bundle.js?v=20231015",
+    "Wed, 31 Dec 1986 18:00:00 GMT"
+};
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    ngx_uint_t  rounds, failed;
+
+    rounds = (argc > 1) ? (ngx_uint_t) atoi(argv[1]) : 2000000;
+
+    ngx_http_huff_decode_init();
+
+    failed = ngx_http_huff_test_exhaustive();
+    failed += ngx_http_huff_test_round_trip(rounds);
+
+    ngx_http_huff_test_bench(rounds);
+
+    return failed ? 1 : 0;
+}
+
+
+static ngx_int_t
+ngx_http_huff_decode_orig(u_char *state, u_char *src, size_t len,
+    u_char **dst, ngx_uint_t last)
+{
+    u_char  *end, ch, ending;
+
+    ending = 1;
+
+    end = src + len;
+
+    while (src != end) {
+        ch = *src++;
+
+        if (ngx_http_huff_decode_bits(state, &ending, ch >> 4, dst)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        if (ngx_http_huff_decode_bits(state, &ending, ch & 0xf, dst)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    if (last) {
+        if (!ending) {
+            return NGX_ERROR;
+        }
+
+        *state = 0;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_huff_test_exhaustive(void)
+{
+    u_char      s1, s2, in[2], o1[8], o2[8], *p1, *p2;
+    ngx_int_t   rc1, rc2;
+    ngx_uint_t  i, n, last, checks, failed;
+
+    checks = 0;
+    failed = 0;
+
+    for (i = 0; i < 256; i++) {
+        for (n = 0; n < 65536; n++) {
+            in[0] = (u_char) (n >> 8);
+            in[1] = (u_char) n;
+
+            for (last = 0; last < 2; last++) {
+                s1 = (u_char) i;
+                s2 = (u_char) i;
+                p1 = o1;
+                p2 = o2;
+
+                rc1 = ngx_http_huff_decode_orig(&s1, in, 2, &p1, last);
+                rc2 = ngx_http_huff_decode(&s2, in, 2, &p2, last,
+                                           &ngx_http_huff_test_log);
+
+                checks++;
+
+                if (rc1 != rc2
+                    || (rc1 == NGX_OK
+                        && (s1 != s2
+                            || p1 - o1 != p2 - o2
+                            || ngx_memcmp(o1, o2, p1 - o1) != 0)))
+                {
+                    failed++;
+                }
+            }
+        }
+    }
+
+    printf("exhaustive: %lu checks, %lu mismatches\n",
+           (unsigned long) checks, (unsigned long) failed);
+
+    return failed;
+}
+
+
+static ngx_uint_t
+ngx_http_huff_test_round_trip(ngx_uint_t rounds)
+{
+    u_char      state, in[256], enc[512], out[512], *p;
+    size_t      len, hlen, cut;
+    ngx_int_t   rc;
+    ngx_uint_t  i, n, failed;
+
+    static u_char  chars[] = "abcdefghijklmnopqrstuvwxyz0123456789"
+                             "-/.:; =ABCXYZ";
+
+    failed = 0;
+
+    for (n = 0; n < rounds; n++) {
+        len = ngx_http_huff_test_random() % 200 + 1;
+
+        for (i = 0; i < len; i++) {
+            in[i] = (n & 1) ? (u_char) ngx_http_huff_test_random()
+                            : chars[ngx_http_huff_test_random()
+                                    % (sizeof(chars) - 1)];
+        }
+
+        hlen = ngx_http_huff_encode(in, len, enc, 0);
+
+        if (hlen == 0) {
+
+            /* the encoded string is not shorter, and is not used */
+            continue;
+        }
+
+        cut = ngx_http_huff_test_random() % (hlen + 1);
+
+        state = 0;
+        p = out;
+
+        rc = ngx_http_huff_decode(&state, enc, cut, &p, 0,
+                                  &ngx_http_huff_test_log);
+
+        if (rc == NGX_OK) {
+            rc = ngx_http_huff_decode(&state, enc + cut, hlen - cut, &p, 1,
+                                      &ngx_http_huff_test_log);
+        }
+
+        if (rc != NGX_OK
+            || (size_t) (p - out) != len
+            || ngx_memcmp(out, in, len) != 0)
+        {
+            failed++;
+        }
+    }
+
+    printf("round trip: %lu strings, %lu failures\n",
+           (unsigned long) rounds, (unsigned long) failed);
+
+    return failed;
+}
+
+
+static void
+ngx_http_huff_test_bench(ngx_uint_t rounds)
+{
+    u_char      state, enc[5][256], out[512], *p;
+    size_t      len[5], total;
+    double      t, orig;
+    ngx_uint_t  i, n;
+
+    total = 0;
+
+    for (i = 0; i < 5; i++) {
+        len[i] = ngx_http_huff_encode((u_char *) ngx_http_huff_test_values[i],
+                                      ngx_strlen(ngx_http_huff_test_values[i]),
+                                      enc[i], 0);
+    }
+
+    t = ngx_http_huff_test_now();
+
+    for (n = 0; n < rounds; n++) {
+        i = n % 5;
+        state = 0;
+        p = out;
+
+        (void) ngx_http_huff_decode_orig(&state, enc[i], len[i], &p, 1);
+
+        sink = out[0];
+        total += len[i];
+    }
+
+    orig = ngx_http_huff_test_now() - t;
+
+    t = ngx_http_huff_test_now();
+
+    for (n = 0; n < rounds; n++) {
+        i = n % 5;
+        state = 0;
+        p = out;
+
+        (void) ngx_http_huff_decode(&state, enc[i], len[i], &p, 1,
+                                    &ngx_http_huff_test_log);
+
+        sink = out[0];
+    }
+
+    t = ngx_http_huff_test_now() - t;
+
+    printf("decode: original %.1f MB/s, octet-wide %.1f MB/s\n",
+           total / orig / 1e6, total / t / 1e6);
+}
+
+
+static uint32_t
+ngx_http_huff_test_random(void)
+{
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+
+    return (uint32_t) (seed >> 33);
+}
+
+
+static double
+ngx_http_huff_test_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void ngx_cdecl
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
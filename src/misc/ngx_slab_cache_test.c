@@ -0,0 +1,370 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * The slab worker cache tests.  Workers are simulated in one process
+ * by switching ngx_worker and ngx_pid.  The memory taken by the caches
+ * is checked for pools of various sizes, including the cleanup when the
+ * caches do not fit.  Then the number of chunks which can be allocated
+ * while other workers hold cached chunks is compared with the number
+ * allocated from the same pool without caches.  Sizes of more than a page
+ * are not compared, as chunks returned from the caches late may leave
+ * free pages between them.
+ *
+ * The slab code is included, so the test is built on its own from
+ * the source root after ./configure:
+ *
+ *     cc -O2 -I src/core -I src/event -I src/event/modules -I src/os/unix \
+ *         -I objs -o objs/ngx_slab_cache_test src/misc/ngx_slab_cache_test.c
+ *
+ *     objs/ngx_slab_cache_test [workers [cache]]
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include "../core/ngx_shmtx.c"
+#include "../core/ngx_slab.c"
+
+
+static ngx_slab_pool_t *ngx_slab_test_pool(size_t size);
+static ngx_uint_t ngx_slab_test_share(ngx_uint_t cache);
+static ngx_uint_t ngx_slab_test_cleanup(ngx_uint_t workers, ngx_uint_t cache);
+static ngx_uint_t ngx_slab_test_reclaim(ngx_uint_t workers, ngx_uint_t cache);
+static void ngx_slab_test_fill(ngx_slab_pool_t *pool, ngx_uint_t workers,
+    ngx_uint_t cache, void **chunks);
+static ngx_uint_t ngx_slab_test_count(ngx_slab_pool_t *pool, size_t size,
+    void **chunks);
+static void ngx_slab_test_worker(ngx_uint_t n);
+
+
+ngx_pid_t                ngx_pid;
+ngx_uint_t               ngx_process;
+ngx_uint_t               ngx_worker;
+ngx_int_t                ngx_ncpu = 1;
+ngx_uint_t               ngx_pagesize;
+ngx_uint_t               ngx_pagesize_shift;
+volatile ngx_cycle_t    *ngx_cycle;
+
+static ngx_log_t         ngx_slab_test_log;
+static ngx_cycle_t       ngx_slab_test_cycle;
+
+static size_t            ngx_slab_test_sizes[] = {
+    8, 24, 64, 200, 512, 1024, 2048, 4096
+};
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    ngx_uint_t  workers, cache, failed, n;
+
+    workers = (argc > 1) ? (ngx_uint_t) atoi(argv[1]) : 4;
+    cache = (argc > 2) ? (ngx_uint_t) atoi(argv[2]) : 64;
+
+    if (workers == 0 || cache < 2) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    ngx_pagesize = getpagesize();
+    for (n = ngx_pagesize; n >>= 1; ngx_pagesize_shift++) { /* void */ }
+
+    ngx_slab_test_cycle.log = &ngx_slab_test_log;
+    ngx_cycle = &ngx_slab_test_cycle;
+
+    ngx_slab_sizes_init();
+
+    failed = ngx_slab_test_share(cache);
+    failed += ngx_slab_test_cleanup(workers, cache);
+    failed += ngx_slab_test_reclaim(workers, cache);
+
+    return failed ? 1 : 0;
+}
+
+
+static ngx_slab_pool_t *
+ngx_slab_test_pool(size_t size)
+{
+    u_char           *addr;
+    ngx_slab_pool_t  *pool;
+
+    addr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+
+    if (addr == MAP_FAILED) {
+        fprintf(stderr, "mmap() failed\n");
+        exit(1);
+    }
+
+    pool = (ngx_slab_pool_t *) addr;
+
+    pool->end = addr + size;
+    pool->min_shift = 3;
+    pool->addr = addr;
+
+    if (ngx_shmtx_create(&pool->mutex, &pool->lock, NULL) != NGX_OK) {
+        fprintf(stderr, "ngx_shmtx_create() failed\n");
+        exit(1);
+    }
+
+    ngx_slab_init(pool);
+
+    pool->log_nomem = 0;
+
+    return pool;
+}
+
+
+static ngx_uint_t
+ngx_slab_test_share(ngx_uint_t cache)
+{
+    size_t            size, used;
+    ngx_uint_t        i, w, pfree, enabled, failed;
+    ngx_slab_pool_t  *pool;
+
+    static size_t      sizes[] = { 32768, 65536, 262144, 1048576, 16777216 };
+    static ngx_uint_t  workers[] = { 1, 4, 16, 64 };
+
+    enabled = 0;
+    failed = 0;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(size_t); i++) {
+        for (w = 0; w < sizeof(workers) / sizeof(ngx_uint_t); w++) {
+            size = sizes[i];
+            pool = ngx_slab_test_pool(size);
+
+            pfree = pool->pfree;
+
+            ngx_slab_cache_init(pool, workers[w], cache);
+
+            used = (pfree - pool->pfree) << ngx_pagesize_shift;
+
+            if (used > (size_t) (pool->end - pool->start)
+                       / NGX_SLAB_CACHE_SHARE
+                || (pool->caches == NULL && used))
+            {
+                printf("share: pool %lu, workers %lu: %lu bytes used\n",
+                       (unsigned long) size, (unsigned long) workers[w],
+                       (unsigned long) used);
+                failed++;
+            }
+
+            if (pool->caches) {
+                enabled++;
+            }
+
+            munmap(pool->addr, size);
+        }
+    }
+
+    printf("share: caches in %lu of %lu pools, %lu failures\n",
+           (unsigned long) enabled,
+           (unsigned long) (sizeof(sizes) / sizeof(size_t)
+                            * sizeof(workers) / sizeof(ngx_uint_t)),
+           (unsigned long) failed);
+
+    return failed;
+}
+
+
+static ngx_uint_t
+ngx_slab_test_cleanup(ngx_uint_t workers, ngx_uint_t cache)
+{
+    size_t            size;
+    ngx_uint_t        n, left, failed;
+    ngx_slab_page_t  *page;
+    ngx_slab_pool_t  *pool;
+
+    size = 16777216;
+    failed = 0;
+
+    /* leave less free pages than the caches need */
+
+    for (left = 0; left < workers + 2; left++) {
+        pool = ngx_slab_test_pool(size);
+
+        n = pool->pfree - left;
+
+        page = ngx_slab_alloc_pages(pool, n);
+
+        if (page == NULL) {
+            fprintf(stderr, "ngx_slab_alloc_pages() failed\n");
+            exit(1);
+        }
+
+        ngx_slab_cache_init(pool, workers, cache);
+
+        if (pool->caches == NULL && pool->pfree != left) {
+            printf("cleanup: %lu pages left, %lu free after init\n",
+                   (unsigned long) left, (unsigned long) pool->pfree);
+            failed++;
+        }
+
+        munmap(pool->addr, size);
+    }
+
+    printf("cleanup: %lu failures\n", (unsigned long) failed);
+
+    return failed;
+}
+
+
+static ngx_uint_t
+ngx_slab_test_reclaim(ngx_uint_t workers, ngx_uint_t cache)
+{
+    void             **chunks;
+    size_t             size, chunk;
+    ngx_uint_t         i, plain, cached, locked, drained, failed;
+    ngx_slab_pool_t   *pool;
+
+    size = 1048576;
+    failed = 0;
+
+    chunks = malloc(size / 8 * sizeof(void *));
+    if (chunks == NULL) {
+        fprintf(stderr, "malloc() failed\n");
+        exit(1);
+    }
+
+    for (i = 0; i < sizeof(ngx_slab_test_sizes) / sizeof(size_t); i++) {
+        chunk = ngx_slab_test_sizes[i];
+
+        pool = ngx_slab_test_pool(size);
+
+        ngx_slab_cache_init(pool, workers, cache);
+
+        if (pool->caches == NULL) {
+            fprintf(stderr, "the pool is too small for the caches\n");
+            exit(1);
+        }
+
+        /* the number of chunks allocated without the caches */
+
+        ngx_process = NGX_PROCESS_SINGLE;
+        ngx_pid = 1;
+
+        plain = ngx_slab_test_count(pool, chunk, chunks);
+
+        /* the chunks cached by all workers are reclaimed */
+
+        ngx_slab_test_fill(pool, workers, cache, chunks);
+
+        ngx_slab_test_worker(0);
+
+        cached = ngx_slab_test_count(pool, chunk, chunks);
+
+        /*
+         * the chunks of a cache locked by its worker are returned
+         * on the worker's next allocation
+         */
+
+        ngx_slab_test_fill(pool, workers, cache, chunks);
+
+        pool->caches[workers - 1]->lock = 0x7fff;
+
+        ngx_slab_test_worker(0);
+
+        locked = ngx_slab_test_count(pool, chunk, chunks);
+
+        pool->caches[workers - 1]->lock = 0;
+
+        ngx_slab_test_worker(workers - 1);
+        ngx_slab_free(pool, ngx_slab_alloc(pool, 8));
+
+        ngx_slab_test_worker(0);
+
+        drained = ngx_slab_test_count(pool, chunk, chunks);
+
+        printf("reclaim: size %lu: %lu chunks without caches, %lu with, "
+               "%lu with a locked cache, %lu after it is drained\n",
+               (unsigned long) chunk, (unsigned long) plain,
+               (unsigned long) cached, (unsigned long) locked,
+               (unsigned long) drained);
+
+        if (cached != plain || drained != plain) {
+            failed++;
+        }
+
+        munmap(pool->addr, size);
+    }
+
+    free(chunks);
+
+    printf("reclaim: %lu failures\n", (unsigned long) failed);
+
+    return failed;
+}
+
+
+static void
+ngx_slab_test_fill(ngx_slab_pool_t *pool, ngx_uint_t workers,
+    ngx_uint_t cache, void **chunks)
+{
+    ngx_uint_t  w, n, shift;
+
+    /* each worker leaves chunks of all sizes in its cache */
+
+    for (w = 0; w < workers; w++) {
+        ngx_slab_test_worker(w);
+
+        for (shift = pool->min_shift;
+             shift <= NGX_SLAB_CACHE_MAX_SHIFT;
+             shift++)
+        {
+            for (n = 0; n < 2 * cache; n++) {
+                chunks[n] = ngx_slab_alloc(pool, (size_t) 1 << shift);
+            }
+
+            while (n--) {
+                ngx_slab_free(pool, chunks[n]);
+            }
+        }
+    }
+}
+
+
+static ngx_uint_t
+ngx_slab_test_count(ngx_slab_pool_t *pool, size_t size, void **chunks)
+{
+    ngx_uint_t  n, i;
+
+    for (n = 0; /* void */; n++) {
+        chunks[n] = ngx_slab_alloc(pool, size);
+
+        if (chunks[n] == NULL) {
+            break;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        ngx_slab_free(pool, chunks[i]);
+    }
+
+    return n;
+}
+
+
+static void
+ngx_slab_test_worker(ngx_uint_t n)
+{
+    ngx_process = NGX_PROCESS_WORKER;
+    ngx_worker = n;
+    ngx_pid = 100 + n;
+}
+
+
+void ngx_cdecl
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+void
+ngx_debug_point(void)
+{
+}
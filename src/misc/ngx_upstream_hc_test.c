@@ -0,0 +1,513 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * The active health check tests.  Stub backends are run in a child
+ * process, nginx is started in the single process mode with an http
+ * and a stream upstream checked every 200ms, and the stubs are switched
+ * between a good response, an unexpected status, an unexpected body and
+ * a closed port.  The notices about servers becoming unhealthy and
+ * healthy again are then expected in the error log, and requests are
+ * expected to be proxied to healthy servers only.
+ *
+ * The test is built on its own, and run from the source root after
+ * ./configure --with-stream && make:
+ *
+ *     cc -O2 -o objs/ngx_upstream_hc_test src/misc/ngx_upstream_hc_test.c
+ *
+ *     objs/ngx_upstream_hc_test [nginx [port]]
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+#define NGX_HC_TEST_OK      0
+#define NGX_HC_TEST_STATUS  1
+#define NGX_HC_TEST_BODY    2
+#define NGX_HC_TEST_CLOSED  3
+
+#define NGX_HC_TEST_STUBS   3
+
+
+typedef struct {
+    volatile int   mode[NGX_HC_TEST_STUBS];
+} ngx_hc_test_shared_t;
+
+
+static void ngx_hc_test_stubs(int port);
+static int ngx_hc_test_listen(int port);
+static void ngx_hc_test_respond(int fd, int stub, int mode);
+static int ngx_hc_test_conf(const char *prefix, int port);
+static int ngx_hc_test_wait(const char *prefix, const char *line, int count);
+static int ngx_hc_test_count(const char *prefix, const char *line);
+static int ngx_hc_test_request(int port, char *reply, size_t len);
+static int ngx_hc_test_balance(int port, int *a, int *b);
+static void ngx_hc_test_check(const char *name, int ok);
+
+
+static ngx_hc_test_shared_t  *shared;
+static int                    failed;
+
+
+int
+main(int argc, char *const *argv)
+{
+    int          port, a, b;
+    char         prefix[] = "/tmp/ngx_hc_test.XXXXXX", line[128];
+    const char  *nginx;
+    pid_t        stubs, server;
+
+    nginx = (argc > 1) ? argv[1] : "objs/nginx";
+    port = (argc > 2) ? atoi(argv[2]) : 18700;
+
+    shared = mmap(NULL, sizeof(ngx_hc_test_shared_t), PROT_READ|PROT_WRITE,
+                  MAP_SHARED|MAP_ANON, -1, 0);
+
+    if (shared == MAP_FAILED || mkdtemp(prefix) == NULL) {
+        perror("ngx_hc_test");
+        return 2;
+    }
+
+    memset(shared, 0, sizeof(ngx_hc_test_shared_t));
+
+    if (ngx_hc_test_conf(prefix, port) != 0) {
+        return 2;
+    }
+
+    stubs = fork();
+
+    if (stubs == 0) {
+        ngx_hc_test_stubs(port);
+        _exit(0);
+    }
+
+    server = fork();
+
+    if (server == 0) {
+        execl(nginx, nginx, "-p", prefix, "-c", "nginx.conf", (char *) NULL);
+        perror("execl");
+        _exit(2);
+    }
+
+    usleep(1000000);
+
+    /* all servers pass the checks */
+
+    ngx_hc_test_check("no unhealthy servers at start",
+                      ngx_hc_test_count(prefix, "unhealthy") == 0);
+
+    ngx_hc_test_check("both http servers used",
+                      ngx_hc_test_balance(port, &a, &b) == 0 && a && b);
+
+    /* an unexpected status */
+
+    shared->mode[0] = NGX_HC_TEST_STATUS;
+
+    snprintf(line, sizeof(line), "127.0.0.1:%d in upstream \"h\" is unhealthy",
+             port + 1);
+
+    ngx_hc_test_check("status mismatch", ngx_hc_test_wait(prefix, line, 1));
+
+    ngx_hc_test_check("unhealthy server skipped",
+                      ngx_hc_test_balance(port, &a, &b) == 0 && !a && b);
+
+    /* recovery after "passes" successful checks */
+
+    shared->mode[0] = NGX_HC_TEST_OK;
+
+    snprintf(line, sizeof(line), "127.0.0.1:%d in upstream \"h\" is healthy",
+             port + 1);
+
+    ngx_hc_test_check("status recovery", ngx_hc_test_wait(prefix, line, 1));
+
+    ngx_hc_test_check("recovered server used",
+                      ngx_hc_test_balance(port, &a, &b) == 0 && a && b);
+
+    /* an unexpected body, then a closed port */
+
+    shared->mode[1] = NGX_HC_TEST_BODY;
+
+    snprintf(line, sizeof(line), "127.0.0.1:%d in upstream \"h\" is unhealthy",
+             port + 2);
+
+    ngx_hc_test_check("body mismatch", ngx_hc_test_wait(prefix, line, 1));
+
+    shared->mode[1] = NGX_HC_TEST_CLOSED;
+
+    usleep(500000);
+
+    ngx_hc_test_check("closed port stays unhealthy",
+                      ngx_hc_test_count(prefix, line) == 1
+                      && ngx_hc_test_balance(port, &a, &b) == 0 && a && !b);
+
+    shared->mode[1] = NGX_HC_TEST_OK;
+
+    snprintf(line, sizeof(line), "127.0.0.1:%d in upstream \"h\" is healthy",
+             port + 2);
+
+    ngx_hc_test_check("closed port recovery",
+                      ngx_hc_test_wait(prefix, line, 1));
+
+    /* stream connect checks */
+
+    shared->mode[2] = NGX_HC_TEST_CLOSED;
+
+    snprintf(line, sizeof(line), "127.0.0.1:%d in upstream \"s\" is unhealthy",
+             port + 3);
+
+    ngx_hc_test_check("stream closed port", ngx_hc_test_wait(prefix, line, 1));
+
+    shared->mode[2] = NGX_HC_TEST_OK;
+
+    snprintf(line, sizeof(line), "127.0.0.1:%d in upstream \"s\" is healthy",
+             port + 3);
+
+    ngx_hc_test_check("stream recovery", ngx_hc_test_wait(prefix, line, 1));
+
+    kill(server, SIGTERM);
+    kill(stubs, SIGTERM);
+
+    (void) waitpid(server, NULL, 0);
+    (void) waitpid(stubs, NULL, 0);
+
+    if (failed) {
+        printf("%d failed, see %s/error.log\n", failed, prefix);
+        return 1;
+    }
+
+    printf("all passed\n");
+
+    return 0;
+}
+
+
+static void
+ngx_hc_test_stubs(int port)
+{
+    int            i, fd, ls[NGX_HC_TEST_STUBS];
+    struct pollfd  pfd[NGX_HC_TEST_STUBS];
+
+    for (i = 0; i < NGX_HC_TEST_STUBS; i++) {
+        ls[i] = -1;
+    }
+
+    for ( ;; ) {
+
+        /* a closed port refuses connections */
+
+        for (i = 0; i < NGX_HC_TEST_STUBS; i++) {
+
+            if (shared->mode[i] == NGX_HC_TEST_CLOSED) {
+                if (ls[i] != -1) {
+                    close(ls[i]);
+                    ls[i] = -1;
+                }
+
+            } else if (ls[i] == -1) {
+                ls[i] = ngx_hc_test_listen(port + 1 + i);
+            }
+
+            pfd[i].fd = ls[i];
+            pfd[i].events = POLLIN;
+            pfd[i].revents = 0;
+        }
+
+        if (poll(pfd, NGX_HC_TEST_STUBS, 50) <= 0) {
+            continue;
+        }
+
+        for (i = 0; i < NGX_HC_TEST_STUBS; i++) {
+
+            if (!(pfd[i].revents & POLLIN)) {
+                continue;
+            }
+
+            fd = accept(ls[i], NULL, NULL);
+
+            if (fd == -1) {
+                continue;
+            }
+
+            ngx_hc_test_respond(fd, i, shared->mode[i]);
+
+            close(fd);
+        }
+    }
+}
+
+
+static int
+ngx_hc_test_listen(int port)
+{
+    int                 fd, on;
+    struct sockaddr_in  sin;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd == -1) {
+        return -1;
+    }
+
+    on = 1;
+    (void) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int));
+
+    memset(&sin, 0, sizeof(struct sockaddr_in));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(fd, (struct sockaddr *) &sin, sizeof(struct sockaddr_in)) == -1
+        || listen(fd, 128) == -1)
+    {
+        perror("stub");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+static void
+ngx_hc_test_respond(int fd, int stub, int mode)
+{
+    int      status;
+    char     buf[1024], body[16];
+    ssize_t  n;
+
+    /* the stream stub only accepts connections */
+
+    if (stub == NGX_HC_TEST_STUBS - 1) {
+        return;
+    }
+
+    n = recv(fd, buf, sizeof(buf), 0);
+
+    if (n <= 0) {
+        return;
+    }
+
+    status = (mode == NGX_HC_TEST_STATUS) ? 500 : 200;
+
+    snprintf(body, sizeof(body), "%s %c",
+             (mode == NGX_HC_TEST_BODY) ? "FAIL" : "OK", 'a' + stub);
+
+    n = snprintf(buf, sizeof(buf), "HTTP/1.0 %d X\r\n"
+                 "Content-Length: %d\r\n\r\n%s",
+                 status, (int) strlen(body), body);
+
+    (void) send(fd, buf, n, 0);
+}
+
+
+static int
+ngx_hc_test_conf(const char *prefix, int port)
+{
+    char   name[256];
+    FILE  *f;
+
+    /* the default error log is opened before the configuration is read */
+
+    snprintf(name, sizeof(name), "%s/logs", prefix);
+
+    if (mkdir(name, 0700) == -1) {
+        perror(name);
+        return -1;
+    }
+
+    snprintf(name, sizeof(name), "%s/nginx.conf", prefix);
+
+    f = fopen(name, "w");
+
+    if (f == NULL) {
+        perror(name);
+        return -1;
+    }
+
+    fprintf(f,
+        "daemon off;\n"
+        "master_process off;\n"
+        "error_log %s/error.log info;\n"
+        "pid %s/nginx.pid;\n"
+        "events {}\n"
+        "http {\n"
+        "    access_log off;\n"
+        "    client_body_temp_path %s;\n"
+        "    proxy_temp_path %s;\n"
+        "    fastcgi_temp_path %s;\n"
+        "    uwsgi_temp_path %s;\n"
+        "    scgi_temp_path %s;\n"
+        "    upstream h {\n"
+        "        zone h 64k;\n"
+        "        server 127.0.0.1:%d max_fails=0;\n"
+        "        server 127.0.0.1:%d max_fails=0;\n"
+        "        health_check interval=200ms passes=2 uri=/hc body=OK;\n"
+        "    }\n"
+        "    server {\n"
+        "        listen 127.0.0.1:%d;\n"
+        "        location / { proxy_pass http://h; }\n"
+        "    }\n"
+        "}\n"
+        "stream {\n"
+        "    upstream s {\n"
+        "        zone s 64k;\n"
+        "        server 127.0.0.1:%d;\n"
+        "        health_check interval=200ms;\n"
+        "    }\n"
+        "    server { listen 127.0.0.1:%d; proxy_pass s; }\n"
+        "}\n",
+        prefix, prefix, prefix, prefix, prefix, prefix, prefix,
+        port + 1, port + 2, port, port + 3, port + 4);
+
+    fclose(f);
+
+    return 0;
+}
+
+
+static int
+ngx_hc_test_wait(const char *prefix, const char *line, int count)
+{
+    int  i;
+
+    for (i = 0; i < 30; i++) {
+        if (ngx_hc_test_count(prefix, line) >= count) {
+            return 1;
+        }
+
+        usleep(100000);
+    }
+
+    return 0;
+}
+
+
+static int
+ngx_hc_test_count(const char *prefix, const char *line)
+{
+    int    n;
+    char   name[256], buf[1024];
+    FILE  *f;
+
+    snprintf(name, sizeof(name), "%s/error.log", prefix);
+
+    f = fopen(name, "r");
+
+    if (f == NULL) {
+        return 0;
+    }
+
+    n = 0;
+
+    while (fgets(buf, sizeof(buf), f)) {
+        if (strstr(buf, line)) {
+            n++;
+        }
+    }
+
+    fclose(f);
+
+    return n;
+}
+
+
+static int
+ngx_hc_test_request(int port, char *reply, size_t len)
+{
+    int                 fd;
+    size_t              n;
+    ssize_t             r;
+    struct sockaddr_in  sin;
+
+    static char  request[] = "GET / HTTP/1.0\r\n\r\n";
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd == -1) {
+        return -1;
+    }
+
+    memset(&sin, 0, sizeof(struct sockaddr_in));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr *) &sin, sizeof(struct sockaddr_in))
+        == -1
+        || send(fd, request, sizeof(request) - 1, 0) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    n = 0;
+
+    while (n < len - 1) {
+        r = recv(fd, reply + n, len - 1 - n, 0);
+
+        if (r <= 0) {
+            break;
+        }
+
+        n += r;
+    }
+
+    reply[n] = '\0';
+
+    close(fd);
+
+    return 0;
+}
+
+
+static int
+ngx_hc_test_balance(int port, int *a, int *b)
+{
+    int   i;
+    char  reply[1024];
+
+    *a = 0;
+    *b = 0;
+
+    for (i = 0; i < 20; i++) {
+        if (ngx_hc_test_request(port, reply, sizeof(reply)) != 0) {
+            return -1;
+        }
+
+        if (strstr(reply, "\r\n\r\nOK a")) {
+            (*a)++;
+
+        } else if (strstr(reply, "\r\n\r\nOK b")) {
+            (*b)++;
+        }
+    }
+
+    return 0;
+}
+
+
+static void
+ngx_hc_test_check(const char *name, int ok)
+{
+    printf("%s: %s\n", name, ok ? "ok" : "FAILED");
+
+    if (!ok) {
+        failed++;
+    }
+}
@@ -655,10 +655,26 @@ ngx_reap_children(ngx_cycle_t *cycle)
 static void
 ngx_master_process_exit(ngx_cycle_t *cycle)
 {
-    ngx_uint_t  i;
+    ngx_uint_t   i;
+    ngx_path_t **path;
 
     ngx_delete_pidfile(cycle);
 
+    /*
+     * all children have exited at this point, so the savers may walk
+     * shared memory without interference; the state is not saved if
+     * a new binary has taken over the shared paths
+     */
+
+    if (ngx_new_binary == 0) {
+        path = cycle->paths.elts;
+        for (i = 0; i < cycle->paths.nelts; i++) {
+            if (path[i]->saver) {
+                path[i]->saver(path[i]->data);
+            }
+        }
+    }
+
     ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "exit");
 
     for (i = 0; cycle->modules[i]; i++) {
@@ -949,6 +965,8 @@ static void
 ngx_worker_process_exit(ngx_cycle_t *cycle)
 {
     ngx_uint_t         i;
+    ngx_list_part_t   *part;
+    ngx_shm_zone_t    *shm_zone;
     ngx_connection_t  *c;
 
     for (i = 0; cycle->modules[i]; i++) {
@@ -957,6 +975,25 @@ ngx_worker_process_exit(ngx_cycle_t *cycle)
         }
     }
 
+    /* return chunks cached by the worker to shared memory zones */
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        ngx_slab_cache_flush((ngx_slab_pool_t *) shm_zone[i].shm.addr);
+    }
+
     if (ngx_exiting) {
         c = cycle->connections;
         for (i = 0; i < cycle->connection_n; i++) {
@@ -1089,6 +1126,35 @@ ngx_channel_handler(ngx_event_t *ev)
 
             ngx_processes[ch.slot].channel[0] = -1;
             break;
+
+        case NGX_CMD_PASS_CONNECTION:
+
+            ngx_log_debug3(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                           "get connection s:%i pid:%P fd:%d",
+                           ch.slot, ch.pid, ch.fd);
+
+            if (ngx_channel_pass_handler) {
+                ngx_channel_pass_handler(&ch);
+                break;
+            }
+
+            if (close(ch.fd) == -1) {
+                ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_errno,
+                              "close() passed connection failed");
+            }
+
+            break;
+
+        case NGX_CMD_NOTIFY:
+
+            ngx_log_debug2(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                           "get notification s:%i pid:%P", ch.slot, ch.pid);
+
+            if (ngx_channel_notify_handler) {
+                ngx_channel_notify_handler(&ch);
+            }
+
+            break;
         }
     }
 }
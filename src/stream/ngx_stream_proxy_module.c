@@ -32,6 +32,7 @@ typedef struct {
     ngx_flag_t                       next_upstream;
     ngx_flag_t                       proxy_protocol;
     ngx_flag_t                       half_close;
+    ngx_flag_t                       splice;
     ngx_stream_upstream_local_t     *local;
     ngx_flag_t                       socket_keepalive;
 
@@ -78,6 +79,13 @@ static void ngx_stream_proxy_process(ngx_stream_session_t *s,
     ngx_uint_t from_upstream, ngx_uint_t do_write);
 static ngx_int_t ngx_stream_proxy_test_finalize(ngx_stream_session_t *s,
     ngx_uint_t from_upstream);
+#if (NGX_HAVE_SPLICE)
+static ngx_stream_upstream_pipe_t *ngx_stream_proxy_splice_pipe(
+    ngx_stream_session_t *s, ngx_uint_t from_upstream);
+static ngx_int_t ngx_stream_proxy_splice(ngx_stream_session_t *s,
+    ngx_uint_t from_upstream, ngx_stream_upstream_pipe_t *p);
+static void ngx_stream_proxy_splice_cleanup(void *data);
+#endif
 static void ngx_stream_proxy_next_upstream(ngx_stream_session_t *s);
 static void ngx_stream_proxy_finalize(ngx_stream_session_t *s, ngx_uint_t rc);
 static u_char *ngx_stream_proxy_log_error(ngx_log_t *log, u_char *buf,
@@ -253,6 +261,13 @@ static ngx_command_t  ngx_stream_proxy_commands[] = {
       offsetof(ngx_stream_proxy_srv_conf_t, half_close),
       NULL },
 
+    { ngx_string("proxy_splice"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_proxy_srv_conf_t, splice),
+      NULL },
+
 #if (NGX_STREAM_SSL)
 
     { ngx_string("proxy_ssl"),
@@ -1595,6 +1610,9 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
     ngx_log_handler_pt            handler;
     ngx_stream_upstream_t        *u;
     ngx_stream_proxy_srv_conf_t  *pscf;
+#if (NGX_HAVE_SPLICE)
+    ngx_stream_upstream_pipe_t   *p;
+#endif
 
     u = s->upstream;
 
@@ -1643,6 +1661,30 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
         send_action = "proxying and sending to upstream";
     }
 
+#if (NGX_HAVE_SPLICE)
+
+    /*
+     * the data are moved through a pipe once everything
+     * read into the buffers has been sent
+     */
+
+    if (pscf->splice && !u->splice_failed && c->type == SOCK_STREAM
+        && src && dst
+        && (u->pipe[from_upstream] || !(*out || *busy || dst->buffered)))
+    {
+        p = ngx_stream_proxy_splice_pipe(s, from_upstream);
+
+        if (p) {
+            if (ngx_stream_proxy_splice(s, from_upstream, p) != NGX_OK) {
+                return;
+            }
+
+            goto done;
+        }
+    }
+
+#endif
+
     for ( ;; ) {
 
         if (do_write && dst) {
@@ -1749,6 +1791,10 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
         break;
     }
 
+#if (NGX_HAVE_SPLICE)
+done:
+#endif
+
     c->log->action = "proxying connection";
 
     if (ngx_stream_proxy_test_finalize(s, from_upstream) == NGX_OK) {
@@ -1884,6 +1930,282 @@ ngx_stream_proxy_test_finalize(ngx_stream_session_t *s,
 }
 
 
+#if (NGX_HAVE_SPLICE)
+
+static ngx_stream_upstream_pipe_t *
+ngx_stream_proxy_splice_pipe(ngx_stream_session_t *s, ngx_uint_t from_upstream)
+{
+    int                           size;
+    ngx_fd_t                      fd[2];
+    ngx_connection_t             *c;
+    ngx_pool_cleanup_t           *cln;
+    ngx_stream_upstream_t        *u;
+    ngx_stream_upstream_pipe_t   *p;
+    ngx_stream_proxy_srv_conf_t  *pscf;
+#if (NGX_SSL)
+    ngx_connection_t             *pc;
+#endif
+
+    u = s->upstream;
+
+    if (u->pipe[from_upstream]) {
+        return u->pipe[from_upstream];
+    }
+
+    c = s->connection;
+
+#if (NGX_SSL)
+    pc = u->peer.connection;
+
+    if (c->ssl || pc->ssl) {
+        u->splice_failed = 1;
+        return NULL;
+    }
+#endif
+
+    if (pipe2(fd, O_NONBLOCK|O_CLOEXEC) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno, "pipe2() failed");
+        u->splice_failed = 1;
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(c->pool, sizeof(ngx_stream_upstream_pipe_t));
+    if (cln == NULL) {
+        (void) close(fd[0]);
+        (void) close(fd[1]);
+        u->splice_failed = 1;
+        return NULL;
+    }
+
+    p = cln->data;
+
+    p->fd[0] = fd[0];
+    p->fd[1] = fd[1];
+    p->size = 0;
+    p->blocked = 0;
+
+    cln->handler = ngx_stream_proxy_splice_cleanup;
+
+    pscf = ngx_stream_get_module_srv_conf(s, ngx_stream_proxy_module);
+
+    /* the pipe holds as much as the buffer would */
+
+    size = fcntl(fd[1], F_SETPIPE_SZ, (int) pscf->buffer_size);
+
+    if (size == -1) {
+        size = fcntl(fd[1], F_GETPIPE_SZ);
+
+        if (size == -1) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno,
+                          "fcntl(F_GETPIPE_SZ) failed");
+            u->splice_failed = 1;
+            return NULL;
+        }
+    }
+
+    p->capacity = size;
+
+    u->pipe[from_upstream] = p;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                   "stream proxy splice %s pipe %d size:%d",
+                   from_upstream ? "downstream" : "upstream", fd[0], size);
+
+    return p;
+}
+
+
+static ngx_int_t
+ngx_stream_proxy_splice(ngx_stream_session_t *s, ngx_uint_t from_upstream,
+    ngx_stream_upstream_pipe_t *p)
+{
+    char                   *recv_action, *send_action;
+    off_t                  *received, limit;
+    size_t                  size, limit_rate;
+    ssize_t                 n;
+    ngx_err_t               err;
+    ngx_uint_t             *packets;
+    ngx_msec_t              delay;
+    ngx_connection_t       *c, *src, *dst;
+    ngx_stream_upstream_t  *u;
+
+    u = s->upstream;
+    c = s->connection;
+
+    if (from_upstream) {
+        src = u->peer.connection;
+        dst = c;
+        limit_rate = u->download_rate;
+        received = &u->received;
+        packets = &u->responses;
+        recv_action = "proxying and reading from upstream";
+        send_action = "proxying and sending to client";
+
+    } else {
+        src = c;
+        dst = u->peer.connection;
+        limit_rate = u->upload_rate;
+        received = &s->received;
+        packets = &u->requests;
+        recv_action = "proxying and reading from client";
+        send_action = "proxying and sending to upstream";
+    }
+
+    for ( ;; ) {
+
+        if (p->size && dst->write->ready && !dst->write->error) {
+
+            c->log->action = send_action;
+
+            n = splice(p->fd[0], NULL, dst->fd, NULL, p->size,
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                           "splice to %d: %z", dst->fd, n);
+
+            if (n == -1) {
+                err = ngx_errno;
+
+                if (err != NGX_EAGAIN) {
+                    dst->write->error = 1;
+                    ngx_connection_error(dst, err, "splice() failed");
+                    ngx_stream_proxy_finalize(s, NGX_STREAM_OK);
+                    return NGX_DONE;
+                }
+
+                dst->write->ready = 0;
+
+            } else {
+                p->size -= n;
+                dst->sent += n;
+
+                if (p->size == 0) {
+                    dst->buffered &= ~NGX_STREAM_WRITE_BUFFERED;
+
+                    /* the read could have stopped on the full pipe */
+
+                    if (p->blocked) {
+                        p->blocked = 0;
+                        src->read->ready = 1;
+                    }
+                }
+
+                continue;
+            }
+        }
+
+        size = p->capacity - p->size;
+
+        if (size && !p->blocked && src->read->ready && !src->read->delayed
+            && !src->read->error && !src->read->eof)
+        {
+            if (limit_rate) {
+                limit = (off_t) limit_rate * (ngx_time() - u->start_sec + 1)
+                        - *received;
+
+                if (limit <= 0) {
+                    src->read->delayed = 1;
+                    delay = (ngx_msec_t) (- limit * 1000 / limit_rate + 1);
+                    ngx_add_timer(src->read, delay);
+                    break;
+                }
+
+                if ((off_t) size > limit) {
+                    size = (size_t) limit;
+                }
+            }
+
+            c->log->action = recv_action;
+
+            n = splice(src->fd, NULL, p->fd[1], NULL, size,
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                           "splice from %d: %z", src->fd, n);
+
+            if (n == -1) {
+                err = ngx_errno;
+
+                if (err == NGX_EAGAIN) {
+
+                    /*
+                     * EAGAIN is also returned on the full pipe,
+                     * the read is retried when the pipe is drained
+                     */
+
+                    if (p->size) {
+                        p->blocked = 1;
+
+                    } else {
+                        src->read->ready = 0;
+                    }
+
+                    break;
+                }
+
+                src->read->error = 1;
+                ngx_connection_error(src, err, "splice() failed");
+                n = 0;
+            }
+
+            if (n == 0) {
+                src->read->ready = 0;
+                src->read->eof = 1;
+            }
+
+            if (limit_rate) {
+                delay = (ngx_msec_t) (n * 1000 / limit_rate);
+
+                if (delay > 0) {
+                    src->read->delayed = 1;
+                    ngx_add_timer(src->read, delay);
+                }
+            }
+
+            if (from_upstream) {
+                if (u->state->first_byte_time == (ngx_msec_t) -1) {
+                    u->state->first_byte_time = ngx_current_msec
+                                                - u->start_time;
+                }
+            }
+
+            if (n) {
+                dst->buffered |= NGX_STREAM_WRITE_BUFFERED;
+            }
+
+            (*packets)++;
+            *received += n;
+            p->size += n;
+
+            continue;
+        }
+
+        break;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_stream_proxy_splice_cleanup(void *data)
+{
+    ngx_stream_upstream_pipe_t  *p = data;
+
+    if (close(p->fd[0]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "close() pipe failed");
+    }
+
+    if (close(p->fd[1]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "close() pipe failed");
+    }
+}
+
+#endif
+
+
 static void
 ngx_stream_proxy_next_upstream(ngx_stream_session_t *s)
 {
@@ -2086,6 +2408,7 @@ ngx_stream_proxy_create_srv_conf(ngx_conf_t *cf)
     conf->local = NGX_CONF_UNSET_PTR;
     conf->socket_keepalive = NGX_CONF_UNSET;
     conf->half_close = NGX_CONF_UNSET;
+    conf->splice = NGX_CONF_UNSET;
 
 #if (NGX_STREAM_SSL)
     conf->ssl_enable = NGX_CONF_UNSET;
@@ -2146,6 +2469,8 @@ ngx_stream_proxy_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_value(conf->half_close, prev->half_close, 0);
 
+    ngx_conf_merge_value(conf->splice, prev->splice, 0);
+
 #if (NGX_STREAM_SSL)
 
     ngx_conf_merge_value(conf->ssl_enable, prev->ssl_enable, 0);
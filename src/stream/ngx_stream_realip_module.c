@@ -11,7 +11,7 @@
 
 
 typedef struct {
-    ngx_array_t       *from;     /* array of ngx_cidr_t */
+    ngx_cidr_tree_t   *from;
 } ngx_stream_realip_srv_conf_t;
 
 
@@ -112,7 +112,7 @@ ngx_stream_realip_handler(ngx_stream_session_t *s)
         return NGX_DECLINED;
     }
 
-    if (ngx_cidr_match(c->sockaddr, rscf->from) != NGX_OK) {
+    if (ngx_cidr_tree_match(c->sockaddr, rscf->from) != NGX_OK) {
         return NGX_DECLINED;
     }
 
@@ -181,7 +181,7 @@ ngx_stream_realip_from(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_int_t             rc;
     ngx_str_t            *value;
     ngx_url_t             u;
-    ngx_cidr_t            c, *cidr;
+    ngx_cidr_t            c;
     ngx_uint_t            i;
     struct sockaddr_in   *sin;
 #if (NGX_HAVE_INET6)
@@ -191,8 +191,7 @@ ngx_stream_realip_from(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     value = cf->args->elts;
 
     if (rscf->from == NULL) {
-        rscf->from = ngx_array_create(cf->pool, 2,
-                                      sizeof(ngx_cidr_t));
+        rscf->from = ngx_cidr_tree_create(cf->pool);
         if (rscf->from == NULL) {
             return NGX_CONF_ERROR;
         }
@@ -201,12 +200,12 @@ ngx_stream_realip_from(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 #if (NGX_HAVE_UNIX_DOMAIN)
 
     if (ngx_strcmp(value[1].data, "unix:") == 0) {
-        cidr = ngx_array_push(rscf->from);
-        if (cidr == NULL) {
+        c.family = AF_UNIX;
+
+        if (ngx_cidr_tree_add(rscf->from, &c) != NGX_OK) {
             return NGX_CONF_ERROR;
         }
 
-        cidr->family = AF_UNIX;
         return NGX_CONF_OK;
     }
 
@@ -221,13 +220,10 @@ ngx_stream_realip_from(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                                &value[1]);
         }
 
-        cidr = ngx_array_push(rscf->from);
-        if (cidr == NULL) {
+        if (ngx_cidr_tree_add(rscf->from, &c) != NGX_OK) {
             return NGX_CONF_ERROR;
         }
 
-        *cidr = c;
-
         return NGX_CONF_OK;
     }
 
@@ -244,32 +240,31 @@ ngx_stream_realip_from(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
-    cidr = ngx_array_push_n(rscf->from, u.naddrs);
-    if (cidr == NULL) {
-        return NGX_CONF_ERROR;
-    }
-
-    ngx_memzero(cidr, u.naddrs * sizeof(ngx_cidr_t));
-
     for (i = 0; i < u.naddrs; i++) {
-        cidr[i].family = u.addrs[i].sockaddr->sa_family;
+        ngx_memzero(&c, sizeof(ngx_cidr_t));
+
+        c.family = u.addrs[i].sockaddr->sa_family;
 
-        switch (cidr[i].family) {
+        switch (c.family) {
 
 #if (NGX_HAVE_INET6)
         case AF_INET6:
             sin6 = (struct sockaddr_in6 *) u.addrs[i].sockaddr;
-            cidr[i].u.in6.addr = sin6->sin6_addr;
-            ngx_memset(cidr[i].u.in6.mask.s6_addr, 0xff, 16);
+            c.u.in6.addr = sin6->sin6_addr;
+            ngx_memset(c.u.in6.mask.s6_addr, 0xff, 16);
             break;
 #endif
 
         default: /* AF_INET */
             sin = (struct sockaddr_in *) u.addrs[i].sockaddr;
-            cidr[i].u.in.addr = sin->sin_addr.s_addr;
-            cidr[i].u.in.mask = 0xffffffff;
+            c.u.in.addr = sin->sin_addr.s_addr;
+            c.u.in.mask = 0xffffffff;
             break;
         }
+
+        if (ngx_cidr_tree_add(rscf->from, &c) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
     }
 
     return NGX_CONF_OK;
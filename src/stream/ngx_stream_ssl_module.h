@@ -18,6 +18,7 @@ typedef struct {
     ngx_msec_t       handshake_timeout;
 
     ngx_flag_t       prefer_server_ciphers;
+    ngx_flag_t       ktls;
 
     ngx_ssl_t        ssl;
 
@@ -53,6 +54,7 @@ typedef struct {
 
     ngx_flag_t       session_tickets;
     ngx_array_t     *session_ticket_keys;
+    ngx_flag_t       session_ticket_rotation;
 
     u_char          *file;
     ngx_uint_t       line;
@@ -21,6 +21,7 @@
 #define NGX_STREAM_UPSTREAM_FAIL_TIMEOUT  0x0008
 #define NGX_STREAM_UPSTREAM_DOWN          0x0010
 #define NGX_STREAM_UPSTREAM_BACKUP        0x0020
+#define NGX_STREAM_UPSTREAM_SLOW_START    0x0040
 #define NGX_STREAM_UPSTREAM_MAX_CONNS     0x0100
 
 
@@ -114,6 +115,18 @@ typedef struct {
 } ngx_stream_upstream_resolved_t;
 
 
+#if (NGX_HAVE_SPLICE)
+
+typedef struct {
+    ngx_fd_t                           fd[2];
+    size_t                             size;
+    size_t                             capacity;
+    unsigned                           blocked:1;
+} ngx_stream_upstream_pipe_t;
+
+#endif
+
+
 typedef struct {
     ngx_peer_connection_t              peer;
 
@@ -140,9 +153,15 @@ typedef struct {
     ngx_stream_upstream_srv_conf_t    *upstream;
     ngx_stream_upstream_resolved_t    *resolved;
     ngx_stream_upstream_state_t       *state;
+
+#if (NGX_HAVE_SPLICE)
+    ngx_stream_upstream_pipe_t        *pipe[2];
+#endif
+
     unsigned                           connected:1;
     unsigned                           proxy_protocol:1;
     unsigned                           half_closed:1;
+    unsigned                           splice_failed:1;
 } ngx_stream_upstream_t;
 
 
@@ -25,6 +25,9 @@ typedef struct {
 typedef struct {
     ngx_stream_complex_value_t            key;
     ngx_stream_upstream_chash_points_t   *points;
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    ngx_uint_t                            config;
+#endif
 } ngx_stream_upstream_hash_srv_conf_t;
 
 
@@ -49,6 +52,8 @@ static ngx_int_t ngx_stream_upstream_get_hash_peer(ngx_peer_connection_t *pc,
 
 static ngx_int_t ngx_stream_upstream_init_chash(ngx_conf_t *cf,
     ngx_stream_upstream_srv_conf_t *us);
+static ngx_int_t ngx_stream_upstream_update_chash(ngx_pool_t *pool,
+    ngx_stream_upstream_srv_conf_t *us);
 static int ngx_libc_cdecl
     ngx_stream_upstream_chash_cmp_points(const void *one, const void *two);
 static ngx_uint_t ngx_stream_upstream_find_chash_point(
@@ -178,7 +183,11 @@ ngx_stream_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_stream_upstream_rr_peers_rlock(hp->rrp.peers);
 
-    if (hp->tries > 20 || hp->rrp.peers->single || hp->key.len == 0) {
+    if (hp->tries > 20
+        || hp->rrp.peers->single
+        || hp->key.len == 0
+        || ngx_stream_upstream_rr_peers_changed(&hp->rrp))
+    {
         ngx_stream_upstream_rr_peers_unlock(hp->rrp.peers);
         return hp->get_rr_peer(pc, &hp->rrp);
     }
@@ -250,6 +259,13 @@ ngx_stream_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
             goto next;
         }
 
+        /* a growing share of keys moves to a peer in slow start */
+
+        if (ngx_stream_upstream_rr_peer_slow(peer, hp->hash)) {
+            ngx_stream_upstream_rr_peer_unlock(hp->rrp.peers, peer);
+            goto next;
+        }
+
         break;
 
     next:
@@ -266,7 +282,7 @@ ngx_stream_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
     pc->socklen = peer->socklen;
     pc->name = &peer->name;
 
-    peer->conns++;
+    ngx_stream_upstream_rr_peer_inc_conns(hp->rrp.peers, peer);
 
     if (now - peer->checked > peer->fail_timeout) {
         peer->checked = now;
@@ -284,6 +300,20 @@ ngx_stream_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
 static ngx_int_t
 ngx_stream_upstream_init_chash(ngx_conf_t *cf,
     ngx_stream_upstream_srv_conf_t *us)
+{
+    if (ngx_stream_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_stream_upstream_init_chash_peer;
+
+    return ngx_stream_upstream_update_chash(cf->pool, us);
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_update_chash(ngx_pool_t *pool,
+    ngx_stream_upstream_srv_conf_t *us)
 {
     u_char                               *host, *port, c;
     size_t                                host_len, port_len, size;
@@ -299,19 +329,13 @@ ngx_stream_upstream_init_chash(ngx_conf_t *cf,
         u_char                            byte[4];
     } prev_hash;
 
-    if (ngx_stream_upstream_init_round_robin(cf, us) != NGX_OK) {
-        return NGX_ERROR;
-    }
-
-    us->peer.init = ngx_stream_upstream_init_chash_peer;
-
     peers = us->peer.data;
     npoints = peers->total_weight * 160;
 
     size = sizeof(ngx_stream_upstream_chash_points_t)
            + sizeof(ngx_stream_upstream_chash_point_t) * (npoints - 1);
 
-    points = ngx_palloc(cf->pool, size);
+    points = pool ? ngx_palloc(pool, size) : ngx_alloc(size, ngx_cycle->log);
     if (points == NULL) {
         return NGX_ERROR;
     }
@@ -403,6 +427,19 @@ ngx_stream_upstream_init_chash(ngx_conf_t *cf,
 
     hcf = ngx_stream_conf_upstream_srv_conf(us,
                                             ngx_stream_upstream_hash_module);
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+    /* points of the configuration are allocated from its pool */
+
+    if (pool == NULL && hcf->config) {
+        ngx_free(hcf->points);
+    }
+
+    hcf->config = peers->config;
+
+#endif
+
     hcf->points = points;
 
     return NGX_OK;
@@ -483,6 +520,15 @@ ngx_stream_upstream_init_chash_peer(ngx_stream_session_t *s,
 
     ngx_stream_upstream_rr_peers_rlock(hp->rrp.peers);
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    if (hp->rrp.peers->shpool && hcf->config != hp->rrp.peers->config) {
+        if (ngx_stream_upstream_update_chash(NULL, us) != NGX_OK) {
+            ngx_stream_upstream_rr_peers_unlock(hp->rrp.peers);
+            return NGX_ERROR;
+        }
+    }
+#endif
+
     hp->hash = ngx_stream_upstream_find_chash_point(hcf->points, hash);
 
     ngx_stream_upstream_rr_peers_unlock(hp->rrp.peers);
@@ -497,6 +543,7 @@ ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
     ngx_stream_upstream_hash_peer_data_t *hp = data;
 
     time_t                                now;
+    uint32_t                              hash;
     intptr_t                              m;
     ngx_str_t                            *server;
     ngx_int_t                             total;
@@ -511,7 +558,11 @@ ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_stream_upstream_rr_peers_wlock(hp->rrp.peers);
 
-    if (hp->tries > 20 || hp->rrp.peers->single || hp->key.len == 0) {
+    if (hp->tries > 20
+        || hp->rrp.peers->single
+        || hp->key.len == 0
+        || ngx_stream_upstream_rr_peers_changed(&hp->rrp))
+    {
         ngx_stream_upstream_rr_peers_unlock(hp->rrp.peers);
         return hp->get_rr_peer(pc, &hp->rrp);
     }
@@ -526,6 +577,7 @@ ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
 
     for ( ;; ) {
         server = point[hp->hash % points->number].server;
+        hash = point[hp->hash % points->number].hash;
 
         ngx_log_debug2(NGX_LOG_DEBUG_STREAM, pc->log, 0,
                        "consistent hash peer:%uD, server:\"%V\"",
@@ -568,6 +620,10 @@ ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
                 continue;
             }
 
+            if (ngx_stream_upstream_rr_peer_slow(peer, hash)) {
+                continue;
+            }
+
             peer->current_weight += peer->effective_weight;
             total += peer->effective_weight;
 
@@ -630,6 +686,10 @@ ngx_stream_upstream_hash_create_conf(ngx_conf_t *cf)
 
     conf->points = NULL;
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    conf->config = 0;
+#endif
+
     return conf;
 }
 
@@ -667,7 +727,8 @@ ngx_stream_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                   |NGX_STREAM_UPSTREAM_MAX_CONNS
                   |NGX_STREAM_UPSTREAM_MAX_FAILS
                   |NGX_STREAM_UPSTREAM_FAIL_TIMEOUT
-                  |NGX_STREAM_UPSTREAM_DOWN;
+                  |NGX_STREAM_UPSTREAM_DOWN
+                  |NGX_STREAM_UPSTREAM_SLOW_START;
 
     if (cf->args->nelts == 2) {
         uscf->peer.init_upstream = ngx_stream_upstream_init_hash;
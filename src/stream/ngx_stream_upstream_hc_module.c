@@ -0,0 +1,759 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_stream.h>
+
+
+typedef struct {
+    ngx_uint_t                            enable;
+    ngx_msec_t                            interval;
+    ngx_msec_t                            timeout;
+    ngx_uint_t                            fails;
+    ngx_uint_t                            passes;
+#if (NGX_STREAM_SSL)
+    ngx_ssl_t                            *ssl;
+#endif
+} ngx_stream_upstream_hc_srv_conf_t;
+
+
+typedef struct {
+    ngx_stream_upstream_hc_srv_conf_t    *conf;
+    ngx_stream_upstream_srv_conf_t       *upstream;
+    ngx_uint_t                            pending;
+    ngx_event_t                           event;
+    ngx_log_t                            *log;
+} ngx_stream_upstream_hc_t;
+
+
+typedef struct {
+    ngx_peer_connection_t                 pc;
+    ngx_stream_upstream_hc_t             *hc;
+    ngx_uint_t                            id;
+    ngx_log_t                             log;
+    ngx_pool_t                           *pool;
+} ngx_stream_upstream_hc_probe_t;
+
+
+static void ngx_stream_upstream_hc_handler(ngx_event_t *ev);
+static void ngx_stream_upstream_hc_start(ngx_stream_upstream_hc_t *hc,
+    ngx_stream_upstream_rr_peer_t *peer);
+static void ngx_stream_upstream_hc_connect_handler(ngx_event_t *ev);
+static void ngx_stream_upstream_hc_connected(
+    ngx_stream_upstream_hc_probe_t *pr);
+static ngx_int_t ngx_stream_upstream_hc_test_connect(ngx_connection_t *c);
+#if (NGX_STREAM_SSL)
+static void ngx_stream_upstream_hc_ssl_handshake(ngx_connection_t *c);
+#endif
+static void ngx_stream_upstream_hc_done(ngx_stream_upstream_hc_probe_t *pr,
+    ngx_uint_t healthy);
+static void ngx_stream_upstream_hc_update(ngx_stream_upstream_hc_t *hc,
+    ngx_uint_t id, ngx_uint_t healthy);
+
+static u_char *ngx_stream_upstream_hc_log_error(ngx_log_t *log, u_char *buf,
+    size_t len);
+
+static ngx_int_t ngx_stream_upstream_hc_init(ngx_conf_t *cf);
+static void *ngx_stream_upstream_hc_create_conf(ngx_conf_t *cf);
+static char *ngx_stream_upstream_hc(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#if (NGX_STREAM_SSL)
+static ngx_int_t ngx_stream_upstream_hc_set_ssl(ngx_conf_t *cf,
+    ngx_stream_upstream_hc_srv_conf_t *hcf);
+#endif
+static ngx_int_t ngx_stream_upstream_hc_init_process(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_stream_upstream_hc_commands[] = {
+
+    { ngx_string("health_check"),
+      NGX_STREAM_UPS_CONF|NGX_CONF_ANY,
+      ngx_stream_upstream_hc,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_stream_module_t  ngx_stream_upstream_hc_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_stream_upstream_hc_init,           /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_stream_upstream_hc_create_conf,    /* create server configuration */
+    NULL                                   /* merge server configuration */
+};
+
+
+ngx_module_t  ngx_stream_upstream_hc_module = {
+    NGX_MODULE_V1,
+    &ngx_stream_upstream_hc_module_ctx,    /* module context */
+    ngx_stream_upstream_hc_commands,       /* module directives */
+    NGX_STREAM_MODULE,                     /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_stream_upstream_hc_init_process,   /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static void
+ngx_stream_upstream_hc_handler(ngx_event_t *ev)
+{
+    ngx_stream_upstream_hc_t        *hc;
+    ngx_stream_upstream_rr_peer_t   *peer;
+    ngx_stream_upstream_rr_peers_t  *peers, *list;
+
+    hc = ev->data;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    /* a new round starts only after all probes of the previous one */
+
+    if (hc->pending == 0) {
+
+        ngx_log_debug1(NGX_LOG_DEBUG_STREAM, ev->log, 0,
+                       "stream upstream health check \"%V\"",
+                       &hc->upstream->host);
+
+        peers = hc->upstream->peer.data;
+
+        ngx_stream_upstream_rr_peers_rlock(peers);
+
+        for (list = peers; list; list = list->next) {
+
+            for (peer = list->peer; peer; peer = peer->next) {
+
+                if (peer->down & ~NGX_STREAM_UPSTREAM_RR_UNHEALTHY) {
+                    continue;
+                }
+
+                ngx_stream_upstream_hc_start(hc, peer);
+            }
+        }
+
+        ngx_stream_upstream_rr_peers_unlock(peers);
+    }
+
+    ngx_add_timer(ev, hc->conf->interval);
+}
+
+
+static void
+ngx_stream_upstream_hc_start(ngx_stream_upstream_hc_t *hc,
+    ngx_stream_upstream_rr_peer_t *peer)
+{
+    ngx_int_t                        rc;
+    ngx_pool_t                      *pool;
+    ngx_connection_t                *c;
+    ngx_stream_upstream_hc_probe_t  *pr;
+
+    pool = ngx_create_pool(512, hc->log);
+    if (pool == NULL) {
+        return;
+    }
+
+    pr = ngx_pcalloc(pool, sizeof(ngx_stream_upstream_hc_probe_t));
+    if (pr == NULL) {
+        goto failed;
+    }
+
+    pr->hc = hc;
+    pr->id = peer->id;
+    pr->pool = pool;
+
+    pr->pc.sockaddr = ngx_palloc(pool, peer->socklen);
+    if (pr->pc.sockaddr == NULL) {
+        goto failed;
+    }
+
+    ngx_memcpy(pr->pc.sockaddr, peer->sockaddr, peer->socklen);
+    pr->pc.socklen = peer->socklen;
+
+    pr->pc.name = ngx_palloc(pool, sizeof(ngx_str_t) + peer->name.len);
+    if (pr->pc.name == NULL) {
+        goto failed;
+    }
+
+    pr->pc.name->len = peer->name.len;
+    pr->pc.name->data = (u_char *) pr->pc.name + sizeof(ngx_str_t);
+    ngx_memcpy(pr->pc.name->data, peer->name.data, peer->name.len);
+
+    pr->log = *hc->log;
+    pr->log.handler = ngx_stream_upstream_hc_log_error;
+    pr->log.data = pr;
+    pr->log.action = "health checking";
+
+    pr->pc.get = ngx_event_get_peer;
+    pr->pc.log = &pr->log;
+    pr->pc.log_error = NGX_ERROR_INFO;
+
+    hc->pending++;
+
+    rc = ngx_event_connect_peer(&pr->pc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_stream_upstream_hc_done(pr, 0);
+        return;
+    }
+
+    /* rc == NGX_OK || rc == NGX_AGAIN || rc == NGX_DONE */
+
+    c = pr->pc.connection;
+
+    c->data = pr;
+    c->pool = pool;
+
+    c->read->handler = ngx_stream_upstream_hc_connect_handler;
+    c->write->handler = ngx_stream_upstream_hc_connect_handler;
+
+    /* the whole probe, including TLS handshake, is limited by one timer */
+
+    ngx_add_timer(c->write, hc->conf->timeout);
+
+    if (rc == NGX_OK) {
+        ngx_stream_upstream_hc_connected(pr);
+    }
+
+    return;
+
+failed:
+
+    ngx_destroy_pool(pool);
+}
+
+
+static void
+ngx_stream_upstream_hc_connect_handler(ngx_event_t *ev)
+{
+    ngx_connection_t                *c;
+    ngx_stream_upstream_hc_probe_t  *pr;
+
+    c = ev->data;
+    pr = c->data;
+
+    if (ev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT,
+                      "health check timed out");
+        ngx_stream_upstream_hc_done(pr, 0);
+        return;
+    }
+
+    if (ngx_stream_upstream_hc_test_connect(c) != NGX_OK) {
+        ngx_stream_upstream_hc_done(pr, 0);
+        return;
+    }
+
+    ngx_stream_upstream_hc_connected(pr);
+}
+
+
+static void
+ngx_stream_upstream_hc_connected(ngx_stream_upstream_hc_probe_t *pr)
+{
+#if (NGX_STREAM_SSL)
+
+    ngx_int_t          rc;
+    ngx_connection_t  *c;
+
+    if (pr->hc->conf->ssl) {
+        c = pr->pc.connection;
+
+        if (ngx_ssl_create_connection(pr->hc->conf->ssl, c,
+                                      NGX_SSL_BUFFER|NGX_SSL_CLIENT)
+            != NGX_OK)
+        {
+            ngx_stream_upstream_hc_done(pr, 0);
+            return;
+        }
+
+        rc = ngx_ssl_handshake(c);
+
+        if (rc == NGX_AGAIN) {
+            c->ssl->handler = ngx_stream_upstream_hc_ssl_handshake;
+            return;
+        }
+
+        ngx_stream_upstream_hc_ssl_handshake(c);
+        return;
+    }
+
+#endif
+
+    ngx_stream_upstream_hc_done(pr, 1);
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_hc_test_connect(ngx_connection_t *c)
+{
+    int        err;
+    socklen_t  len;
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
+        err = c->write->kq_errno ? c->write->kq_errno : c->read->kq_errno;
+
+        if (err) {
+            (void) ngx_connection_error(c, err,
+                                    "kevent() reported that connect() failed");
+            return NGX_ERROR;
+        }
+
+    } else
+#endif
+    {
+        err = 0;
+        len = sizeof(int);
+
+        /*
+         * BSDs and Linux return 0 and set a pending error in err
+         * Solaris returns -1 and sets errno
+         */
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_socket_errno;
+        }
+
+        if (err) {
+            (void) ngx_connection_error(c, err, "connect() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+#if (NGX_STREAM_SSL)
+
+static void
+ngx_stream_upstream_hc_ssl_handshake(ngx_connection_t *c)
+{
+    ngx_stream_upstream_hc_probe_t  *pr;
+
+    pr = c->data;
+
+    if (!c->ssl->handshaked) {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "health check SSL handshake failed");
+    }
+
+    ngx_stream_upstream_hc_done(pr, c->ssl->handshaked);
+}
+
+#endif
+
+
+static void
+ngx_stream_upstream_hc_done(ngx_stream_upstream_hc_probe_t *pr,
+    ngx_uint_t healthy)
+{
+    ngx_connection_t          *c;
+    ngx_stream_upstream_hc_t  *hc;
+
+    hc = pr->hc;
+    c = pr->pc.connection;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_STREAM, hc->log, 0,
+                   "stream upstream health check of %V: %ui",
+                   pr->pc.name, healthy);
+
+    if (c) {
+#if (NGX_STREAM_SSL)
+        if (c->ssl) {
+            c->ssl->no_wait_shutdown = 1;
+            (void) ngx_ssl_shutdown(c);
+        }
+#endif
+
+        ngx_close_connection(c);
+    }
+
+    ngx_stream_upstream_hc_update(hc, pr->id, healthy);
+
+    hc->pending--;
+
+    ngx_destroy_pool(pr->pool);
+}
+
+
+static void
+ngx_stream_upstream_hc_update(ngx_stream_upstream_hc_t *hc, ngx_uint_t id,
+    ngx_uint_t healthy)
+{
+    ngx_stream_upstream_rr_peer_t   *peer;
+    ngx_stream_upstream_rr_peers_t  *peers, *list;
+
+    peers = hc->upstream->peer.data;
+
+    ngx_stream_upstream_rr_peers_rlock(peers);
+
+    for (list = peers; list; list = list->next) {
+        for (peer = list->peer; peer; peer = peer->next) {
+            if (peer->id == id) {
+                goto found;
+            }
+        }
+    }
+
+    /* the peer was removed at run time */
+
+    ngx_stream_upstream_rr_peers_unlock(peers);
+
+    return;
+
+found:
+
+    ngx_stream_upstream_rr_peer_lock(list, peer);
+
+    if (healthy) {
+        peer->check_fails = 0;
+
+        if ((peer->down & NGX_STREAM_UPSTREAM_RR_UNHEALTHY)
+            && ++peer->check_passes >= hc->conf->passes)
+        {
+            peer->down &= ~NGX_STREAM_UPSTREAM_RR_UNHEALTHY;
+            peer->check_passes = 0;
+            peer->fails = 0;
+
+            if (peer->slow_start) {
+                peer->start_time = ngx_current_msec;
+            }
+
+            ngx_log_error(NGX_LOG_NOTICE, hc->log, 0,
+                          "upstream server %V in upstream \"%V\" "
+                          "is healthy", &peer->name, &hc->upstream->host);
+        }
+
+    } else {
+        peer->check_passes = 0;
+
+        if (!(peer->down & NGX_STREAM_UPSTREAM_RR_UNHEALTHY)
+            && ++peer->check_fails >= hc->conf->fails)
+        {
+            peer->down |= NGX_STREAM_UPSTREAM_RR_UNHEALTHY;
+            peer->check_fails = 0;
+
+            ngx_log_error(NGX_LOG_WARN, hc->log, 0,
+                          "upstream server %V in upstream \"%V\" "
+                          "is unhealthy", &peer->name, &hc->upstream->host);
+        }
+    }
+
+    ngx_stream_upstream_rr_peer_unlock(list, peer);
+    ngx_stream_upstream_rr_peers_unlock(peers);
+}
+
+
+static u_char *
+ngx_stream_upstream_hc_log_error(ngx_log_t *log, u_char *buf, size_t len)
+{
+    u_char                          *p;
+    ngx_stream_upstream_hc_probe_t  *pr;
+
+    p = buf;
+
+    if (log->action) {
+        p = ngx_snprintf(buf, len, " while %s", log->action);
+        len -= p - buf;
+        buf = p;
+    }
+
+    pr = log->data;
+
+    return ngx_snprintf(buf, len, ", upstream: \"%V\", peer: %V",
+                        &pr->hc->upstream->host, pr->pc.name);
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_hc_init(ngx_conf_t *cf)
+{
+    ngx_uint_t                           i;
+    ngx_stream_upstream_srv_conf_t     **uscfp;
+    ngx_stream_upstream_main_conf_t     *umcf;
+    ngx_stream_upstream_hc_srv_conf_t   *hcf;
+
+    umcf = ngx_stream_conf_get_module_main_conf(cf,
+                                                ngx_stream_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        hcf = ngx_stream_conf_upstream_srv_conf(uscfp[i],
+                                                ngx_stream_upstream_hc_module);
+
+        if (hcf->enable && uscfp[i]->shm_zone == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "health check requires \"zone\" "
+                          "in upstream \"%V\" in %s:%ui",
+                          &uscfp[i]->host, uscfp[i]->file_name,
+                          uscfp[i]->line);
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_stream_upstream_hc_create_conf(ngx_conf_t *cf)
+{
+    ngx_stream_upstream_hc_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_stream_upstream_hc_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->enable = 0;
+     *     conf->ssl = NULL;
+     */
+
+    conf->interval = 5000;
+    conf->timeout = 1000;
+    conf->fails = 1;
+    conf->passes = 1;
+
+    return conf;
+}
+
+
+static char *
+ngx_stream_upstream_hc(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_stream_upstream_hc_srv_conf_t  *hcf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value, s;
+    ngx_uint_t  i;
+
+    if (hcf->enable) {
+        return "is duplicate";
+    }
+
+    hcf->enable = 1;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = &value[i].data[9];
+
+            hcf->interval = ngx_parse_time(&s, 0);
+
+            if (hcf->interval == (ngx_msec_t) NGX_ERROR
+                || hcf->interval == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = &value[i].data[8];
+
+            hcf->timeout = ngx_parse_time(&s, 0);
+
+            if (hcf->timeout == (ngx_msec_t) NGX_ERROR
+                || hcf->timeout == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fails=", 6) == 0) {
+
+            n = ngx_atoi(&value[i].data[6], value[i].len - 6);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->fails = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "passes=", 7) == 0) {
+
+            n = ngx_atoi(&value[i].data[7], value[i].len - 7);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->passes = n;
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "ssl") == 0) {
+
+#if (NGX_STREAM_SSL)
+            if (ngx_stream_upstream_hc_set_ssl(cf, hcf) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "the \"ssl\" parameter requires "
+                               "ngx_stream_ssl_module");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        goto invalid;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+#if (NGX_STREAM_SSL)
+
+static ngx_int_t
+ngx_stream_upstream_hc_set_ssl(ngx_conf_t *cf,
+    ngx_stream_upstream_hc_srv_conf_t *hcf)
+{
+    ngx_pool_cleanup_t  *cln;
+
+    hcf->ssl = ngx_pcalloc(cf->pool, sizeof(ngx_ssl_t));
+    if (hcf->ssl == NULL) {
+        return NGX_ERROR;
+    }
+
+    hcf->ssl->log = cf->log;
+
+    if (ngx_ssl_create(hcf->ssl, NGX_SSL_TLSv1|NGX_SSL_TLSv1_1
+                                 |NGX_SSL_TLSv1_2|NGX_SSL_TLSv1_3, NULL)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        ngx_ssl_cleanup_ctx(hcf->ssl);
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_ssl_cleanup_ctx;
+    cln->data = hcf->ssl;
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_stream_upstream_hc_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                           i, n;
+    ngx_core_conf_t                     *ccf;
+    ngx_stream_upstream_hc_t            *hc;
+    ngx_stream_upstream_srv_conf_t     **uscfp, *uscf;
+    ngx_stream_upstream_main_conf_t     *umcf;
+    ngx_stream_upstream_hc_srv_conf_t   *hcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_stream_cycle_get_module_main_conf(cycle,
+                                                 ngx_stream_upstream_module);
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    uscfp = umcf->upstreams.elts;
+    n = 0;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        if (uscf->srv_conf == NULL) {
+            continue;
+        }
+
+        hcf = ngx_stream_conf_upstream_srv_conf(uscf,
+                                                ngx_stream_upstream_hc_module);
+        if (!hcf->enable) {
+            continue;
+        }
+
+        /* each upstream is checked by one worker process only */
+
+        if (ngx_process == NGX_PROCESS_WORKER
+            && n++ % ccf->worker_processes != ngx_worker)
+        {
+            continue;
+        }
+
+        hc = ngx_pcalloc(cycle->pool, sizeof(ngx_stream_upstream_hc_t));
+        if (hc == NULL) {
+            return NGX_ERROR;
+        }
+
+        hc->conf = hcf;
+        hc->upstream = uscf;
+        hc->log = cycle->log;
+
+        hc->event.handler = ngx_stream_upstream_hc_handler;
+        hc->event.data = hc;
+        hc->event.log = cycle->log;
+        hc->event.cancelable = 1;
+
+        ngx_add_timer(&hc->event, ngx_random() % 1000);
+    }
+
+    return NGX_OK;
+}
@@ -14,11 +14,59 @@
                                       + ((p)->next ? (p)->next->tries : 0))
 
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+/*
+ * shared peers with per-worker weights are selected under the read lock,
+ * connections are counted with atomic operations; per-worker weights follow
+ * weights changed at run time, but peers added at run time have none, and
+ * their list is then selected under the write lock
+ */
+
+#define ngx_stream_upstream_rr_peers_shared(p)                                \
+    ((p)->shpool && (p)->peer->local)
+
+#define ngx_stream_upstream_rr_peers_select_lock(p)                           \
+                                                                              \
+    if (ngx_stream_upstream_rr_peers_shared(p)) {                             \
+        ngx_rwlock_rlock(&(p)->rwlock);                                       \
+                                                                              \
+        if (!ngx_stream_upstream_rr_peers_shared(p)) {                        \
+            ngx_rwlock_unlock(&(p)->rwlock);                                  \
+            ngx_rwlock_wlock(&(p)->rwlock);                                   \
+        }                                                                     \
+                                                                              \
+    } else {                                                                  \
+        ngx_stream_upstream_rr_peers_wlock(p);                                \
+    }
+
+#else
+
+#define ngx_stream_upstream_rr_peers_shared(p)       0
+#define ngx_stream_upstream_rr_peers_select_lock(p)
+
+#endif
+
+
 static ngx_stream_upstream_rr_peer_t *ngx_stream_upstream_get_peer(
     ngx_stream_upstream_rr_peer_data_t *rrp);
+static void ngx_stream_upstream_release_peer(
+    ngx_stream_upstream_rr_peers_t *peers, ngx_stream_upstream_rr_peer_t *peer);
+static ngx_int_t ngx_stream_upstream_take_peer(
+    ngx_stream_upstream_rr_peers_t *peers,
+    ngx_stream_upstream_rr_peer_t *peer);
 static void ngx_stream_upstream_notify_round_robin_peer(
     ngx_peer_connection_t *pc, void *data, ngx_uint_t state);
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+static ngx_stream_upstream_rr_peer_t *ngx_stream_upstream_get_shared_peer(
+    ngx_stream_upstream_rr_peer_data_t *rrp);
+static void ngx_stream_upstream_free_shared_peer(ngx_peer_connection_t *pc,
+    ngx_stream_upstream_rr_peer_data_t *rrp, ngx_uint_t state);
+static void ngx_stream_upstream_release_shared_peer(
+    ngx_stream_upstream_rr_peers_t *peers, ngx_stream_upstream_rr_peer_t *peer);
+#endif
+
 #if (NGX_STREAM_SSL)
 
 static ngx_int_t ngx_stream_upstream_set_round_robin_peer_session(
@@ -107,6 +155,7 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
                 peer[n].max_conns = server[i].max_conns;
                 peer[n].max_fails = server[i].max_fails;
                 peer[n].fail_timeout = server[i].fail_timeout;
+                peer[n].slow_start = server[i].slow_start;
                 peer[n].down = server[i].down;
                 peer[n].server = server[i].name;
 
@@ -177,6 +226,7 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
                 peer[n].max_conns = server[i].max_conns;
                 peer[n].max_fails = server[i].max_fails;
                 peer[n].fail_timeout = server[i].fail_timeout;
+                peer[n].slow_start = server[i].slow_start;
                 peer[n].down = server[i].down;
                 peer[n].server = server[i].name;
 
@@ -280,7 +330,14 @@ ngx_stream_upstream_init_round_robin_peer(ngx_stream_session_t *s,
 
     rrp->peers = us->peer.data;
     rrp->current = NULL;
+
+    ngx_stream_upstream_rr_peers_rlock(rrp->peers);
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    rrp->config = rrp->peers->config;
+#else
     rrp->config = 0;
+#endif
 
     n = rrp->peers->number;
 
@@ -288,6 +345,10 @@ ngx_stream_upstream_init_round_robin_peer(ngx_stream_session_t *s,
         n = rrp->peers->next->number;
     }
 
+    s->upstream->peer.tries = ngx_stream_upstream_tries(rrp->peers);
+
+    ngx_stream_upstream_rr_peers_unlock(rrp->peers);
+
     if (n <= 8 * sizeof(uintptr_t)) {
         rrp->tried = &rrp->data;
         rrp->data = 0;
@@ -304,7 +365,6 @@ ngx_stream_upstream_init_round_robin_peer(ngx_stream_session_t *s,
     s->upstream->peer.get = ngx_stream_upstream_get_round_robin_peer;
     s->upstream->peer.free = ngx_stream_upstream_free_round_robin_peer;
     s->upstream->peer.notify = ngx_stream_upstream_notify_round_robin_peer;
-    s->upstream->peer.tries = ngx_stream_upstream_tries(rrp->peers);
 #if (NGX_STREAM_SSL)
     s->upstream->peer.set_session =
                              ngx_stream_upstream_set_round_robin_peer_session;
@@ -453,7 +513,11 @@ ngx_stream_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     pc->connection = NULL;
 
     peers = rrp->peers;
-    ngx_stream_upstream_rr_peers_wlock(peers);
+    ngx_stream_upstream_rr_peers_select_lock(peers);
+
+    if (ngx_stream_upstream_rr_peers_changed(rrp)) {
+        goto busy;
+    }
 
     if (peers->single) {
         peer = peers->peer;
@@ -462,7 +526,7 @@ ngx_stream_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
             goto failed;
         }
 
-        if (peer->max_conns && peer->conns >= peer->max_conns) {
+        if (ngx_stream_upstream_take_peer(peers, peer) != NGX_OK) {
             goto failed;
         }
 
@@ -487,8 +551,6 @@ ngx_stream_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     pc->socklen = peer->socklen;
     pc->name = &peer->name;
 
-    peer->conns++;
-
     ngx_stream_upstream_rr_peers_unlock(peers);
 
     return NGX_OK;
@@ -516,9 +578,11 @@ failed:
             return rc;
         }
 
-        ngx_stream_upstream_rr_peers_wlock(peers);
+        ngx_stream_upstream_rr_peers_select_lock(peers);
     }
 
+busy:
+
     ngx_stream_upstream_rr_peers_unlock(peers);
 
     pc->name = peers->name;
@@ -533,18 +597,30 @@ ngx_stream_upstream_get_peer(ngx_stream_upstream_rr_peer_data_t *rrp)
     time_t                          now;
     uintptr_t                       m;
     ngx_int_t                       total;
-    ngx_uint_t                      i, n, p;
+    ngx_uint_t                      i, n, p, r, ramp, held;
     ngx_stream_upstream_rr_peer_t  *peer, *best;
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    if (ngx_stream_upstream_rr_peers_shared(rrp->peers)) {
+        return ngx_stream_upstream_get_shared_peer(rrp);
+    }
+#endif
+
     now = ngx_time();
 
-    best = NULL;
-    total = 0;
+    r = ngx_random();
+    ramp = 1;
 
 #if (NGX_SUPPRESS_WARN)
     p = 0;
 #endif
 
+again:
+
+    best = NULL;
+    total = 0;
+    held = 0;
+
     for (peer = rrp->peers->peer, i = 0;
          peer;
          peer = peer->next, i++)
@@ -571,6 +647,11 @@ ngx_stream_upstream_get_peer(ngx_stream_upstream_rr_peer_data_t *rrp)
             continue;
         }
 
+        if (ramp && ngx_stream_upstream_rr_peer_slow(peer, r)) {
+            held = 1;
+            continue;
+        }
+
         peer->current_weight += peer->effective_weight;
         total += peer->effective_weight;
 
@@ -585,6 +666,13 @@ ngx_stream_upstream_get_peer(ngx_stream_upstream_rr_peer_data_t *rrp)
     }
 
     if (best == NULL) {
+
+        if (held) {
+            /* all available peers are in slow start */
+            ramp = 0;
+            goto again;
+        }
+
         return NULL;
     }
 
@@ -601,10 +689,190 @@ ngx_stream_upstream_get_peer(ngx_stream_upstream_rr_peer_data_t *rrp)
         best->checked = now;
     }
 
+    best->conns++;
+
     return best;
 }
 
 
+static ngx_int_t
+ngx_stream_upstream_take_peer(ngx_stream_upstream_rr_peers_t *peers,
+    ngx_stream_upstream_rr_peer_t *peer)
+{
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    ngx_atomic_uint_t  conns;
+
+    if (peers->shpool) {
+
+        if (peer->max_conns == 0) {
+            (void) ngx_atomic_fetch_add((ngx_atomic_t *) &peer->conns, 1);
+            return NGX_OK;
+        }
+
+        do {
+            conns = peer->conns;
+
+            if (conns >= peer->max_conns) {
+                return NGX_BUSY;
+            }
+
+        } while (!ngx_atomic_cmp_set((ngx_atomic_t *) &peer->conns,
+                                     conns, conns + 1));
+
+        return NGX_OK;
+    }
+#endif
+
+    if (peer->max_conns && peer->conns >= peer->max_conns) {
+        return NGX_BUSY;
+    }
+
+    peer->conns++;
+
+    return NGX_OK;
+}
+
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+static ngx_stream_upstream_rr_peer_t *
+ngx_stream_upstream_get_shared_peer(ngx_stream_upstream_rr_peer_data_t *rrp)
+{
+    time_t                           now;
+    uintptr_t                        m;
+    ngx_int_t                        total;
+    ngx_uint_t                       i, n, p, r, ramp, held;
+    ngx_stream_upstream_rr_peer_t   *peer, *best;
+    ngx_stream_upstream_rr_peers_t  *peers;
+
+    /*
+     * smooth weighted round robin runs over the weights of this worker
+     * process, so the shared peers are only read here, except for
+     * the connections counter and the rare check of a failed peer
+     */
+
+    peers = rrp->peers;
+    now = ngx_time();
+
+    r = ngx_random();
+    ramp = 1;
+
+#if (NGX_SUPPRESS_WARN)
+    p = 0;
+#endif
+
+again:
+
+    best = NULL;
+    total = 0;
+    held = 0;
+
+    for (peer = peers->peer, i = 0;
+         peer;
+         peer = peer->next, i++)
+    {
+        n = i / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+        if (rrp->tried[n] & m) {
+            continue;
+        }
+
+        if (peer->down) {
+            continue;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            continue;
+        }
+
+        if (peer->max_conns && peer->conns >= peer->max_conns) {
+            continue;
+        }
+
+        if (ramp && ngx_stream_upstream_rr_peer_slow(peer, r)) {
+            held = 1;
+            continue;
+        }
+
+        if (peer->local->weight != peer->weight) {
+
+            /* the weight was changed at run time */
+
+            peer->local->weight = peer->weight;
+            peer->local->effective_weight = peer->weight;
+            peer->local->current_weight = 0;
+        }
+
+        peer->local->current_weight += peer->local->effective_weight;
+        total += peer->local->effective_weight;
+
+        if (peer->local->effective_weight < peer->weight) {
+            peer->local->effective_weight++;
+        }
+
+        if (best == NULL
+            || peer->local->current_weight > best->local->current_weight)
+        {
+            best = peer;
+            p = i;
+        }
+    }
+
+    if (best == NULL) {
+
+        if (held) {
+            ramp = 0;
+            goto again;
+        }
+
+        return NULL;
+    }
+
+    n = p / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+    rrp->tried[n] |= m;
+
+    best->local->current_weight -= total;
+
+    if (ngx_stream_upstream_take_peer(peers, best) != NGX_OK) {
+        goto again;
+    }
+
+    if (now - best->checked > best->fail_timeout) {
+
+        /* only one worker process may start checking a failed peer */
+
+        ngx_stream_upstream_rr_peer_lock(peers, best);
+
+        if (best->max_fails
+            && best->fails >= best->max_fails
+            && now - best->checked <= best->fail_timeout)
+        {
+            ngx_stream_upstream_rr_peer_unlock(peers, best);
+
+            (void) ngx_atomic_fetch_add((ngx_atomic_t *) &best->conns, -1);
+
+            goto again;
+        }
+
+        best->checked = now;
+
+        ngx_stream_upstream_rr_peer_unlock(peers, best);
+    }
+
+    rrp->current = best;
+
+    return best;
+}
+
+#endif
+
+
 void
 ngx_stream_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
     ngx_uint_t state)
@@ -620,12 +888,18 @@ ngx_stream_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
     peer = rrp->current;
 
     ngx_stream_upstream_rr_peers_rlock(rrp->peers);
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    if (ngx_stream_upstream_rr_peers_shared(rrp->peers)) {
+        ngx_stream_upstream_free_shared_peer(pc, rrp, state);
+        return;
+    }
+#endif
+
     ngx_stream_upstream_rr_peer_lock(rrp->peers, peer);
 
     if (rrp->peers->single) {
-        peer->conns--;
-
-        ngx_stream_upstream_rr_peer_unlock(rrp->peers, peer);
+        ngx_stream_upstream_release_peer(rrp->peers, peer);
         ngx_stream_upstream_rr_peers_unlock(rrp->peers);
 
         pc->tries = 0;
@@ -661,14 +935,133 @@ ngx_stream_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
         /* mark peer live if check passed */
 
         if (peer->accessed < peer->checked) {
+
+            if (peer->slow_start
+                && peer->max_fails
+                && peer->fails >= peer->max_fails)
+            {
+                peer->start_time = ngx_current_msec;
+            }
+
             peer->fails = 0;
         }
     }
 
+    ngx_stream_upstream_release_peer(rrp->peers, peer);
+    ngx_stream_upstream_rr_peers_unlock(rrp->peers);
+
+    if (pc->tries) {
+        pc->tries--;
+    }
+}
+
+
+static void
+ngx_stream_upstream_release_peer(ngx_stream_upstream_rr_peers_t *peers,
+    ngx_stream_upstream_rr_peer_t *peer)
+{
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    ngx_uint_t  zombie;
+#endif
+
     peer->conns--;
 
-    ngx_stream_upstream_rr_peer_unlock(rrp->peers, peer);
-    ngx_stream_upstream_rr_peers_unlock(rrp->peers);
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    zombie = (peer->zombie && peer->conns == 0);
+#endif
+
+    ngx_stream_upstream_rr_peer_unlock(peers, peer);
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+    /* the peer was removed at run time, and this was its last connection */
+
+    if (zombie) {
+        ngx_shmtx_lock(&peers->shpool->mutex);
+        ngx_stream_upstream_zone_free_peer(peers, peer);
+        ngx_shmtx_unlock(&peers->shpool->mutex);
+    }
+
+#endif
+}
+
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+static void
+ngx_stream_upstream_free_shared_peer(ngx_peer_connection_t *pc,
+    ngx_stream_upstream_rr_peer_data_t *rrp, ngx_uint_t state)
+{
+    time_t                           now;
+    ngx_stream_upstream_rr_peer_t   *peer;
+    ngx_stream_upstream_rr_peers_t  *peers;
+
+    peer = rrp->current;
+    peers = rrp->peers;
+
+    /* the read lock is held by the caller */
+
+    if (peers->single) {
+        ngx_stream_upstream_release_shared_peer(peers, peer);
+
+        ngx_stream_upstream_rr_peers_unlock(peers);
+
+        pc->tries = 0;
+        return;
+    }
+
+    if (state & NGX_PEER_FAILED) {
+        now = ngx_time();
+
+        ngx_stream_upstream_rr_peer_lock(peers, peer);
+
+        peer->fails++;
+        peer->accessed = now;
+        peer->checked = now;
+
+        if (peer->max_fails && peer->fails >= peer->max_fails) {
+            ngx_log_error(NGX_LOG_WARN, pc->log, 0,
+                          "upstream server temporarily disabled");
+        }
+
+        ngx_stream_upstream_rr_peer_unlock(peers, peer);
+
+        if (peer->max_fails) {
+            peer->local->effective_weight -= peer->weight / peer->max_fails;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_STREAM, pc->log, 0,
+                       "free rr peer failed: %p %i",
+                       peer, peer->local->effective_weight);
+
+        if (peer->local->effective_weight < 0) {
+            peer->local->effective_weight = 0;
+        }
+
+    } else if (peer->accessed < peer->checked) {
+
+        /* mark peer live if check passed */
+
+        ngx_stream_upstream_rr_peer_lock(peers, peer);
+
+        if (peer->accessed < peer->checked) {
+
+            if (peer->slow_start
+                && peer->max_fails
+                && peer->fails >= peer->max_fails)
+            {
+                peer->start_time = ngx_current_msec;
+            }
+
+            peer->fails = 0;
+        }
+
+        ngx_stream_upstream_rr_peer_unlock(peers, peer);
+    }
+
+    ngx_stream_upstream_release_shared_peer(peers, peer);
+
+    ngx_stream_upstream_rr_peers_unlock(peers);
 
     if (pc->tries) {
         pc->tries--;
@@ -676,6 +1069,27 @@ ngx_stream_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 }
 
 
+static void
+ngx_stream_upstream_release_shared_peer(ngx_stream_upstream_rr_peers_t *peers,
+    ngx_stream_upstream_rr_peer_t *peer)
+{
+    ngx_atomic_uint_t  conns;
+
+    conns = ngx_atomic_fetch_add((ngx_atomic_t *) &peer->conns, -1);
+
+    /* the peer was removed at run time, and this was its last connection */
+
+    if (peer->zombie && conns == 1) {
+        ngx_shmtx_lock(&peers->shpool->mutex);
+        ngx_stream_upstream_zone_free_peer(peers, peer);
+        ngx_shmtx_unlock(&peers->shpool->mutex);
+    }
+}
+
+#endif
+
+
+
 static void
 ngx_stream_upstream_notify_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t type)
@@ -687,12 +1101,21 @@ ngx_stream_upstream_notify_round_robin_peer(ngx_peer_connection_t *pc,
     peer = rrp->current;
 
     if (type == NGX_STREAM_UPSTREAM_NOTIFY_CONNECT
-        && pc->connection->type == SOCK_STREAM)
+        && pc->connection->type == SOCK_STREAM
+        && peer->accessed < peer->checked)
     {
         ngx_stream_upstream_rr_peers_rlock(rrp->peers);
         ngx_stream_upstream_rr_peer_lock(rrp->peers, peer);
 
         if (peer->accessed < peer->checked) {
+
+            if (peer->slow_start
+                && peer->max_fails
+                && peer->fails >= peer->max_fails)
+            {
+                peer->start_time = ngx_current_msec;
+            }
+
             peer->fails = 0;
         }
 
@@ -702,6 +1125,34 @@ ngx_stream_upstream_notify_round_robin_peer(ngx_peer_connection_t *pc,
 }
 
 
+ngx_uint_t
+ngx_stream_upstream_rr_peer_ramp(ngx_stream_upstream_rr_peer_t *peer,
+    ngx_uint_t n)
+{
+    ngx_msec_t      start;
+    ngx_msec_int_t  elapsed;
+
+    start = peer->start_time;
+
+    if (start == 0) {
+        return 0;
+    }
+
+    elapsed = (ngx_msec_int_t) (ngx_current_msec - start);
+
+    if (elapsed < 0) {
+        elapsed = 0;
+    }
+
+    if ((ngx_msec_t) elapsed >= peer->slow_start) {
+        peer->start_time = 0;
+        return 0;
+    }
+
+    return (n % peer->slow_start >= (ngx_msec_t) elapsed);
+}
+
+
 #if (NGX_STREAM_SSL)
 
 static ngx_int_t
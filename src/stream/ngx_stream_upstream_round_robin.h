@@ -49,11 +49,29 @@ struct ngx_stream_upstream_rr_peer_s {
 
     ngx_stream_upstream_rr_peer_t   *next;
 
-    NGX_COMPAT_BEGIN(25)
+    ngx_uint_t                       ewma;
+    ngx_msec_t                       ewma_time;
+
+    ngx_uint_t                       check_fails;
+    ngx_uint_t                       check_passes;
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    ngx_stream_upstream_rr_peer_t   *local;
+    ngx_uint_t                       id;
+    ngx_uint_t                       zombie;
+
+    NGX_COMPAT_BEGIN(18)
+#else
+    NGX_COMPAT_BEGIN(21)
+#endif
     NGX_COMPAT_END
 };
 
 
+/* the "down" bit set by health checks, in addition to the configured one */
+#define NGX_STREAM_UPSTREAM_RR_UNHEALTHY  0x02
+
+
 typedef struct ngx_stream_upstream_rr_peers_s  ngx_stream_upstream_rr_peers_t;
 
 struct ngx_stream_upstream_rr_peers_s {
@@ -76,6 +94,11 @@ struct ngx_stream_upstream_rr_peers_s {
     ngx_stream_upstream_rr_peers_t  *next;
 
     ngx_stream_upstream_rr_peer_t   *peer;
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    ngx_uint_t                       config;
+    ngx_uint_t                       next_id;
+#endif
 };
 
 
@@ -112,6 +135,20 @@ struct ngx_stream_upstream_rr_peers_s {
         ngx_rwlock_unlock(&peer->lock);                                       \
     }
 
+#define ngx_stream_upstream_rr_peer_inc_conns(peers, peer)                    \
+                                                                              \
+    if (peers->shpool) {                                                      \
+        (void) ngx_atomic_fetch_add((ngx_atomic_t *) &peer->conns, 1);        \
+                                                                              \
+    } else {                                                                  \
+        peer->conns++;                                                        \
+    }
+
+/* the peers were changed at run time after the session was started */
+
+#define ngx_stream_upstream_rr_peers_changed(rrp)                             \
+    ((rrp)->config != (rrp)->peers->config)
+
 #else
 
 #define ngx_stream_upstream_rr_peers_rlock(peers)
@@ -119,10 +156,21 @@ struct ngx_stream_upstream_rr_peers_s {
 #define ngx_stream_upstream_rr_peers_unlock(peers)
 #define ngx_stream_upstream_rr_peer_lock(peers, peer)
 #define ngx_stream_upstream_rr_peer_unlock(peers, peer)
+#define ngx_stream_upstream_rr_peer_inc_conns(peers, peer)  peer->conns++
+#define ngx_stream_upstream_rr_peers_changed(rrp)  0
 
 #endif
 
 
+/*
+ * a peer in slow start is held back unless "n" falls into the share
+ * of selections that grows linearly over the slow start time
+ */
+
+#define ngx_stream_upstream_rr_peer_slow(peer, n)                             \
+    ((peer)->start_time && ngx_stream_upstream_rr_peer_ramp(peer, n))
+
+
 typedef struct {
     ngx_uint_t                       config;
     ngx_stream_upstream_rr_peers_t  *peers;
@@ -140,8 +188,17 @@ ngx_int_t ngx_stream_upstream_create_round_robin_peer(ngx_stream_session_t *s,
     ngx_stream_upstream_resolved_t *ur);
 ngx_int_t ngx_stream_upstream_get_round_robin_peer(ngx_peer_connection_t *pc,
     void *data);
+ngx_uint_t ngx_stream_upstream_rr_peer_ramp(
+    ngx_stream_upstream_rr_peer_t *peer, ngx_uint_t n);
 void ngx_stream_upstream_free_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+ngx_stream_upstream_rr_peer_t *ngx_stream_upstream_zone_copy_peer(
+    ngx_stream_upstream_rr_peers_t *peers, ngx_stream_upstream_rr_peer_t *src);
+void ngx_stream_upstream_zone_free_peer(ngx_stream_upstream_rr_peers_t *peers,
+    ngx_stream_upstream_rr_peer_t *peer);
+#endif
+
 
 #endif /* _NGX_STREAM_UPSTREAM_ROUND_ROBIN_H_INCLUDED_ */
@@ -16,8 +16,6 @@ static ngx_int_t ngx_stream_upstream_init_zone(ngx_shm_zone_t *shm_zone,
     void *data);
 static ngx_stream_upstream_rr_peers_t *ngx_stream_upstream_zone_copy_peers(
     ngx_slab_pool_t *shpool, ngx_stream_upstream_srv_conf_t *uscf);
-static ngx_stream_upstream_rr_peer_t *ngx_stream_upstream_zone_copy_peer(
-    ngx_stream_upstream_rr_peers_t *peers, ngx_stream_upstream_rr_peer_t *src);
 
 
 static ngx_command_t  ngx_stream_upstream_zone_commands[] = {
@@ -185,6 +183,7 @@ ngx_stream_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
     ngx_stream_upstream_srv_conf_t *uscf)
 {
     ngx_str_t                       *name;
+    ngx_uint_t                       id;
     ngx_stream_upstream_rr_peer_t   *peer, **peerp;
     ngx_stream_upstream_rr_peers_t  *peers, *backup;
 
@@ -212,6 +211,8 @@ ngx_stream_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
 
     peers->shpool = shpool;
 
+    id = 0;
+
     for (peerp = &peers->peer; *peerp; peerp = &peer->next) {
         /* pool is unlocked */
         peer = ngx_stream_upstream_zone_copy_peer(peers, *peerp);
@@ -219,6 +220,8 @@ ngx_stream_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
             return NULL;
         }
 
+        peer->id = id++;
+
         *peerp = peer;
     }
 
@@ -244,6 +247,8 @@ ngx_stream_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
             return NULL;
         }
 
+        peer->id = id++;
+
         *peerp = peer;
     }
 
@@ -251,13 +256,17 @@ ngx_stream_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
 
 done:
 
+    /* identifiers of peers added at run time */
+
+    peers->next_id = id;
+
     uscf->peer.data = peers;
 
     return peers;
 }
 
 
-static ngx_stream_upstream_rr_peer_t *
+ngx_stream_upstream_rr_peer_t *
 ngx_stream_upstream_zone_copy_peer(ngx_stream_upstream_rr_peers_t *peers,
     ngx_stream_upstream_rr_peer_t *src)
 {
@@ -276,6 +285,15 @@ ngx_stream_upstream_zone_copy_peer(ngx_stream_upstream_rr_peers_t *peers,
         dst->sockaddr = NULL;
         dst->name.data = NULL;
         dst->server.data = NULL;
+
+#if !(NGX_WIN32)
+        /*
+         * the configuration copy of the peer is inherited by each worker
+         * process at the same address, and keeps per-worker weights
+         */
+
+        dst->local = src;
+#endif
     }
 
     dst->sockaddr = ngx_slab_calloc_locked(pool, sizeof(ngx_sockaddr_t));
@@ -320,3 +338,26 @@ failed:
 
     return NULL;
 }
+
+
+void
+ngx_stream_upstream_zone_free_peer(ngx_stream_upstream_rr_peers_t *peers,
+    ngx_stream_upstream_rr_peer_t *peer)
+{
+    ngx_slab_pool_t  *pool;
+
+    pool = peers->shpool;
+
+    if (peer->server.data) {
+        ngx_slab_free_locked(pool, peer->server.data);
+    }
+
+    ngx_slab_free_locked(pool, peer->name.data);
+    ngx_slab_free_locked(pool, peer->sockaddr);
+
+    if (peer->ssl_session) {
+        ngx_slab_free_locked(pool, peer->ssl_session);
+    }
+
+    ngx_slab_free_locked(pool, peer);
+}